@@ -0,0 +1,19 @@
+#ifndef _MQTT_HOST_H_
+#define _MQTT_HOST_H_
+
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* host build has no broker, publishes go to this callback, an error fails the publish */
+typedef esp_err_t (*mqtt_host_publish_cb_t)(const char *topic, const char *data, void *arg);
+
+void mqtt_host_set_publish_cb(mqtt_host_publish_cb_t cb, void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,37 @@
+#include <string.h>
+#include <inttypes.h>
+#include "esp_log.h"
+#include "app/mqtt_mngr.h"
+#include "app/mqtt_host.h"
+
+/*
+ * Host stand-in for the mqtt manager, there is no network on the simulator.
+ * Publishes are handed to the registered callback, downlinks are injected with
+ * downlink_mngr_handle_mqtt() like the subscription handler does.
+ */
+
+static const char *TAG = "mqtt-mngr";
+
+static mqtt_host_publish_cb_t s_publish_cb = NULL;
+static void *s_publish_cb_arg = NULL;
+
+void mqtt_host_set_publish_cb(mqtt_host_publish_cb_t cb, void *arg)
+{
+    s_publish_cb_arg = arg;
+    s_publish_cb = cb;
+}
+
+esp_err_t mqtt_publish_data(const char *topic, const char *data)
+{
+    ESP_LOGD(TAG, "publish %s: %s", topic, data);
+    if (s_publish_cb) {
+        return s_publish_cb(topic, data, s_publish_cb_arg);
+    }
+    return ESP_OK;
+}
+
+esp_err_t mqtt_process_start_client(const char *broker, uint32_t port, const char *uname, const char *pass, void *event_data_callback)
+{
+    ESP_LOGI(TAG, "host build, %s:%" PRIu32 " is not connected", broker ? broker : "", port);
+    return ESP_OK;
+}
@@ -0,0 +1,42 @@
+#ifndef _ADDRESS_MANAGER_H_
+#define _ADDRESS_MANAGER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "app/lora_manager.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * The gateway gives every client a short address in PROVISING_OK, later frames carry it
+ * instead of the dev eui. Address n is entry n - 1 of the table, the table is saved on
+ * every new device so the addresses outlive a restart of either side. A device gets its
+ * address only once the table is saved: the nonce of an addressed frame has no dev eui,
+ * an address given twice would repeat nonces.
+ */
+#define ADDRESS_DEV_MAX             256
+
+typedef struct {
+    uint32_t assigned;
+    uint32_t reassigned;        /* a known device provisioned again, it keeps its address */
+    uint32_t table_full;
+    uint32_t save_failures;     /* new device left without an address, it asks again */
+    uint32_t resolved;
+    uint32_t unknown;           /* address not in the table, frame dropped */
+} address_stats_t;
+
+esp_err_t address_mngr_init(void);
+esp_err_t address_mngr_assign(const uint8_t *dev_eui, uint16_t *dev_addr);
+const uint8_t *address_mngr_resolve(uint16_t dev_addr);
+uint16_t address_mngr_own(void);
+esp_err_t address_mngr_set_own(uint16_t dev_addr);
+void address_mngr_get_stats(address_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
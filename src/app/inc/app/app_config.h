@@ -13,10 +13,29 @@
 #define APP_CONFIG_MQTT_BROKER          "mqtt://mqtt.meplis.dev"
 #define APP_CONFIG_MQTT_BROKER_PORT     (1883)
 
+/* lora listen before talk defaults */
+#define APP_LORA_LBT_CAD_STR            "cad"
+#define APP_LORA_LBT_RSSI_STR           "rssi"
+#define APP_LORA_LBT_RSSI_THRESHOLD     (-90)
+#define APP_LORA_LBT_MAX_ATTEMPTS       (6)
+#define APP_LORA_LBT_BACKOFF_MIN_MS     (20)
+#define APP_LORA_LBT_BACKOFF_MAX_MS     (2000)
+
+/* lora duty cycle defaults */
+#define APP_LORA_DUTY_CYCLE_DROP_STR    "drop"
+#define APP_LORA_DUTY_CYCLE_MAX_DEFER_MS (60000)
+
+/* lora rx window after an uplink, class A style */
+#define APP_LORA_RX1_DELAY_MS           (1000)
 
 /* file paths */
 #define APP_CONFIG_FILE_BASE_PATH       "/fs"
 #define APP_CONFIG_FILE_APPROVE_GW      APP_CONFIG_FILE_BASE_PATH"/approved_gw.data"
+#define APP_CONFIG_FILE_FCNT            APP_CONFIG_FILE_BASE_PATH"/fcnt.data"
+#define APP_CONFIG_FILE_DEV_ADDR        APP_CONFIG_FILE_BASE_PATH"/dev_addr.data"
+#define APP_CONFIG_FILE_ADDR_TABLE      APP_CONFIG_FILE_BASE_PATH"/addr_table.data"
+#define APP_CONFIG_FILE_REPLAY_TABLE    APP_CONFIG_FILE_BASE_PATH"/replay_table.data"
+#define APP_CONFIG_FILE_RELIABLE_EPOCH  APP_CONFIG_FILE_BASE_PATH"/reliable_epoch.data"
 #define APP_CONFIG_FILE_DEVICE_CFG      APP_CONFIG_FILE_BASE_PATH"/device_cfg.json"
 #define APP_CONFIG_FILE_DEVICE_CFG_TEMP APP_CONFIG_FILE_BASE_PATH"/device_cfg_temp.json"
 
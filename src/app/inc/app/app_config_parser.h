@@ -0,0 +1,19 @@
+#ifndef _APP_CONFIG_PARSER_H_
+#define _APP_CONFIG_PARSER_H_
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "app/app_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* device_cfg.json to params, keys missing in data keep their current values */
+esp_err_t app_parse_config_data(app_params_t *params, const char *data, uint16_t data_len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
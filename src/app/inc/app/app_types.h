@@ -2,12 +2,51 @@
 #define _APP_TYPES_H
 
 #include <stdint.h>
+#include <stdbool.h>
+#include "core/sx127x_modem.h"
+#include "app/duty_cycle_manager.h"
 
 typedef enum {
     APP_DEVICE_IS_MASTER,
     APP_DEVICE_IS_CLIENT
 } app_device_type;
 
+#define APP_LORA_CAD_SF_MAX     6
+#define APP_LORA_RADIO_MAX      2
+#define APP_LORA_RELIABLE_ID_MAX 8
+#define APP_LORA_COMPRESS_ID_MAX 8
+
+typedef enum {
+    APP_LORA_LBT_OFF,
+    APP_LORA_LBT_CAD,
+    APP_LORA_LBT_RSSI
+} app_lora_lbt_mode_t;
+
+/* listen before talk, busy channel is retried with randomized exponential backoff */
+typedef struct {
+    app_lora_lbt_mode_t mode;
+    int16_t rssi_threshold;     /* dBm, channel is busy above it */
+    uint8_t max_attempts;
+    uint16_t backoff_min_ms;
+    uint16_t backoff_max_ms;
+} app_lora_lbt_t;
+
+/* regulatory airtime budget per sub-band */
+typedef struct {
+    bool enabled;
+    duty_cycle_policy_t policy;
+    uint32_t max_defer_ms;      /* frames waiting longer than this are dropped */
+} app_lora_duty_cycle_t;
+
+/* per radio pins and channel, zero frequency/sf fall back to lora_modem */
+typedef struct {
+    uint8_t pin_nss;
+    uint8_t pin_rst;
+    uint8_t pin_dio0;
+    long frequency;
+    uint8_t spreading_factor;
+} app_lora_radio_t;
+
 typedef struct {
     const char *dev_serial;
     const char *dev_model;
@@ -16,6 +55,21 @@ typedef struct {
     const char *dev_mqtt_broker;
     uint32_t dev_mqtt_broker_port;
     app_device_type device_type;
+    sx127x_modem_config_t lora_modem;
+    uint8_t lora_cad_sf[APP_LORA_CAD_SF_MAX];
+    uint8_t lora_cad_sf_cnt;
+    app_lora_radio_t lora_radios[APP_LORA_RADIO_MAX];
+    uint8_t lora_radio_cnt;
+    app_lora_lbt_t lora_lbt;
+    app_lora_duty_cycle_t lora_duty_cycle;
+    bool lora_class_a;          /* client listens only in the window after its uplinks */
+    uint32_t lora_rx1_delay_ms; /* from the end of an uplink to its rx window */
+    bool lora_payload_raw;      /* schema uplinks are published as hex instead of json */
+    uint32_t lora_aggregate_ms; /* client holds uplinks this long to send them in one frame, 0 sends each */
+    uint8_t lora_reliable_ids[APP_LORA_RELIABLE_ID_MAX];    /* client packet ids sent until the gateway acknowledges them */
+    uint8_t lora_reliable_id_cnt;
+    uint8_t lora_compress_ids[APP_LORA_COMPRESS_ID_MAX];    /* packet ids of text payloads, sent compressed when it saves airtime */
+    uint8_t lora_compress_id_cnt;
 } app_params_t;
 
 extern app_params_t app_params;
@@ -24,6 +78,10 @@ extern app_params_t app_params;
 #define MIN(a, b) (((a) < (b)) ? (a) : (b))
 #endif
 
+#ifndef MAX
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
+#endif
+
 #ifndef ARRAY_SIZE
 #define ARRAY_SIZE(a)   (sizeof((a)) / sizeof((a)[0]))
 #endif
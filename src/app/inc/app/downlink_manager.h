@@ -0,0 +1,42 @@
+#ifndef _DOWNLINK_MANAGER_H_
+#define _DOWNLINK_MANAGER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "app/lora_manager.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DOWNLINK_DEV_MAX            8
+#define DOWNLINK_QUEUE_LEN          4   /* per device */
+
+typedef struct {
+    uint8_t packet_id;
+    uint8_t data[LORA_PACKET_MAX_DATA_LEN];
+    uint8_t data_len;
+} downlink_t;
+
+typedef struct {
+    uint32_t queued;
+    uint32_t delivered;
+    uint32_t queue_full;
+    uint32_t table_full;
+    uint32_t invalid;
+} downlink_stats_t;
+
+esp_err_t downlink_mngr_init(void);
+esp_err_t downlink_mngr_push(const uint8_t *dev_eui, const uint8_t *data, uint8_t data_len);
+esp_err_t downlink_mngr_push_packet(const uint8_t *dev_eui, uint8_t packet_id, const uint8_t *data, uint8_t data_len);
+bool downlink_mngr_pop(const uint8_t *dev_eui, downlink_t *downlink);
+esp_err_t downlink_mngr_handle_mqtt(const char *data, size_t data_len);
+void downlink_mngr_get_stats(downlink_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef _DUTY_CYCLE_MANAGER_H_
+#define _DUTY_CYCLE_MANAGER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DUTY_CYCLE_WINDOW_S         3600    /* ETSI EN 300 220 observation period */
+#define DUTY_CYCLE_BUCKETS          60      /* one minute granularity */
+#define DUTY_CYCLE_NO_LIMIT         (-1)
+
+typedef enum {
+    DUTY_CYCLE_POLICY_DEFER,
+    DUTY_CYCLE_POLICY_DROP
+} duty_cycle_policy_t;
+
+typedef struct {
+    uint32_t checked;
+    uint32_t deferred;
+    uint64_t deferred_ms;
+    uint32_t dropped;
+    uint32_t unrestricted;      /* frequency is outside of the band table */
+    uint64_t airtime_us;
+} duty_cycle_stats_t;
+
+/**
+ * @brief Checks the airtime budget of the band of the frequency.
+ *
+ * @return ESP_OK when the frame can go now, ESP_ERR_TIMEOUT with the wait time
+ *         when the budget is exhausted, ESP_ERR_NOT_SUPPORTED if it never fits.
+ */
+esp_err_t duty_cycle_mngr_check(long frequency, uint32_t airtime_us, uint32_t *wait_ms);
+void duty_cycle_mngr_commit(long frequency, uint32_t airtime_us);
+void duty_cycle_mngr_add_deferral(uint32_t wait_ms);
+void duty_cycle_mngr_add_drop(void);
+int64_t duty_cycle_mngr_remaining_us(long frequency);
+void duty_cycle_mngr_get_stats(duty_cycle_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
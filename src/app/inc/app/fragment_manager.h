@@ -0,0 +1,73 @@
+#ifndef _FRAGMENT_MANAGER_H_
+#define _FRAGMENT_MANAGER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "app/lora_manager.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Payloads over LORA_PACKET_MAX_DATA_LEN go as LORA_PACKET_ID_FRAGMENT frames:
+ * message id, packet id of the payload, fragment index, fragment count and the chunk.
+ * The receiver answers with LORA_PACKET_ID_FRAGMENT_STATUS: message id and the bitmap
+ * of the missing fragments, big endian, an empty bitmap acknowledges the message.
+ */
+#define FRAGMENT_HEADER_LEN         4
+#define FRAGMENT_CHUNK_MAX          (LORA_PACKET_MAX_DATA_LEN - FRAGMENT_HEADER_LEN)
+#define FRAGMENT_STATUS_LEN         3
+#define FRAGMENT_COUNT_MAX          16  /* bits of the status bitmap */
+#define FRAGMENT_PAYLOAD_MAX        2048
+#define FRAGMENT_RX_SLOTS           4   /* reassembly buffers shared by all devices */
+#define FRAGMENT_RX_PER_DEV         2
+#define FRAGMENT_TX_SLOTS           2
+#define FRAGMENT_DONE_MAX           8   /* acknowledged messages remembered for late retransmissions */
+#define FRAGMENT_RX_TIMEOUT_MS      60000   /* class A downlinks move one per uplink */
+#define FRAGMENT_TX_TIMEOUT_MS      20000
+#define FRAGMENT_TX_RETRY_MAX       5
+/* as long as the sender may retransmit, a rebooted one reuses the ids of its earlier messages */
+#define FRAGMENT_DONE_TTL_MS        (FRAGMENT_TX_TIMEOUT_MS * (FRAGMENT_TX_RETRY_MAX + 1))
+#define FRAGMENT_POLL_MS            1000
+
+/* a reassembled payload, owned by the caller of fragment_mngr_handle() until fragment_mngr_release() */
+typedef struct {
+    uint8_t dev_eui[LORA_DEV_EUI_LEN];
+    uint8_t packet_id;
+    uint16_t len;
+    uint8_t data[FRAGMENT_PAYLOAD_MAX + 1];     /* zero terminated for text payloads */
+} fragment_msg_t;
+
+/* sends a fragment or status frame about dev_eui, ESP_OK once it is queued */
+typedef esp_err_t (*fragment_send_cb_t)(const uint8_t *dev_eui, uint8_t packet_id, const uint8_t *data, uint8_t data_len);
+
+typedef struct {
+    uint32_t tx_messages;
+    uint32_t tx_delivered;
+    uint32_t tx_failed;         /* out of retries */
+    uint32_t tx_fragments;
+    uint32_t tx_retransmits;
+    uint32_t rx_messages;
+    uint32_t rx_fragments;
+    uint32_t rx_duplicates;
+    uint32_t rx_timeouts;
+    uint32_t rx_pool_full;
+    uint32_t rx_invalid;
+    uint8_t rx_high_water;      /* reassembly buffers in use */
+} fragment_stats_t;
+
+esp_err_t fragment_mngr_init(fragment_send_cb_t send_cb);
+esp_err_t fragment_mngr_send(const uint8_t *dev_eui, uint8_t packet_id, const uint8_t *data, uint16_t data_len);
+fragment_msg_t *fragment_mngr_handle(const lora_frame_t *frame);
+void fragment_mngr_release(fragment_msg_t *msg);
+void fragment_mngr_poll(void);
+void fragment_mngr_get_stats(fragment_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef _FRAME_POOL_MANAGER_H_
+#define _FRAME_POOL_MANAGER_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "app/tx_queue_manager.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Tx frames live in a fixed pool of dma capable buffers from the submit to the end of
+ * the send, the tx queues carry their handles. The one that allocates a buffer owns it
+ * until it hands the handle on, the tx task frees it once the frame is on air.
+ */
+#define FRAME_POOL_SIZE     (TX_QUEUE_CONTROL_DEPTH + TX_QUEUE_DOWNLINK_DEPTH + TX_QUEUE_BULK_DEPTH + 1)  /* queues full, one on air */
+
+typedef struct {
+    uint32_t allocated;
+    uint32_t freed;
+    uint32_t in_use;
+    uint32_t high_water;
+    uint32_t exhausted;         /* allocations that found no free buffer */
+    uint32_t bad_frees;         /* handles not from the pool or already free */
+} frame_pool_stats_t;
+
+esp_err_t frame_pool_mngr_init(size_t item_size);
+void *frame_pool_mngr_alloc(void);
+esp_err_t frame_pool_mngr_free(void *item);
+void frame_pool_mngr_get_stats(frame_pool_stats_t *stats);
+void frame_pool_mngr_log_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -2,7 +2,10 @@
 #define _LORA_MANAGER_H_
 
 #include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
 #include "esp_err.h"
+#include "core/sx127x_modem.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -10,19 +13,128 @@ extern "C" {
 
 #define LORA_PACKET_ID_PROVISING 0xE1
 #define LORA_PACKET_ID_PROVISING_OK 0xD1
+#define LORA_PACKET_ID_PROVISING_CHALLENGE 0xD2  /* gateway, the next request has to echo it */
 #define LORA_PACKET_ID_STREAM       0xF1
-#define LORA_PACKET_MAX_DATA_LEN    236   //maximum data len of frame.
+#define LORA_PACKET_ID_DOWNLINK     0xC1
+#define LORA_PACKET_ID_AGGREGATE    0xB1  /* records of a client in one frame */
+#define LORA_PACKET_ID_FRAGMENT     0xB2  /* a part of a payload over LORA_PACKET_MAX_DATA_LEN */
+#define LORA_PACKET_ID_FRAGMENT_STATUS 0xB3
+#define LORA_PACKET_ID_RELIABLE     0xB4  /* a numbered uplink the gateway acknowledges */
+#define LORA_PACKET_ID_ACK          0xB5
+#define LORA_PACKET_ID_COMPRESSED   0xB6  /* packet id of the payload, then the payload through lz_codec */
+#define LORA_DEV_EUI_LEN            6     //binary mac of the client.
+#define LORA_DEV_ADDR_LEN           2     //short address the gateway assigns at provisioning.
+#define LORA_DEV_ADDR_NONE          0x0000  /* not provisioned yet, the dev eui goes on air */
+#define LORA_DEV_ADDR_BROADCAST     0xffff
+#define LORA_PACKET_MAX_DATA_LEN    228   //maximum data len of frame.
 
 typedef struct __attribute__((packed))
 {
     uint8_t packet_id;
+    uint8_t dev_eui[LORA_DEV_EUI_LEN];  /* sender of uplinks, receiver of downlinks */
+    uint16_t dev_addr;                  /* short address of dev_eui, on air instead of it */
+    uint32_t fcnt;                      /* frame counter of the sender, set on tx */
     uint8_t data[LORA_PACKET_MAX_DATA_LEN];
     uint16_t data_len;
     uint8_t end_of_frame;
 } lora_frame_t;
 
+/*
+ * On air frame: a clear header of packet id, dev addr, dev eui only when the address is
+ * LORA_DEV_ADDR_NONE, frame counter and data len, then the data encrypted by aes ccm and
+ * its tag. The tag covers the header too, the nonce is the direction, the address, the
+ * dev eui of an unaddressed frame and the 32 bit frame counter. An addressed uplink carries
+ * the low 16 bits of its counter, the gateway keeps the rest for the device; downlinks and
+ * unaddressed frames carry all of it, their receiver may not know the sender's counter.
+ * Implicit header mode pads every frame to the max length after the tag.
+ */
+#define LORA_WIRE_FCNT_LEN          2
+#define LORA_WIRE_FCNT_FULL_LEN     4
+#define LORA_WIRE_HEADER_LEN        (1 + LORA_DEV_ADDR_LEN + LORA_WIRE_FCNT_LEN + 1)
+#define LORA_WIRE_DOWN_HEADER_LEN   (1 + LORA_DEV_ADDR_LEN + LORA_WIRE_FCNT_FULL_LEN + 1)
+#define LORA_WIRE_EUI_HEADER_LEN    (LORA_WIRE_DOWN_HEADER_LEN + LORA_DEV_EUI_LEN)
+#define LORA_WIRE_TAG_LEN           4
+#define LORA_WIRE_LEN(data_len)     (LORA_WIRE_HEADER_LEN + (data_len) + LORA_WIRE_TAG_LEN)
+#define LORA_WIRE_EUI_LEN(data_len) (LORA_WIRE_EUI_HEADER_LEN + (data_len) + LORA_WIRE_TAG_LEN)
+#define LORA_FRAME_MAX_LEN          (LORA_WIRE_DOWN_HEADER_LEN + LORA_PACKET_MAX_DATA_LEN + LORA_WIRE_TAG_LEN)
+/* frames with the dev eui, provisioning ones, have to fit the same max length */
+#define LORA_PACKET_MAX_EUI_DATA_LEN (LORA_FRAME_MAX_LEN - LORA_WIRE_EUI_HEADER_LEN - LORA_WIRE_TAG_LEN)
+
+/* aggregate frame data: packet id, data len and data of every record */
+#define LORA_RECORD_HEADER_LEN      2
+#define LORA_RECORD_MAX             8     /* a frame fits the gateway publish ring */
+#define LORA_COMPRESS_HEADER_LEN    1
+
+typedef struct {
+    uint32_t rx_frames;
+    uint32_t rx_ring_drops;
+    uint32_t rx_ring_high_water;
+    uint32_t pub_ring_drops;
+    uint32_t pub_ring_high_water;
+    uint32_t published;
+    uint32_t publish_failures;
+    int64_t publish_latency_max_us;
+    int64_t publish_latency_avg_us;
+    uint32_t downlinks_received;
+    uint32_t rx_records;        /* split from aggregate frames */
+    uint32_t rx_record_errors;
+    uint32_t rx_duplicates;     /* frame counter seen before */
+    uint32_t rx_replays;        /* frame counter behind the replay window */
+    uint32_t rx_decompress_errors;
+    uint32_t rx_bad_lengths;    /* header and frame length don't agree */
+    uint32_t rx_bad_tags;       /* failed the ccm tag, a foreign key or a damaged frame */
+    uint32_t rx_fcnt_resyncs;   /* counter of a device found again after a gap of over 32768 frames */
+} lora_rx_stats_t;
+
+typedef struct {
+    uint32_t sent;
+    uint32_t send_failures;
+    uint32_t lbt_checks;
+    uint32_t lbt_busy;          /* cad detection or rssi above the threshold */
+    uint32_t lbt_rx_ongoing;    /* radio was receiving a frame */
+    uint32_t lbt_gave_up;
+    uint32_t lbt_backoff_ms;
+    uint32_t replies_sent;          /* in the rx window after an uplink */
+    uint32_t reply_windows_missed;
+    uint32_t aggregated_records;
+    uint32_t aggregated_frames;
+    uint32_t aggregate_deadlines;   /* frames sent by the deadline before they were full */
+    uint32_t compressed;
+    uint32_t compress_raw;          /* went raw, compression saved no aes block */
+    uint32_t compress_saved_bytes;
+} lora_tx_stats_t;
+
+/* uplinks held for one frame, lora_aggregate_put() fills it and hands full frames to the sender */
+typedef struct {
+    lora_frame_t frame;
+    uint8_t cnt;
+    bool compress;              /* a record of a compressed packet id is held */
+} lora_aggregate_t;
+
+/* a frame of the aggregation, records is the number of uplinks in it */
+typedef esp_err_t (*lora_aggregate_send_t)(uint8_t packet_id, uint8_t *data, uint8_t data_len, bool compress,
+                                           uint8_t records, void *arg);
+
 esp_err_t lora_process_start(void);
 esp_err_t lora_send_tx_queue(uint8_t packet_id, uint8_t *data, uint8_t data_len);
+esp_err_t lora_send_large(uint8_t packet_id, const uint8_t *data, uint16_t data_len);
+esp_err_t lora_send_aggregated(uint8_t packet_id, uint8_t *data, uint8_t data_len);
+esp_err_t lora_record_put(lora_frame_t *frame, uint8_t packet_id, const uint8_t *data, uint8_t data_len);
+esp_err_t lora_record_next(const lora_frame_t *frame, uint16_t *pos, lora_frame_t *record);
+esp_err_t lora_aggregate_put(lora_aggregate_t *aggregate, uint8_t packet_id, const uint8_t *data, uint8_t data_len,
+                             bool compress, lora_aggregate_send_t send, void *arg);
+esp_err_t lora_aggregate_flush(lora_aggregate_t *aggregate, lora_aggregate_send_t send, void *arg);
+esp_err_t lora_compress_init(void);
+esp_err_t lora_frame_compress(lora_frame_t *frame, uint8_t extra);
+uint8_t lora_data_max(void);
+void lora_prepare_provisioning_packet(lora_frame_t *packet);
+void lora_provisioning_frame(lora_frame_t *packet, const uint8_t *dev_eui, const uint8_t *challenge);
+void lora_fcnt_floor(uint32_t fcnt);
+esp_err_t lora_frame_encode(const lora_frame_t *frame, bool uplink, uint8_t *buf, size_t *len);
+esp_err_t lora_frame_header(const uint8_t *buf, size_t len, bool uplink, lora_frame_t *frame);
+esp_err_t lora_frame_decode(const uint8_t *buf, size_t len, bool uplink, uint32_t fcnt_ref, lora_frame_t *frame);
+void lora_get_rx_stats(lora_rx_stats_t *stats);
+void lora_get_tx_stats(lora_tx_stats_t *stats);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,35 @@
+#ifndef _LZ_CODEC_H_
+#define _LZ_CODEC_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * LZ77 for text payloads of one frame. Both sides start with a static dictionary in the
+ * window, so even a short payload finds its json keys in it.
+ *
+ * A literal run is a byte 0LLLLLLL and L + 1 bytes, a match is two bytes 1LLLLLDD DDDDDDDD
+ * copying L + 3 bytes from D + 1 bytes back, the dictionary is just before the payload.
+ */
+#define LZ_CODEC_INPUT_MAX          256
+#define LZ_CODEC_LITERAL_MAX        128
+#define LZ_CODEC_MATCH_MIN          3
+#define LZ_CODEC_MATCH_MAX          34
+#define LZ_CODEC_DISTANCE_MAX       1024
+#define LZ_CODEC_HASH_BITS          8
+#define LZ_CODEC_CHAIN_MAX          16  /* candidates looked at for a match */
+
+esp_err_t lz_codec_init(void);
+int lz_codec_compress(const uint8_t *in, size_t len, uint8_t *out, size_t size);
+int lz_codec_decompress(const uint8_t *in, size_t len, uint8_t *out, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
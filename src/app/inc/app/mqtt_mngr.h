@@ -7,6 +7,7 @@ extern "C" {
 
 #define MQTT_CONFIG_TOPIC               "device/cfg"
 #define MQTT_CONFIG_DATA_TOPIC          "device/data"
+#define MQTT_DOWNLINK_TOPIC             "device/downlink"
 
 #include <stdint.h>
 #include "esp_err.h"
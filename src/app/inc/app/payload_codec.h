@@ -0,0 +1,83 @@
+#ifndef _PAYLOAD_CODEC_H_
+#define _PAYLOAD_CODEC_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "app/payload_schema.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PAYLOAD_CODEC_FIELD_MAX         8
+#define PAYLOAD_CODEC_KEY_INTERVAL      8   /* a lost delta reading costs at most this many */
+#define PAYLOAD_CODEC_DEV_MAX           32  /* devices the gateway keeps the last reading of */
+#define PAYLOAD_CODEC_SEQ_MASK          0x7f
+#define PAYLOAD_CODEC_KEY_FLAG          0x80
+
+/* packet ids of the schemas, ie: PAYLOAD_ID_ENV */
+#define PAYLOAD_SCHEMA_ID(id, NAME, name, FIELDS)   PAYLOAD_ID_##NAME = id,
+typedef enum {
+    PAYLOAD_SCHEMAS(PAYLOAD_SCHEMA_ID)
+} payload_id_t;
+#undef PAYLOAD_SCHEMA_ID
+
+/* readings of the schemas as the device has them, ie: payload_env_t */
+#define PAYLOAD_FIELD_MEMBER(s, field, decimals, delta)   double field;
+#define PAYLOAD_SCHEMA_STRUCT(id, NAME, name, FIELDS) \
+    typedef struct { FIELDS(PAYLOAD_FIELD_MEMBER, name) } payload_##name##_t;
+PAYLOAD_SCHEMAS(PAYLOAD_SCHEMA_STRUCT)
+#undef PAYLOAD_SCHEMA_STRUCT
+#undef PAYLOAD_FIELD_MEMBER
+
+typedef struct {
+    const char *name;
+    uint16_t offset;        /* of the double in the reading struct */
+    uint8_t decimals;
+    bool delta;
+} payload_field_t;
+
+typedef struct {
+    uint8_t packet_id;
+    const char *name;
+    const payload_field_t *fields;
+    uint8_t field_cnt;
+} payload_schema_t;
+
+/* last reading of a device, the base of the next delta */
+typedef struct {
+    bool valid;
+    uint8_t seq;
+    int32_t values[PAYLOAD_CODEC_FIELD_MAX];
+} payload_codec_state_t;
+
+/* a decoded reading, fixed point values in schema order */
+typedef struct {
+    const payload_schema_t *schema;
+    uint8_t seq;
+    bool key;
+    int32_t values[PAYLOAD_CODEC_FIELD_MAX];
+} payload_reading_t;
+
+typedef struct {
+    uint32_t encoded;
+    uint32_t decoded;
+    uint32_t no_base;       /* delta reading without the previous one, waits for a key reading */
+    uint32_t duplicates;
+    uint32_t invalid;
+} payload_codec_stats_t;
+
+const payload_schema_t *payload_codec_schema(uint8_t packet_id);
+esp_err_t payload_codec_encode(uint8_t packet_id, const void *reading, payload_codec_state_t *state, uint8_t *buf, size_t *len);
+esp_err_t payload_codec_decode(uint8_t packet_id, const uint8_t *buf, size_t len, payload_codec_state_t *state, payload_reading_t *reading);
+payload_codec_state_t *payload_codec_rx_state(const uint8_t *dev_eui, uint8_t packet_id);
+int payload_codec_to_json(const payload_reading_t *reading, const uint8_t *dev_eui, char *buf, size_t size);
+void payload_codec_get_stats(payload_codec_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
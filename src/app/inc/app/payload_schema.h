@@ -0,0 +1,29 @@
+#ifndef _PAYLOAD_SCHEMA_H_
+#define _PAYLOAD_SCHEMA_H_
+
+/*
+ * Binary uplink schemas, one per packet id. Everything the codec needs, the reading
+ * structs, packet ids and field tables, is generated from these lists at compile time.
+ *
+ * X(struct, field, decimals, delta)
+ *  decimals    fixed point digits on air, the value goes as value * 10^decimals
+ *  delta       sent as the change from the previous reading of the device
+ */
+#define PAYLOAD_STATUS_FIELDS(X, s)             \
+    X(s, uptime_s,          0, true)            \
+    X(s, free_heap,         0, true)            \
+    X(s, min_free_heap,     0, true)            \
+    X(s, tx_sent,           0, true)
+
+#define PAYLOAD_ENV_FIELDS(X, s)                \
+    X(s, temperature_c,     2, true)            \
+    X(s, humidity_pct,      1, true)            \
+    X(s, pressure_hpa,      1, true)            \
+    X(s, battery_v,         3, true)
+
+/* X(packet id, NAME, name, field list) */
+#define PAYLOAD_SCHEMAS(X)                                  \
+    X(0xA0, STATUS, status, PAYLOAD_STATUS_FIELDS)          \
+    X(0xA1, ENV,    env,    PAYLOAD_ENV_FIELDS)
+
+#endif
@@ -9,13 +9,30 @@
 extern "C" {
 #endif
 
+/*
+ * A request whose frame counter the gateway has seen before may be an old copy, or come
+ * from a client that lost its counter. The gateway answers it with a random challenge,
+ * the next request of the client echoes it and proves itself fresh. PROVISING_OK then
+ * gives the client a counter above every one it used, its window is never restarted.
+ */
+#define PROVISIONING_CHALLENGE_LEN  4
+#define PROVISIONING_CHALLENGE_MAX  4   /* clients proving a request fresh at a time */
+
 typedef struct {
     uint8_t global_dev_eui[12 + 1];
     uint8_t app_key[16];
+    uint8_t dev_addr[2];    /* PROVISING_OK, the address the gateway assigned, big endian */
+    uint8_t fcnt_floor[4];  /* PROVISING_OK, the client's frame counter goes on from it, big endian */
+    uint8_t challenge[PROVISIONING_CHALLENGE_LEN];  /* PROVISING, the last challenge the client got */
 } provisioning_t;
 
 esp_err_t provisioning_mngr_add_new_client(lora_frame_t *lora_data, char *app_key);
 esp_err_t provisioning_mngr_provis_is_ok(lora_frame_t *lora_data, char *app_key);
+esp_err_t provisioning_mngr_parse_ok(const lora_frame_t *lora_data, char *app_key, uint16_t *dev_addr, uint32_t *fcnt_floor);
+esp_err_t provisioning_mngr_check_fresh(const uint8_t *dev_eui, const provisioning_t *request, char *app_key);
+void provisioning_mngr_set_challenge(const uint8_t *challenge, uint8_t len);
+void provisioning_mngr_get_challenge(uint8_t *challenge);
+bool provisioning_mngr_challenged(void);
 bool provisioning_mngr_check_device_is_approved(void);
 
 
@@ -0,0 +1,57 @@
+#ifndef _RELIABLE_MANAGER_H_
+#define _RELIABLE_MANAGER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "app/lora_manager.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Reliable uplinks go as LORA_PACKET_ID_RELIABLE frames: sequence number, packet id of
+ * the payload, session epoch and the payload. The sequence restarts at 0 with every boot of
+ * the client and the saved epoch steps, a new epoch restarts the window at the gateway.
+ * The gateway answers in the rx window with
+ * LORA_PACKET_ID_ACK: the next sequence it expects and a bitmap of the 8 after it, a
+ * reply of the same window rides on the ack as a record. Delivery is not ordered.
+ */
+#define RELIABLE_HEADER_LEN         3
+#define RELIABLE_ACK_LEN            2
+#define RELIABLE_WINDOW             4   /* frames in flight */
+#define RELIABLE_RETRY_MAX          6
+#define RELIABLE_DEV_MAX            32  /* devices the gateway keeps the sequence window of */
+#define RELIABLE_RTO_MAX_MS         30000
+#define RELIABLE_POLL_MS            50
+
+/* sends a LORA_PACKET_ID_RELIABLE frame, ESP_OK once it is queued */
+typedef esp_err_t (*reliable_send_cb_t)(uint8_t *data, uint8_t data_len);
+
+typedef struct {
+    uint32_t sent;
+    uint32_t retransmits;
+    uint32_t fast_retransmits;  /* a later frame was acknowledged first */
+    uint32_t acked;
+    uint32_t gave_up;
+    uint32_t window_full;
+    uint32_t rtt_ms;            /* smoothed */
+    uint32_t rto_ms;
+    uint32_t rx_delivered;
+    uint32_t rx_duplicates;
+} reliable_stats_t;
+
+esp_err_t reliable_mngr_init(reliable_send_cb_t send_cb, uint32_t rto_min_ms);
+esp_err_t reliable_mngr_send(uint8_t packet_id, const uint8_t *data, uint8_t data_len);
+bool reliable_mngr_in_flight(void);
+void reliable_mngr_handle_ack(const uint8_t *ack, int64_t rx_us);
+bool reliable_mngr_receive(const uint8_t *dev_eui, const uint8_t *header, uint8_t *ack);
+void reliable_mngr_poll(void);
+void reliable_mngr_get_stats(reliable_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef _REPLAY_MANAGER_H_
+#define _REPLAY_MANAGER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "app/lora_manager.h"
+#include "app/address_manager.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Every frame carries the frame counter of its sender, the gateway keeps the highest one
+ * of a device and a bitmap of the REPLAY_WINDOW before it. A counter seen before or older
+ * than the window is dropped before the dispatch, so before any flash or mqtt work.
+ *
+ * A device is never forgotten: the hash table has twice the slots of the devices that can
+ * get an address and a device is looked for in REPLAY_PROBE_MAX of them, a new device that
+ * finds none free is dropped. The highest counters are saved REPLAY_SAVE_STEP ahead, after
+ * a restart a device goes on above its saved counter. The check itself never waits on the
+ * flash, replay_mngr_save() writes the table from another task once a device is half way.
+ */
+#define REPLAY_WINDOW               32  /* bits of the bitmap */
+#define REPLAY_DEV_MAX              (2 * ADDRESS_DEV_MAX)   /* power of two, slots of the device hash table */
+#define REPLAY_PROBE_MAX            16  /* slots looked at for a device */
+#define REPLAY_SAVE_STEP            32  /* counters accepted before the next save, lost after a restart */
+
+typedef struct {
+    uint32_t accepted;
+    uint32_t late;              /* accepted behind the highest counter, reordered or a lost copy */
+    uint32_t duplicates;        /* counter in the window seen before */
+    uint32_t replays;           /* counter behind the window */
+    uint32_t new_devices;
+    uint32_t table_full;        /* frames of a new device dropped, there was no free slot */
+    uint32_t saves;
+    uint32_t save_failures;
+} replay_stats_t;
+
+esp_err_t replay_mngr_init(void);
+uint32_t replay_mngr_last(const uint8_t *dev_eui);
+bool replay_mngr_accept(const uint8_t *dev_eui, uint32_t fcnt);
+esp_err_t replay_mngr_save(void);
+void replay_mngr_get_stats(replay_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef _TX_QUEUE_MANAGER_H_
+#define _TX_QUEUE_MANAGER_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Tx frames wait in one queue per class. Control goes first whenever it has a frame,
+ * downlink and bulk share the rest by deficit round robin on the frame bytes, so a
+ * stream burst can neither delay a reply nor starve the downlinks.
+ *
+ * A frame may wait for a time, a reply for its rx window, a deferred or backing off frame
+ * for its retry. The pop takes the first frame due in the order above, the others keep
+ * their place, and starts no frame within the guard before a reply is due. While the
+ * queues are held, a class A client listening after its uplink, the pop gives no frame.
+ */
+typedef enum {
+    TX_CLASS_CONTROL,           /* replies, provisioning, acks, fragment status */
+    TX_CLASS_DOWNLINK,
+    TX_CLASS_BULK,
+    TX_CLASS_MAX
+} tx_class_t;
+
+#define TX_QUEUE_CONTROL_DEPTH      4
+#define TX_QUEUE_DOWNLINK_DEPTH     4
+#define TX_QUEUE_BULK_DEPTH         8
+#define TX_QUEUE_DOWNLINK_WEIGHT    3   /* bytes served per round, in frames of the max length */
+#define TX_QUEUE_BULK_WEIGHT        1
+#define TX_QUEUE_WAIT_BUCKETS       12  /* bucket n counts waits under 2^n ms, the last one the rest */
+
+#define TX_QUEUE_FLAG_REPLY         0x01    /* first at its time, no frame starts within the guard before it */
+#define TX_QUEUE_FLAG_RETRY         0x02    /* put back until its retry, keeps its place ahead of the class */
+
+typedef struct {
+    uint32_t queued;
+    uint32_t sent;              /* handed to the tx task, a retry again */
+    uint32_t dropped;           /* class was full */
+    uint32_t requeued;          /* put back to wait for its retry */
+    uint32_t high_water;
+    uint32_t wait_max_ms;
+    uint32_t wait_hist[TX_QUEUE_WAIT_BUCKETS];
+} tx_queue_class_stats_t;
+
+typedef struct {
+    tx_queue_class_stats_t classes[TX_CLASS_MAX];
+} tx_queue_stats_t;
+
+esp_err_t tx_queue_mngr_init(size_t item_size, uint32_t guard_us);
+esp_err_t tx_queue_mngr_push(tx_class_t tx_class, const void *item, uint16_t cost, int64_t not_before_us, uint8_t flags);
+esp_err_t tx_queue_mngr_pop(void *item, TickType_t timeout);
+void tx_queue_mngr_hold(bool hold);
+uint32_t tx_queue_mngr_waiting(void);
+void tx_queue_mngr_get_stats(tx_queue_stats_t *stats);
+void tx_queue_mngr_log_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
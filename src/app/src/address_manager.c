@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "core/file_mngr.h"
+#include "app/app_types.h"
+#include "app/app_config.h"
+#include "app/lora_manager.h"
+#include "app/address_manager.h"
+
+static const char *TAG = "address_manager";
+
+/* gateway, a zero eui is a free entry */
+static uint8_t s_table[ADDRESS_DEV_MAX][LORA_DEV_EUI_LEN];
+static const uint8_t s_free_eui[LORA_DEV_EUI_LEN] = {0};
+/* client, its own address, LORA_DEV_ADDR_NONE until provisioned */
+static uint16_t s_own_addr = LORA_DEV_ADDR_NONE;
+static SemaphoreHandle_t s_lock = NULL;
+static address_stats_t s_stats = {0};
+
+/* binary, read back whole or not at all; file_save() keeps the old one over a power loss */
+static esp_err_t address_mngr_load(const char *path, void *data, size_t len)
+{
+    char *buf = NULL;
+    esp_err_t err = ESP_ERR_NOT_FOUND;
+    if (file_load(path, &buf) == (int)len + 1) {
+        memcpy(data, buf, len);
+        err = ESP_OK;
+    }
+    free(buf);
+    return err;
+}
+
+esp_err_t address_mngr_init(void)
+{
+    s_lock = xSemaphoreCreateMutex();
+    if (!s_lock) {
+        ESP_LOGE(TAG, "couldn't create the address lock!");
+        return ESP_FAIL;
+    }
+    if (app_params.device_type == APP_DEVICE_IS_MASTER) {
+        if (address_mngr_load(APP_CONFIG_FILE_ADDR_TABLE, s_table, sizeof(s_table)) == ESP_OK) {
+            ESP_LOGI(TAG, "address table loaded");
+        }
+        return ESP_OK;
+    }
+    uint8_t addr[LORA_DEV_ADDR_LEN];
+    if (address_mngr_load(APP_CONFIG_FILE_DEV_ADDR, addr, sizeof(addr)) == ESP_OK) {
+        s_own_addr = addr[0] << 8 | addr[1];
+        ESP_LOGI(TAG, "device address:0x%04x", s_own_addr);
+    }
+    return ESP_OK;
+}
+
+/* provisioning only, so the linear search for a known device is fine */
+esp_err_t address_mngr_assign(const uint8_t *dev_eui, uint16_t *dev_addr)
+{
+    if (!s_lock) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (!memcmp(dev_eui, s_free_eui, LORA_DEV_EUI_LEN)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_err_t err = ESP_OK;
+    int16_t free_index = -1;
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    for (int16_t i = 0; i < ADDRESS_DEV_MAX; i++) {
+        if (!memcmp(s_table[i], dev_eui, LORA_DEV_EUI_LEN)) {
+            *dev_addr = i + 1;
+            s_stats.reassigned++;
+            xSemaphoreGive(s_lock);
+            return ESP_OK;
+        }
+        if (free_index < 0 && !memcmp(s_table[i], s_free_eui, LORA_DEV_EUI_LEN)) {
+            free_index = i;
+        }
+    }
+    if (free_index < 0) {
+        s_stats.table_full++;
+        err = ESP_ERR_NO_MEM;
+    } else {
+        memcpy(s_table[free_index], dev_eui, LORA_DEV_EUI_LEN);
+        /* an unsaved address would go to another device after a restart, with the same nonces */
+        if (file_save(APP_CONFIG_FILE_ADDR_TABLE, (char *)s_table, sizeof(s_table)) != sizeof(s_table)) {
+            memset(s_table[free_index], 0, LORA_DEV_EUI_LEN);
+            s_stats.save_failures++;
+            err = ESP_FAIL;
+        } else {
+            *dev_addr = free_index + 1;
+            s_stats.assigned++;
+        }
+    }
+    xSemaphoreGive(s_lock);
+    if (err == ESP_ERR_NO_MEM) {
+        ESP_LOGE(TAG, "address table is full!");
+    } else if (err != ESP_OK) {
+        ESP_LOGE(TAG, "address table couldn't be saved!");
+    }
+    return err;
+}
+
+/* gateway dispatch stage, an index into the table, NULL for an unknown address */
+const uint8_t *address_mngr_resolve(uint16_t dev_addr)
+{
+    if (dev_addr == LORA_DEV_ADDR_NONE || dev_addr > ADDRESS_DEV_MAX ||
+            !memcmp(s_table[dev_addr - 1], s_free_eui, LORA_DEV_EUI_LEN)) {
+        s_stats.unknown++;
+        return NULL;
+    }
+    s_stats.resolved++;
+    return s_table[dev_addr - 1];
+}
+
+uint16_t address_mngr_own(void)
+{
+    return s_own_addr;
+}
+
+esp_err_t address_mngr_set_own(uint16_t dev_addr)
+{
+    uint8_t addr[LORA_DEV_ADDR_LEN] = {dev_addr >> 8, dev_addr & 0xff};
+    if (dev_addr == s_own_addr) {
+        return ESP_OK;
+    }
+    /* used from now on even unsaved, a restart goes back to the eui until provisioned again */
+    s_own_addr = dev_addr;
+    ESP_LOGI(TAG, "device address:0x%04x", s_own_addr);
+    if (file_save(APP_CONFIG_FILE_DEV_ADDR, (char *)addr, sizeof(addr)) != sizeof(addr)) {
+        ESP_LOGE(TAG, "device address couldn't be saved!");
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+void address_mngr_get_stats(address_stats_t *stats)
+{
+    *stats = s_stats;
+}
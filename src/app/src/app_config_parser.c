@@ -0,0 +1,251 @@
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "cJSON.h"
+#include "core/sx127x_modem.h"
+#include "app/app_config.h"
+#include "app/app_types.h"
+#include "app/app_config_parser.h"
+
+static const char *TAG = "app-config";
+
+/* packet ids of the framing (0xb0-0xbf) wrap the others, they are not options of their own */
+static uint8_t app_parse_packet_ids(const cJSON *array, uint8_t *ids, uint8_t max)
+{
+    const cJSON *item = NULL;
+    uint8_t cnt = 0;
+    cJSON_ArrayForEach(item, array) {
+        if (!cJSON_IsNumber(item) || item->valueint <= 0 || item->valueint > 0xff || (item->valueint & 0xf0) == 0xb0) {
+            ESP_LOGW(TAG, "invalid packet id skipped");
+            continue;
+        }
+        if (cnt >= max) {
+            break;
+        }
+        ids[cnt++] = item->valueint;
+    }
+    return cnt;
+}
+
+/* strings of an earlier parse are freed, they are either NULL or strdup'ed here */
+esp_err_t app_parse_config_data(app_params_t *params, const char *data, uint16_t data_len)
+{
+    cJSON *root = cJSON_ParseWithLength(data, data_len);
+    if (!root) {
+        ESP_LOGE(TAG, "json string couldn't be parsed at line (%d)", __LINE__);
+        return ESP_FAIL;
+    }
+    cJSON *object  =  cJSON_GetObjectItemCaseSensitive(root, "device_type");
+    if (cJSON_IsString(object)) {
+        if (!strcmp(object->valuestring, APP_DEVICE_TYPE_MASTER_STR)) {
+            params->device_type = APP_DEVICE_IS_MASTER;
+        } else if (!strcmp(object->valuestring, APP_DEVICE_TYPE_CLIENT_STR)) {
+            params->device_type = APP_DEVICE_IS_CLIENT;
+        } else {
+            ESP_LOGW(TAG, "device_type object couldn't match any type(%s). device_type changed to default(%s).!", object->valuestring, APP_DEVICE_TYPE_MASTER_STR);
+        }
+        ESP_LOGI(TAG, "Device type is %d - %s", params->device_type, params->device_type ? APP_DEVICE_TYPE_CLIENT_STR : APP_DEVICE_TYPE_MASTER_STR);
+    }
+    object  =  cJSON_GetObjectItemCaseSensitive(root, "wifi_ssid");
+    if (cJSON_IsString(object)) {
+        free((void *)params->dev_wifi_ssid);
+        params->dev_wifi_ssid = strdup(object->valuestring);
+        ESP_LOGI(TAG, "Device wifi ssid is %s", params->dev_wifi_ssid);
+    }
+    object  =  cJSON_GetObjectItemCaseSensitive(root, "wifi_pass");
+    if (cJSON_IsString(object)) {
+        free((void *)params->dev_wifi_pass);
+        params->dev_wifi_pass = strdup(object->valuestring);
+        ESP_LOGI(TAG, "Device wifi pass is %s", params->dev_wifi_pass);
+    }
+
+    object = cJSON_GetObjectItemCaseSensitive(root, "mqtt_broker");
+    if (cJSON_IsString(object)) {
+        free((void *)params->dev_mqtt_broker);
+        params->dev_mqtt_broker = strdup(object->valuestring);
+        ESP_LOGI(TAG, "Device MQTT Broker Url: %s", params->dev_mqtt_broker);
+    }
+
+    object = cJSON_GetObjectItemCaseSensitive(root, "mqtt_broker_port");
+    if (cJSON_IsNumber(object)) {
+        params->dev_mqtt_broker_port = object->valueint;
+        ESP_LOGI(TAG, "Device MQTT Broker Port:%" PRIu32 "", params->dev_mqtt_broker_port);
+    }
+    object = cJSON_GetObjectItemCaseSensitive(root, "lora_frequency");
+    if (cJSON_IsNumber(object)) {
+        params->lora_modem.frequency = (long)object->valuedouble;
+        ESP_LOGI(TAG, "LoRa frequency:%ld", params->lora_modem.frequency);
+    }
+    object = cJSON_GetObjectItemCaseSensitive(root, "lora_sf");
+    if (cJSON_IsNumber(object)) {
+        params->lora_modem.spreading_factor = object->valueint;
+        ESP_LOGI(TAG, "LoRa spreading factor:%d", params->lora_modem.spreading_factor);
+    }
+    object = cJSON_GetObjectItemCaseSensitive(root, "lora_bw");
+    if (cJSON_IsNumber(object)) {
+        /* bandwidth is in kHz, ie: 7.8, 62.5, 125 */
+        params->lora_modem.bandwidth = sx127x_modem_bandwidth_from_hz((uint32_t)(object->valuedouble * 1000 + 0.5));
+        ESP_LOGI(TAG, "LoRa bandwidth:%.1f kHz", object->valuedouble);
+    }
+    object = cJSON_GetObjectItemCaseSensitive(root, "lora_cr");
+    if (cJSON_IsNumber(object)) {
+        /* coding rate denominator, 5 to 8 for 4/5 to 4/8 */
+        params->lora_modem.coding_rate = (sx127x_cr_t)(object->valueint - 4);
+        ESP_LOGI(TAG, "LoRa coding rate:4/%d", object->valueint);
+    }
+    object = cJSON_GetObjectItemCaseSensitive(root, "lora_preamble");
+    if (cJSON_IsNumber(object)) {
+        params->lora_modem.preamble_len = object->valueint;
+        ESP_LOGI(TAG, "LoRa preamble length:%d", params->lora_modem.preamble_len);
+    }
+    object = cJSON_GetObjectItemCaseSensitive(root, "lora_implicit_header");
+    if (cJSON_IsBool(object)) {
+        params->lora_modem.implicit_header = cJSON_IsTrue(object);
+        ESP_LOGI(TAG, "LoRa %s header mode", params->lora_modem.implicit_header ? "implicit" : "explicit");
+    }
+    object = cJSON_GetObjectItemCaseSensitive(root, "lora_implicit_len");
+    if (cJSON_IsNumber(object)) {
+        params->lora_modem.payload_len = object->valueint;
+        ESP_LOGI(TAG, "LoRa implicit header frame length:%d", params->lora_modem.payload_len);
+    }
+    object = cJSON_GetObjectItemCaseSensitive(root, "lora_sync_word");
+    if (cJSON_IsNumber(object)) {
+        params->lora_modem.sync_word = object->valueint;
+        ESP_LOGI(TAG, "LoRa sync word:0x%02x", params->lora_modem.sync_word);
+    }
+    object = cJSON_GetObjectItemCaseSensitive(root, "lora_cad_sf");
+    if (cJSON_IsArray(object)) {
+        /* gateway listens on all of these SFs with channel activity detection */
+        cJSON *item = NULL;
+        params->lora_cad_sf_cnt = 0;
+        cJSON_ArrayForEach(item, object) {
+            if (!cJSON_IsNumber(item) || item->valueint <= SX127X_SF_MIN || item->valueint > SX127X_SF_MAX) {
+                ESP_LOGW(TAG, "invalid cad spreading factor skipped");
+                continue;
+            }
+            if (params->lora_cad_sf_cnt >= APP_LORA_CAD_SF_MAX) {
+                break;
+            }
+            params->lora_cad_sf[params->lora_cad_sf_cnt++] = item->valueint;
+        }
+        ESP_LOGI(TAG, "LoRa cad spreading factor count:%d", params->lora_cad_sf_cnt);
+    }
+    object = cJSON_GetObjectItemCaseSensitive(root, "lora_radios");
+    if (cJSON_IsArray(object) && cJSON_GetArraySize(object) > 0) {
+        /* every radio has its own chip select, reset and dio0 pins on the shared spi bus */
+        cJSON *item = NULL;
+        params->lora_radio_cnt = 0;
+        cJSON_ArrayForEach(item, object) {
+            cJSON *nss = cJSON_GetObjectItemCaseSensitive(item, "nss");
+            cJSON *rst = cJSON_GetObjectItemCaseSensitive(item, "rst");
+            cJSON *dio0 = cJSON_GetObjectItemCaseSensitive(item, "dio0");
+            if (!cJSON_IsNumber(nss) || !cJSON_IsNumber(rst) || !cJSON_IsNumber(dio0)) {
+                ESP_LOGW(TAG, "lora radio without nss/rst/dio0 pins skipped");
+                continue;
+            }
+            if (params->lora_radio_cnt >= APP_LORA_RADIO_MAX) {
+                break;
+            }
+            app_lora_radio_t *radio = &params->lora_radios[params->lora_radio_cnt++];
+            memset(radio, 0, sizeof(app_lora_radio_t));
+            radio->pin_nss = nss->valueint;
+            radio->pin_rst = rst->valueint;
+            radio->pin_dio0 = dio0->valueint;
+            cJSON *frequency = cJSON_GetObjectItemCaseSensitive(item, "frequency");
+            if (cJSON_IsNumber(frequency)) {
+                radio->frequency = (long)frequency->valuedouble;
+            }
+            cJSON *sf = cJSON_GetObjectItemCaseSensitive(item, "sf");
+            if (cJSON_IsNumber(sf)) {
+                radio->spreading_factor = sf->valueint;
+            }
+        }
+        if (!params->lora_radio_cnt) {
+            /* keep the on board radio when none of the entries is usable */
+            params->lora_radio_cnt = 1;
+        }
+        ESP_LOGI(TAG, "LoRa radio count:%d", params->lora_radio_cnt);
+    }
+    object = cJSON_GetObjectItemCaseSensitive(root, "lora_duty_cycle");
+    if (cJSON_IsBool(object)) {
+        params->lora_duty_cycle.enabled = cJSON_IsTrue(object);
+        ESP_LOGI(TAG, "LoRa duty cycle limit:%d", params->lora_duty_cycle.enabled);
+    }
+    object = cJSON_GetObjectItemCaseSensitive(root, "lora_duty_cycle_policy");
+    if (cJSON_IsString(object)) {
+        params->lora_duty_cycle.policy = strcmp(object->valuestring, APP_LORA_DUTY_CYCLE_DROP_STR) ?
+                                            DUTY_CYCLE_POLICY_DEFER : DUTY_CYCLE_POLICY_DROP;
+        ESP_LOGI(TAG, "LoRa duty cycle policy:%d", params->lora_duty_cycle.policy);
+    }
+    object = cJSON_GetObjectItemCaseSensitive(root, "lora_duty_cycle_max_defer_ms");
+    if (cJSON_IsNumber(object) && object->valueint >= 0) {
+        params->lora_duty_cycle.max_defer_ms = object->valueint;
+        ESP_LOGI(TAG, "LoRa duty cycle max defer:%" PRIu32 "ms", params->lora_duty_cycle.max_defer_ms);
+    }
+    object = cJSON_GetObjectItemCaseSensitive(root, "lora_class_a");
+    if (cJSON_IsBool(object)) {
+        params->lora_class_a = cJSON_IsTrue(object);
+        ESP_LOGI(TAG, "LoRa class A rx windows:%d", params->lora_class_a);
+    }
+    object = cJSON_GetObjectItemCaseSensitive(root, "lora_rx1_delay_ms");
+    if (cJSON_IsNumber(object) && object->valueint > 0) {
+        params->lora_rx1_delay_ms = object->valueint;
+        ESP_LOGI(TAG, "LoRa rx1 delay:%" PRIu32 "ms", params->lora_rx1_delay_ms);
+    }
+    object = cJSON_GetObjectItemCaseSensitive(root, "lora_payload_raw");
+    if (cJSON_IsBool(object)) {
+        params->lora_payload_raw = cJSON_IsTrue(object);
+        ESP_LOGI(TAG, "LoRa schema payloads are published %s", params->lora_payload_raw ? "raw" : "as json");
+    }
+    object = cJSON_GetObjectItemCaseSensitive(root, "lora_aggregate_ms");
+    if (cJSON_IsNumber(object) && object->valueint >= 0) {
+        params->lora_aggregate_ms = object->valueint;
+        ESP_LOGI(TAG, "LoRa uplink aggregation:%" PRIu32 "ms", params->lora_aggregate_ms);
+    }
+    object = cJSON_GetObjectItemCaseSensitive(root, "lora_reliable");
+    if (cJSON_IsArray(object)) {
+        params->lora_reliable_id_cnt = app_parse_packet_ids(object, params->lora_reliable_ids, APP_LORA_RELIABLE_ID_MAX);
+        ESP_LOGI(TAG, "LoRa reliable packet id count:%d", params->lora_reliable_id_cnt);
+    }
+    object = cJSON_GetObjectItemCaseSensitive(root, "lora_compress");
+    if (cJSON_IsArray(object)) {
+        params->lora_compress_id_cnt = app_parse_packet_ids(object, params->lora_compress_ids, APP_LORA_COMPRESS_ID_MAX);
+        ESP_LOGI(TAG, "LoRa compressed packet id count:%d", params->lora_compress_id_cnt);
+    }
+    object = cJSON_GetObjectItemCaseSensitive(root, "lora_lbt");
+    if (cJSON_IsString(object)) {
+        if (!strcmp(object->valuestring, APP_LORA_LBT_CAD_STR)) {
+            params->lora_lbt.mode = APP_LORA_LBT_CAD;
+        } else if (!strcmp(object->valuestring, APP_LORA_LBT_RSSI_STR)) {
+            params->lora_lbt.mode = APP_LORA_LBT_RSSI;
+        } else {
+            params->lora_lbt.mode = APP_LORA_LBT_OFF;
+        }
+        ESP_LOGI(TAG, "LoRa listen before talk:%d", params->lora_lbt.mode);
+    }
+    object = cJSON_GetObjectItemCaseSensitive(root, "lora_lbt_rssi_threshold");
+    if (cJSON_IsNumber(object)) {
+        params->lora_lbt.rssi_threshold = object->valueint;
+        ESP_LOGI(TAG, "LoRa lbt rssi threshold:%d dBm", params->lora_lbt.rssi_threshold);
+    }
+    object = cJSON_GetObjectItemCaseSensitive(root, "lora_lbt_max_attempts");
+    if (cJSON_IsNumber(object) && object->valueint > 0) {
+        params->lora_lbt.max_attempts = object->valueint;
+        ESP_LOGI(TAG, "LoRa lbt max attempts:%d", params->lora_lbt.max_attempts);
+    }
+    object = cJSON_GetObjectItemCaseSensitive(root, "lora_lbt_backoff_min_ms");
+    if (cJSON_IsNumber(object) && object->valueint > 0) {
+        params->lora_lbt.backoff_min_ms = object->valueint;
+        ESP_LOGI(TAG, "LoRa lbt backoff min:%dms", params->lora_lbt.backoff_min_ms);
+    }
+    object = cJSON_GetObjectItemCaseSensitive(root, "lora_lbt_backoff_max_ms");
+    if (cJSON_IsNumber(object) && object->valueint > 0) {
+        params->lora_lbt.backoff_max_ms = object->valueint;
+        ESP_LOGI(TAG, "LoRa lbt backoff max:%dms", params->lora_lbt.backoff_max_ms);
+    }
+
+    cJSON_Delete(root);
+    return ESP_OK;
+}
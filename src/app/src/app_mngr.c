@@ -14,9 +14,11 @@
 #include "core/utils.h"
 #include "app/app_config.h"
 #include "app/app_types.h"
+#include "app/app_config_parser.h"
 #include "app/wifi_mngr.h"
 #include "app/lora_manager.h"
 #include "app/mqtt_mngr.h"
+#include "app/downlink_manager.h"
 
 static const char *TAG = "appmngr";
 
@@ -73,51 +75,6 @@ static void print_heap_usage(const char *msg)
 
 #endif
 
-static esp_err_t app_parse_config_data(char *data, uint16_t data_len)
-{
-    cJSON *root = cJSON_ParseWithLength(data, data_len);
-    if (!root) {
-        ESP_LOGE(TAG, "json string couldn't be parsed at line (%d)", __LINE__);
-        return ESP_FAIL;
-    }
-    cJSON *object  =  cJSON_GetObjectItemCaseSensitive(root, "device_type");
-    if (cJSON_IsString(object)) {
-        if (!strcmp(object->valuestring, APP_DEVICE_TYPE_MASTER_STR)) {
-            app_params.device_type = APP_DEVICE_IS_MASTER;
-        } else if (!strcmp(object->valuestring, APP_DEVICE_TYPE_CLIENT_STR)) {
-            app_params.device_type = APP_DEVICE_IS_CLIENT;
-        } else {
-            ESP_LOGW(TAG, "device_type object couldn't match any type(%s). device_type changed to default(%s).!", object->valuestring, APP_DEVICE_TYPE_MASTER_STR);
-        }
-        ESP_LOGI(TAG, "Device type is %d - %s", app_params.device_type, app_params.device_type ? APP_DEVICE_TYPE_CLIENT_STR : APP_DEVICE_TYPE_MASTER_STR);
-    }
-    object  =  cJSON_GetObjectItemCaseSensitive(root, "wifi_ssid");
-    if (cJSON_IsString(object)) {
-        app_params.dev_wifi_ssid = strdup(object->valuestring);
-        ESP_LOGI(TAG, "Device wifi ssid is %s", app_params.dev_wifi_ssid);
-    }
-    object  =  cJSON_GetObjectItemCaseSensitive(root, "wifi_pass");
-    if (cJSON_IsString(object)) {
-        app_params.dev_wifi_pass = strdup(object->valuestring);
-        ESP_LOGI(TAG, "Device wifi pass is %s", app_params.dev_wifi_pass);
-    }
-
-    object = cJSON_GetObjectItemCaseSensitive(root, "mqtt_broker");
-    if (cJSON_IsString(object)) {
-        app_params.dev_mqtt_broker = strdup(object->valuestring);
-        ESP_LOGI(TAG, "Device MQTT Broker Url: %s", app_params.dev_mqtt_broker);
-    }
-
-    object = cJSON_GetObjectItemCaseSensitive(root, "mqtt_broker_port");
-    if (cJSON_IsNumber(object)) {
-        app_params.dev_mqtt_broker_port = object->valueint;
-        ESP_LOGI(TAG, "Device MQTT Broker Port:%" PRIu32 "", app_params.dev_mqtt_broker_port);
-    }
-
-    cJSON_Delete(root);
-    return ESP_OK;
-}
-
 static esp_err_t app_set_default_dev_config(void)
 {
     cJSON *root = cJSON_CreateObject();
@@ -149,7 +106,7 @@ static esp_err_t app_get_device_config(void)
     int flen = file_read(APP_CONFIG_FILE_DEVICE_CFG, &buff);
     if (flen > 0) {
         ESP_LOGI(TAG, "%d bytes read from %s", flen, APP_CONFIG_FILE_DEVICE_CFG);
-        status = app_parse_config_data(buff, flen);
+        status = app_parse_config_data(&app_params, buff, flen);
     }
     free((void *)buff);
     return status;
@@ -198,6 +155,13 @@ static void app_mngr_mqtt_sub_handle(const char *topic_name, esp_mqtt_event_hand
                 esp_restart();
             }
         }
+    } else if (!strcmp(topic_name, MQTT_DOWNLINK_TOPIC)) {
+        /* downlinks are small, a chunked one is not expected */
+        if (evt->current_data_offset != 0 || evt->data_len != evt->total_data_len) {
+            ESP_LOGE(TAG, "chunked downlink is dropped!");
+            return;
+        }
+        downlink_mngr_handle_mqtt(evt->data, evt->data_len);
     }
 }
 
@@ -213,6 +177,26 @@ esp_err_t app_start(void)
 
     app_params.dev_serial = app_get_serial();
     app_params.dev_model = APP_DEV_MODEL;
+    app_params.lora_modem = (sx127x_modem_config_t)SX127X_MODEM_CONFIG_DEFAULT();
+    app_params.lora_radios[0] = (app_lora_radio_t) {
+        .pin_nss = TTN_PIN_NSS,
+        .pin_rst = TTN_PIN_RST,
+        .pin_dio0 = TTN_PIN_DIO0,
+    };
+    app_params.lora_radio_cnt = 1;
+    app_params.lora_lbt = (app_lora_lbt_t) {
+        .mode = APP_LORA_LBT_OFF,
+        .rssi_threshold = APP_LORA_LBT_RSSI_THRESHOLD,
+        .max_attempts = APP_LORA_LBT_MAX_ATTEMPTS,
+        .backoff_min_ms = APP_LORA_LBT_BACKOFF_MIN_MS,
+        .backoff_max_ms = APP_LORA_LBT_BACKOFF_MAX_MS,
+    };
+    app_params.lora_duty_cycle = (app_lora_duty_cycle_t) {
+        .enabled = true,
+        .policy = DUTY_CYCLE_POLICY_DEFER,
+        .max_defer_ms = APP_LORA_DUTY_CYCLE_MAX_DEFER_MS,
+    };
+    app_params.lora_rx1_delay_ms = APP_LORA_RX1_DELAY_MS;
 
 #ifdef DEBUG_BUILD
     print_app_info();
@@ -0,0 +1,181 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "cJSON.h"
+#include "app/app_types.h"
+#include "app/lora_manager.h"
+#include "app/downlink_manager.h"
+#include "app/fragment_manager.h"
+
+static const char *TAG = "downlink_manager";
+
+/*
+ * Downlinks wait here until their device sends an uplink, the gateway answers
+ * in the rx window after it. A device entry is freed once its queue is empty.
+ */
+typedef struct {
+    bool used;
+    uint8_t dev_eui[LORA_DEV_EUI_LEN];
+    downlink_t queue[DOWNLINK_QUEUE_LEN];
+    uint8_t head;
+    uint8_t count;
+} downlink_dev_t;
+
+static downlink_dev_t s_devices[DOWNLINK_DEV_MAX];
+static SemaphoreHandle_t s_lock = NULL;
+static downlink_stats_t s_stats = {0};
+
+static downlink_dev_t *downlink_mngr_find(const uint8_t *dev_eui)
+{
+    for (uint8_t i = 0; i < DOWNLINK_DEV_MAX; i++) {
+        if (s_devices[i].used && !memcmp(s_devices[i].dev_eui, dev_eui, LORA_DEV_EUI_LEN)) {
+            return &s_devices[i];
+        }
+    }
+    return NULL;
+}
+
+static downlink_dev_t *downlink_mngr_alloc(const uint8_t *dev_eui)
+{
+    for (uint8_t i = 0; i < DOWNLINK_DEV_MAX; i++) {
+        if (!s_devices[i].used) {
+            memset(&s_devices[i], 0, sizeof(downlink_dev_t));
+            s_devices[i].used = true;
+            memcpy(s_devices[i].dev_eui, dev_eui, LORA_DEV_EUI_LEN);
+            return &s_devices[i];
+        }
+    }
+    return NULL;
+}
+
+esp_err_t downlink_mngr_init(void)
+{
+    s_lock = xSemaphoreCreateMutex();
+    if (!s_lock) {
+        ESP_LOGE(TAG, "couldn't create the downlink lock!");
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t downlink_mngr_push(const uint8_t *dev_eui, const uint8_t *data, uint8_t data_len)
+{
+    return downlink_mngr_push_packet(dev_eui, LORA_PACKET_ID_DOWNLINK, data, data_len);
+}
+
+/* fragments of large downlinks and fragment status frames wait in the same queue */
+esp_err_t downlink_mngr_push_packet(const uint8_t *dev_eui, uint8_t packet_id, const uint8_t *data, uint8_t data_len)
+{
+    esp_err_t err = ESP_OK;
+    if (!s_lock) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (data_len > LORA_PACKET_MAX_DATA_LEN) {
+        ESP_LOGE(TAG, "data_len(%d) > LORA_PACKET_MAX_DATA_LEN(%d)", data_len, LORA_PACKET_MAX_DATA_LEN);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    downlink_dev_t *dev = downlink_mngr_find(dev_eui);
+    if (!dev) {
+        dev = downlink_mngr_alloc(dev_eui);
+    }
+    if (!dev) {
+        s_stats.table_full++;
+        err = ESP_ERR_NO_MEM;
+    } else if (dev->count >= DOWNLINK_QUEUE_LEN) {
+        s_stats.queue_full++;
+        err = ESP_ERR_NO_MEM;
+    } else {
+        downlink_t *downlink = &dev->queue[(dev->head + dev->count) % DOWNLINK_QUEUE_LEN];
+        downlink->packet_id = packet_id;
+        memcpy(downlink->data, data, data_len);
+        downlink->data_len = data_len;
+        dev->count++;
+        s_stats.queued++;
+    }
+    xSemaphoreGive(s_lock);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "downlink couldn't be queued (%s)", esp_err_to_name(err));
+    }
+    return err;
+}
+
+bool downlink_mngr_pop(const uint8_t *dev_eui, downlink_t *downlink)
+{
+    bool found = false;
+    if (!s_lock) {
+        return false;
+    }
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    downlink_dev_t *dev = downlink_mngr_find(dev_eui);
+    if (dev && dev->count) {
+        *downlink = dev->queue[dev->head];
+        dev->head = (dev->head + 1) % DOWNLINK_QUEUE_LEN;
+        if (!--dev->count) {
+            dev->used = false;
+        }
+        s_stats.delivered++;
+        found = true;
+    }
+    xSemaphoreGive(s_lock);
+    return found;
+}
+
+static bool downlink_mngr_parse_eui(const char *str, uint8_t *dev_eui)
+{
+    if (strlen(str) != 2 * LORA_DEV_EUI_LEN) {
+        return false;
+    }
+    for (uint8_t i = 0; i < LORA_DEV_EUI_LEN; i++) {
+        unsigned int byte = 0;
+        if (sscanf(&str[2 * i], "%2x", &byte) != 1) {
+            return false;
+        }
+        dev_eui[i] = byte;
+    }
+    return true;
+}
+
+/* {"dev_eui":"A1B2C3D4E5F6","data":"..."}, dev_eui is the client mac */
+esp_err_t downlink_mngr_handle_mqtt(const char *data, size_t data_len)
+{
+    uint8_t dev_eui[LORA_DEV_EUI_LEN] = {0};
+    cJSON *root = cJSON_ParseWithLength(data, data_len);
+    if (!root) {
+        ESP_LOGE(TAG, "downlink is not a json!");
+        s_stats.invalid++;
+        return ESP_FAIL;
+    }
+    cJSON *eui = cJSON_GetObjectItemCaseSensitive(root, "dev_eui");
+    cJSON *payload = cJSON_GetObjectItemCaseSensitive(root, "data");
+    if (!cJSON_IsString(eui) || !cJSON_IsString(payload) ||
+            !downlink_mngr_parse_eui(eui->valuestring, dev_eui)) {
+        ESP_LOGE(TAG, "downlink needs dev_eui and data!");
+        s_stats.invalid++;
+        cJSON_Delete(root);
+        return ESP_FAIL;
+    }
+    size_t payload_len = strlen(payload->valuestring);
+    esp_err_t err = ESP_OK;
+    if (payload_len > FRAGMENT_PAYLOAD_MAX) {
+        err = ESP_ERR_INVALID_SIZE;
+    } else if (payload_len > lora_data_max()) {
+        err = fragment_mngr_send(dev_eui, LORA_PACKET_ID_DOWNLINK, (const uint8_t *)payload->valuestring, payload_len);
+    } else {
+        err = downlink_mngr_push(dev_eui, (const uint8_t *)payload->valuestring, payload_len);
+    }
+    if (err == ESP_OK) {
+        ESP_LOGI(TAG, "downlink queued for %s, len:%d", eui->valuestring, (int)payload_len);
+    }
+    cJSON_Delete(root);
+    return err;
+}
+
+void downlink_mngr_get_stats(downlink_stats_t *stats)
+{
+    *stats = s_stats;
+}
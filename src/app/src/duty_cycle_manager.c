@@ -0,0 +1,159 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <inttypes.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "app/app_types.h"
+#include "app/duty_cycle_manager.h"
+
+#define DUTY_CYCLE_BUCKET_US    ((int64_t)DUTY_CYCLE_WINDOW_S * 1000000 / DUTY_CYCLE_BUCKETS)
+
+static const char *TAG = "duty_cycle_manager";
+
+/* EU868 sub-bands, duty cycle is in 0.1% steps */
+typedef struct {
+    const char *name;
+    long freq_min;
+    long freq_max;
+    uint16_t duty_permille;
+} duty_cycle_band_t;
+
+static const duty_cycle_band_t s_bands[] = {
+    { "h1.2", 863000000, 865000000, 1 },
+    { "h1.3", 865000000, 868000000, 10 },
+    { "g1",   868000000, 868600000, 10 },
+    { "g2",   868700000, 869200000, 1 },
+    { "g3",   869400000, 869650000, 100 },
+    { "g4",   869700000, 870000000, 10 },
+};
+
+/*
+ * Sliding window airtime per band. The window is split in buckets, a bucket is
+ * counted until its whole span has left the window, so the sum never under counts.
+ */
+typedef struct {
+    uint32_t bucket_id[DUTY_CYCLE_BUCKETS];
+    uint32_t airtime_us[DUTY_CYCLE_BUCKETS];
+} duty_cycle_usage_t;
+
+static duty_cycle_usage_t s_usage[ARRAY_SIZE(s_bands)];
+static duty_cycle_stats_t s_stats = {0};
+static long s_warned_frequency = 0;
+
+static int duty_cycle_mngr_band(long frequency)
+{
+    for (size_t i = 0; i < ARRAY_SIZE(s_bands); i++) {
+        if (frequency >= s_bands[i].freq_min && frequency <= s_bands[i].freq_max) {
+            return i;
+        }
+    }
+    if (frequency != s_warned_frequency) {
+        s_warned_frequency = frequency;
+        ESP_LOGW(TAG, "%ld Hz is out of the band table, airtime is not limited!", frequency);
+    }
+    return -1;
+}
+
+static int64_t duty_cycle_mngr_budget_us(int band)
+{
+    return (int64_t)DUTY_CYCLE_WINDOW_S * 1000000 * s_bands[band].duty_permille / 1000;
+}
+
+static bool duty_cycle_mngr_in_window(uint32_t bucket_id, uint32_t now_id)
+{
+    return bucket_id + DUTY_CYCLE_BUCKETS > now_id;
+}
+
+static int64_t duty_cycle_mngr_used_us(int band, uint32_t now_id)
+{
+    int64_t used_us = 0;
+    duty_cycle_usage_t *usage = &s_usage[band];
+    for (uint8_t i = 0; i < DUTY_CYCLE_BUCKETS; i++) {
+        if (usage->airtime_us[i] && duty_cycle_mngr_in_window(usage->bucket_id[i], now_id)) {
+            used_us += usage->airtime_us[i];
+        }
+    }
+    return used_us;
+}
+
+esp_err_t duty_cycle_mngr_check(long frequency, uint32_t airtime_us, uint32_t *wait_ms)
+{
+    int band = duty_cycle_mngr_band(frequency);
+    *wait_ms = 0;
+    s_stats.checked++;
+    if (band < 0) {
+        s_stats.unrestricted++;
+        return ESP_OK;
+    }
+    int64_t budget_us = duty_cycle_mngr_budget_us(band);
+    if (airtime_us > budget_us) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    int64_t now_us = esp_timer_get_time();
+    uint32_t now_id = now_us / DUTY_CYCLE_BUCKET_US;
+    int64_t used_us = duty_cycle_mngr_used_us(band, now_id);
+    if (used_us + airtime_us <= budget_us) {
+        return ESP_OK;
+    }
+
+    /* walk the window from the oldest bucket until enough airtime is released */
+    duty_cycle_usage_t *usage = &s_usage[band];
+    uint32_t oldest_id = now_id >= DUTY_CYCLE_BUCKETS ? now_id + 1 - DUTY_CYCLE_BUCKETS : 0;
+    for (uint32_t id = oldest_id; id <= now_id; id++) {
+        uint8_t idx = id % DUTY_CYCLE_BUCKETS;
+        if (usage->bucket_id[idx] == id) {
+            used_us -= usage->airtime_us[idx];
+        }
+        if (used_us + airtime_us <= budget_us) {
+            *wait_ms = ((int64_t)(id + DUTY_CYCLE_BUCKETS) * DUTY_CYCLE_BUCKET_US - now_us) / 1000 + 1;
+            break;
+        }
+    }
+    return ESP_ERR_TIMEOUT;
+}
+
+void duty_cycle_mngr_commit(long frequency, uint32_t airtime_us)
+{
+    int band = duty_cycle_mngr_band(frequency);
+    s_stats.airtime_us += airtime_us;
+    if (band < 0) {
+        return;
+    }
+    uint32_t now_id = esp_timer_get_time() / DUTY_CYCLE_BUCKET_US;
+    duty_cycle_usage_t *usage = &s_usage[band];
+    uint8_t idx = now_id % DUTY_CYCLE_BUCKETS;
+    if (usage->bucket_id[idx] != now_id) {
+        usage->bucket_id[idx] = now_id;
+        usage->airtime_us[idx] = 0;
+    }
+    usage->airtime_us[idx] += airtime_us;
+}
+
+void duty_cycle_mngr_add_deferral(uint32_t wait_ms)
+{
+    s_stats.deferred++;
+    s_stats.deferred_ms += wait_ms;
+}
+
+void duty_cycle_mngr_add_drop(void)
+{
+    s_stats.dropped++;
+}
+
+int64_t duty_cycle_mngr_remaining_us(long frequency)
+{
+    int band = duty_cycle_mngr_band(frequency);
+    if (band < 0) {
+        return DUTY_CYCLE_NO_LIMIT;
+    }
+    uint32_t now_id = esp_timer_get_time() / DUTY_CYCLE_BUCKET_US;
+    int64_t remaining_us = duty_cycle_mngr_budget_us(band) - duty_cycle_mngr_used_us(band, now_id);
+    return remaining_us > 0 ? remaining_us : 0;
+}
+
+void duty_cycle_mngr_get_stats(duty_cycle_stats_t *stats)
+{
+    *stats = s_stats;
+}
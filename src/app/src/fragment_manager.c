@@ -0,0 +1,375 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_random.h"
+#include "app/app_types.h"
+#include "app/lora_manager.h"
+#include "app/fragment_manager.h"
+
+static const char *TAG = "fragment_manager";
+
+/*
+ * Both sides run the same tables: messages being sent wait in a tx slot until their
+ * status acknowledges them, messages being received fill an rx slot until complete.
+ * Frames always carry the eui of the client, so device and message id name a message
+ * in both directions.
+ */
+typedef enum {
+    FRAGMENT_RX_FREE,
+    FRAGMENT_RX_FILLING,
+    FRAGMENT_RX_DELIVERED,  /* owned by the caller of fragment_mngr_handle() */
+} fragment_rx_state_t;
+
+typedef struct {
+    fragment_rx_state_t state;
+    uint8_t msg_id;
+    uint8_t count;
+    uint16_t received;      /* bitmap */
+    int64_t last_us;
+    fragment_msg_t msg;
+} fragment_rx_t;
+
+typedef struct {
+    bool used;
+    uint8_t dev_eui[LORA_DEV_EUI_LEN];
+    uint8_t msg_id;
+    uint8_t packet_id;
+    uint8_t count;
+    uint16_t len;
+    uint16_t pending;       /* bitmap of the fragments to (re)send */
+    uint8_t retries;
+    int64_t last_us;
+    uint8_t data[FRAGMENT_PAYLOAD_MAX];
+} fragment_tx_t;
+
+typedef struct {
+    uint8_t dev_eui[LORA_DEV_EUI_LEN];
+    uint8_t msg_id;
+    int64_t done_us;
+} fragment_done_t;
+
+static fragment_rx_t s_rx[FRAGMENT_RX_SLOTS];
+static fragment_tx_t s_tx[FRAGMENT_TX_SLOTS];
+static fragment_done_t s_done[FRAGMENT_DONE_MAX];
+static uint8_t s_done_cnt = 0, s_done_head = 0;
+static uint8_t s_msg_id = 0;
+/* FRAGMENT_CHUNK_MAX, less with a short implicit header frame, both sides agree on it */
+static uint8_t s_chunk_max = FRAGMENT_CHUNK_MAX;
+static SemaphoreHandle_t s_lock = NULL;
+static fragment_send_cb_t s_send_cb = NULL;
+static fragment_stats_t s_stats = {0};
+
+static uint16_t fragment_mngr_all(uint8_t count)
+{
+    return count >= FRAGMENT_COUNT_MAX ? 0xffff : (1 << count) - 1;
+}
+
+esp_err_t fragment_mngr_init(fragment_send_cb_t send_cb)
+{
+    if (!send_cb) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    s_send_cb = send_cb;
+    s_chunk_max = MIN(lora_data_max() - FRAGMENT_HEADER_LEN, FRAGMENT_CHUNK_MAX);
+    /* the ids of the messages before a restart may still be remembered by the receiver */
+    s_msg_id = esp_random();
+    s_lock = xSemaphoreCreateMutex();
+    if (!s_lock) {
+        ESP_LOGE(TAG, "couldn't create the fragment lock!");
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+/* called with the lock held, stops at the first fragment the queue doesn't take */
+static void fragment_mngr_send_pending(fragment_tx_t *tx)
+{
+    uint8_t buf[LORA_PACKET_MAX_DATA_LEN];
+    for (uint8_t i = 0; i < tx->count && tx->pending; i++) {
+        if (!(tx->pending & (1 << i))) {
+            continue;
+        }
+        uint16_t offset = i * s_chunk_max;
+        uint8_t chunk_len = MIN(tx->len - offset, s_chunk_max);
+        buf[0] = tx->msg_id;
+        buf[1] = tx->packet_id;
+        buf[2] = i;
+        buf[3] = tx->count;
+        memcpy(&buf[FRAGMENT_HEADER_LEN], &tx->data[offset], chunk_len);
+        if (s_send_cb(tx->dev_eui, LORA_PACKET_ID_FRAGMENT, buf, FRAGMENT_HEADER_LEN + chunk_len) != ESP_OK) {
+            break;
+        }
+        tx->pending &= ~(1 << i);
+        tx->last_us = esp_timer_get_time();
+        s_stats.tx_fragments++;
+    }
+}
+
+esp_err_t fragment_mngr_send(const uint8_t *dev_eui, uint8_t packet_id, const uint8_t *data, uint16_t data_len)
+{
+    if (!s_lock) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    uint16_t payload_max = MIN(FRAGMENT_PAYLOAD_MAX, FRAGMENT_COUNT_MAX * s_chunk_max);
+    if (!data || !data_len || data_len > payload_max) {
+        ESP_LOGE(TAG, "data_len(%d) > %d", data_len, payload_max);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    esp_err_t err = ESP_ERR_NO_MEM;
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    for (uint8_t i = 0; i < FRAGMENT_TX_SLOTS; i++) {
+        fragment_tx_t *tx = &s_tx[i];
+        if (tx->used) {
+            continue;
+        }
+        tx->used = true;
+        memcpy(tx->dev_eui, dev_eui, LORA_DEV_EUI_LEN);
+        tx->msg_id = s_msg_id++;
+        tx->packet_id = packet_id;
+        tx->count = (data_len + s_chunk_max - 1) / s_chunk_max;
+        tx->len = data_len;
+        tx->pending = fragment_mngr_all(tx->count);
+        tx->retries = 0;
+        tx->last_us = esp_timer_get_time();
+        memcpy(tx->data, data, data_len);
+        s_stats.tx_messages++;
+        fragment_mngr_send_pending(tx);
+        err = ESP_OK;
+        break;
+    }
+    xSemaphoreGive(s_lock);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "there is no free fragment tx slot!");
+    }
+    return err;
+}
+
+static void fragment_mngr_send_status(const uint8_t *dev_eui, uint8_t msg_id, uint16_t missing)
+{
+    uint8_t buf[FRAGMENT_STATUS_LEN] = {msg_id, missing >> 8, missing & 0xff};
+    if (s_send_cb(dev_eui, LORA_PACKET_ID_FRAGMENT_STATUS, buf, sizeof(buf)) != ESP_OK) {
+        ESP_LOGW(TAG, "fragment status couldn't be queued, msg:%d", msg_id);
+    }
+}
+
+static void fragment_mngr_handle_status(const lora_frame_t *frame)
+{
+    if (frame->data_len != FRAGMENT_STATUS_LEN) {
+        s_stats.rx_invalid++;
+        return;
+    }
+    uint8_t msg_id = frame->data[0];
+    uint16_t missing = (frame->data[1] << 8) | frame->data[2];
+    for (uint8_t i = 0; i < FRAGMENT_TX_SLOTS; i++) {
+        fragment_tx_t *tx = &s_tx[i];
+        if (!tx->used || tx->msg_id != msg_id || memcmp(tx->dev_eui, frame->dev_eui, LORA_DEV_EUI_LEN)) {
+            continue;
+        }
+        missing &= fragment_mngr_all(tx->count);
+        if (!missing) {
+            tx->used = false;
+            s_stats.tx_delivered++;
+            ESP_LOGI(TAG, "msg:%d delivered in %d fragments", msg_id, tx->count);
+        } else if (tx->retries++ >= FRAGMENT_TX_RETRY_MAX) {
+            tx->used = false;
+            s_stats.tx_failed++;
+            ESP_LOGE(TAG, "msg:%d failed, missing:0x%04x", msg_id, missing);
+        } else {
+            /* only the missing ones go again */
+            tx->pending |= missing;
+            for (uint8_t j = 0; j < tx->count; j++) {
+                s_stats.tx_retransmits += (missing >> j) & 1;
+            }
+            fragment_mngr_send_pending(tx);
+        }
+        return;
+    }
+}
+
+/* an entry past the ttl is forgotten, the sender gave up on it long ago */
+static bool fragment_mngr_is_done(const uint8_t *dev_eui, uint8_t msg_id)
+{
+    int64_t now_us = esp_timer_get_time();
+    for (uint8_t i = 0; i < s_done_cnt; i++) {
+        if (s_done[i].msg_id == msg_id && !memcmp(s_done[i].dev_eui, dev_eui, LORA_DEV_EUI_LEN) &&
+                now_us - s_done[i].done_us < FRAGMENT_DONE_TTL_MS * 1000LL) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void fragment_mngr_add_done(const uint8_t *dev_eui, uint8_t msg_id)
+{
+    memcpy(s_done[s_done_head].dev_eui, dev_eui, LORA_DEV_EUI_LEN);
+    s_done[s_done_head].msg_id = msg_id;
+    s_done[s_done_head].done_us = esp_timer_get_time();
+    s_done_head = (s_done_head + 1) % FRAGMENT_DONE_MAX;
+    s_done_cnt = MIN(s_done_cnt + 1, FRAGMENT_DONE_MAX);
+}
+
+/* the slot of the message, a new one within the pool and per device caps */
+static fragment_rx_t *fragment_mngr_rx_slot(const uint8_t *dev_eui, uint8_t msg_id, uint8_t count)
+{
+    fragment_rx_t *free_slot = NULL;
+    uint8_t dev_slots = 0, used = 0;
+    for (uint8_t i = 0; i < FRAGMENT_RX_SLOTS; i++) {
+        fragment_rx_t *rx = &s_rx[i];
+        if (rx->state == FRAGMENT_RX_FREE) {
+            free_slot = free_slot ? free_slot : rx;
+            continue;
+        }
+        used++;
+        if (!memcmp(rx->msg.dev_eui, dev_eui, LORA_DEV_EUI_LEN)) {
+            if (rx->state == FRAGMENT_RX_FILLING && rx->msg_id == msg_id) {
+                return rx->count == count ? rx : NULL;
+            }
+            dev_slots++;
+        }
+    }
+    if (!free_slot || dev_slots >= FRAGMENT_RX_PER_DEV) {
+        s_stats.rx_pool_full++;
+        return NULL;
+    }
+    memset(free_slot, 0, offsetof(fragment_rx_t, msg) + offsetof(fragment_msg_t, data));
+    free_slot->state = FRAGMENT_RX_FILLING;
+    free_slot->msg_id = msg_id;
+    free_slot->count = count;
+    memcpy(free_slot->msg.dev_eui, dev_eui, LORA_DEV_EUI_LEN);
+    s_stats.rx_high_water = MAX(s_stats.rx_high_water, used + 1);
+    return free_slot;
+}
+
+static fragment_msg_t *fragment_mngr_handle_fragment(const lora_frame_t *frame)
+{
+    uint16_t data_len = MIN(frame->data_len, LORA_PACKET_MAX_DATA_LEN);
+    if (data_len <= FRAGMENT_HEADER_LEN) {
+        s_stats.rx_invalid++;
+        return NULL;
+    }
+    uint8_t msg_id = frame->data[0], packet_id = frame->data[1], index = frame->data[2], count = frame->data[3];
+    uint16_t chunk_len = data_len - FRAGMENT_HEADER_LEN;
+    uint16_t offset = index * s_chunk_max;
+    /* only the last fragment may be short */
+    if (!count || count > FRAGMENT_COUNT_MAX || index >= count || offset + chunk_len > FRAGMENT_PAYLOAD_MAX ||
+            (index < count - 1 && chunk_len != s_chunk_max)) {
+        s_stats.rx_invalid++;
+        return NULL;
+    }
+    s_stats.rx_fragments++;
+    if (fragment_mngr_is_done(frame->dev_eui, msg_id)) {
+        /* the acknowledgement was lost */
+        s_stats.rx_duplicates++;
+        fragment_mngr_send_status(frame->dev_eui, msg_id, 0);
+        return NULL;
+    }
+    fragment_rx_t *rx = fragment_mngr_rx_slot(frame->dev_eui, msg_id, count);
+    if (!rx) {
+        return NULL;
+    }
+    if (rx->received & (1 << index)) {
+        s_stats.rx_duplicates++;
+    }
+    memcpy(&rx->msg.data[offset], &frame->data[FRAGMENT_HEADER_LEN], chunk_len);
+    rx->received |= 1 << index;
+    rx->last_us = esp_timer_get_time();
+    rx->msg.packet_id = packet_id;
+    if (index == count - 1) {
+        rx->msg.len = offset + chunk_len;
+    }
+    uint16_t missing = fragment_mngr_all(count) & ~rx->received;
+    if (!missing) {
+        rx->state = FRAGMENT_RX_DELIVERED;
+        rx->msg.data[rx->msg.len] = '\0';
+        fragment_mngr_add_done(frame->dev_eui, msg_id);
+        fragment_mngr_send_status(frame->dev_eui, msg_id, 0);
+        s_stats.rx_messages++;
+        return &rx->msg;
+    }
+    if (index == count - 1) {
+        /* the sender is done, ask for the gaps */
+        fragment_mngr_send_status(frame->dev_eui, msg_id, missing);
+    }
+    return NULL;
+}
+
+/* dispatch stage, fragment and status frames of both directions, returns a completed message */
+fragment_msg_t *fragment_mngr_handle(const lora_frame_t *frame)
+{
+    fragment_msg_t *msg = NULL;
+    if (!s_lock) {
+        return NULL;
+    }
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (frame->packet_id == LORA_PACKET_ID_FRAGMENT_STATUS) {
+        fragment_mngr_handle_status(frame);
+    } else if (frame->packet_id == LORA_PACKET_ID_FRAGMENT) {
+        msg = fragment_mngr_handle_fragment(frame);
+    }
+    xSemaphoreGive(s_lock);
+    if (msg) {
+        ESP_LOGI(TAG, "packet id:0x%x reassembled, len:%d", msg->packet_id, msg->len);
+    }
+    return msg;
+}
+
+void fragment_mngr_release(fragment_msg_t *msg)
+{
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    for (uint8_t i = 0; i < FRAGMENT_RX_SLOTS; i++) {
+        if (&s_rx[i].msg == msg) {
+            s_rx[i].state = FRAGMENT_RX_FREE;
+        }
+    }
+    xSemaphoreGive(s_lock);
+}
+
+/*
+ * Expires stale reassemblies, sends what the queue didn't take and probes silent receivers.
+ * Every FRAGMENT_POLL_MS from a task that may wait, not from a timer callback.
+ */
+void fragment_mngr_poll(void)
+{
+    if (!s_lock) {
+        return;
+    }
+    int64_t now_us = esp_timer_get_time();
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    for (uint8_t i = 0; i < FRAGMENT_RX_SLOTS; i++) {
+        fragment_rx_t *rx = &s_rx[i];
+        if (rx->state == FRAGMENT_RX_FILLING && now_us - rx->last_us > FRAGMENT_RX_TIMEOUT_MS * 1000LL) {
+            rx->state = FRAGMENT_RX_FREE;
+            s_stats.rx_timeouts++;
+            ESP_LOGW(TAG, "msg:%d timed out, received:0x%04x", rx->msg_id, rx->received);
+        }
+    }
+    for (uint8_t i = 0; i < FRAGMENT_TX_SLOTS; i++) {
+        fragment_tx_t *tx = &s_tx[i];
+        if (!tx->used) {
+            continue;
+        }
+        if (!tx->pending && now_us - tx->last_us > FRAGMENT_TX_TIMEOUT_MS * 1000LL) {
+            if (tx->retries++ >= FRAGMENT_TX_RETRY_MAX) {
+                tx->used = false;
+                s_stats.tx_failed++;
+                ESP_LOGE(TAG, "msg:%d failed, no status", tx->msg_id);
+                continue;
+            }
+            /* the last fragment makes the receiver report the gaps */
+            tx->pending = 1 << (tx->count - 1);
+            s_stats.tx_retransmits++;
+        }
+        fragment_mngr_send_pending(tx);
+    }
+    xSemaphoreGive(s_lock);
+}
+
+void fragment_mngr_get_stats(fragment_stats_t *stats)
+{
+    *stats = s_stats;
+}
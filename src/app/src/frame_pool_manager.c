@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "app/app_types.h"
+#include "app/frame_pool_manager.h"
+
+static const char *TAG = "frame_pool_manager";
+
+/* spi dma reads words, every buffer starts word aligned */
+#define FRAME_POOL_ALIGN    4
+
+static uint8_t *s_storage = NULL;
+static size_t s_item_size = 0;
+/* indexes of the free buffers, the last freed goes out first while it is still in cache */
+static uint8_t s_free[FRAME_POOL_SIZE];
+static uint8_t s_free_cnt = 0;
+static bool s_in_use[FRAME_POOL_SIZE];
+static SemaphoreHandle_t s_lock = NULL;
+static frame_pool_stats_t s_stats = {0};
+
+_Static_assert(FRAME_POOL_SIZE <= UINT8_MAX, "free list holds 8 bit indexes");
+
+esp_err_t frame_pool_mngr_init(size_t item_size)
+{
+    item_size = (item_size + FRAME_POOL_ALIGN - 1) & ~(size_t)(FRAME_POOL_ALIGN - 1);
+    s_storage = heap_caps_calloc(FRAME_POOL_SIZE, item_size, MALLOC_CAP_DMA | MALLOC_CAP_8BIT);
+    s_lock = xSemaphoreCreateMutex();
+    if (!s_storage || !s_lock) {
+        ESP_LOGE(TAG, "couldn't create the frame pool!");
+        return ESP_ERR_NO_MEM;
+    }
+    s_item_size = item_size;
+    for (uint8_t i = 0; i < FRAME_POOL_SIZE; i++) {
+        s_free[i] = FRAME_POOL_SIZE - 1 - i;
+    }
+    s_free_cnt = FRAME_POOL_SIZE;
+    ESP_LOGI(TAG, "%d buffers of %d bytes", FRAME_POOL_SIZE, (int)item_size);
+    return ESP_OK;
+}
+
+/* NULL when every buffer is taken, the caller drops its frame like on a full queue */
+void *frame_pool_mngr_alloc(void)
+{
+    if (!s_lock) {
+        return NULL;
+    }
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (!s_free_cnt) {
+        s_stats.exhausted++;
+        xSemaphoreGive(s_lock);
+        ESP_LOGE(TAG, "frame pool is exhausted!");
+        return NULL;
+    }
+    uint8_t index = s_free[--s_free_cnt];
+    s_in_use[index] = true;
+    s_stats.allocated++;
+    s_stats.in_use++;
+    s_stats.high_water = MAX(s_stats.high_water, s_stats.in_use);
+    xSemaphoreGive(s_lock);
+    return &s_storage[index * s_item_size];
+}
+
+esp_err_t frame_pool_mngr_free(void *item)
+{
+    if (!s_lock || !item) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    size_t offset = (uint8_t *)item - s_storage;
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if ((uint8_t *)item < s_storage || offset % s_item_size || offset / s_item_size >= FRAME_POOL_SIZE ||
+            !s_in_use[offset / s_item_size]) {
+        s_stats.bad_frees++;
+        xSemaphoreGive(s_lock);
+        ESP_LOGE(TAG, "%p is not a buffer of the pool in use!", item);
+        return ESP_ERR_INVALID_ARG;
+    }
+    uint8_t index = offset / s_item_size;
+    s_in_use[index] = false;
+    s_free[s_free_cnt++] = index;
+    s_stats.freed++;
+    s_stats.in_use--;
+    xSemaphoreGive(s_lock);
+    return ESP_OK;
+}
+
+void frame_pool_mngr_log_stats(void)
+{
+    frame_pool_stats_t stats;
+    frame_pool_mngr_get_stats(&stats);
+    ESP_LOGI(TAG, "frame pool in use:%" PRIu32 "/%d high water:%" PRIu32 " allocated:%" PRIu32 " freed:%" PRIu32
+             " exhausted:%" PRIu32 " bad frees:%" PRIu32, stats.in_use, FRAME_POOL_SIZE, stats.high_water,
+             stats.allocated, stats.freed, stats.exhausted, stats.bad_frees);
+}
+
+void frame_pool_mngr_get_stats(frame_pool_stats_t *stats)
+{
+    if (!s_lock) {
+        memset(stats, 0, sizeof(frame_pool_stats_t));
+        return;
+    }
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    *stats = s_stats;
+    xSemaphoreGive(s_lock);
+}
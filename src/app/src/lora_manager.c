@@ -1,69 +1,1123 @@
 #include <stdio.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <inttypes.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
-#include "freertos/queue.h"
 #include "freertos/timers.h"
+#include "freertos/semphr.h"
 #include "esp_err.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_random.h"
 #include "cJSON.h"
 #include "core/core_tasks.h"
 #include "core/sx127x.h"
 #include "core/utils.h"
 #include "core/cryption_mngr.h"
+#include "core/ring_buf.h"
+#include "core/file_mngr.h"
+#include "app/app_config.h"
 #include "app/app_types.h"
 #include "app/lora_manager.h"
 #include "app/provisioning_manager.h"
 #include "app/mqtt_mngr.h"
+#include "app/downlink_manager.h"
+#include "app/duty_cycle_manager.h"
+#include "app/payload_codec.h"
+#include "app/fragment_manager.h"
+#include "app/reliable_manager.h"
+#include "app/replay_manager.h"
+#include "app/address_manager.h"
+#include "app/lz_codec.h"
+#include "app/tx_queue_manager.h"
+#include "app/frame_pool_manager.h"
 
 #define TEST_APP_KEY "1234567890abcdef"
-#define LORA_TX_QUEUE_SIZE 10
+#define LORA_CAD_DONE_TIMEOUT_MS    100
+#define LORA_CAD_SYMBOL_TIMEOUT     32
+#define LORA_RX_SINGLE_MARGIN_MS    10
+#define LORA_RX_RING_SIZE           8   /* power of two */
+#define LORA_PUB_RING_SIZE          8   /* power of two */
+#define LORA_RX_WINDOW_LEAD_MS      20  /* class A window opens early, covers tick rounding on both ends */
+#define LORA_REPLY_LATE_MS          50  /* a reply starting later than this misses the client's window */
+#define LORA_RELIABLE_RTO_MARGIN_MS 100 /* ack turnaround on the gateway */
+#define LORA_PROVISIONING_PERIOD_MS 5000
+#define LORA_FCNT_SAVE_STEP         64  /* frame counters a device may use before saving the next limit */
+#define LORA_FCNT_LAST              UINT32_MAX  /* the nonce would repeat after it, nothing goes out */
+#define LORA_FCNT_LOST_BASE         0x80000000u /* a lost counter goes on from a random one above it */
+#define LORA_FCNT_LOST_SPAN         0x40000000u
+#define LORA_FCNT_RESYNC_FAILS      4       /* tag failures in a row before the counter of a device is looked for */
+#define LORA_FCNT_RESYNC_EPOCHS     16      /* 2^16 counters each, a gap of about a million frames */
+#define LORA_WORKER_PERIOD_MS       FRAGMENT_POLL_MS    /* the fragment poll, the flash saves at most this often */
+#define LORA_COMPRESS_MIN_LEN       8   /* shorter payloads gain too little for the compression */
+#define LORA_PUB_TEXT_MAX           (2 * LORA_PACKET_MAX_DATA_LEN + 96)   /* raw schema uplinks are hex */
+/* an implicit header frame holds a provisioning frame, reliable or riding on an ack */
+#define LORA_IMPLICIT_LEN_MIN       (LORA_WIRE_EUI_HEADER_LEN + RELIABLE_ACK_LEN + LORA_RECORD_HEADER_LEN + \
+                                     sizeof(provisioning_t) + LORA_WIRE_TAG_LEN)
 
 static const char *TAG = "lora_manager";
 
-static QueueHandle_t s_tx_queue = {0};
 static TimerHandle_t s_client_test_payload_timer = NULL;
-static lora_frame_t s_lora_tx_frame = {0}, s_lora_rx_frame = {0}, s_tx_queue_packet = {0};
+static lora_frame_t s_lora_rx_frame = {0};
 
-void lora_prepare_provisioning_packet(lora_frame_t *packet)
+/*
+ * Tx frame in a buffer of the frame pool, the queues pass it by handle. Replies carry the
+ * rx window and the radio of the uplink they answer. A frame deferred by the duty cycle or
+ * backing off a busy channel goes back to the queue until not_before_us.
+ */
+typedef struct {
+    uint8_t wire[LORA_FRAME_MAX_LEN];   /* sealed straight into, the spi dma reads it from here */
+    uint8_t wire_len;   /* 0 until encoded, a retry sends the same bytes */
+    lora_frame_t frame;
+    int64_t tx_at_us;   /* 0 to send as soon as possible */
+    int8_t radio;       /* -1 for the radio the last frame came in */
+    uint8_t lbt_attempts;
+    uint32_t deferred_ms;
+    int64_t not_before_us;
+} lora_tx_item_t;
+
+/* uplink being dispatched, replies queued meanwhile go out in its rx window */
+typedef struct {
+    bool valid;
+    bool replied;
+    uint8_t dev_eui[LORA_DEV_EUI_LEN];
+    uint16_t dev_addr;              /* LORA_DEV_ADDR_NONE, the reply goes with the dev eui */
+    int64_t rx_done_us;
+    uint8_t radio;
+    bool ack_pending;               /* a reliable uplink, the reply goes as its ack */
+    uint8_t ack[RELIABLE_ACK_LEN];
+} lora_reply_ctx_t;
+static lora_reply_ctx_t s_reply_ctx = {0};
+static uint8_t s_dev_eui[LORA_DEV_EUI_LEN] = {0};
+static const uint8_t s_broadcast_eui[LORA_DEV_EUI_LEN] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+static uint32_t s_downlinks_received = 0;
+static uint32_t s_rx_records = 0, s_rx_record_errors = 0, s_rx_decompress_errors = 0;
+static uint32_t s_rx_bad_lengths = 0, s_rx_bad_tags = 0, s_rx_fcnt_resyncs = 0;
+/* tag failures in a row of every address, rx_proc stage only */
+static uint8_t s_rx_tag_failures[ADDRESS_DEV_MAX];
+/* counters below the saved limit may have been used, a restart continues from it */
+static uint32_t s_fcnt = 0, s_fcnt_limit = 0;
+/* PROVISING_OK, the counter goes on from here if it is lower */
+static volatile uint32_t s_fcnt_floor = 0;
+/* the counter file is gone after frames went out, only provisioning goes until PROVISING_OK */
+static volatile bool s_fcnt_lost = false;
+/* client uplinks held for one frame, it goes when full or at the deadline of its first record */
+static lora_aggregate_t s_aggregate = {0};
+static SemaphoreHandle_t s_aggregate_lock = NULL;
+static TimerHandle_t s_aggregate_timer = NULL;
+static volatile bool s_aggregate_due = false;
+/* lz_codec compresses in static buffers, one frame at a time */
+static uint8_t s_compress_buf[LORA_PACKET_MAX_DATA_LEN];
+static SemaphoreHandle_t s_compress_lock = NULL;
+/* raw frames from the rx task to the decrypt/dispatch stage */
+typedef struct {
+    uint8_t raw[LORA_FRAME_MAX_LEN];
+    uint8_t len;
+    sx127x_rx_metadata_t meta;
+} lora_rx_slot_t;
+
+/* uplink payloads from the dispatch stage to the publish stage */
+typedef struct {
+    char data[LORA_PACKET_MAX_DATA_LEN + 1];    /* text, or a schema uplink in raw mode */
+    uint8_t data_len;
+    uint8_t packet_id;
+    uint8_t dev_eui[LORA_DEV_EUI_LEN];
+    bool has_reading;                           /* schema uplink decoded on the dispatch stage */
+    payload_reading_t reading;
+    fragment_msg_t *msg;                        /* reassembled payload, released after the publish */
+    sx127x_rx_metadata_t meta;
+} lora_pub_slot_t;
+
+static lora_pub_slot_t s_pub_ring_storage[LORA_PUB_RING_SIZE];
+static ring_buf_t s_pub_ring;
+static TaskHandle_t s_rx_proc_task = NULL, s_pub_task = NULL, s_worker_task = NULL;
+static uint32_t s_published = 0, s_publish_failures = 0;
+static int64_t s_publish_latency_max_us = 0, s_publish_latency_total_us = 0;
+
+typedef struct {
+    uint32_t cad_runs;
+    uint32_t cad_detected;
+    uint32_t rx_single_timeouts;
+    uint32_t rx_packets;
+} lora_cad_stats_t;
+
+/*
+ * Every radio has its own rx task and rx ring, the ring is single producer (the radio's
+ * rx task) single consumer (the dispatch stage) so the radios never lock each other.
+ */
+typedef struct {
+    uint8_t index;
+    sx127x_handle_t dev;
+    SemaphoreHandle_t lock;
+    volatile bool tx_request;
+    uint8_t last_rx_sf;
+    lora_rx_slot_t rx_ring_storage[LORA_RX_RING_SIZE];
+    ring_buf_t rx_ring;
+    uint8_t rx_drop_buf[LORA_FRAME_MAX_LEN];
+    uint32_t rx_frames;
+    lora_cad_stats_t cad_stats;
+} lora_radio_t;
+
+static lora_radio_t s_radios[APP_LORA_RADIO_MAX];
+static uint8_t s_radio_cnt = 0;
+/* 0 sends compact frames, implicit header mode needs every frame at this length */
+static uint8_t s_wire_pad_len = 0;
+/* data room of an addressed frame, less with a short implicit header length */
+static uint8_t s_data_max = LORA_PACKET_MAX_DATA_LEN;
+/* replies go out on the radio, so on the channel, the last frame came in */
+static volatile uint8_t s_tx_radio = 0;
+static lora_tx_stats_t s_tx_stats = {0};
+
+static bool lora_cad_scan_enabled(void)
+{
+    return app_params.device_type == APP_DEVICE_IS_MASTER && app_params.lora_cad_sf_cnt > 0;
+}
+
+static bool lora_class_a_enabled(void)
+{
+    return app_params.device_type == APP_DEVICE_IS_CLIENT && app_params.lora_class_a;
+}
+
+/* runs with the radio lock held, true when the channel is free to transmit */
+static bool lora_lbt_channel_clear(lora_radio_t *radio)
+{
+    const app_lora_lbt_t *lbt = &app_params.lora_lbt;
+    bool busy = false;
+    s_tx_stats.lbt_checks++;
+    /* never cut a frame the radio is receiving */
+    if (sx127x_rx_ongoing(radio->dev)) {
+        s_tx_stats.lbt_rx_ongoing++;
+        return false;
+    }
+    if (lbt->mode == APP_LORA_LBT_CAD) {
+        bool detected = false;
+        busy = sx127x_channel_activity(radio->dev, &detected) == ESP_OK && detected;
+    } else if (lbt->mode == APP_LORA_LBT_RSSI) {
+        int16_t rssi = 0;
+        busy = sx127x_channel_rssi(radio->dev, &rssi) == ESP_OK && rssi > lbt->rssi_threshold;
+    }
+    if (busy) {
+        s_tx_stats.lbt_busy++;
+    }
+    return !busy;
+}
+
+/* random delay in [min, min << attempt], capped by the max, nodes backing off together spread out */
+static uint32_t lora_lbt_backoff_ms(uint8_t attempt)
+{
+    const app_lora_lbt_t *lbt = &app_params.lora_lbt;
+    uint32_t window_ms = MIN((uint32_t)lbt->backoff_min_ms << MIN(attempt, 16), lbt->backoff_max_ms);
+    window_ms = MAX(window_ms, lbt->backoff_min_ms);
+    return lbt->backoff_min_ms + esp_random() % (window_ms - lbt->backoff_min_ms + 1);
+}
+
+/* one channel check, ESP_ERR_TIMEOUT when the channel is busy */
+static esp_err_t lora_radio_send(lora_radio_t *radio, uint8_t *buf, size_t len)
+{
+    bool lbt = app_params.lora_lbt.mode != APP_LORA_LBT_OFF;
+    /* cad scan releases the radio as soon as it sees a pending tx */
+    radio->tx_request = true;
+    xSemaphoreTake(radio->lock, portMAX_DELAY);
+    if (lora_cad_scan_enabled()) {
+        /* reply on the data rate the last frame came in */
+        sx127x_set_spreading_factor(radio->dev, radio->last_rx_sf);
+    }
+    bool clear = !lbt || lora_lbt_channel_clear(radio);
+    esp_err_t err = ESP_ERR_TIMEOUT;
+    if (clear) {
+        err = sx127x_send_packet(radio->dev, buf, len);
+    } else if (!lora_cad_scan_enabled()) {
+        sx127x_receive(radio->dev);
+    }
+    radio->tx_request = false;
+    xSemaphoreGive(radio->lock);
+    if (clear) {
+        if (err == ESP_OK) {
+            s_tx_stats.sent++;
+        } else {
+            s_tx_stats.send_failures++;
+        }
+    }
+    return err;
+}
+
+/*
+ * Class A client keeps the radio idle except a short window rx1 delay after the end of
+ * each uplink. The tx task steps the window between frames, the queues are held until it
+ * is over, the rx task fetches a frame caught in it.
+ */
+typedef enum {
+    LORA_CLASS_A_IDLE,
+    LORA_CLASS_A_WAIT,          /* rx1 delay after the uplink */
+    LORA_CLASS_A_LISTEN,        /* rx single until the symbol timeout */
+    LORA_CLASS_A_RECEIVE,       /* a downlink is coming in, the next uplink must not cut it */
+} lora_class_a_state_t;
+
+/* tx task only */
+static struct {
+    lora_class_a_state_t state;
+    lora_radio_t *radio;
+    sx127x_modem_config_t modem;
+    int64_t step_us;
+} s_class_a = {0};
+
+static void lora_class_a_rx_window(lora_radio_t *radio)
+{
+    xSemaphoreTake(radio->lock, portMAX_DELAY);
+    s_class_a.step_us = sx127x_dio0_timestamp_us(radio->dev) +
+                        ((int64_t)app_params.lora_rx1_delay_ms - LORA_RX_WINDOW_LEAD_MS) * 1000;
+    sx127x_idle(radio->dev);
+    sx127x_get_modem_config(radio->dev, &s_class_a.modem);
+    xSemaphoreGive(radio->lock);
+    s_class_a.radio = radio;
+    s_class_a.state = LORA_CLASS_A_WAIT;
+    tx_queue_mngr_hold(true);
+}
+
+/* runs the step of the window that is due, the ticks until the next one, portMAX_DELAY without a window */
+static TickType_t lora_class_a_step(void)
+{
+    if (s_class_a.state == LORA_CLASS_A_IDLE) {
+        return portMAX_DELAY;
+    }
+    int64_t now_us = esp_timer_get_time();
+    if (s_class_a.step_us > now_us) {
+        return MAX(pdMS_TO_TICKS((s_class_a.step_us - now_us) / 1000), 1);
+    }
+    lora_radio_t *radio = s_class_a.radio;
+    const sx127x_modem_config_t *modem = &s_class_a.modem;
+    xSemaphoreTake(radio->lock, portMAX_DELAY);
+    if (s_class_a.state == LORA_CLASS_A_WAIT) {
+        sx127x_receive_single(radio->dev);
+        /* rx single gives up after symbol timeout without a preamble */
+        s_class_a.step_us = now_us + ((int64_t)modem->symbol_timeout * sx127x_modem_symbol_time_us(modem) / 1000 +
+                                      LORA_RX_SINGLE_MARGIN_MS) * 1000;
+        s_class_a.state = LORA_CLASS_A_LISTEN;
+    } else if (s_class_a.state == LORA_CLASS_A_LISTEN && sx127x_rx_ongoing(radio->dev)) {
+        s_class_a.step_us = now_us + sx127x_modem_time_on_air_us(modem, LORA_FRAME_MAX_LEN) + LORA_RX_SINGLE_MARGIN_MS * 1000;
+        s_class_a.state = LORA_CLASS_A_RECEIVE;
+    } else {
+        s_class_a.state = LORA_CLASS_A_IDLE;
+    }
+    xSemaphoreGive(radio->lock);
+    if (s_class_a.state == LORA_CLASS_A_IDLE) {
+        tx_queue_mngr_hold(false);
+        return portMAX_DELAY;
+    }
+    return lora_class_a_step();
+}
+
+/*
+ * Airtime budget of the band, a frame waits for it or is dropped by the policy. A deferred
+ * frame gets its retry time, ESP_ERR_NOT_FINISHED, and waits in the queue, not in the task.
+ */
+static esp_err_t lora_duty_cycle_acquire(lora_tx_item_t *item, long frequency, uint32_t airtime_us)
+{
+    const app_lora_duty_cycle_t *duty_cycle = &app_params.lora_duty_cycle;
+    uint32_t wait_ms = 0;
+    if (!duty_cycle->enabled) {
+        return ESP_OK;
+    }
+    esp_err_t err = duty_cycle_mngr_check(frequency, airtime_us, &wait_ms);
+    /* a reply can not be deferred, its rx window is fixed */
+    if (err == ESP_ERR_TIMEOUT && !item->tx_at_us && duty_cycle->policy == DUTY_CYCLE_POLICY_DEFER &&
+            item->deferred_ms + wait_ms <= duty_cycle->max_defer_ms) {
+        ESP_LOGW(TAG, "duty cycle budget is used up, tx deferred %" PRIu32 "ms", wait_ms);
+        duty_cycle_mngr_add_deferral(wait_ms);
+        item->deferred_ms += wait_ms;
+        item->not_before_us = esp_timer_get_time() + (int64_t)wait_ms * 1000;
+        return ESP_ERR_NOT_FINISHED;
+    }
+    if (err != ESP_OK) {
+        duty_cycle_mngr_add_drop();
+        ESP_LOGE(TAG, "duty cycle budget is used up, tx dropped (wait %" PRIu32 "ms)", wait_ms);
+    }
+    return err;
+}
+
+/* a downlink that couldn't go out tries again after the next uplink */
+static void lora_downlink_requeue(lora_tx_item_t *item)
+{
+    const lora_frame_t *frame = &item->frame;
+    lora_frame_t record;
+    uint16_t pos = RELIABLE_ACK_LEN;
+    /* a downlink riding on an ack goes back alone, the client retransmits for the ack */
+    if (frame->packet_id == LORA_PACKET_ID_ACK && lora_record_next(frame, &pos, &record) == ESP_OK) {
+        frame = &record;
+    }
+    uint8_t packet_id = frame->packet_id;
+    if (packet_id == LORA_PACKET_ID_DOWNLINK ||
+            (app_params.device_type == APP_DEVICE_IS_MASTER &&
+             (packet_id == LORA_PACKET_ID_FRAGMENT || packet_id == LORA_PACKET_ID_FRAGMENT_STATUS ||
+              packet_id == LORA_PACKET_ID_COMPRESSED))) {
+        downlink_mngr_push_packet(frame->dev_eui, packet_id, frame->data, frame->data_len);
+    }
+}
+
+/* a counter on air in full, the other side may not know the sender's counter */
+static bool lora_wire_fcnt_full(uint16_t dev_addr, bool uplink)
+{
+    return !uplink || dev_addr == LORA_DEV_ADDR_NONE;
+}
+
+static size_t lora_wire_header_len(uint16_t dev_addr, bool uplink)
+{
+    if (dev_addr == LORA_DEV_ADDR_NONE) {
+        return LORA_WIRE_EUI_HEADER_LEN;
+    }
+    return uplink ? LORA_WIRE_HEADER_LEN : LORA_WIRE_DOWN_HEADER_LEN;
+}
+
+/* direction, dev addr, the dev eui of an unaddressed frame and the whole 32 bit counter */
+static void lora_wire_nonce(const lora_frame_t *frame, bool uplink, uint8_t *nonce)
+{
+    memset(nonce, 0, CRYPTION_NONCE_LEN);
+    nonce[0] = uplink ? 0x00 : 0x01;
+    nonce[1] = frame->dev_addr >> 8;
+    nonce[2] = frame->dev_addr & 0xff;
+    if (frame->dev_addr == LORA_DEV_ADDR_NONE) {
+        memcpy(&nonce[3], frame->dev_eui, LORA_DEV_EUI_LEN);
+    }
+    nonce[9] = frame->fcnt >> 24;
+    nonce[10] = frame->fcnt >> 16;
+    nonce[11] = frame->fcnt >> 8;
+    nonce[12] = frame->fcnt & 0xff;
+}
+
+/* the counter nearest to the last one of the sender with these low 16 bits */
+static uint32_t lora_fcnt_expand(uint32_t fcnt_ref, uint16_t fcnt_low)
+{
+    return fcnt_ref + (int16_t)(fcnt_low - (uint16_t)fcnt_ref);
+}
+
+/*
+ * Frame to its on air bytes, len is the buffer size in and the encoded length out. The
+ * header goes in clear, the data is encrypted from frame straight behind it. The counter of the
+ * sender makes the nonce, the same counter must never go twice under the key.
+ */
+esp_err_t lora_frame_encode(const lora_frame_t *frame, bool uplink, uint8_t *buf, size_t *len)
+{
+    bool with_eui = frame->dev_addr == LORA_DEV_ADDR_NONE;
+    if (frame->data_len > (with_eui ? LORA_PACKET_MAX_EUI_DATA_LEN : LORA_PACKET_MAX_DATA_LEN)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    size_t header_len = lora_wire_header_len(frame->dev_addr, uplink);
+    size_t tag_pos = header_len + frame->data_len;
+    size_t wire_len = s_wire_pad_len ? s_wire_pad_len : tag_pos + LORA_WIRE_TAG_LEN;
+    if (*len < wire_len || tag_pos + LORA_WIRE_TAG_LEN > wire_len) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    size_t pos = 0;
+    buf[pos++] = frame->packet_id;
+    buf[pos++] = frame->dev_addr >> 8;
+    buf[pos++] = frame->dev_addr & 0xff;
+    if (with_eui) {
+        memcpy(&buf[pos], frame->dev_eui, LORA_DEV_EUI_LEN);
+        pos += LORA_DEV_EUI_LEN;
+    }
+    if (lora_wire_fcnt_full(frame->dev_addr, uplink)) {
+        buf[pos++] = frame->fcnt >> 24;
+        buf[pos++] = frame->fcnt >> 16;
+    }
+    buf[pos++] = frame->fcnt >> 8;
+    buf[pos++] = frame->fcnt & 0xff;
+    buf[pos++] = frame->data_len;
+    memset(&buf[tag_pos + LORA_WIRE_TAG_LEN], 0, wire_len - tag_pos - LORA_WIRE_TAG_LEN);
+    uint8_t nonce[CRYPTION_NONCE_LEN];
+    lora_wire_nonce(frame, uplink, nonce);
+    *len = wire_len;
+    return cryption_mngr_seal(nonce, buf, header_len, frame->data, frame->data_len, &buf[header_len],
+                              &buf[tag_pos], LORA_WIRE_TAG_LEN);
+}
+
+/*
+ * The clear header of a frame: packet id, dev addr, the dev eui of an unaddressed frame,
+ * the counter as it is on air and the data len. ESP_ERR_INVALID_SIZE when the header and
+ * the frame length don't agree. The dev eui of an addressed frame is left as it is.
+ */
+esp_err_t lora_frame_header(const uint8_t *buf, size_t len, bool uplink, lora_frame_t *frame)
+{
+    if (len < LORA_WIRE_LEN(0) || len > LORA_FRAME_MAX_LEN) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    uint16_t dev_addr = buf[1] << 8 | buf[2];
+    size_t header_len = lora_wire_header_len(dev_addr, uplink);
+    if (len < header_len + LORA_WIRE_TAG_LEN) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    uint8_t data_len = buf[header_len - 1];
+    size_t tag_pos = header_len + data_len;
+    /* only implicit header frames carry padding */
+    if (data_len > LORA_PACKET_MAX_DATA_LEN || tag_pos + LORA_WIRE_TAG_LEN > len ||
+            (!s_wire_pad_len && tag_pos + LORA_WIRE_TAG_LEN != len)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    frame->packet_id = buf[0];
+    frame->dev_addr = dev_addr;
+    if (dev_addr == LORA_DEV_ADDR_NONE) {
+        memcpy(frame->dev_eui, &buf[1 + LORA_DEV_ADDR_LEN], LORA_DEV_EUI_LEN);
+    }
+    const uint8_t *fcnt = &buf[header_len - 1 - LORA_WIRE_FCNT_LEN];
+    frame->fcnt = fcnt[0] << 8 | fcnt[1];
+    if (lora_wire_fcnt_full(dev_addr, uplink)) {
+        frame->fcnt |= (uint32_t)fcnt[-2] << 24 | (uint32_t)fcnt[-1] << 16;
+    }
+    frame->data_len = data_len;
+    return ESP_OK;
+}
+
+/*
+ * An addressed frame comes without the dev eui, the caller resolves the address first.
+ * fcnt_ref is the last counter seen from the sender, an addressed uplink's low 16 bits are
+ * taken as the counter nearest to it. A frame of the wrong length or with a wrong tag is
+ * ESP_ERR_INVALID_SIZE or ESP_ERR_INVALID_CRC, the data of frame is not valid then. The
+ * data is decrypted straight into frame.
+ */
+esp_err_t lora_frame_decode(const uint8_t *buf, size_t len, bool uplink, uint32_t fcnt_ref, lora_frame_t *frame)
+{
+    esp_err_t err = lora_frame_header(buf, len, uplink, frame);
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (!lora_wire_fcnt_full(frame->dev_addr, uplink)) {
+        frame->fcnt = lora_fcnt_expand(fcnt_ref, frame->fcnt);
+    }
+    size_t header_len = lora_wire_header_len(frame->dev_addr, uplink);
+    uint8_t nonce[CRYPTION_NONCE_LEN];
+    lora_wire_nonce(frame, uplink, nonce);
+    err = cryption_mngr_open(nonce, buf, header_len, &buf[header_len], frame->data_len, frame->data,
+                             &buf[header_len + frame->data_len], LORA_WIRE_TAG_LEN);
+    if (err != ESP_OK) {
+        return err;
+    }
+    frame->end_of_frame = 0xDE;
+    return ESP_OK;
+}
+
+/* appends a record to an aggregate frame, ESP_ERR_INVALID_SIZE if it doesn't fit */
+esp_err_t lora_record_put(lora_frame_t *frame, uint8_t packet_id, const uint8_t *data, uint8_t data_len)
+{
+    if (packet_id == LORA_PACKET_ID_AGGREGATE || (!data && data_len)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (frame->packet_id != LORA_PACKET_ID_AGGREGATE) {
+        frame->packet_id = LORA_PACKET_ID_AGGREGATE;
+        frame->data_len = 0;
+    }
+    uint8_t records = 0;
+    for (uint16_t pos = 0; pos + LORA_RECORD_HEADER_LEN <= frame->data_len; pos += LORA_RECORD_HEADER_LEN + frame->data[pos + 1]) {
+        records++;
+    }
+    if (records >= LORA_RECORD_MAX || frame->data_len + LORA_RECORD_HEADER_LEN + data_len > s_data_max) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    frame->data[frame->data_len++] = packet_id;
+    frame->data[frame->data_len++] = data_len;
+    if (data_len) {
+        memcpy(&frame->data[frame->data_len], data, data_len);
+    }
+    frame->data_len += data_len;
+    frame->end_of_frame = 0xDE;
+    return ESP_OK;
+}
+
+/* record at pos as a frame of the same device, ESP_ERR_NOT_FOUND after the last one */
+esp_err_t lora_record_next(const lora_frame_t *frame, uint16_t *pos, lora_frame_t *record)
+{
+    uint16_t data_len = MIN(frame->data_len, LORA_PACKET_MAX_DATA_LEN);
+    if (*pos >= data_len) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (*pos + LORA_RECORD_HEADER_LEN > data_len || *pos + LORA_RECORD_HEADER_LEN + frame->data[*pos + 1] > data_len) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (frame->data[*pos] == LORA_PACKET_ID_AGGREGATE) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    record->packet_id = frame->data[*pos];
+    record->data_len = frame->data[*pos + 1];
+    memcpy(record->dev_eui, frame->dev_eui, LORA_DEV_EUI_LEN);
+    record->dev_addr = frame->dev_addr;
+    memcpy(record->data, &frame->data[*pos + LORA_RECORD_HEADER_LEN], record->data_len);
+    record->end_of_frame = 0xDE;
+    *pos += LORA_RECORD_HEADER_LEN + record->data_len;
+    return ESP_OK;
+}
+
+/*
+ * Holds the record for one frame with the next ones. The held frame goes through send
+ * before a record that doesn't fit it and once it is full, the caller sends it at its
+ * deadline with lora_aggregate_flush(). ESP_ERR_INVALID_SIZE when the record doesn't fit
+ * a frame of its own either, it goes alone then.
+ */
+esp_err_t lora_aggregate_put(lora_aggregate_t *aggregate, uint8_t packet_id, const uint8_t *data, uint8_t data_len,
+                             bool compress, lora_aggregate_send_t send, void *arg)
+{
+    esp_err_t err = lora_record_put(&aggregate->frame, packet_id, data, data_len);
+    if (err == ESP_ERR_INVALID_SIZE && aggregate->cnt) {
+        /* the held records go now, this one starts the next frame */
+        err = lora_aggregate_flush(aggregate, send, arg);
+        err = err == ESP_OK ? lora_record_put(&aggregate->frame, packet_id, data, data_len) : err;
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+    aggregate->compress |= compress;
+    if (++aggregate->cnt == LORA_RECORD_MAX) {
+        return lora_aggregate_flush(aggregate, send, arg);
+    }
+    return ESP_OK;
+}
+
+/* a single record goes without the record header */
+esp_err_t lora_aggregate_flush(lora_aggregate_t *aggregate, lora_aggregate_send_t send, void *arg)
+{
+    lora_frame_t *frame = &aggregate->frame;
+    esp_err_t err = ESP_OK;
+    if (aggregate->cnt == 1) {
+        err = send(frame->data[0], &frame->data[LORA_RECORD_HEADER_LEN], frame->data[1], aggregate->compress, 1, arg);
+    } else if (aggregate->cnt) {
+        err = send(LORA_PACKET_ID_AGGREGATE, frame->data, frame->data_len, aggregate->compress, aggregate->cnt, arg);
+    }
+    frame->data_len = 0;
+    aggregate->cnt = 0;
+    aggregate->compress = false;
+    return err;
+}
+
+static const provisioning_t *lora_provisioning_request(const lora_frame_t *frame)
+{
+    const uint8_t *data = frame->data;
+    uint16_t data_len = MIN(frame->data_len, LORA_PACKET_MAX_DATA_LEN);
+    if (frame->dev_addr != LORA_DEV_ADDR_NONE) {
+        return NULL;
+    }
+    if (frame->packet_id == LORA_PACKET_ID_RELIABLE && data_len >= RELIABLE_HEADER_LEN &&
+            data[1] == LORA_PACKET_ID_PROVISING) {
+        data += RELIABLE_HEADER_LEN;
+        data_len -= RELIABLE_HEADER_LEN;
+    } else if (frame->packet_id != LORA_PACKET_ID_PROVISING) {
+        return NULL;
+    }
+    return data_len >= sizeof(provisioning_t) ? (const provisioning_t *)data : NULL;
+}
+
+static esp_err_t lora_fcnt_save(uint32_t limit)
+{
+    char buf[12];
+    int len = snprintf(buf, sizeof(buf), "%" PRIu32, limit);
+    if (file_save(APP_CONFIG_FILE_FCNT, buf, len) != len) {
+        ESP_LOGE(TAG, "frame counter limit couldn't be saved!");
+        return ESP_FAIL;
+    }
+    s_fcnt_limit = limit;
+    return ESP_OK;
+}
+
+/*
+ * Both sides start from their saved limit: the counter makes the nonce, one used before a
+ * restart must not go again, and the gateway would drop a client's lower ones as replays.
+ * Without the limit but with an address the used counters are unknown. Counting from a
+ * random one far above keeps off them, a client gives up its address and provisions again.
+ */
+static void lora_fcnt_restore(void)
+{
+    char *buf = NULL;
+    if (file_load(APP_CONFIG_FILE_FCNT, &buf) > 0) {
+        s_fcnt = strtoul(buf, NULL, 10);
+    } else if (file_is_exist(APP_CONFIG_FILE_APPROVE_GW) || file_is_exist(APP_CONFIG_FILE_DEV_ADDR) ||
+               file_is_exist(APP_CONFIG_FILE_ADDR_TABLE)) {
+        s_fcnt = LORA_FCNT_LOST_BASE + esp_random() % LORA_FCNT_LOST_SPAN;
+        if (app_params.device_type == APP_DEVICE_IS_CLIENT) {
+            s_fcnt_lost = true;
+            file_delete(APP_CONFIG_FILE_APPROVE_GW);
+            file_delete(APP_CONFIG_FILE_DEV_ADDR);
+        }
+        ESP_LOGE(TAG, "frame counter is lost, the device has to provision again!");
+    }
+    free(buf);
+    /* the first frame saves the next limit */
+    s_fcnt_limit = s_fcnt;
+    ESP_LOGI(TAG, "frame counter starts at %" PRIu32, s_fcnt);
+}
+
+/*
+ * Every transmission has its own counter, a retransmission too. Nothing goes out past the
+ * saved limit or once the counter is used up, the device needs a new key then.
+ */
+static esp_err_t lora_fcnt_next(const lora_frame_t *frame, uint32_t *fcnt)
+{
+    if (s_fcnt_lost && !lora_provisioning_request(frame)) {
+        ESP_LOGE(TAG, "frame counter is lost, packet id:0x%x waits for the provisioning!", frame->packet_id);
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (s_fcnt < s_fcnt_floor) {
+        /* saved before the first frame from it */
+        s_fcnt = s_fcnt_limit = s_fcnt_floor;
+    }
+    if (s_fcnt == LORA_FCNT_LAST) {
+        ESP_LOGE(TAG, "frame counter is used up, the key has to change!");
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (s_fcnt == s_fcnt_limit &&
+            lora_fcnt_save(s_fcnt_limit + MIN(LORA_FCNT_SAVE_STEP, LORA_FCNT_LAST - s_fcnt_limit)) != ESP_OK) {
+        return ESP_FAIL;
+    }
+    *fcnt = s_fcnt++;
+    return ESP_OK;
+}
+
+/* a client that lost its counter gets the one after the last the gateway accepted */
+void lora_fcnt_floor(uint32_t fcnt)
+{
+    if (fcnt > s_fcnt_floor) {
+        s_fcnt_floor = fcnt;
+        ESP_LOGI(TAG, "frame counter floor %" PRIu32, fcnt);
+    }
+    s_fcnt_lost = false;
+}
+
+/* a new frame in the item, encoded and sent from the start */
+static void lora_tx_item_init(lora_tx_item_t *item, int64_t tx_at_us, int8_t radio)
+{
+    item->wire_len = 0;
+    item->tx_at_us = tx_at_us;
+    item->radio = radio;
+    item->lbt_attempts = 0;
+    item->deferred_ms = 0;
+    item->not_before_us = 0;
+}
+
+/*
+ * Encrypts a queue item in its own buffer once and sends it from there, the queue holds a
+ * reply until its rx window. ESP_ERR_NOT_FINISHED when the item has to be sent again at
+ * not_before_us. The caller keeps the item, a new frame in it needs lora_tx_item_init().
+ */
+static esp_err_t lora_tx_item_send(lora_tx_item_t *item)
+{
+    lora_radio_t *radio = &s_radios[item->radio < 0 ? s_tx_radio : item->radio];
+    size_t tx_len = item->wire_len;
+    esp_err_t err = ESP_OK;
+    if (!tx_len) {
+        uint32_t fcnt = 0;
+        tx_len = sizeof(item->wire);
+        err = lora_fcnt_next(&item->frame, &fcnt);
+        if (err != ESP_OK) {
+            return err;
+        }
+        item->frame.fcnt = fcnt;
+        err = lora_frame_encode(&item->frame, app_params.device_type == APP_DEVICE_IS_CLIENT, item->wire, &tx_len);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "packet id:0x%x couldn't be encoded!", item->frame.packet_id);
+            return err;
+        }
+        item->wire_len = tx_len;
+    }
+    sx127x_modem_config_t modem;
+    sx127x_get_modem_config(radio->dev, &modem);
+    if (lora_cad_scan_enabled()) {
+        modem.spreading_factor = radio->last_rx_sf;
+    }
+    uint32_t airtime_us = sx127x_modem_time_on_air_us(&modem, tx_len);
+    err = lora_duty_cycle_acquire(item, modem.frequency, airtime_us);
+    if (err == ESP_ERR_NOT_FINISHED) {
+        return err;
+    }
+    if (err != ESP_OK) {
+        lora_downlink_requeue(item);
+        return err;
+    }
+
+    if (item->tx_at_us) {
+        int64_t late_us = esp_timer_get_time() - item->tx_at_us;
+        if (late_us > LORA_REPLY_LATE_MS * 1000) {
+            s_tx_stats.reply_windows_missed++;
+            ESP_LOGE(TAG, "rx window missed by %" PRIi64 "us, packet id:0x%x", late_us, item->frame.packet_id);
+            lora_downlink_requeue(item);
+            return ESP_ERR_TIMEOUT;
+        }
+    }
+    err = lora_radio_send(radio, item->wire, tx_len);
+    if (err == ESP_ERR_TIMEOUT) {
+        /* timed replies get a single channel check, a backoff would miss the rx window anyway */
+        uint8_t attempts = item->tx_at_us ? 1 : app_params.lora_lbt.max_attempts;
+        if (++item->lbt_attempts < attempts) {
+            /* the radio is free while backing off, rx and the other frames go on meanwhile */
+            uint32_t backoff_ms = lora_lbt_backoff_ms(item->lbt_attempts - 1);
+            s_tx_stats.lbt_backoff_ms += backoff_ms;
+            item->not_before_us = esp_timer_get_time() + (int64_t)backoff_ms * 1000;
+            return ESP_ERR_NOT_FINISHED;
+        }
+        s_tx_stats.lbt_gave_up++;
+        ESP_LOGW(TAG, "radio%d channel is busy, tx gave up after %d attempts", radio->index, item->lbt_attempts);
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+    duty_cycle_mngr_commit(modem.frequency, airtime_us);
+    if (item->tx_at_us) {
+        s_tx_stats.replies_sent++;
+    }
+    ESP_LOGV(TAG, "radio%d sent frame:", radio->index);
+    ESP_LOG_BUFFER_HEXDUMP(TAG, item->wire, tx_len, ESP_LOG_VERBOSE);
+    if (lora_class_a_enabled()) {
+        lora_class_a_rx_window(radio);
+    }
+    return ESP_OK;
+}
+
+/* gateway replies to the uplink being dispatched, in its rx1 window on the radio it came in */
+static bool lora_reply_pending(void)
+{
+    return app_params.device_type == APP_DEVICE_IS_MASTER && s_reply_ctx.valid && !s_reply_ctx.replied &&
+           xTaskGetCurrentTaskHandle() == s_rx_proc_task;
+}
+
+static bool lora_reliable_enabled(uint8_t packet_id)
+{
+    for (uint8_t i = 0; i < app_params.lora_reliable_id_cnt; i++) {
+        if (app_params.lora_reliable_ids[i] == packet_id) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* a reply has a fixed window, wrapped frames go in the class of the frame they carry */
+static tx_class_t lora_tx_class(const lora_tx_item_t *item)
+{
+    const lora_frame_t *frame = &item->frame;
+    uint8_t packet_id = frame->packet_id;
+    if (item->tx_at_us) {
+        return TX_CLASS_CONTROL;
+    }
+    if (packet_id == LORA_PACKET_ID_RELIABLE && frame->data_len >= RELIABLE_HEADER_LEN) {
+        packet_id = frame->data[1];
+    }
+    if (packet_id == LORA_PACKET_ID_COMPRESSED && frame->data_len > LORA_COMPRESS_HEADER_LEN) {
+        packet_id = frame->data[0];
+    }
+    switch (packet_id) {
+    case LORA_PACKET_ID_PROVISING:
+    case LORA_PACKET_ID_PROVISING_OK:
+    case LORA_PACKET_ID_PROVISING_CHALLENGE:
+    case LORA_PACKET_ID_ACK:
+    case LORA_PACKET_ID_FRAGMENT_STATUS:
+        return TX_CLASS_CONTROL;
+    case LORA_PACKET_ID_DOWNLINK:
+        return TX_CLASS_DOWNLINK;
+    case LORA_PACKET_ID_FRAGMENT:
+        return app_params.device_type == APP_DEVICE_IS_MASTER ? TX_CLASS_DOWNLINK : TX_CLASS_BULK;
+    default:
+        return TX_CLASS_BULK;
+    }
+}
+
+static bool lora_compress_enabled(uint8_t packet_id)
+{
+    for (uint8_t i = 0; i < app_params.lora_compress_id_cnt; i++) {
+        if (app_params.lora_compress_ids[i] == packet_id) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* the reply rides on the ack of the reliable uplink it answers, one that doesn't fit goes plain */
+static void lora_reply_wrap_ack(lora_frame_t *packet)
+{
+    if (packet->packet_id != LORA_PACKET_ID_ACK) {
+        if (RELIABLE_ACK_LEN + LORA_RECORD_HEADER_LEN + packet->data_len > s_data_max) {
+            return;
+        }
+        memmove(&packet->data[RELIABLE_ACK_LEN + LORA_RECORD_HEADER_LEN], packet->data, packet->data_len);
+        packet->data[RELIABLE_ACK_LEN] = packet->packet_id;
+        packet->data[RELIABLE_ACK_LEN + 1] = packet->data_len;
+        packet->data_len += RELIABLE_ACK_LEN + LORA_RECORD_HEADER_LEN;
+        packet->packet_id = LORA_PACKET_ID_ACK;
+    } else {
+        packet->data_len = RELIABLE_ACK_LEN;
+    }
+    memcpy(packet->data, s_reply_ctx.ack, RELIABLE_ACK_LEN);
+    s_reply_ctx.ack_pending = false;
+}
+
+/* request of the device with dev_eui, challenge is the last one it got from the gateway */
+void lora_provisioning_frame(lora_frame_t *packet, const uint8_t *dev_eui, const uint8_t *challenge)
 {
     provisioning_t provisioning_packet = {
         .app_key = {TEST_APP_KEY},
     };
-    strcpy((char *)provisioning_packet.global_dev_eui,  utils_get_mac());
+    /* the mac as utils_get_mac() has it */
+    snprintf((char *)provisioning_packet.global_dev_eui, sizeof(provisioning_packet.global_dev_eui),
+             "%02X%02X%02X%02X%02X%02X", dev_eui[0], dev_eui[1], dev_eui[2], dev_eui[3], dev_eui[4], dev_eui[5]);
+    memcpy(provisioning_packet.challenge, challenge, PROVISIONING_CHALLENGE_LEN);
     packet->packet_id = LORA_PACKET_ID_PROVISING;
+    /* the gateway learns the dev eui from it */
+    packet->dev_addr = LORA_DEV_ADDR_NONE;
+    memcpy(packet->dev_eui, dev_eui, LORA_DEV_EUI_LEN);
     memcpy(packet->data, &provisioning_packet, sizeof(provisioning_packet));
     packet->data_len = sizeof(provisioning_packet);
     packet->end_of_frame = 0xDE;
 }
 
-esp_err_t lora_send_tx_queue(uint8_t packet_id, uint8_t *data, uint8_t data_len)
+void lora_prepare_provisioning_packet(lora_frame_t *packet)
+{
+    uint8_t challenge[PROVISIONING_CHALLENGE_LEN];
+    provisioning_mngr_get_challenge(challenge);
+    lora_provisioning_frame(packet, s_dev_eui, challenge);
+}
+
+static esp_err_t lora_tx_queue_put(uint8_t packet_id, uint8_t *data, uint8_t data_len, bool reliable)
 {
-    if (data_len > LORA_PACKET_MAX_DATA_LEN) {
-        ESP_LOGE(TAG, "data_len(%d) > LORA_PACKET_MAX_DATA_LEN(%d)", data_len, LORA_PACKET_MAX_DATA_LEN);
+    if (data_len > s_data_max) {
+        ESP_LOGE(TAG, "data_len(%d) > lora_data_max(%d)", data_len, s_data_max);
         return ESP_FAIL;
     }
+    if (reliable && data_len <= s_data_max - RELIABLE_HEADER_LEN) {
+        return reliable_mngr_send(packet_id, data, data_len);
+    }
+    /* the item is ours until the queue takes its handle */
+    lora_tx_item_t *item = frame_pool_mngr_alloc();
+    if (!item) {
+        return ESP_ERR_NO_MEM;
+    }
+    lora_frame_t *packet = &item->frame;
     if (packet_id == LORA_PACKET_ID_PROVISING_OK) {
-        lora_prepare_provisioning_packet(&s_tx_queue_packet);
-        s_tx_queue_packet.packet_id = LORA_PACKET_ID_PROVISING_OK;
+        lora_prepare_provisioning_packet(packet);
+        packet->packet_id = LORA_PACKET_ID_PROVISING_OK;
+        /* data is the address the gateway assigned and the counter floor, big endian */
+        provisioning_t *provisioning_ok = (provisioning_t *)packet->data;
+        if (data && data_len == LORA_DEV_ADDR_LEN + sizeof(provisioning_ok->fcnt_floor)) {
+            memcpy(provisioning_ok->dev_addr, data, LORA_DEV_ADDR_LEN);
+            memcpy(provisioning_ok->fcnt_floor, &data[LORA_DEV_ADDR_LEN], sizeof(provisioning_ok->fcnt_floor));
+        }
         ESP_LOGW(TAG, "%s handled", __func__);
     } else {
-        s_tx_queue_packet.packet_id = packet_id;
+        packet->packet_id = packet_id;
         if (data != NULL) {
-            memcpy(s_tx_queue_packet.data, data, data_len);
+            memcpy(packet->data, data, data_len);
         }
-        if (data_len) {
-            s_tx_queue_packet.data_len = data_len;
+        /* only data_len bytes go on air */
+        packet->data_len = data ? data_len : 0;
+        packet->end_of_frame = 0xDE;
+    }
+    bool reply = lora_reply_pending();
+    if (reply) {
+        if (s_reply_ctx.ack_pending) {
+            lora_reply_wrap_ack(packet);
         }
-        s_tx_queue_packet.end_of_frame = 0xDE;
+        s_reply_ctx.replied = true;
+        memcpy(packet->dev_eui, s_reply_ctx.dev_eui, LORA_DEV_EUI_LEN);
+        packet->dev_addr = s_reply_ctx.dev_addr;
+        lora_tx_item_init(item, s_reply_ctx.rx_done_us + (int64_t)app_params.lora_rx1_delay_ms * 1000, s_reply_ctx.radio);
+    } else {
+        memcpy(packet->dev_eui, app_params.device_type == APP_DEVICE_IS_CLIENT ? s_dev_eui : s_broadcast_eui, LORA_DEV_EUI_LEN);
+        packet->dev_addr = app_params.device_type == APP_DEVICE_IS_CLIENT ? address_mngr_own() : LORA_DEV_ADDR_BROADCAST;
+        lora_tx_item_init(item, 0, -1);
+    }
+    /* a reply can not wait behind the queue, the queue holds it until its window */
+    esp_err_t err = tx_queue_mngr_push(lora_tx_class(item), &item, LORA_WIRE_LEN(packet->data_len),
+                                       item->tx_at_us, reply ? TX_QUEUE_FLAG_REPLY : 0);
+    if (err != ESP_OK) {
+        frame_pool_mngr_free(item);
+        return err;
     }
-    if (xQueueSend(s_tx_queue, (void *)&s_tx_queue_packet, 0) == pdPASS) {
-        ESP_LOGI(TAG, "Lora tx command processed, waiting msg cnt:%d", uxQueueMessagesWaiting(s_tx_queue));
+    ESP_LOGI(TAG, "Lora tx command processed, waiting msg cnt:%" PRIu32, tx_queue_mngr_waiting());
+    return ESP_OK;
+}
+
+/* an unaddressed frame with the dev eui, a reply from the gateway finds the client without an address */
+static esp_err_t lora_provisioning_queue(const lora_frame_t *request)
+{
+    lora_tx_item_t *item = frame_pool_mngr_alloc();
+    if (!item) {
+        return ESP_ERR_NO_MEM;
+    }
+    item->frame = *request;
+    lora_tx_item_init(item, 0, -1);
+    esp_err_t err = tx_queue_mngr_push(lora_tx_class(item), &item, LORA_WIRE_LEN(request->data_len), 0, 0);
+    if (err != ESP_OK) {
+        frame_pool_mngr_free(item);
+    }
+    return err;
+}
+
+/* lz_codec and the buffer for every compressing task of the process */
+esp_err_t lora_compress_init(void)
+{
+    if (s_compress_lock) {
         return ESP_OK;
     }
-    return ESP_FAIL;
+    s_compress_lock = xSemaphoreCreateMutex();
+    if (!s_compress_lock || lz_codec_init() != ESP_OK) {
+        ESP_LOGE(TAG, "couldn't start the compression!");
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+/* extra is the header going in front, the reliable one. Padded frames of implicit header mode gain nothing */
+static bool lora_compress_worth(uint8_t data_len, uint8_t extra)
+{
+    return !s_wire_pad_len && data_len <= s_data_max - extra && data_len >= LORA_COMPRESS_MIN_LEN;
+}
+
+/* with the compress lock held, the COMPRESSED data in s_compress_buf, 0 when it isn't shorter on air */
+static uint8_t lora_compress_locked(uint8_t packet_id, const uint8_t *data, uint8_t data_len, uint8_t extra)
+{
+    int len = lz_codec_compress(data, data_len, &s_compress_buf[LORA_COMPRESS_HEADER_LEN],
+                                data_len - LORA_COMPRESS_HEADER_LEN);
+    if (len < 0 || LORA_WIRE_LEN(extra + LORA_COMPRESS_HEADER_LEN + len) >= LORA_WIRE_LEN(extra + data_len)) {
+        return 0;
+    }
+    s_compress_buf[0] = packet_id;
+    return LORA_COMPRESS_HEADER_LEN + len;
+}
+
+/* the frame goes as COMPRESSED when that is shorter on air, ESP_ERR_INVALID_SIZE when it stays raw */
+esp_err_t lora_frame_compress(lora_frame_t *frame, uint8_t extra)
+{
+    if (!s_compress_lock) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (!lora_compress_worth(frame->data_len, extra)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    xSemaphoreTake(s_compress_lock, portMAX_DELAY);
+    uint8_t len = lora_compress_locked(frame->packet_id, frame->data, frame->data_len, extra);
+    if (len) {
+        frame->packet_id = LORA_PACKET_ID_COMPRESSED;
+        frame->data_len = len;
+        memcpy(frame->data, s_compress_buf, len);
+    }
+    xSemaphoreGive(s_compress_lock);
+    return len ? ESP_OK : ESP_ERR_INVALID_SIZE;
+}
+
+/* between the payload and the encryption, the frame goes as COMPRESSED when that is shorter on air */
+static esp_err_t lora_send_compressed(uint8_t packet_id, uint8_t *data, uint8_t data_len, bool reliable)
+{
+    uint8_t extra = reliable ? RELIABLE_HEADER_LEN : 0;
+    if (!s_compress_lock || !data || !lora_compress_worth(data_len, extra)) {
+        return lora_tx_queue_put(packet_id, data, data_len, reliable);
+    }
+    xSemaphoreTake(s_compress_lock, portMAX_DELAY);
+    uint8_t len = lora_compress_locked(packet_id, data, data_len, extra);
+    esp_err_t err = ESP_OK;
+    if (!len) {
+        s_tx_stats.compress_raw++;
+        err = lora_tx_queue_put(packet_id, data, data_len, reliable);
+    } else {
+        s_tx_stats.compressed++;
+        s_tx_stats.compress_saved_bytes += data_len - len;
+        err = lora_tx_queue_put(LORA_PACKET_ID_COMPRESSED, s_compress_buf, len, reliable);
+    }
+    xSemaphoreGive(s_compress_lock);
+    return err;
+}
+
+esp_err_t lora_send_tx_queue(uint8_t packet_id, uint8_t *data, uint8_t data_len)
+{
+    bool reliable = app_params.device_type == APP_DEVICE_IS_CLIENT && lora_reliable_enabled(packet_id);
+    if (lora_compress_enabled(packet_id)) {
+        return lora_send_compressed(packet_id, data, data_len, reliable);
+    }
+    return lora_tx_queue_put(packet_id, data, data_len, reliable);
+}
+
+/* payloads over one frame go in fragments, gateway ones come from the downlink topic */
+esp_err_t lora_send_large(uint8_t packet_id, const uint8_t *data, uint16_t data_len)
+{
+    if (data_len <= s_data_max) {
+        return lora_send_tx_queue(packet_id, (uint8_t *)data, data_len);
+    }
+    if (app_params.device_type != APP_DEVICE_IS_CLIENT) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    return fragment_mngr_send(s_dev_eui, packet_id, data, data_len);
+}
+
+/* frames of the client aggregation, called with the aggregate lock held */
+static esp_err_t lora_aggregate_send(uint8_t packet_id, uint8_t *data, uint8_t data_len, bool compress,
+                                     uint8_t records, void *arg)
+{
+    xTimerStop(s_aggregate_timer, 0);
+    if (records > 1) {
+        s_tx_stats.aggregated_frames++;
+    }
+    /* the records share the window, one compression does better than one per record */
+    return compress ? lora_send_compressed(packet_id, data, data_len, false) : lora_tx_queue_put(packet_id, data, data_len, false);
+}
+
+/* the timer task must not wait on the aggregate lock, the worker flushes */
+static void lora_aggregate_timer_cb(TimerHandle_t xTimer)
+{
+    s_aggregate_due = true;
+    xTaskNotifyGive(s_worker_task);
+}
+
+static void lora_aggregate_deadline(void)
+{
+    xSemaphoreTake(s_aggregate_lock, portMAX_DELAY);
+    s_tx_stats.aggregate_deadlines += s_aggregate.cnt != 0;
+    if (lora_aggregate_flush(&s_aggregate, lora_aggregate_send, NULL) != ESP_OK) {
+        ESP_LOGE(TAG, "aggregate frame couldn't be queued!");
+    }
+    xSemaphoreGive(s_aggregate_lock);
+}
+
+/*
+ * Client uplinks wait up to lora_aggregate_ms to share a frame with the next ones, one
+ * preamble, header and tag for all. Without aggregation it is lora_send_tx_queue().
+ */
+esp_err_t lora_send_aggregated(uint8_t packet_id, uint8_t *data, uint8_t data_len)
+{
+    /* reliable uplinks are numbered one by one */
+    if (!s_aggregate_lock || packet_id == LORA_PACKET_ID_PROVISING_OK || packet_id == LORA_PACKET_ID_AGGREGATE ||
+            lora_reliable_enabled(packet_id)) {
+        return lora_send_tx_queue(packet_id, data, data_len);
+    }
+    xSemaphoreTake(s_aggregate_lock, portMAX_DELAY);
+    esp_err_t err = lora_aggregate_put(&s_aggregate, packet_id, data, data_len, lora_compress_enabled(packet_id),
+                                       lora_aggregate_send, NULL);
+    if (err == ESP_ERR_INVALID_SIZE) {
+        /* doesn't fit a record, goes alone */
+        err = lora_send_tx_queue(packet_id, data, data_len);
+    } else if (err == ESP_OK) {
+        s_tx_stats.aggregated_records++;
+        if (s_aggregate.cnt == 1) {
+            xTimerChangePeriod(s_aggregate_timer, pdMS_TO_TICKS(app_params.lora_aggregate_ms), 0);
+        }
+    }
+    xSemaphoreGive(s_aggregate_lock);
+    return err;
+}
+
+/* the tx task owns a popped item, it goes back to the pool once sent or given up */
+static void lora_tx_queue_send_next(TickType_t timeout)
+{
+    lora_tx_item_t *item = NULL;
+    /* the pop comes back by the next step of a class A window, it holds the queues meanwhile */
+    if (tx_queue_mngr_pop(&item, MIN(timeout, lora_class_a_step())) != ESP_OK) {
+        return;
+    }
+    esp_err_t err = lora_tx_item_send(item);
+    if (err == ESP_ERR_NOT_FINISHED) {
+        /* back in its class until the retry, the frames behind it go meanwhile */
+        if (tx_queue_mngr_push(lora_tx_class(item), &item, item->wire_len, item->not_before_us, TX_QUEUE_FLAG_RETRY) == ESP_OK) {
+            return;
+        }
+        err = ESP_ERR_NO_MEM;
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "packet could not be sent, packet id:0x%x", item->frame.packet_id);
+    } else {
+        ESP_LOGI(TAG, "encrypted packet sent, packet id:0x%x", item->frame.packet_id);
+    }
+    frame_pool_mngr_free(item);
 }
 
 void lora_process_task_tx(void *p)
@@ -71,34 +1125,237 @@ void lora_process_task_tx(void *p)
     ESP_LOGI(TAG, "%s started", __func__);
 
     if (app_params.device_type == APP_DEVICE_IS_CLIENT) {
-        /* Client needs provisioning with master */
-        lora_prepare_provisioning_packet(&s_lora_tx_frame);
+        /* Client needs provisioning with master, the requests wait in the queues like any frame */
+        int64_t next_request_us = 0;
         while (!provisioning_mngr_check_device_is_approved()) {
-            lora_frame_t tx_enc_buff = {0};
-            cryption_mngr_encrypt((char *)&s_lora_tx_frame, sizeof(lora_frame_t), (char *)&tx_enc_buff);
-            sx127x_send_packet((uint8_t *)&tx_enc_buff, sizeof(lora_frame_t));
-            ESP_LOGW(TAG, "sent provisioning packet:");
-            ESP_LOG_BUFFER_HEXDUMP(TAG, &s_lora_tx_frame, sizeof(lora_frame_t), ESP_LOG_INFO);
-            ESP_LOGW(TAG, "sent provisioning encrypted packet:");
-            ESP_LOG_BUFFER_HEXDUMP(TAG, &tx_enc_buff, sizeof(lora_frame_t), ESP_LOG_INFO);
-            vTaskDelay(pdMS_TO_TICKS(5000));
+            bool reliable = lora_reliable_enabled(LORA_PACKET_ID_PROVISING);
+            bool challenged = provisioning_mngr_challenged();
+            bool due = esp_timer_get_time() >= next_request_us && (!reliable || !reliable_mngr_in_flight());
+            /* retransmissions follow the rto, PROVISING_OK comes on the ack of the request */
+            if (due || challenged) {
+                /* with the last challenge of the gateway */
+                lora_frame_t request;
+                lora_prepare_provisioning_packet(&request);
+                if (reliable) {
+                    reliable_mngr_send(LORA_PACKET_ID_PROVISING, request.data, request.data_len);
+                } else if (lora_provisioning_queue(&request) != ESP_OK) {
+                    ESP_LOGE(TAG, "provisioning request couldn't be queued!");
+                }
+                next_request_us = esp_timer_get_time() + (int64_t)LORA_PROVISIONING_PERIOD_MS * 1000;
+            }
+            lora_tx_queue_send_next(pdMS_TO_TICKS(100));
         }
         /* This timer using to generate test data from clients to master. TODO Remove later */
         xTimerStart(s_client_test_payload_timer, portMAX_DELAY);
     }
     while (pdTRUE) {
-        if (xQueueReceive(s_tx_queue, (void *)&s_lora_tx_frame, portMAX_DELAY)) {
-            lora_frame_t tx_enc_buff = {0};
-            cryption_mngr_encrypt((char *)&s_lora_tx_frame, sizeof(lora_frame_t), (char *)&tx_enc_buff);
-            sx127x_send_packet((uint8_t *)&tx_enc_buff, sizeof(lora_frame_t));
-            ESP_LOGI(TAG, "encrypted packet sent, packet id:0x%x", s_lora_tx_frame.packet_id);
-            ESP_LOGW(TAG, "Sent encrypted packet:");
-            ESP_LOG_BUFFER_HEXDUMP(TAG, &tx_enc_buff, sizeof(lora_frame_t), ESP_LOG_INFO);
+        lora_tx_queue_send_next(portMAX_DELAY);
+    }
+}
+
+static void lora_publish_enqueue(lora_frame_t *lora_rx_packet, const sx127x_rx_metadata_t *meta)
+{
+    lora_pub_slot_t *slot = ring_buf_reserve(&s_pub_ring);
+    if (!slot) {
+        ESP_LOGE(TAG, "publish ring is full, uplink dropped(%" PRIu32 ")", s_pub_ring.drops);
+        return;
+    }
+    uint8_t data_len = MIN(lora_rx_packet->data_len, LORA_PACKET_MAX_DATA_LEN);
+    slot->packet_id = lora_rx_packet->packet_id;
+    memcpy(slot->dev_eui, lora_rx_packet->dev_eui, LORA_DEV_EUI_LEN);
+    slot->msg = NULL;
+    slot->has_reading = payload_codec_schema(slot->packet_id) && !app_params.lora_payload_raw;
+    if (slot->has_reading) {
+        /* deltas need the readings in arrival order, they are decoded here, not on the publish stage */
+        payload_codec_state_t *state = payload_codec_rx_state(slot->dev_eui, slot->packet_id);
+        esp_err_t err = payload_codec_decode(slot->packet_id, lora_rx_packet->data, data_len, state, &slot->reading);
+        if (err != ESP_OK) {
+            ESP_LOGW(TAG, "packet id:0x%x reading dropped (%s)", slot->packet_id, esp_err_to_name(err));
+            return;
         }
+    } else {
+        memcpy(slot->data, lora_rx_packet->data, data_len);
+        slot->data[data_len] = '\0';
     }
+    slot->data_len = data_len;
+    slot->meta = *meta;
+    ring_buf_commit(&s_pub_ring);
+    xTaskNotifyGive(s_pub_task);
 }
 
-void lora_rx_commander(lora_frame_t *lora_rx_packet)
+/* a reassembled payload, the publish stage releases it */
+static void lora_publish_enqueue_msg(fragment_msg_t *msg, const sx127x_rx_metadata_t *meta)
+{
+    lora_pub_slot_t *slot = ring_buf_reserve(&s_pub_ring);
+    if (!slot) {
+        ESP_LOGE(TAG, "publish ring is full, uplink dropped(%" PRIu32 ")", s_pub_ring.drops);
+        fragment_mngr_release(msg);
+        return;
+    }
+    slot->packet_id = msg->packet_id;
+    memcpy(slot->dev_eui, msg->dev_eui, LORA_DEV_EUI_LEN);
+    slot->has_reading = false;
+    slot->msg = msg;
+    slot->data_len = 0;
+    slot->meta = *meta;
+    ring_buf_commit(&s_pub_ring);
+    xTaskNotifyGive(s_pub_task);
+}
+
+/* text uplinks go as they are, schema uplinks as json or as hex in raw mode */
+static const char *lora_publish_text(const lora_pub_slot_t *slot, char *buf, size_t size)
+{
+    if (slot->msg) {
+        return (const char *)slot->msg->data;
+    }
+    if (slot->has_reading) {
+        return payload_codec_to_json(&slot->reading, slot->dev_eui, buf, size) > 0 ? buf : NULL;
+    }
+    if (!payload_codec_schema(slot->packet_id)) {
+        return slot->data;
+    }
+    const uint8_t *eui = slot->dev_eui;
+    size_t len = snprintf(buf, size, "{\"dev_eui\":\"%02X%02X%02X%02X%02X%02X\",\"packet_id\":%d,\"raw\":\"",
+                          eui[0], eui[1], eui[2], eui[3], eui[4], eui[5], slot->packet_id);
+    /* two hex digits a byte and the closing "} */
+    if (len + 2 * slot->data_len + 3 > size) {
+        return NULL;
+    }
+    for (uint8_t i = 0; i < slot->data_len; i++) {
+        len += sprintf(&buf[len], "%02X", (uint8_t)slot->data[i]);
+    }
+    strcpy(&buf[len], "\"}");
+    return buf;
+}
+
+static void lora_process_task_publish(void *p)
+{
+    while (pdTRUE) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        lora_pub_slot_t *slot = NULL;
+        while ((slot = ring_buf_peek(&s_pub_ring)) != NULL) {
+            static char s_text[LORA_PUB_TEXT_MAX];
+            const char *text = lora_publish_text(slot, s_text, sizeof(s_text));
+            if (text && mqtt_publish_data(MQTT_CONFIG_DATA_TOPIC, text) == ESP_OK) {
+                /* radio to publish latency, from the RxDone interrupt */
+                int64_t latency_us = esp_timer_get_time() - slot->meta.timestamp_us;
+                s_publish_latency_total_us += latency_us;
+                if (latency_us > s_publish_latency_max_us) {
+                    s_publish_latency_max_us = latency_us;
+                }
+                s_published++;
+            } else {
+                s_publish_failures++;
+            }
+            if (slot->msg) {
+                fragment_mngr_release(slot->msg);
+            }
+            ring_buf_release(&s_pub_ring);
+        }
+    }
+}
+
+void lora_rx_commander(lora_frame_t *lora_rx_packet, const sx127x_rx_metadata_t *meta);
+
+/* gateway fragments wait for an uplink of their device like downlinks, client ones are uplinks */
+static esp_err_t lora_fragment_send(const uint8_t *dev_eui, uint8_t packet_id, const uint8_t *data, uint8_t data_len)
+{
+    if (app_params.device_type == APP_DEVICE_IS_MASTER) {
+        return downlink_mngr_push_packet(dev_eui, packet_id, data, data_len);
+    }
+    return lora_send_tx_queue(packet_id, (uint8_t *)data, data_len);
+}
+
+static void lora_rx_fragment(lora_frame_t *lora_rx_packet, const sx127x_rx_metadata_t *meta)
+{
+    fragment_msg_t *msg = fragment_mngr_handle(lora_rx_packet);
+    if (!msg) {
+        return;
+    }
+    if (app_params.device_type == APP_DEVICE_IS_MASTER) {
+        lora_publish_enqueue_msg(msg, meta);
+        return;
+    }
+    if (msg->packet_id == LORA_PACKET_ID_DOWNLINK) {
+        s_downlinks_received++;
+        ESP_LOGI(TAG, "downlink received, len:%d", msg->len);
+        ESP_LOG_BUFFER_HEXDUMP(TAG, msg->data, msg->len, ESP_LOG_DEBUG);
+    }
+    fragment_mngr_release(msg);
+}
+
+/* every record from pos is dispatched as a frame of its own, a broken record ends the frame */
+static void lora_rx_records(const lora_frame_t *lora_rx_packet, uint16_t pos, const sx127x_rx_metadata_t *meta)
+{
+    static lora_frame_t s_record;   /* dispatch stage only */
+    esp_err_t err = ESP_OK;
+    while ((err = lora_record_next(lora_rx_packet, &pos, &s_record)) == ESP_OK) {
+        if (s_record.packet_id == LORA_PACKET_ID_ACK || s_record.packet_id == LORA_PACKET_ID_RELIABLE) {
+            err = ESP_ERR_INVALID_ARG;
+            break;
+        }
+        s_rx_records++;
+        lora_rx_commander(&s_record, meta);
+    }
+    if (err != ESP_ERR_NOT_FOUND) {
+        s_rx_record_errors++;
+        ESP_LOGW(TAG, "aggregate frame broken at %d (%s)", pos, esp_err_to_name(err));
+    }
+}
+
+/* gateway, acks every copy and dispatches the payload of the first one */
+static void lora_rx_reliable(const lora_frame_t *lora_rx_packet, const sx127x_rx_metadata_t *meta)
+{
+    static lora_frame_t s_inner;    /* dispatch stage only */
+    if (lora_rx_packet->data_len < RELIABLE_HEADER_LEN || lora_rx_packet->data_len > LORA_PACKET_MAX_DATA_LEN) {
+        return;
+    }
+    bool fresh = reliable_mngr_receive(lora_rx_packet->dev_eui, lora_rx_packet->data, s_reply_ctx.ack);
+    s_reply_ctx.ack_pending = s_reply_ctx.valid;
+    uint8_t packet_id = lora_rx_packet->data[1];
+    if (!fresh || packet_id == LORA_PACKET_ID_RELIABLE || packet_id == LORA_PACKET_ID_ACK) {
+        return;
+    }
+    s_inner.packet_id = packet_id;
+    memcpy(s_inner.dev_eui, lora_rx_packet->dev_eui, LORA_DEV_EUI_LEN);
+    s_inner.dev_addr = lora_rx_packet->dev_addr;
+    s_inner.data_len = lora_rx_packet->data_len - RELIABLE_HEADER_LEN;
+    memcpy(s_inner.data, &lora_rx_packet->data[RELIABLE_HEADER_LEN], s_inner.data_len);
+    s_inner.end_of_frame = 0xDE;
+    lora_rx_commander(&s_inner, meta);
+}
+
+/* the payload of a compressed frame is dispatched as a frame of its own */
+static void lora_rx_compressed(const lora_frame_t *lora_rx_packet, const sx127x_rx_metadata_t *meta)
+{
+    static lora_frame_t s_plain;    /* dispatch stage only */
+    static bool s_nested = false;   /* s_plain is in use, a compressed frame holds no other one */
+    uint8_t packet_id = lora_rx_packet->data[0];
+    int len = -1;
+    if (!s_nested && lora_rx_packet->data_len > LORA_COMPRESS_HEADER_LEN &&
+            lora_rx_packet->data_len <= LORA_PACKET_MAX_DATA_LEN &&
+            packet_id != LORA_PACKET_ID_RELIABLE && packet_id != LORA_PACKET_ID_ACK) {
+        len = lz_codec_decompress(&lora_rx_packet->data[LORA_COMPRESS_HEADER_LEN],
+                                  lora_rx_packet->data_len - LORA_COMPRESS_HEADER_LEN,
+                                  s_plain.data, LORA_PACKET_MAX_DATA_LEN);
+    }
+    if (len < 0) {
+        s_rx_decompress_errors++;
+        ESP_LOGW(TAG, "compressed frame dropped, packet id:0x%x", packet_id);
+        return;
+    }
+    s_plain.packet_id = packet_id;
+    memcpy(s_plain.dev_eui, lora_rx_packet->dev_eui, LORA_DEV_EUI_LEN);
+    s_plain.dev_addr = lora_rx_packet->dev_addr;
+    s_plain.fcnt = lora_rx_packet->fcnt;
+    s_plain.data_len = len;
+    s_plain.end_of_frame = 0xDE;
+    s_nested = true;
+    lora_rx_commander(&s_plain, meta);
+    s_nested = false;
+}
+
+void lora_rx_commander(lora_frame_t *lora_rx_packet, const sx127x_rx_metadata_t *meta)
 {
     ESP_LOGI(TAG, "%s handled", __func__);
     switch (lora_rx_packet->packet_id) {
@@ -108,67 +1365,568 @@ void lora_rx_commander(lora_frame_t *lora_rx_packet)
     case LORA_PACKET_ID_PROVISING_OK:
         provisioning_mngr_provis_is_ok(lora_rx_packet, TEST_APP_KEY);
         break;
+    case LORA_PACKET_ID_PROVISING_CHALLENGE:
+        if (app_params.device_type == APP_DEVICE_IS_CLIENT) {
+            provisioning_mngr_set_challenge(lora_rx_packet->data, lora_rx_packet->data_len);
+        }
+        break;
+    case LORA_PACKET_ID_DOWNLINK:
+        if (app_params.device_type == APP_DEVICE_IS_CLIENT) {
+            s_downlinks_received++;
+            ESP_LOGI(TAG, "downlink received, len:%d", lora_rx_packet->data_len);
+            ESP_LOG_BUFFER_HEXDUMP(TAG, lora_rx_packet->data, MIN(lora_rx_packet->data_len, LORA_PACKET_MAX_DATA_LEN), ESP_LOG_DEBUG);
+        }
+        break;
+    case LORA_PACKET_ID_AGGREGATE:
+        if (app_params.device_type == APP_DEVICE_IS_MASTER) {
+            lora_rx_records(lora_rx_packet, 0, meta);
+        }
+        break;
+    case LORA_PACKET_ID_RELIABLE:
+        if (app_params.device_type == APP_DEVICE_IS_MASTER) {
+            lora_rx_reliable(lora_rx_packet, meta);
+        }
+        break;
+    case LORA_PACKET_ID_ACK:
+        /* rtt counts from the queueing, so it covers the lbt backoff as well */
+        if (app_params.device_type == APP_DEVICE_IS_CLIENT && lora_rx_packet->data_len >= RELIABLE_ACK_LEN) {
+            reliable_mngr_handle_ack(lora_rx_packet->data, meta->timestamp_us);
+            lora_rx_records(lora_rx_packet, RELIABLE_ACK_LEN, meta);
+        }
+        break;
+    case LORA_PACKET_ID_FRAGMENT:
+    case LORA_PACKET_ID_FRAGMENT_STATUS:
+        lora_rx_fragment(lora_rx_packet, meta);
+        break;
+    case LORA_PACKET_ID_COMPRESSED:
+        lora_rx_compressed(lora_rx_packet, meta);
+        break;
     default:
         if (app_params.device_type == APP_DEVICE_IS_MASTER) {
-            mqtt_publish_data(MQTT_CONFIG_DATA_TOPIC, (char *)lora_rx_packet->data);
+            lora_publish_enqueue(lora_rx_packet, meta);
         }
         break;
     }
 }
 
-void lora_process_task_rx(void *pvParameter)
+/*
+ * Rx stage, runs with the radio lock held: burst read the fifo into the ring,
+ * the caller re-arms rx right after. Everything else happens in later stages.
+ */
+static void lora_rx_fetch_frame(lora_radio_t *radio)
+{
+    lora_rx_slot_t *slot = ring_buf_reserve(&radio->rx_ring);
+    /* a full ring still needs the fifo and irq flags handled */
+    uint8_t *buf = slot ? slot->raw : radio->rx_drop_buf;
+    int len = sx127x_receive_packet(radio->dev, buf, LORA_FRAME_MAX_LEN, slot ? &slot->meta : NULL);
+    if (len <= 0) {
+        return;
+    }
+    if (!slot) {
+        ESP_LOGE(TAG, "radio%d rx ring is full, frame dropped(%" PRIu32 ")", radio->index, radio->rx_ring.drops);
+        return;
+    }
+    radio->rx_frames++;
+    slot->len = len;
+    ring_buf_commit(&radio->rx_ring);
+    xTaskNotifyGive(s_rx_proc_task);
+}
+
+/* a queued downlink rides the rx window of the uplink, unless a reply already took it */
+static void lora_downlink_on_uplink(void)
+{
+    downlink_t downlink;
+    if (!lora_reply_pending() || !downlink_mngr_pop(s_reply_ctx.dev_eui, &downlink)) {
+        return;
+    }
+    if (lora_send_tx_queue(downlink.packet_id, downlink.data, downlink.data_len) != ESP_OK) {
+        downlink_mngr_push_packet(s_reply_ctx.dev_eui, downlink.packet_id, downlink.data, downlink.data_len);
+    }
+}
+
+/* a reliable uplink nothing answered gets a bare ack */
+static void lora_ack_on_uplink(void)
+{
+    if (lora_reply_pending() && s_reply_ctx.ack_pending) {
+        lora_send_tx_queue(LORA_PACKET_ID_ACK, s_reply_ctx.ack, RELIABLE_ACK_LEN);
+    }
+}
+
+/*
+ * Fills the dev eui of an addressed frame, false if the gateway doesn't know the address.
+ * A client knows only its own address and the broadcast one, others are left zero.
+ */
+static bool lora_rx_resolve(lora_frame_t *frame)
+{
+    if (frame->dev_addr == LORA_DEV_ADDR_NONE) {
+        return true;
+    }
+    if (app_params.device_type == APP_DEVICE_IS_CLIENT) {
+        if (frame->dev_addr == LORA_DEV_ADDR_BROADCAST) {
+            memcpy(frame->dev_eui, s_broadcast_eui, LORA_DEV_EUI_LEN);
+        } else if (frame->dev_addr == address_mngr_own()) {
+            memcpy(frame->dev_eui, s_dev_eui, LORA_DEV_EUI_LEN);
+        } else {
+            memset(frame->dev_eui, 0, LORA_DEV_EUI_LEN);
+        }
+        return true;
+    }
+    const uint8_t *dev_eui = address_mngr_resolve(frame->dev_addr);
+    if (!dev_eui) {
+        return false;
+    }
+    memcpy(frame->dev_eui, dev_eui, LORA_DEV_EUI_LEN);
+    return true;
+}
+
+/*
+ * An addressed uplink has the low 16 bits of its counter on air only, a device that lost
+ * more than 32768 frames on the way fails every tag. After LORA_FCNT_RESYNC_FAILS failures
+ * in a row its frames are tried LORA_FCNT_RESYNC_EPOCHS times 2^16 counters further ahead
+ * too. The tag covers the whole counter, a frame that passes was sent with it.
+ */
+static esp_err_t lora_rx_decode(const lora_rx_slot_t *slot, bool uplink, lora_frame_t *frame)
+{
+    uint32_t fcnt_ref = uplink ? replay_mngr_last(frame->dev_eui) : 0;
+    esp_err_t err = lora_frame_decode(slot->raw, slot->len, uplink, fcnt_ref, frame);
+    if (!uplink || frame->dev_addr == LORA_DEV_ADDR_NONE || err == ESP_ERR_INVALID_SIZE) {
+        return err;
+    }
+    uint8_t *failures = &s_rx_tag_failures[(frame->dev_addr - 1) % ADDRESS_DEV_MAX];
+    for (uint32_t epoch = 1; err == ESP_ERR_INVALID_CRC && *failures >= LORA_FCNT_RESYNC_FAILS &&
+            epoch <= LORA_FCNT_RESYNC_EPOCHS; epoch++) {
+        err = lora_frame_decode(slot->raw, slot->len, uplink, fcnt_ref + (epoch << 16), frame);
+    }
+    if (err != ESP_OK) {
+        *failures = *failures < UINT8_MAX ? *failures + 1 : UINT8_MAX;
+        return err;
+    }
+    if (*failures >= LORA_FCNT_RESYNC_FAILS) {
+        s_rx_fcnt_resyncs++;
+        ESP_LOGW(TAG, "address 0x%04x counter found again at %" PRIu32, frame->dev_addr, frame->fcnt);
+    }
+    *failures = 0;
+    return ESP_OK;
+}
+
+/* decrypt and dispatch stage, drains the rx rings of all radios */
+static void lora_process_task_rx_proc(void *p)
+{
+    while (pdTRUE) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        bool pending = true;
+        while (pending) {
+            pending = false;
+            /* one frame per radio at a time, a busy channel can not starve the others */
+            for (uint8_t i = 0; i < s_radio_cnt; i++) {
+                lora_rx_slot_t *slot = ring_buf_peek(&s_radios[i].rx_ring);
+                if (!slot) {
+                    continue;
+                }
+                pending = true;
+                ESP_LOGV(TAG, "radio%d received frame:", i);
+                ESP_LOG_BUFFER_HEXDUMP(TAG, slot->raw, slot->len, ESP_LOG_VERBOSE);
+                bool uplink = app_params.device_type == APP_DEVICE_IS_MASTER;
+                /* the address gives the sender, so the counter the low bits on air belong to */
+                esp_err_t err = lora_frame_header(slot->raw, slot->len, uplink, &s_lora_rx_frame);
+                bool known = err != ESP_OK || lora_rx_resolve(&s_lora_rx_frame);
+                /* junk and foreign frames fail the tag here, before any dispatch; the one ccm pass
+                 * reads the slot and writes the plain data to the rx frame, no copy either way */
+                if (err == ESP_OK && known) {
+                    err = lora_rx_decode(slot, uplink, &s_lora_rx_frame);
+                }
+                sx127x_rx_metadata_t meta = slot->meta;
+                uint8_t len = slot->len;
+                ring_buf_release(&s_radios[i].rx_ring);
+                if (!known) {
+                    ESP_LOGW(TAG, "radio%d unknown device address 0x%04x", i, s_lora_rx_frame.dev_addr);
+                    continue;
+                }
+                if (err != ESP_OK) {
+                    if (err == ESP_ERR_INVALID_CRC) {
+                        s_rx_bad_tags++;
+                    } else if (err == ESP_ERR_INVALID_SIZE) {
+                        s_rx_bad_lengths++;
+                    }
+                    ESP_LOGE(TAG, "radio%d frame couldn't be decoded, len:%d (%s)", i, len, esp_err_to_name(err));
+                    continue;
+                }
+                ESP_LOGI(TAG, "radio%d SF%d rssi:%d(%d)dBm snr:%.2fdB freq error:%" PRIi32 "Hz", i,
+                         meta.spreading_factor, meta.rssi, meta.rssi_corrected, meta.snr, meta.freq_error_hz);
+                ESP_LOGD(TAG, "packet id:0x%x fcnt:%" PRIu32 " data:", s_lora_rx_frame.packet_id, s_lora_rx_frame.fcnt);
+                ESP_LOG_BUFFER_HEXDUMP(TAG, s_lora_rx_frame.data, s_lora_rx_frame.data_len, ESP_LOG_DEBUG);
+                if (app_params.device_type == APP_DEVICE_IS_CLIENT &&
+                        memcmp(s_lora_rx_frame.dev_eui, s_dev_eui, LORA_DEV_EUI_LEN) &&
+                        memcmp(s_lora_rx_frame.dev_eui, s_broadcast_eui, LORA_DEV_EUI_LEN)) {
+                    ESP_LOGD(TAG, "frame for another device");
+                    continue;
+                }
+                /* a relayed or replayed copy stops here, before any flash or mqtt work */
+                const provisioning_t *request = NULL;
+                if (app_params.device_type == APP_DEVICE_IS_MASTER &&
+                        !replay_mngr_accept(s_lora_rx_frame.dev_eui, s_lora_rx_frame.fcnt) &&
+                        (request = lora_provisioning_request(&s_lora_rx_frame)) == NULL) {
+                    ESP_LOGW(TAG, "radio%d frame counter %" PRIu32 " dropped", i, s_lora_rx_frame.fcnt);
+                    continue;
+                }
+                s_tx_radio = i;
+                s_reply_ctx = (lora_reply_ctx_t) {
+                    .valid = true,
+                    .dev_addr = s_lora_rx_frame.dev_addr,
+                    .rx_done_us = meta.timestamp_us,
+                    .radio = i,
+                };
+                memcpy(s_reply_ctx.dev_eui, s_lora_rx_frame.dev_eui, LORA_DEV_EUI_LEN);
+                /* an old request goes on only once its client proved it fresh */
+                if (!request || provisioning_mngr_check_fresh(s_lora_rx_frame.dev_eui, request, TEST_APP_KEY) == ESP_OK) {
+                    lora_rx_commander(&s_lora_rx_frame, &meta);
+                    lora_downlink_on_uplink();
+                    lora_ack_on_uplink();
+                }
+                s_reply_ctx.valid = false;
+            }
+        }
+    }
+}
+
+static void lora_rx_continuous(lora_radio_t *radio)
 {
     while (pdTRUE) {
         ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
-        ESP_LOGW(TAG, "%s handled.", __func__);
-        if (sx127x_received()) {
-            lora_frame_t rx_rec_buff = {0};
-            sx127x_receive_packet((uint8_t *)&rx_rec_buff, sizeof(lora_frame_t));
-            cryption_mngr_decrypt((char *)&rx_rec_buff, sizeof(lora_frame_t), (char *)&s_lora_rx_frame);
-            ESP_LOGW(TAG, "Encrypted frame:");
-            ESP_LOG_BUFFER_HEXDUMP(TAG, &rx_rec_buff, sizeof(lora_frame_t), ESP_LOG_INFO);
-            ESP_LOGW(TAG, "Decrypted frame:");
-            ESP_LOG_BUFFER_HEXDUMP(TAG, &s_lora_rx_frame, sizeof(lora_frame_t), ESP_LOG_INFO);
-            lora_rx_commander(&s_lora_rx_frame);
+        ESP_LOGD(TAG, "%s handled.", __func__);
+        xSemaphoreTake(radio->lock, portMAX_DELAY);
+        lora_rx_fetch_frame(radio);
+        if (!lora_class_a_enabled()) {
+            /* class A stays idle until the window after the next uplink */
+            sx127x_receive(radio->dev);
+        }
+        xSemaphoreGive(radio->lock);
+    }
+}
+
+/* listen for one frame on the current SF after a CAD hit */
+static bool lora_rx_single(lora_radio_t *radio)
+{
+    sx127x_modem_config_t modem;
+    sx127x_get_modem_config(radio->dev, &modem);
+    uint32_t timeout_ms = modem.symbol_timeout * sx127x_modem_symbol_time_us(&modem) / 1000 + LORA_RX_SINGLE_MARGIN_MS;
+
+    sx127x_receive_single(radio->dev);
+    bool rx_done = ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(timeout_ms));
+    if (!rx_done && !sx127x_rx_timed_out(radio->dev)) {
+        /* preamble is locked, wait for the end of the frame */
+        timeout_ms = sx127x_time_on_air_us(radio->dev, LORA_FRAME_MAX_LEN) / 1000 + LORA_RX_SINGLE_MARGIN_MS;
+        rx_done = ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(timeout_ms));
+    }
+    if (!rx_done) {
+        radio->cad_stats.rx_single_timeouts++;
+    }
+    return rx_done;
+}
+
+/*
+ * Cycle CAD over the configured SFs and switch to single rx on the SF a preamble is
+ * detected. A full cycle has to be shorter than the preamble to catch every data rate.
+ */
+static void lora_rx_cad_scan(lora_radio_t *radio)
+{
+    uint8_t sf_idx = 0;
+    lora_cad_stats_t *stats = &radio->cad_stats;
+    sx127x_set_symbol_timeout(radio->dev, LORA_CAD_SYMBOL_TIMEOUT);
+    while (pdTRUE) {
+        if (radio->tx_request) {
+            vTaskDelay(1);
+            continue;
+        }
+        uint8_t sf = app_params.lora_cad_sf[sf_idx];
+        sf_idx = (sf_idx + 1) % app_params.lora_cad_sf_cnt;
+
+        bool detected = false;
+        xSemaphoreTake(radio->lock, portMAX_DELAY);
+        ulTaskNotifyTake(pdTRUE, 0); /* drop stale dio0 events */
+        sx127x_set_spreading_factor(radio->dev, sf);
+        sx127x_start_cad(radio->dev);
+        stats->cad_runs++;
+        if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(LORA_CAD_DONE_TIMEOUT_MS)) &&
+                sx127x_cad_result(radio->dev, &detected) == ESP_OK && detected) {
+            stats->cad_detected++;
+            if (lora_rx_single(radio)) {
+                radio->last_rx_sf = sf;
+                stats->rx_packets++;
+                lora_rx_fetch_frame(radio);
+                ESP_LOGI(TAG, "radio%d SF%d frame, cad runs:%" PRIu32 " detected:%" PRIu32 " rx:%" PRIu32 " timeouts:%" PRIu32,
+                         radio->index, sf, stats->cad_runs, stats->cad_detected,
+                         stats->rx_packets, stats->rx_single_timeouts);
+            }
+        }
+        xSemaphoreGive(radio->lock);
+    }
+}
+
+/* one per radio, created by the driver with the radio handle */
+void lora_process_task_rx(void *pvParameter)
+{
+    lora_radio_t *radio = sx127x_get_user_ctx((sx127x_handle_t)pvParameter);
+    /* lora_radio_start holds the radio until its handle is stored */
+    xSemaphoreTake(radio->lock, portMAX_DELAY);
+    xSemaphoreGive(radio->lock);
+    if (lora_cad_scan_enabled()) {
+        ESP_LOGI(TAG, "radio%d cad scan over %d spreading factors", radio->index, app_params.lora_cad_sf_cnt);
+        lora_rx_cad_scan(radio);
+    } else {
+        lora_rx_continuous(radio);
+    }
+}
+
+void lora_get_rx_stats(lora_rx_stats_t *stats)
+{
+    memset(stats, 0, sizeof(lora_rx_stats_t));
+    for (uint8_t i = 0; i < s_radio_cnt; i++) {
+        stats->rx_frames += s_radios[i].rx_frames;
+        stats->rx_ring_drops += s_radios[i].rx_ring.drops;
+        stats->rx_ring_high_water = MAX(stats->rx_ring_high_water, s_radios[i].rx_ring.high_water);
+    }
+    stats->pub_ring_drops = s_pub_ring.drops;
+    stats->pub_ring_high_water = s_pub_ring.high_water;
+    stats->published = s_published;
+    stats->publish_failures = s_publish_failures;
+    stats->publish_latency_max_us = s_publish_latency_max_us;
+    stats->publish_latency_avg_us = s_published ? s_publish_latency_total_us / s_published : 0;
+    stats->downlinks_received = s_downlinks_received;
+    stats->rx_records = s_rx_records;
+    stats->rx_record_errors = s_rx_record_errors;
+    stats->rx_decompress_errors = s_rx_decompress_errors;
+    stats->rx_bad_lengths = s_rx_bad_lengths;
+    stats->rx_bad_tags = s_rx_bad_tags;
+    stats->rx_fcnt_resyncs = s_rx_fcnt_resyncs;
+    replay_stats_t replay;
+    replay_mngr_get_stats(&replay);
+    stats->rx_duplicates = replay.duplicates;
+    stats->rx_replays = replay.replays;
+}
+
+void lora_get_tx_stats(lora_tx_stats_t *stats)
+{
+    *stats = s_tx_stats;
+}
+
+/*
+ * Flash saves and the polls of the managers, none of it may hold up the rx, dispatch or tx
+ * stages and the timer callbacks only wake it. Reliable retransmissions are due within
+ * RELIABLE_POLL_MS, the rest within LORA_WORKER_PERIOD_MS.
+ */
+static void lora_process_task_worker(void *p)
+{
+    bool reliable = app_params.device_type == APP_DEVICE_IS_CLIENT && app_params.lora_reliable_id_cnt;
+    TickType_t period = pdMS_TO_TICKS(reliable ? RELIABLE_POLL_MS : LORA_WORKER_PERIOD_MS);
+    int64_t slow_us = 0;
+    while (pdTRUE) {
+        ulTaskNotifyTake(pdTRUE, period);
+        if (s_aggregate_due) {
+            s_aggregate_due = false;
+            lora_aggregate_deadline();
+        }
+        if (reliable) {
+            reliable_mngr_poll();
+        }
+        int64_t now_us = esp_timer_get_time();
+        if (now_us < slow_us) {
+            continue;
+        }
+        slow_us = now_us + (int64_t)LORA_WORKER_PERIOD_MS * 1000;
+        fragment_mngr_poll();
+        if (app_params.device_type == APP_DEVICE_IS_MASTER) {
+            replay_mngr_save();
         }
-        sx127x_receive();
     }
 }
 
+/* data bytes an addressed frame holds, an unaddressed one holds 6 less for the dev eui */
+uint8_t lora_data_max(void)
+{
+    return s_data_max;
+}
+
+static esp_err_t lora_reliable_send(uint8_t *data, uint8_t data_len)
+{
+    return lora_send_tx_queue(LORA_PACKET_ID_RELIABLE, data, data_len);
+}
+
 static void client_timer_cb(TimerHandle_t xTimer)
 {
-    static uint8_t test_data[LORA_PACKET_MAX_DATA_LEN] = {"0123456789ABCDEF_client_test_data"};
-    lora_send_tx_queue(0xAE, test_data, sizeof(test_data));
+    static payload_codec_state_t s_status_state = {0};
+    uint8_t data[LORA_PACKET_MAX_DATA_LEN];
+    size_t data_len = sizeof(data);
+    payload_status_t status = {
+        .uptime_s = esp_timer_get_time() / 1000000,
+        .free_heap = esp_get_free_heap_size(),
+        .min_free_heap = esp_get_minimum_free_heap_size(),
+        .tx_sent = s_tx_stats.sent,
+    };
+    if (payload_codec_encode(PAYLOAD_ID_STATUS, &status, &s_status_state, data, &data_len) == ESP_OK) {
+        lora_send_aggregated(PAYLOAD_ID_STATUS, data, data_len);
+    }
 
     ESP_LOGW(TAG, "free_heap/min_heap size %" PRIu32 "/%" PRIu32 " Bytes",
              esp_get_free_heap_size(),
              esp_get_minimum_free_heap_size());
+
+    for (uint8_t i = 0; i < s_radio_cnt; i++) {
+        sx127x_spi_stats_t spi_stats;
+        sx127x_get_spi_stats(s_radios[i].dev, &spi_stats);
+        sx127x_spi_op_stats_t *tx = &spi_stats.op[SX127X_SPI_OP_TX_PACKET];
+        ESP_LOGI(TAG, "radio%d spi tx packets:%" PRIu32 " transactions:%" PRIu32 " time:%" PRIu64 "us",
+                 i, tx->calls, tx->transactions, tx->time_us);
+    }
+    ESP_LOGI(TAG, "lbt checks:%" PRIu32 " busy:%" PRIu32 " rx ongoing:%" PRIu32 " gave up:%" PRIu32 " backoff:%" PRIu32 "ms",
+             s_tx_stats.lbt_checks, s_tx_stats.lbt_busy, s_tx_stats.lbt_rx_ongoing,
+             s_tx_stats.lbt_gave_up, s_tx_stats.lbt_backoff_ms);
+    duty_cycle_stats_t duty_cycle;
+    duty_cycle_mngr_get_stats(&duty_cycle);
+    ESP_LOGI(TAG, "duty cycle remaining:%" PRIi64 "us deferred:%" PRIu32 "(%" PRIu64 "ms) dropped:%" PRIu32,
+             duty_cycle_mngr_remaining_us(app_params.lora_modem.frequency),
+             duty_cycle.deferred, duty_cycle.deferred_ms, duty_cycle.dropped);
+    if (s_aggregate_lock) {
+        ESP_LOGI(TAG, "aggregated records:%" PRIu32 " frames:%" PRIu32 " by deadline:%" PRIu32,
+                 s_tx_stats.aggregated_records, s_tx_stats.aggregated_frames, s_tx_stats.aggregate_deadlines);
+    }
+    tx_queue_mngr_log_stats();
+    frame_pool_mngr_log_stats();
+    if (s_compress_lock) {
+        ESP_LOGI(TAG, "compressed frames:%" PRIu32 " raw:%" PRIu32 " saved:%" PRIu32 " bytes",
+                 s_tx_stats.compressed, s_tx_stats.compress_raw, s_tx_stats.compress_saved_bytes);
+    }
+    if (app_params.lora_reliable_id_cnt) {
+        reliable_stats_t reliable;
+        reliable_mngr_get_stats(&reliable);
+        ESP_LOGI(TAG, "reliable sent:%" PRIu32 " acked:%" PRIu32 " retransmits:%" PRIu32 "(fast %" PRIu32 ") gave up:%" PRIu32
+                 " window full:%" PRIu32 " rtt/rto:%" PRIu32 "/%" PRIu32 "ms",
+                 reliable.sent, reliable.acked, reliable.retransmits, reliable.fast_retransmits, reliable.gave_up,
+                 reliable.window_full, reliable.rtt_ms, reliable.rto_ms);
+    }
 }
 
-esp_err_t lora_process_start(void)
+/* the shared modem settings with the channel of a radio */
+static void lora_radio_modem(const app_lora_radio_t *radio_params, sx127x_modem_config_t *modem)
 {
-    esp_err_t ret = ESP_OK;
-    sx127x_configure_pins(TTN_SPI_HOST, TTN_PIN_SPI_MISO, TTN_PIN_SPI_MOSI, TTN_PIN_SPI_SCLK, TTN_PIN_NSS, TTN_PIN_RST, TTN_PIN_DIO0);
-    sx127x_set_task_params(lora_process_task_rx);
+    *modem = app_params.lora_modem;
+    if (radio_params->frequency) {
+        modem->frequency = radio_params->frequency;
+    }
+    if (radio_params->spreading_factor) {
+        modem->spreading_factor = radio_params->spreading_factor;
+    }
+}
 
-    sx127x_init();
-    sx127x_receive();
-    cryption_mngr_init(TEST_APP_KEY);
+static esp_err_t lora_radio_start(const app_lora_radio_t *radio_params)
+{
+    lora_radio_t *radio = &s_radios[s_radio_cnt];
+    sx127x_config_t config = {
+        .spi_host = TTN_SPI_HOST,
+        .pin_miso = TTN_PIN_SPI_MISO,
+        .pin_mosi = TTN_PIN_SPI_MOSI,
+        .pin_sclk = TTN_PIN_SPI_SCLK,
+        .pin_nss = radio_params->pin_nss,
+        .pin_rst = radio_params->pin_rst,
+        .pin_dio0 = radio_params->pin_dio0,
+        .rx_task = lora_process_task_rx,
+        .user_ctx = radio,
+    };
+    lora_radio_modem(radio_params, &config.modem);
 
-    ESP_LOGI(TAG, "size of lora frame is:%d", sizeof(lora_frame_t));
-    s_tx_queue = xQueueCreate(LORA_TX_QUEUE_SIZE, sizeof(lora_frame_t));
-    if (!s_tx_queue) {
-        ESP_LOGE(TAG, "couldn't create the lora tx queue!");
+    memset(radio, 0, sizeof(lora_radio_t));
+    radio->index = s_radio_cnt;
+    radio->last_rx_sf = config.modem.spreading_factor;
+    ring_buf_init(&radio->rx_ring, radio->rx_ring_storage, sizeof(lora_rx_slot_t), LORA_RX_RING_SIZE);
+    radio->lock = xSemaphoreCreateMutex();
+    if (!radio->lock) {
+        ESP_LOGE(TAG, "couldn't create the radio lock!");
         return ESP_FAIL;
     }
+    /* rx task starts in the driver, hold the radio until the handle is stored */
+    xSemaphoreTake(radio->lock, portMAX_DELAY);
+    esp_err_t err = sx127x_init(&config, &radio->dev);
+    if (err != ESP_OK) {
+        xSemaphoreGive(radio->lock);
+        vSemaphoreDelete(radio->lock);
+        return err;
+    }
+    if (!lora_class_a_enabled()) {
+        sx127x_receive(radio->dev);
+    }
+    s_radio_cnt++;
+    xSemaphoreGive(radio->lock);
+    return ESP_OK;
+}
 
-    ret |= xTaskCreate(lora_process_task_tx,
-                       CORE_LORA_TASK_NAME,
-                       CORE_LORA_TASK_STACK,
-                       NULL,
-                       CORE_LORA_TASK_PRIO,
-                       NULL);
+esp_err_t lora_process_start(void)
+{
+    if (!app_params.lora_radio_cnt) {
+        ESP_LOGE(TAG, "there is no lora radio!");
+        return ESP_FAIL;
+    }
+    if (app_params.lora_modem.implicit_header) {
+        /* every frame goes on air with the same length, gateway and clients must agree on it */
+        uint8_t frame_len = app_params.lora_modem.payload_len ? app_params.lora_modem.payload_len : LORA_FRAME_MAX_LEN;
+        if (frame_len < LORA_IMPLICIT_LEN_MIN || frame_len > LORA_FRAME_MAX_LEN) {
+            ESP_LOGE(TAG, "implicit header frame len(%d) not in %d..%d", frame_len, (int)LORA_IMPLICIT_LEN_MIN, LORA_FRAME_MAX_LEN);
+            return ESP_ERR_INVALID_SIZE;
+        }
+        app_params.lora_modem.payload_len = frame_len;
+        s_wire_pad_len = frame_len;
+        s_data_max = frame_len - LORA_WIRE_DOWN_HEADER_LEN - LORA_WIRE_TAG_LEN;
+    }
+    /* airtimes of the first radio, it carries the replies */
+    sx127x_modem_config_t modem;
+    lora_radio_modem(&app_params.lora_radios[0], &modem);
+    uint32_t frame_max_us = sx127x_modem_time_on_air_us(&modem, LORA_FRAME_MAX_LEN);
+    ESP_LOGI(TAG, "lora frame on air min/max:%d/%d bytes", s_wire_pad_len ? s_wire_pad_len : LORA_WIRE_LEN(0),
+             s_wire_pad_len ? s_wire_pad_len : LORA_FRAME_MAX_LEN);
+    ESP_LOGI(TAG, "lora frame time on air min/max:%" PRIu32 "/%" PRIu32 "us",
+             sx127x_modem_time_on_air_us(&modem, LORA_WIRE_LEN(0)), frame_max_us);
 
+    if (utils_get_mac_bytes(s_dev_eui) != ESP_OK) {
+        ESP_LOGE(TAG, "couldn't read the device eui!");
+    }
+    /* everything a received or queued frame goes through is up before the radios start */
+    if (cryption_mngr_init(TEST_APP_KEY) != ESP_OK) {
+        ESP_LOGE(TAG, "couldn't init the frame cipher!");
+        return ESP_FAIL;
+    }
+    /* the queues carry handles of the pool buffers, no frame starts a max frame before a reply */
+    if (frame_pool_mngr_init(sizeof(lora_tx_item_t)) != ESP_OK ||
+            tx_queue_mngr_init(sizeof(lora_tx_item_t *), frame_max_us) != ESP_OK) {
+        return ESP_FAIL;
+    }
+    lora_fcnt_restore();
+    if (address_mngr_init() != ESP_OK) {
+        return ESP_FAIL;
+    }
+    if (app_params.device_type == APP_DEVICE_IS_MASTER && (downlink_mngr_init() != ESP_OK || replay_mngr_init() != ESP_OK)) {
+        return ESP_FAIL;
+    }
+    if (fragment_mngr_init(lora_fragment_send) != ESP_OK) {
+        return ESP_FAIL;
+    }
+    if (app_params.device_type == APP_DEVICE_IS_CLIENT && app_params.lora_reliable_id_cnt) {
+        /* the first rto is a full frame up, the rx1 delay and a full frame down */
+        uint32_t rto_min_ms = 2 * frame_max_us / 1000 + app_params.lora_rx1_delay_ms + LORA_RELIABLE_RTO_MARGIN_MS;
+        if (reliable_mngr_init(lora_reliable_send, rto_min_ms) != ESP_OK) {
+            return ESP_FAIL;
+        }
+    }
+    if (app_params.lora_compress_id_cnt && lora_compress_init() != ESP_OK) {
+        return ESP_FAIL;
+    }
+    if (app_params.device_type == APP_DEVICE_IS_CLIENT && app_params.lora_aggregate_ms) {
+        s_aggregate_lock = xSemaphoreCreateMutex();
+        s_aggregate_timer = xTimerCreate("lora_aggregate_timer", pdMS_TO_TICKS(app_params.lora_aggregate_ms),
+                                         pdFALSE, NULL, lora_aggregate_timer_cb);
+        if (!s_aggregate_lock || !s_aggregate_timer) {
+            ESP_LOGE(TAG, "couldn't create the uplink aggregation!");
+            return ESP_FAIL;
+        }
+    }
     /* This timer using to generate test data from clients to master. TODO Remove later */
     if (app_params.device_type == APP_DEVICE_IS_CLIENT) {
         s_client_test_payload_timer = xTimerCreate(
@@ -180,5 +1938,48 @@ esp_err_t lora_process_start(void)
         xTimerStop(s_client_test_payload_timer, portMAX_DELAY);
     }
 
-    return ret;
+    ring_buf_init(&s_pub_ring, s_pub_ring_storage, sizeof(lora_pub_slot_t), LORA_PUB_RING_SIZE);
+    /* later stages have to exist before the rx task starts feeding them */
+    if (xTaskCreate(lora_process_task_rx_proc,
+                    CORE_LORA_RX_PROC_TASK_NAME,
+                    CORE_LORA_RX_PROC_TASK_STACK,
+                    NULL,
+                    CORE_LORA_RX_PROC_TASK_PRIO,
+                    &s_rx_proc_task) != pdPASS ||
+            xTaskCreate(lora_process_task_publish,
+                        CORE_LORA_PUB_TASK_NAME,
+                        CORE_LORA_PUB_TASK_STACK,
+                        NULL,
+                        CORE_LORA_PUB_TASK_PRIO,
+                        &s_pub_task) != pdPASS ||
+            xTaskCreate(lora_process_task_worker,
+                        CORE_LORA_WORKER_TASK_NAME,
+                        CORE_LORA_WORKER_TASK_STACK,
+                        NULL,
+                        CORE_LORA_WORKER_TASK_PRIO,
+                        &s_worker_task) != pdPASS) {
+        ESP_LOGE(TAG, "couldn't create the lora rx stages!");
+        return ESP_FAIL;
+    }
+    for (uint8_t i = 0; i < app_params.lora_radio_cnt; i++) {
+        if (lora_radio_start(&app_params.lora_radios[i]) != ESP_OK) {
+            ESP_LOGE(TAG, "radio%d couldn't be started!", i);
+        }
+    }
+    if (!s_radio_cnt) {
+        ESP_LOGE(TAG, "there is no lora radio!");
+        return ESP_FAIL;
+    }
+    /* a client sends its provisioning request right away */
+    if (xTaskCreate(lora_process_task_tx,
+                    CORE_LORA_TASK_NAME,
+                    CORE_LORA_TASK_STACK,
+                    NULL,
+                    CORE_LORA_TASK_PRIO,
+                    NULL) != pdPASS) {
+        ESP_LOGE(TAG, "couldn't create the lora tx task!");
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
 }
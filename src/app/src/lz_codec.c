@@ -0,0 +1,166 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "app/payload_schema.h"
+#include "app/lz_codec.h"
+
+static const char *TAG = "lz_codec";
+
+/*
+ * What the text uplinks are made of: the json the gateway publishes, so the keys of the
+ * schemas. Both sides build it from the same schemas. No whole payload goes in here, one
+ * would compress to a single match and tell nothing about the others.
+ */
+#define LZ_DICT_FIELD(s, field, decimals, delta)    ",\"" #field "\":"
+#define LZ_DICT_SCHEMA(id, NAME, name, FIELDS)      "\"type\":\"" #name "\",\"seq\":" FIELDS(LZ_DICT_FIELD, name)
+static const char s_dict[] =
+    "true,false,null,\"status\":\"ok\",\"error\":\"value\":[{\"dev_eui\":\""
+    PAYLOAD_SCHEMAS(LZ_DICT_SCHEMA)
+    "}";
+#undef LZ_DICT_SCHEMA
+#undef LZ_DICT_FIELD
+
+#define LZ_DICT_LEN         (sizeof(s_dict) - 1)
+#define LZ_WINDOW_LEN       (LZ_DICT_LEN + LZ_CODEC_INPUT_MAX)
+#define LZ_HASH_SIZE        (1 << LZ_CODEC_HASH_BITS)
+#define LZ_NONE             0xffff
+
+_Static_assert(LZ_WINDOW_LEN <= LZ_CODEC_DISTANCE_MAX, "the dictionary is out of reach of the last byte");
+
+/* compression only, not reentrant, the callers serialize it */
+static uint8_t s_window[LZ_WINDOW_LEN];
+static uint16_t s_head[LZ_HASH_SIZE];
+static uint16_t s_prev[LZ_WINDOW_LEN];
+/* chains of the dictionary, every compression starts from them */
+static uint16_t s_dict_head[LZ_HASH_SIZE];
+static bool s_ready = false;
+
+static inline uint16_t lz_hash(const uint8_t *p)
+{
+    return (uint32_t)(p[0] << 16 | p[1] << 8 | p[2]) * 2654435761u >> (32 - LZ_CODEC_HASH_BITS);
+}
+
+static inline void lz_insert(uint16_t *head, uint16_t pos)
+{
+    uint16_t hash = lz_hash(&s_window[pos]);
+    s_prev[pos] = head[hash];
+    head[hash] = pos;
+}
+
+esp_err_t lz_codec_init(void)
+{
+    if (s_ready) {
+        return ESP_OK;
+    }
+    memcpy(s_window, s_dict, LZ_DICT_LEN);
+    memset(s_dict_head, 0xff, sizeof(s_dict_head));
+    for (uint16_t pos = 0; pos + LZ_CODEC_MATCH_MIN <= LZ_DICT_LEN; pos++) {
+        lz_insert(s_dict_head, pos);
+    }
+    s_ready = true;
+    ESP_LOGI(TAG, "dictionary:%d bytes", (int)LZ_DICT_LEN);
+    return ESP_OK;
+}
+
+static int lz_put_literals(const uint8_t *src, size_t n, uint8_t *out, size_t pos, size_t size)
+{
+    while (n) {
+        size_t run = n > LZ_CODEC_LITERAL_MAX ? LZ_CODEC_LITERAL_MAX : n;
+        if (pos + 1 + run > size) {
+            return -1;
+        }
+        out[pos++] = run - 1;
+        memcpy(&out[pos], src, run);
+        pos += run;
+        src += run;
+        n -= run;
+    }
+    return pos;
+}
+
+/* greedy, the longest of the chain at every position; -1 when it doesn't fit size */
+int lz_codec_compress(const uint8_t *in, size_t len, uint8_t *out, size_t size)
+{
+    if (!s_ready || len > LZ_CODEC_INPUT_MAX) {
+        return -1;
+    }
+    memcpy(&s_window[LZ_DICT_LEN], in, len);
+    memcpy(s_head, s_dict_head, sizeof(s_head));
+    size_t end = LZ_DICT_LEN + len, pos = LZ_DICT_LEN, literal = LZ_DICT_LEN;
+    int o = 0;
+    while (pos < end) {
+        size_t best_len = 0, best_dist = 0;
+        if (end - pos >= LZ_CODEC_MATCH_MIN) {
+            size_t max = end - pos > LZ_CODEC_MATCH_MAX ? LZ_CODEC_MATCH_MAX : end - pos;
+            uint16_t cand = s_head[lz_hash(&s_window[pos])];
+            for (uint8_t chain = 0; cand != LZ_NONE && chain < LZ_CODEC_CHAIN_MAX; chain++, cand = s_prev[cand]) {
+                size_t n = 0;
+                while (n < max && s_window[cand + n] == s_window[pos + n]) {
+                    n++;
+                }
+                if (n > best_len) {
+                    best_len = n;
+                    best_dist = pos - cand;
+                    if (n == max) {
+                        break;
+                    }
+                }
+            }
+        }
+        if (best_len < LZ_CODEC_MATCH_MIN) {
+            if (end - pos >= LZ_CODEC_MATCH_MIN) {
+                lz_insert(s_head, pos);
+            }
+            pos++;
+            continue;
+        }
+        o = lz_put_literals(&s_window[literal], pos - literal, out, o, size);
+        if (o < 0 || (size_t)o + 2 > size) {
+            return -1;
+        }
+        out[o++] = 0x80 | (best_len - LZ_CODEC_MATCH_MIN) << 2 | (best_dist - 1) >> 8;
+        out[o++] = (best_dist - 1) & 0xff;
+        for (size_t i = 0; i < best_len; i++, pos++) {
+            if (end - pos >= LZ_CODEC_MATCH_MIN) {
+                lz_insert(s_head, pos);
+            }
+        }
+        literal = pos;
+    }
+    return lz_put_literals(&s_window[literal], pos - literal, out, o, size);
+}
+
+/* reentrant, it reads the dictionary only; -1 for a broken or oversized input */
+int lz_codec_decompress(const uint8_t *in, size_t len, uint8_t *out, size_t size)
+{
+    size_t i = 0, o = 0;
+    while (i < len) {
+        uint8_t token = in[i++];
+        if (!(token & 0x80)) {
+            size_t run = token + 1;
+            if (i + run > len || o + run > size) {
+                return -1;
+            }
+            memcpy(&out[o], &in[i], run);
+            i += run;
+            o += run;
+            continue;
+        }
+        if (i >= len) {
+            return -1;
+        }
+        size_t n = ((token >> 2) & 0x1f) + LZ_CODEC_MATCH_MIN;
+        size_t dist = ((token & 0x03) << 8 | in[i++]) + 1;
+        if (dist > o + LZ_DICT_LEN || o + n > size) {
+            return -1;
+        }
+        /* byte by byte, a match may overlap the bytes it produces */
+        for (size_t k = 0; k < n; k++, o++) {
+            out[o] = dist > o ? (uint8_t)s_dict[LZ_DICT_LEN - (dist - o)] : out[o - dist];
+        }
+    }
+    return o;
+}
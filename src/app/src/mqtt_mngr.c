@@ -30,6 +30,7 @@ static void (*f_event_cb)(const char *, esp_mqtt_event_handle_t);
 
 static mqtt_sub_table_t s_mqtt_sub_table[] = {
     { .msg_id = -1, MQTT_CONFIG_TOPIC, false},
+    { .msg_id = -1, MQTT_DOWNLINK_TOPIC, false},
 };
 
 static void log_error_if_nonzero(const char *message, int error_code)
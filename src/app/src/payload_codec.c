@@ -0,0 +1,250 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <inttypes.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "app/lora_manager.h"
+#include "app/payload_codec.h"
+
+static const char *TAG = "payload_codec";
+
+/*
+ * A reading on air: a header byte, key flag and 7 bit sequence, then a zigzag varint per
+ * field. Key readings carry the values, the others carry the change of the delta fields.
+ */
+
+#define PAYLOAD_CODEC_VARINT_MAX    5   /* uint32 */
+#define PAYLOAD_CODEC_DECIMALS_MAX  9
+
+#define PAYLOAD_FIELD_DESC(s, field, dec, is_delta) {   \
+    .name = #field,                                     \
+    .offset = offsetof(payload_##s##_t, field),         \
+    .decimals = dec,                                    \
+    .delta = is_delta,                                  \
+},
+#define PAYLOAD_SCHEMA_FIELDS(id, NAME, name, FIELDS) \
+    static const payload_field_t s_##name##_fields[] = { FIELDS(PAYLOAD_FIELD_DESC, name) };
+PAYLOAD_SCHEMAS(PAYLOAD_SCHEMA_FIELDS)
+
+#define PAYLOAD_FIELD_ONE(s, field, dec, is_delta)  + 1
+#define PAYLOAD_FIELD_CHECK(s, field, dec, is_delta)                                        \
+    _Static_assert(dec <= PAYLOAD_CODEC_DECIMALS_MAX, #s "." #field " has too many decimals");
+#define PAYLOAD_SCHEMA_CHECK(id, NAME, name, FIELDS)                                        \
+    _Static_assert((0 FIELDS(PAYLOAD_FIELD_ONE, name)) <= PAYLOAD_CODEC_FIELD_MAX,          \
+                   #name " has more fields than PAYLOAD_CODEC_FIELD_MAX");                  \
+    FIELDS(PAYLOAD_FIELD_CHECK, name)
+PAYLOAD_SCHEMAS(PAYLOAD_SCHEMA_CHECK)
+
+#define PAYLOAD_SCHEMA_DESC(id, NAME, schema, FIELDS) {                     \
+    .packet_id = id,                                                        \
+    .name = #schema,                                                        \
+    .fields = s_##schema##_fields,                                          \
+    .field_cnt = sizeof(s_##schema##_fields) / sizeof(payload_field_t),     \
+},
+static const payload_schema_t s_schemas[] = {
+    PAYLOAD_SCHEMAS(PAYLOAD_SCHEMA_DESC)
+};
+
+static const double s_pow10[PAYLOAD_CODEC_DECIMALS_MAX + 1] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9
+};
+
+/* gateway side, the last reading of every device and schema, oldest one is reused */
+typedef struct {
+    bool used;
+    uint8_t dev_eui[LORA_DEV_EUI_LEN];
+    uint8_t packet_id;
+    uint32_t last_use;
+    payload_codec_state_t state;
+} payload_codec_dev_t;
+
+static payload_codec_dev_t s_devices[PAYLOAD_CODEC_DEV_MAX];
+static uint32_t s_use_cnt = 0;
+static payload_codec_stats_t s_stats = {0};
+
+const payload_schema_t *payload_codec_schema(uint8_t packet_id)
+{
+    for (uint8_t i = 0; i < sizeof(s_schemas) / sizeof(payload_schema_t); i++) {
+        if (s_schemas[i].packet_id == packet_id) {
+            return &s_schemas[i];
+        }
+    }
+    return NULL;
+}
+
+static size_t payload_codec_put_varint(uint8_t *buf, uint32_t value)
+{
+    size_t len = 0;
+    while (value >= 0x80) {
+        buf[len++] = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+    buf[len++] = value;
+    return len;
+}
+
+static size_t payload_codec_get_varint(const uint8_t *buf, size_t len, uint32_t *value)
+{
+    uint32_t result = 0;
+    for (size_t i = 0; i < len && i < PAYLOAD_CODEC_VARINT_MAX; i++) {
+        result |= (uint32_t)(buf[i] & 0x7f) << (7 * i);
+        if (!(buf[i] & 0x80)) {
+            *value = result;
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+/* small negative deltas stay one byte */
+static uint32_t payload_codec_zigzag(int32_t value)
+{
+    return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static int32_t payload_codec_unzigzag(uint32_t value)
+{
+    return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+static esp_err_t payload_codec_to_fixed(const payload_field_t *field, double value, int32_t *fixed)
+{
+    double scaled = round(value * s_pow10[field->decimals]);
+    if (!isfinite(scaled) || scaled > INT32_MAX || scaled < INT32_MIN) {
+        ESP_LOGE(TAG, "%s is out of range", field->name);
+        return ESP_ERR_INVALID_ARG;
+    }
+    *fixed = (int32_t)scaled;
+    return ESP_OK;
+}
+
+esp_err_t payload_codec_encode(uint8_t packet_id, const void *reading, payload_codec_state_t *state, uint8_t *buf, size_t *len)
+{
+    const payload_schema_t *schema = payload_codec_schema(packet_id);
+    int32_t values[PAYLOAD_CODEC_FIELD_MAX];
+    if (!schema || !reading || !state || !buf || !len) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (*len < 1 + schema->field_cnt * PAYLOAD_CODEC_VARINT_MAX) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    for (uint8_t i = 0; i < schema->field_cnt; i++) {
+        const payload_field_t *field = &schema->fields[i];
+        esp_err_t err = payload_codec_to_fixed(field, *(const double *)((const uint8_t *)reading + field->offset), &values[i]);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+    uint8_t seq = state->valid ? (state->seq + 1) & PAYLOAD_CODEC_SEQ_MASK : 0;
+    bool key = !state->valid || !(seq % PAYLOAD_CODEC_KEY_INTERVAL);
+    size_t pos = 0;
+    buf[pos++] = seq | (key ? PAYLOAD_CODEC_KEY_FLAG : 0);
+    for (uint8_t i = 0; i < schema->field_cnt; i++) {
+        /* wraps like the decoder adds it back */
+        int32_t value = key || !schema->fields[i].delta ? values[i] : (int32_t)((uint32_t)values[i] - (uint32_t)state->values[i]);
+        pos += payload_codec_put_varint(&buf[pos], payload_codec_zigzag(value));
+    }
+    state->valid = true;
+    state->seq = seq;
+    memcpy(state->values, values, sizeof(int32_t) * schema->field_cnt);
+    *len = pos;
+    s_stats.encoded++;
+    return ESP_OK;
+}
+
+esp_err_t payload_codec_decode(uint8_t packet_id, const uint8_t *buf, size_t len, payload_codec_state_t *state, payload_reading_t *reading)
+{
+    const payload_schema_t *schema = payload_codec_schema(packet_id);
+    if (!schema || !buf || !state || !reading) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!len) {
+        s_stats.invalid++;
+        return ESP_ERR_INVALID_SIZE;
+    }
+    uint8_t seq = buf[0] & PAYLOAD_CODEC_SEQ_MASK;
+    bool key = buf[0] & PAYLOAD_CODEC_KEY_FLAG;
+    if (!key) {
+        if (state->valid && seq == state->seq) {
+            s_stats.duplicates++;
+            return ESP_ERR_INVALID_STATE;
+        }
+        if (!state->valid || seq != ((state->seq + 1) & PAYLOAD_CODEC_SEQ_MASK)) {
+            /* the base is lost, the deltas mean nothing until the next key reading */
+            state->valid = false;
+            s_stats.no_base++;
+            return ESP_ERR_INVALID_STATE;
+        }
+    }
+    size_t pos = 1;
+    for (uint8_t i = 0; i < schema->field_cnt; i++) {
+        uint32_t raw = 0;
+        size_t used = payload_codec_get_varint(&buf[pos], len - pos, &raw);
+        if (!used) {
+            s_stats.invalid++;
+            return ESP_ERR_INVALID_SIZE;
+        }
+        pos += used;
+        int32_t value = payload_codec_unzigzag(raw);
+        reading->values[i] = key || !schema->fields[i].delta ? value : (int32_t)((uint32_t)state->values[i] + (uint32_t)value);
+    }
+    reading->schema = schema;
+    reading->seq = seq;
+    reading->key = key;
+    state->valid = true;
+    state->seq = seq;
+    memcpy(state->values, reading->values, sizeof(int32_t) * schema->field_cnt);
+    s_stats.decoded++;
+    return ESP_OK;
+}
+
+/* runs on the dispatch stage only, so there is no lock */
+payload_codec_state_t *payload_codec_rx_state(const uint8_t *dev_eui, uint8_t packet_id)
+{
+    payload_codec_dev_t *oldest = &s_devices[0];
+    for (uint8_t i = 0; i < PAYLOAD_CODEC_DEV_MAX; i++) {
+        payload_codec_dev_t *dev = &s_devices[i];
+        if (dev->used && dev->packet_id == packet_id && !memcmp(dev->dev_eui, dev_eui, LORA_DEV_EUI_LEN)) {
+            dev->last_use = ++s_use_cnt;
+            return &dev->state;
+        }
+        if (!dev->used || (oldest->used && dev->last_use < oldest->last_use)) {
+            oldest = dev;
+        }
+    }
+    memset(oldest, 0, sizeof(payload_codec_dev_t));
+    oldest->used = true;
+    oldest->packet_id = packet_id;
+    memcpy(oldest->dev_eui, dev_eui, LORA_DEV_EUI_LEN);
+    oldest->last_use = ++s_use_cnt;
+    return &oldest->state;
+}
+
+/* {"dev_eui":"A1B2C3D4E5F6","type":"env","seq":3,"temperature_c":21.53,...}, -1 if size is short */
+int payload_codec_to_json(const payload_reading_t *reading, const uint8_t *dev_eui, char *buf, size_t size)
+{
+    const payload_schema_t *schema = reading->schema;
+    size_t len = snprintf(buf, size, "{\"dev_eui\":\"%02X%02X%02X%02X%02X%02X\",\"type\":\"%s\",\"seq\":%d",
+                          dev_eui[0], dev_eui[1], dev_eui[2], dev_eui[3], dev_eui[4], dev_eui[5],
+                          schema->name, reading->seq);
+    for (uint8_t i = 0; i < schema->field_cnt && len < size; i++) {
+        const payload_field_t *field = &schema->fields[i];
+        if (field->decimals) {
+            len += snprintf(&buf[len], size - len, ",\"%s\":%.*f", field->name, field->decimals,
+                            reading->values[i] / s_pow10[field->decimals]);
+        } else {
+            len += snprintf(&buf[len], size - len, ",\"%s\":%" PRIi32, field->name, reading->values[i]);
+        }
+    }
+    if (len < size) {
+        len += snprintf(&buf[len], size - len, "}");
+    }
+    return len < size ? (int)len : -1;
+}
+
+void payload_codec_get_stats(payload_codec_stats_t *stats)
+{
+    *stats = s_stats;
+}
@@ -5,6 +5,7 @@
 #include "freertos/task.h"
 #include "esp_err.h"
 #include "esp_log.h"
+#include "esp_random.h"
 #include "cJSON.h"
 #include "core/core_tasks.h"
 #include "core/sx127x.h"
@@ -12,9 +13,24 @@
 #include "app/app_config.h"
 #include "app/lora_manager.h"
 #include "app/provisioning_manager.h"
+#include "app/address_manager.h"
+#include "app/replay_manager.h"
 
 static const char *TAG = "provisioning_manager";
 
+/* gateway, challenges waiting for their echo; the dispatch stage only, so there is no lock */
+typedef struct {
+    bool used;
+    uint8_t dev_eui[LORA_DEV_EUI_LEN];
+    uint8_t challenge[PROVISIONING_CHALLENGE_LEN];
+} provisioning_challenge_t;
+
+static provisioning_challenge_t s_challenges[PROVISIONING_CHALLENGE_MAX];
+static uint8_t s_challenge_next = 0;
+/* client, the last challenge of the gateway goes in every request */
+static uint8_t s_challenge[PROVISIONING_CHALLENGE_LEN] = {0};
+static volatile bool s_challenge_new = false;
+
 static esp_err_t provisioning_mngr_check_client_is_exist(provisioning_t *provisioning_packet)
 {
     char c_path[sizeof(provisioning_packet->global_dev_eui) + strlen(APP_CONFIG_FILE_BASE_PATH) + 1];
@@ -34,22 +50,31 @@ static esp_err_t provisioning_mngr_check_client_is_exist(provisioning_t *provisi
     return ESP_FAIL;
 }
 
-static esp_err_t provisioning_mngr_approve_client(provisioning_t *provisioning_packet)
+static esp_err_t provisioning_mngr_approve_client(lora_frame_t *lora_data)
 {
+    provisioning_t *provisioning_packet = (provisioning_t *)lora_data->data;
+    uint16_t dev_addr = LORA_DEV_ADDR_NONE;
     // Save new client to approved clients list.
     // Use flash or nvs.
     if (provisioning_mngr_check_client_is_exist(provisioning_packet) == ESP_OK) {
         ESP_LOGI(TAG, "New client added to client list.");
         ESP_LOG_BUFFER_HEX(TAG, provisioning_packet->global_dev_eui, sizeof(provisioning_packet->global_dev_eui));
-        lora_send_tx_queue(LORA_PACKET_ID_PROVISING_OK, NULL, 0);
+        /* without an address the client keeps sending its dev eui */
+        address_mngr_assign(lora_data->dev_eui, &dev_addr);
+        /* a client that lost its counter goes on above the last one the gateway accepted */
+        uint32_t floor = replay_mngr_last(lora_data->dev_eui) + 1;
+        uint8_t data[LORA_DEV_ADDR_LEN + sizeof(provisioning_packet->fcnt_floor)] = {
+            dev_addr >> 8, dev_addr & 0xff, floor >> 24, floor >> 16, floor >> 8, floor & 0xff,
+        };
+        lora_send_tx_queue(LORA_PACKET_ID_PROVISING_OK, data, sizeof(data));
         return ESP_OK;
     }
     return ESP_FAIL;
 }
 
-static esp_err_t provisioning_mngr_check_app_key(lora_frame_t *lora_data, char *app_key)
+static esp_err_t provisioning_mngr_check_app_key(const lora_frame_t *lora_data, char *app_key)
 {
-    provisioning_t *provisioning_packet = (provisioning_t *)lora_data->data;
+    const provisioning_t *provisioning_packet = (const provisioning_t *)lora_data->data;
     if (!strncmp((char *)&provisioning_packet->app_key, app_key, sizeof(provisioning_packet->app_key))) {
         //ESP_LOG_BUFFER_HEXDUMP(TAG, provisioning_packet->app_key, sizeof(provisioning_packet->app_key), ESP_LOG_WARN);
         ESP_LOGI(TAG, "App keys matched");
@@ -61,26 +86,110 @@ static esp_err_t provisioning_mngr_check_app_key(lora_frame_t *lora_data, char *
 
 esp_err_t provisioning_mngr_add_new_client(lora_frame_t *lora_data, char *app_key)
 {
-    provisioning_t *provisioning_packet = (provisioning_t *)lora_data->data;
     if (provisioning_mngr_check_app_key(lora_data, app_key) == ESP_OK) {
-        return provisioning_mngr_approve_client(provisioning_packet);
+        return provisioning_mngr_approve_client(lora_data);
     }
     return ESP_FAIL;
 }
 
-esp_err_t provisioning_mngr_provis_is_ok(lora_frame_t *lora_data, char *app_key)
+/* client, ESP_ERR_INVALID_SIZE for a PROVISING_OK without the address and the counter floor */
+esp_err_t provisioning_mngr_parse_ok(const lora_frame_t *lora_data, char *app_key, uint16_t *dev_addr, uint32_t *fcnt_floor)
 {
     if (provisioning_mngr_check_app_key(lora_data, app_key) != ESP_OK) {
         return ESP_FAIL;
     }
+    if (lora_data->data_len < sizeof(provisioning_t)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    const provisioning_t *provisioning_packet = (const provisioning_t *)lora_data->data;
+    const uint8_t *floor = provisioning_packet->fcnt_floor;
+    *dev_addr = provisioning_packet->dev_addr[0] << 8 | provisioning_packet->dev_addr[1];
+    *fcnt_floor = (uint32_t)floor[0] << 24 | (uint32_t)floor[1] << 16 | floor[2] << 8 | floor[3];
+    return ESP_OK;
+}
+
+esp_err_t provisioning_mngr_provis_is_ok(lora_frame_t *lora_data, char *app_key)
+{
+    uint16_t dev_addr = LORA_DEV_ADDR_NONE;
+    uint32_t fcnt_floor = 0;
+    esp_err_t err = provisioning_mngr_parse_ok(lora_data, app_key, &dev_addr, &fcnt_floor);
+    if (err == ESP_FAIL) {
+        return ESP_FAIL;
+    }
     provisioning_t *provisioning_packet = (provisioning_t *)lora_data->data;
     if (file_overwrite(APP_CONFIG_FILE_APPROVE_GW, (char *)provisioning_packet->global_dev_eui, sizeof(provisioning_packet->global_dev_eui))) {
         ESP_LOGI(TAG, "New device added");
+        if (err == ESP_OK) {
+            address_mngr_set_own(dev_addr);
+            lora_fcnt_floor(fcnt_floor);
+        }
         return ESP_OK;
     }
     return ESP_FAIL;
 }
 
+/*
+ * Gateway, a request with a counter seen before: ESP_OK when it echoes the challenge sent
+ * to its device, otherwise the device gets a challenge in the rx window of the request.
+ */
+esp_err_t provisioning_mngr_check_fresh(const uint8_t *dev_eui, const provisioning_t *request, char *app_key)
+{
+    if (strncmp((const char *)request->app_key, app_key, sizeof(request->app_key))) {
+        return ESP_FAIL;
+    }
+    provisioning_challenge_t *pending = NULL;
+    for (uint8_t i = 0; i < PROVISIONING_CHALLENGE_MAX; i++) {
+        if (s_challenges[i].used && !memcmp(s_challenges[i].dev_eui, dev_eui, LORA_DEV_EUI_LEN)) {
+            pending = &s_challenges[i];
+            break;
+        }
+    }
+    if (pending && !memcmp(pending->challenge, request->challenge, PROVISIONING_CHALLENGE_LEN)) {
+        pending->used = false;
+        ESP_LOGI(TAG, "provisioning request proved fresh");
+        return ESP_OK;
+    }
+    if (!pending) {
+        /* the oldest challenge gives way, its client asks again */
+        pending = &s_challenges[s_challenge_next];
+        s_challenge_next = (s_challenge_next + 1) % PROVISIONING_CHALLENGE_MAX;
+        uint32_t challenge = 0;
+        while (!challenge) {
+            challenge = esp_random();
+        }
+        pending->used = true;
+        memcpy(pending->dev_eui, dev_eui, LORA_DEV_EUI_LEN);
+        memcpy(pending->challenge, &challenge, PROVISIONING_CHALLENGE_LEN);
+    }
+    /* a lost challenge goes again with the next request, the same one */
+    lora_send_tx_queue(LORA_PACKET_ID_PROVISING_CHALLENGE, pending->challenge, PROVISIONING_CHALLENGE_LEN);
+    ESP_LOGW(TAG, "provisioning request with an old frame counter, challenge sent");
+    return ESP_ERR_INVALID_STATE;
+}
+
+/* client, from the dispatch stage */
+void provisioning_mngr_set_challenge(const uint8_t *challenge, uint8_t len)
+{
+    if (len != PROVISIONING_CHALLENGE_LEN) {
+        return;
+    }
+    memcpy(s_challenge, challenge, PROVISIONING_CHALLENGE_LEN);
+    s_challenge_new = true;
+}
+
+void provisioning_mngr_get_challenge(uint8_t *challenge)
+{
+    memcpy(challenge, s_challenge, PROVISIONING_CHALLENGE_LEN);
+}
+
+/* true once after a new challenge, the next request should go without waiting */
+bool provisioning_mngr_challenged(void)
+{
+    bool challenged = s_challenge_new;
+    s_challenge_new = false;
+    return challenged;
+}
+
 bool provisioning_mngr_check_device_is_approved(void)
 {
     return file_is_exist(APP_CONFIG_FILE_APPROVE_GW);
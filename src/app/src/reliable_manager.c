@@ -0,0 +1,310 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_random.h"
+#include "core/file_mngr.h"
+#include "app/app_types.h"
+#include "app/app_config.h"
+#include "app/lora_manager.h"
+#include "app/reliable_manager.h"
+
+static const char *TAG = "reliable_manager";
+
+/* client side, a frame waits here until an ack covers it or its retries run out */
+typedef struct {
+    bool used;
+    bool retransmitted;     /* no rtt sample from it, the ack may be of any copy */
+    bool fast_retransmitted;
+    bool unsent;            /* the send callback failed, the poll tries again */
+    uint8_t seq;
+    uint8_t retries;
+    int64_t sent_us;
+    int64_t deadline_us;
+    uint8_t data_len;
+    uint8_t data[LORA_PACKET_MAX_DATA_LEN];     /* with the reliable header */
+} reliable_tx_t;
+
+/* gateway side, bit n of the bitmap is next + n */
+typedef struct {
+    bool used;
+    uint8_t dev_eui[LORA_DEV_EUI_LEN];
+    uint8_t epoch;
+    uint8_t next;
+    uint32_t bitmap;
+    uint32_t last_use;
+} reliable_rx_t;
+
+static reliable_tx_t s_tx[RELIABLE_WINDOW];
+static uint8_t s_seq = 0;
+static uint8_t s_epoch = 0;
+static int64_t s_srtt_us = 0, s_rttvar_us = 0;
+static uint32_t s_rto_min_ms = 0;
+static SemaphoreHandle_t s_lock = NULL;
+static reliable_send_cb_t s_send_cb = NULL;
+static reliable_rx_t s_rx[RELIABLE_DEV_MAX];
+static uint32_t s_rx_use_cnt = 0;
+static reliable_stats_t s_stats = {0};
+
+/* one step per boot, a flashed client starts from a random one */
+static void reliable_mngr_epoch_restore(void)
+{
+    char *buf = NULL;
+    if (file_load(APP_CONFIG_FILE_RELIABLE_EPOCH, &buf) > 0) {
+        s_epoch = strtoul(buf, NULL, 10) + 1;
+    } else {
+        s_epoch = esp_random();
+    }
+    free(buf);
+    char saved[4];
+    int len = snprintf(saved, sizeof(saved), "%d", s_epoch);
+    /* through a temp file, a power loss in the write can't leave a torn epoch behind */
+    if (file_save(APP_CONFIG_FILE_RELIABLE_EPOCH, saved, len) != len) {
+        /* the next boot may go with this epoch again, its first frames may be taken as copies */
+        ESP_LOGE(TAG, "reliable epoch couldn't be saved!");
+    }
+    ESP_LOGI(TAG, "reliable epoch:%d", s_epoch);
+}
+
+/* rto_min_ms covers an uplink, the rx1 delay and the ack on air, the rtt estimate starts there */
+esp_err_t reliable_mngr_init(reliable_send_cb_t send_cb, uint32_t rto_min_ms)
+{
+    if (!send_cb) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    s_send_cb = send_cb;
+    s_rto_min_ms = MIN(rto_min_ms, RELIABLE_RTO_MAX_MS);
+    s_lock = xSemaphoreCreateMutex();
+    if (!s_lock) {
+        ESP_LOGE(TAG, "couldn't create the reliable lock!");
+        return ESP_FAIL;
+    }
+    s_stats.rto_ms = s_rto_min_ms;
+    reliable_mngr_epoch_restore();
+    return ESP_OK;
+}
+
+static int64_t reliable_mngr_rto_us(void)
+{
+    int64_t rto_us = s_srtt_us ? s_srtt_us + 4 * s_rttvar_us : 0;
+    return MIN(MAX(rto_us, (int64_t)s_rto_min_ms * 1000), (int64_t)RELIABLE_RTO_MAX_MS * 1000);
+}
+
+/* backs off exponentially, the jitter keeps the clients that lost the same frame apart */
+static void reliable_mngr_arm(reliable_tx_t *tx, int64_t now_us)
+{
+    int64_t rto_us = MIN(reliable_mngr_rto_us() << tx->retries, (int64_t)RELIABLE_RTO_MAX_MS * 1000);
+    tx->deadline_us = now_us + rto_us + esp_random() % (rto_us / 4 + 1);
+}
+
+/* called with the lock held */
+static esp_err_t reliable_mngr_transmit(reliable_tx_t *tx)
+{
+    int64_t now_us = esp_timer_get_time();
+    esp_err_t err = s_send_cb(tx->data, tx->data_len);
+    if (err == ESP_OK) {
+        if (!tx->retransmitted) {
+            tx->sent_us = now_us;
+        }
+        reliable_mngr_arm(tx, now_us);
+    }
+    return err;
+}
+
+esp_err_t reliable_mngr_send(uint8_t packet_id, const uint8_t *data, uint8_t data_len)
+{
+    if (!s_lock) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (data_len > LORA_PACKET_MAX_DATA_LEN - RELIABLE_HEADER_LEN || (!data && data_len)) {
+        ESP_LOGE(TAG, "data_len(%d) > %d", data_len, LORA_PACKET_MAX_DATA_LEN - RELIABLE_HEADER_LEN);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    esp_err_t err = ESP_ERR_NO_MEM;
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    for (uint8_t i = 0; i < RELIABLE_WINDOW; i++) {
+        reliable_tx_t *tx = &s_tx[i];
+        if (tx->used) {
+            continue;
+        }
+        memset(tx, 0, offsetof(reliable_tx_t, data));
+        tx->used = true;
+        tx->seq = s_seq++;
+        tx->data[0] = tx->seq;
+        tx->data[1] = packet_id;
+        tx->data[2] = s_epoch;
+        if (data_len) {
+            memcpy(&tx->data[RELIABLE_HEADER_LEN], data, data_len);
+        }
+        tx->data_len = RELIABLE_HEADER_LEN + data_len;
+        s_stats.sent++;
+        tx->unsent = reliable_mngr_transmit(tx) != ESP_OK;
+        err = ESP_OK;
+        break;
+    }
+    if (err != ESP_OK) {
+        s_stats.window_full++;
+    }
+    xSemaphoreGive(s_lock);
+    return err;
+}
+
+bool reliable_mngr_in_flight(void)
+{
+    bool in_flight = false;
+    if (!s_lock) {
+        return false;
+    }
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    for (uint8_t i = 0; i < RELIABLE_WINDOW; i++) {
+        in_flight |= s_tx[i].used;
+    }
+    xSemaphoreGive(s_lock);
+    return in_flight;
+}
+
+static void reliable_mngr_rtt_sample(int64_t rtt_us)
+{
+    if (!s_srtt_us) {
+        s_srtt_us = rtt_us;
+        s_rttvar_us = rtt_us / 2;
+    } else {
+        int64_t err_us = s_srtt_us > rtt_us ? s_srtt_us - rtt_us : rtt_us - s_srtt_us;
+        s_rttvar_us = (3 * s_rttvar_us + err_us) / 4;
+        s_srtt_us = (7 * s_srtt_us + rtt_us) / 8;
+    }
+    s_stats.rtt_ms = s_srtt_us / 1000;
+    s_stats.rto_ms = reliable_mngr_rto_us() / 1000;
+}
+
+/* client side, ack is the next expected sequence and the bitmap of the 8 after it */
+void reliable_mngr_handle_ack(const uint8_t *ack, int64_t rx_us)
+{
+    uint8_t next = ack[0], bitmap = ack[1];
+    /* frames before the last acknowledged one were lost, no need to wait for their timeout */
+    int8_t last_acked = -1;
+    for (int8_t i = 7; i >= 0 && last_acked < 0; i--) {
+        last_acked = bitmap & (1 << i) ? i + 1 : -1;
+    }
+    if (!s_lock) {
+        return;
+    }
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    for (uint8_t i = 0; i < RELIABLE_WINDOW; i++) {
+        reliable_tx_t *tx = &s_tx[i];
+        if (!tx->used) {
+            continue;
+        }
+        uint8_t distance = tx->seq - next;
+        if (distance >= 0x80 || (distance && distance <= 8 && bitmap & (1 << (distance - 1)))) {
+            if (!tx->retransmitted) {
+                reliable_mngr_rtt_sample(rx_us - tx->sent_us);
+            }
+            tx->used = false;
+            s_stats.acked++;
+        } else if (distance < last_acked && !tx->fast_retransmitted) {
+            /* due now, the next poll sends it like the other retransmissions */
+            tx->fast_retransmitted = true;
+            tx->deadline_us = 0;
+            s_stats.fast_retransmits++;
+        }
+    }
+    xSemaphoreGive(s_lock);
+}
+
+/* every RELIABLE_POLL_MS from a task that may wait, the send callback queues a frame */
+void reliable_mngr_poll(void)
+{
+    if (!s_lock) {
+        return;
+    }
+    int64_t now_us = esp_timer_get_time();
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    for (uint8_t i = 0; i < RELIABLE_WINDOW; i++) {
+        reliable_tx_t *tx = &s_tx[i];
+        if (!tx->used || now_us < tx->deadline_us) {
+            continue;
+        }
+        if (tx->retries >= RELIABLE_RETRY_MAX) {
+            tx->used = false;
+            s_stats.gave_up++;
+            ESP_LOGE(TAG, "seq:%d packet id:0x%x gave up", tx->seq, tx->data[1]);
+            continue;
+        }
+        bool retransmit = !tx->unsent;
+        tx->retransmitted |= retransmit;
+        /* the backoff of this attempt */
+        tx->retries += retransmit;
+        if (reliable_mngr_transmit(tx) != ESP_OK) {
+            tx->retries -= retransmit;
+            continue;
+        }
+        tx->unsent = false;
+        s_stats.retransmits += retransmit;
+    }
+    xSemaphoreGive(s_lock);
+}
+
+/* dispatch stage only, so there is no lock */
+static reliable_rx_t *reliable_mngr_rx_state(const uint8_t *dev_eui, bool *found)
+{
+    reliable_rx_t *oldest = &s_rx[0];
+    for (uint8_t i = 0; i < RELIABLE_DEV_MAX; i++) {
+        reliable_rx_t *rx = &s_rx[i];
+        if (rx->used && !memcmp(rx->dev_eui, dev_eui, LORA_DEV_EUI_LEN)) {
+            rx->last_use = ++s_rx_use_cnt;
+            *found = true;
+            return rx;
+        }
+        if (!rx->used || (oldest->used && rx->last_use < oldest->last_use)) {
+            oldest = rx;
+        }
+    }
+    memset(oldest, 0, sizeof(reliable_rx_t));
+    oldest->used = true;
+    memcpy(oldest->dev_eui, dev_eui, LORA_DEV_EUI_LEN);
+    oldest->last_use = ++s_rx_use_cnt;
+    *found = false;
+    return oldest;
+}
+
+/* gateway side, true when the frame is new and has to be dispatched, the ack is filled either way */
+bool reliable_mngr_receive(const uint8_t *dev_eui, const uint8_t *header, uint8_t *ack)
+{
+    bool found = false, fresh = true;
+    uint8_t seq = header[0], epoch = header[2];
+    reliable_rx_t *rx = reliable_mngr_rx_state(dev_eui, &found);
+    uint8_t distance = seq - rx->next;
+    if (!found || epoch != rx->epoch || (distance >= 32 && distance < 0x80)) {
+        /* a new device, a rebooted one or one far ahead after a loss */
+        rx->epoch = epoch;
+        rx->next = seq;
+        rx->bitmap = 0;
+        distance = 0;
+    } else if (distance >= 0x80 || rx->bitmap & (1u << distance)) {
+        fresh = false;
+    }
+    if (fresh) {
+        rx->bitmap |= 1u << distance;
+        while (rx->bitmap & 1) {
+            rx->next++;
+            rx->bitmap >>= 1;
+        }
+        s_stats.rx_delivered++;
+    } else {
+        s_stats.rx_duplicates++;
+    }
+    ack[0] = rx->next;
+    ack[1] = (rx->bitmap >> 1) & 0xff;
+    return fresh;
+}
+
+void reliable_mngr_get_stats(reliable_stats_t *stats)
+{
+    *stats = s_stats;
+}
@@ -0,0 +1,192 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "core/file_mngr.h"
+#include "app/app_types.h"
+#include "app/app_config.h"
+#include "app/lora_manager.h"
+#include "app/replay_manager.h"
+
+static const char *TAG = "replay_manager";
+
+/* bit n of the bitmap is last - n */
+typedef struct {
+    bool used;
+    uint8_t dev_eui[LORA_DEV_EUI_LEN];
+    uint32_t last;
+    uint32_t bitmap;
+} replay_dev_t;
+
+/* saved slot by slot, a zero eui is a free slot */
+typedef struct __attribute__((packed)) {
+    uint8_t dev_eui[LORA_DEV_EUI_LEN];
+    uint32_t limit;             /* no counter up to it was accepted before the save */
+} replay_saved_t;
+
+/* the devices are the dispatch stage's only, s_lock guards the limits the saving task writes out */
+static replay_dev_t s_devices[REPLAY_DEV_MAX];
+static replay_saved_t s_saved[REPLAY_DEV_MAX];
+static replay_saved_t s_save_buf[REPLAY_DEV_MAX];
+static volatile bool s_save_pending = false;
+static SemaphoreHandle_t s_lock = NULL;
+static replay_stats_t s_stats = {0};
+
+/* fnv-1a, the macs of a batch differ in the last bytes only */
+static uint16_t replay_mngr_hash(const uint8_t *dev_eui)
+{
+    uint32_t hash = 2166136261u;
+    for (uint8_t i = 0; i < LORA_DEV_EUI_LEN; i++) {
+        hash = (hash ^ dev_eui[i]) * 16777619u;
+    }
+    return (hash ^ hash >> 16) & (REPLAY_DEV_MAX - 1);
+}
+
+/* linear probe, a new device takes the first free slot, NULL when there is none nearby */
+static replay_dev_t *replay_mngr_find(const uint8_t *dev_eui, bool add, bool *found)
+{
+    uint16_t index = replay_mngr_hash(dev_eui);
+    *found = false;
+    for (uint16_t i = 0; i < REPLAY_PROBE_MAX; i++) {
+        replay_dev_t *dev = &s_devices[(index + i) & (REPLAY_DEV_MAX - 1)];
+        if (!dev->used) {
+            if (!add) {
+                return NULL;
+            }
+            dev->used = true;
+            memcpy(dev->dev_eui, dev_eui, LORA_DEV_EUI_LEN);
+            return dev;
+        }
+        if (!memcmp(dev->dev_eui, dev_eui, LORA_DEV_EUI_LEN)) {
+            *found = true;
+            return dev;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * No flash work here, only the limit in memory moves REPLAY_SAVE_STEP ahead once a device
+ * is half way to it, replay_mngr_save() writes it out well before the device gets there.
+ */
+static void replay_mngr_save_ahead(replay_dev_t *dev)
+{
+    replay_saved_t *saved = &s_saved[dev - s_devices];
+    if (dev->last < saved->limit - REPLAY_SAVE_STEP / 2 && !memcmp(saved->dev_eui, dev->dev_eui, LORA_DEV_EUI_LEN)) {
+        return;
+    }
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    memcpy(saved->dev_eui, dev->dev_eui, LORA_DEV_EUI_LEN);
+    saved->limit = dev->last > UINT32_MAX - REPLAY_SAVE_STEP ? UINT32_MAX : dev->last + REPLAY_SAVE_STEP;
+    s_save_pending = true;
+    xSemaphoreGive(s_lock);
+}
+
+/* every counter up to the saved limit of a device may have been accepted before the restart */
+esp_err_t replay_mngr_init(void)
+{
+    s_lock = xSemaphoreCreateMutex();
+    if (!s_lock) {
+        ESP_LOGE(TAG, "couldn't create the replay lock!");
+        return ESP_FAIL;
+    }
+    char *buf = NULL;
+    int len = file_load(APP_CONFIG_FILE_REPLAY_TABLE, &buf) - 1;
+    if (len > 0) {
+        memcpy(s_save_buf, buf, MIN((size_t)len, sizeof(s_save_buf)) / sizeof(replay_saved_t) * sizeof(replay_saved_t));
+    }
+    free(buf);
+    static const uint8_t s_free_eui[LORA_DEV_EUI_LEN] = {0};
+    uint16_t loaded = 0;
+    for (uint16_t i = 0; i < REPLAY_DEV_MAX; i++) {
+        bool found = false;
+        if (!memcmp(s_save_buf[i].dev_eui, s_free_eui, LORA_DEV_EUI_LEN)) {
+            continue;
+        }
+        /* hashed again, the table may have had another size before */
+        replay_dev_t *dev = replay_mngr_find(s_save_buf[i].dev_eui, true, &found);
+        if (!dev) {
+            s_stats.table_full++;
+            continue;
+        }
+        dev->last = s_save_buf[i].limit;
+        dev->bitmap = UINT32_MAX;
+        s_saved[dev - s_devices] = s_save_buf[i];
+        loaded++;
+    }
+    ESP_LOGI(TAG, "%d devices loaded", loaded);
+    return ESP_OK;
+}
+
+/* from a task that may wait on the flash, a failed save goes again the next time */
+esp_err_t replay_mngr_save(void)
+{
+    if (!s_save_pending) {
+        return ESP_OK;
+    }
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    memcpy(s_save_buf, s_saved, sizeof(s_save_buf));
+    s_save_pending = false;
+    xSemaphoreGive(s_lock);
+    if (file_save(APP_CONFIG_FILE_REPLAY_TABLE, (char *)s_save_buf, sizeof(s_save_buf)) != sizeof(s_save_buf)) {
+        s_save_pending = true;
+        s_stats.save_failures++;
+        ESP_LOGE(TAG, "replay table couldn't be saved!");
+        return ESP_FAIL;
+    }
+    s_stats.saves++;
+    return ESP_OK;
+}
+
+/* highest counter of a known device, 0 for a new one */
+uint32_t replay_mngr_last(const uint8_t *dev_eui)
+{
+    bool found = false;
+    replay_dev_t *dev = replay_mngr_find(dev_eui, false, &found);
+    return found ? dev->last : 0;
+}
+
+/* true when the frame is new, a device that lost its counter gets a floor from the provisioning */
+bool replay_mngr_accept(const uint8_t *dev_eui, uint32_t fcnt)
+{
+    bool found = false;
+    replay_dev_t *dev = replay_mngr_find(dev_eui, true, &found);
+    if (!dev) {
+        s_stats.table_full++;
+        ESP_LOGE(TAG, "replay table is full, new device dropped!");
+        return false;
+    }
+    uint32_t ahead = fcnt - dev->last, behind = dev->last - fcnt;
+    if (!found || fcnt > dev->last) {
+        /* counters never wrap, a lower one is behind */
+        dev->bitmap = !found || ahead >= REPLAY_WINDOW ? 1 : dev->bitmap << ahead | 1;
+        dev->last = fcnt;
+        replay_mngr_save_ahead(dev);
+        s_stats.new_devices += !found;
+        s_stats.accepted++;
+        return true;
+    }
+    if (behind >= REPLAY_WINDOW) {
+        s_stats.replays++;
+        ESP_LOGW(TAG, "frame counter %" PRIu32 " is %" PRIu32 " behind, replay dropped", fcnt, behind);
+        return false;
+    }
+    if (dev->bitmap & (1u << behind)) {
+        s_stats.duplicates++;
+        return false;
+    }
+    dev->bitmap |= 1u << behind;
+    s_stats.accepted++;
+    s_stats.late++;
+    return true;
+}
+
+void replay_mngr_get_stats(replay_stats_t *stats)
+{
+    *stats = s_stats;
+}
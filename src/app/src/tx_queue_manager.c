@@ -0,0 +1,293 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "app/app_types.h"
+#include "app/lora_manager.h"
+#include "app/tx_queue_manager.h"
+
+static const char *TAG = "tx_queue_manager";
+
+#define TX_QUEUE_DEPTH_TOTAL    (TX_QUEUE_CONTROL_DEPTH + TX_QUEUE_DOWNLINK_DEPTH + TX_QUEUE_BULK_DEPTH)
+#define TX_QUEUE_TICK_US        (portTICK_PERIOD_MS * 1000)    /* a frame due within a tick goes now */
+
+typedef struct {
+    int64_t queued_us;
+    int64_t not_before_us;
+    uint16_t cost;
+    bool reply;
+} tx_queue_slot_t;
+
+/* a ring of depth slots, item i of the class is at (head + i) % depth */
+typedef struct {
+    const char *name;
+    uint8_t depth;
+    uint32_t quantum;           /* 0 for the strict priority class */
+    uint8_t head;
+    uint8_t cnt;
+    uint32_t deficit;
+    uint8_t *items;
+    tx_queue_slot_t slots[TX_QUEUE_BULK_DEPTH];
+} tx_queue_class_t;
+
+static tx_queue_class_t s_classes[TX_CLASS_MAX] = {
+    [TX_CLASS_CONTROL] = {.name = "control", .depth = TX_QUEUE_CONTROL_DEPTH},
+    [TX_CLASS_DOWNLINK] = {.name = "downlink", .depth = TX_QUEUE_DOWNLINK_DEPTH, .quantum = TX_QUEUE_DOWNLINK_WEIGHT * LORA_FRAME_MAX_LEN},
+    [TX_CLASS_BULK] = {.name = "bulk", .depth = TX_QUEUE_BULK_DEPTH, .quantum = TX_QUEUE_BULK_WEIGHT * LORA_FRAME_MAX_LEN},
+};
+_Static_assert(TX_QUEUE_CONTROL_DEPTH <= TX_QUEUE_BULK_DEPTH && TX_QUEUE_DOWNLINK_DEPTH <= TX_QUEUE_BULK_DEPTH,
+               "slots of a class are sized by the bulk depth");
+
+static size_t s_item_size = 0;
+static uint8_t *s_storage = NULL;
+/* round robin position, the class being served keeps its turn while its deficit lasts */
+static tx_class_t s_drr_class = TX_CLASS_DOWNLINK;
+static bool s_drr_granted = false;
+static uint32_t s_guard_us = 0;
+static bool s_hold = false;
+static SemaphoreHandle_t s_lock = NULL;
+static SemaphoreHandle_t s_wake = NULL;     /* given on every push, the pop looks again */
+static tx_queue_stats_t s_stats = {0};
+
+/* guard_us is the longest frame on air, it must not run into the rx window of a reply */
+esp_err_t tx_queue_mngr_init(size_t item_size, uint32_t guard_us)
+{
+    s_storage = calloc(TX_QUEUE_DEPTH_TOTAL, item_size);
+    s_lock = xSemaphoreCreateMutex();
+    s_wake = xSemaphoreCreateBinary();
+    if (!s_storage || !s_lock || !s_wake) {
+        ESP_LOGE(TAG, "couldn't create the tx queues!");
+        return ESP_ERR_NO_MEM;
+    }
+    s_item_size = item_size;
+    s_guard_us = guard_us;
+    uint8_t *items = s_storage;
+    for (uint8_t i = 0; i < TX_CLASS_MAX; i++) {
+        s_classes[i].items = items;
+        items += s_classes[i].depth * item_size;
+    }
+    return ESP_OK;
+}
+
+/* cost is what the round robin charges the class, the frame length on air, not_before_us 0 for now */
+esp_err_t tx_queue_mngr_push(tx_class_t tx_class, const void *item, uint16_t cost, int64_t not_before_us, uint8_t flags)
+{
+    if (!s_lock || tx_class >= TX_CLASS_MAX) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    tx_queue_class_t *q = &s_classes[tx_class];
+    tx_queue_class_stats_t *stats = &s_stats.classes[tx_class];
+    bool front = flags & (TX_QUEUE_FLAG_REPLY | TX_QUEUE_FLAG_RETRY);
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (q->cnt >= q->depth) {
+        stats->dropped++;
+        xSemaphoreGive(s_lock);
+        ESP_LOGE(TAG, "%s queue is full, frame dropped", q->name);
+        return ESP_ERR_NO_MEM;
+    }
+    uint8_t index = front ? (q->head + q->depth - 1) % q->depth : (q->head + q->cnt) % q->depth;
+    if (front) {
+        q->head = index;
+    }
+    memcpy(&q->items[index * s_item_size], item, s_item_size);
+    q->slots[index].queued_us = esp_timer_get_time();
+    q->slots[index].not_before_us = not_before_us;
+    q->slots[index].cost = cost;
+    q->slots[index].reply = flags & TX_QUEUE_FLAG_REPLY;
+    q->cnt++;
+    if (flags & TX_QUEUE_FLAG_RETRY) {
+        stats->requeued++;
+    } else {
+        stats->queued++;
+    }
+    stats->high_water = MAX(stats->high_water, q->cnt);
+    xSemaphoreGive(s_lock);
+    xSemaphoreGive(s_wake);
+    return ESP_OK;
+}
+
+/* position of the first frame of the class due now, -1 when none is */
+static int8_t tx_queue_mngr_first_due(const tx_queue_class_t *q, int64_t now_us, bool reply_only)
+{
+    for (uint8_t i = 0; i < q->cnt; i++) {
+        const tx_queue_slot_t *slot = &q->slots[(q->head + i) % q->depth];
+        if (slot->not_before_us - now_us < TX_QUEUE_TICK_US && (!reply_only || slot->reply)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* called with the lock held, TX_CLASS_MAX when no round robin class has a frame due */
+static tx_class_t tx_queue_mngr_drr_next(int64_t now_us, int8_t *pos)
+{
+    bool due = false;
+    for (uint8_t i = TX_CLASS_DOWNLINK; i < TX_CLASS_MAX; i++) {
+        due |= tx_queue_mngr_first_due(&s_classes[i], now_us, false) >= 0;
+    }
+    while (due) {
+        tx_queue_class_t *q = &s_classes[s_drr_class];
+        *pos = tx_queue_mngr_first_due(q, now_us, false);
+        if (*pos >= 0) {
+            if (!s_drr_granted) {
+                q->deficit += q->quantum;
+                s_drr_granted = true;
+            }
+            uint16_t cost = q->slots[(q->head + *pos) % q->depth].cost;
+            if (cost <= q->deficit) {
+                q->deficit -= cost;
+                return s_drr_class;
+            }
+        } else {
+            /* a class with nothing due saves no credit */
+            q->deficit = 0;
+        }
+        s_drr_class = s_drr_class + 1 < TX_CLASS_MAX ? s_drr_class + 1 : TX_CLASS_DOWNLINK;
+        s_drr_granted = false;
+    }
+    return TX_CLASS_MAX;
+}
+
+/* called with the lock held, the frames ahead of pos move up a slot */
+static void tx_queue_mngr_take(tx_class_t tx_class, int8_t pos, void *item)
+{
+    tx_queue_class_t *q = &s_classes[tx_class];
+    tx_queue_class_stats_t *stats = &s_stats.classes[tx_class];
+    uint8_t index = (q->head + pos) % q->depth;
+    memcpy(item, &q->items[index * s_item_size], s_item_size);
+    uint32_t wait_ms = (esp_timer_get_time() - q->slots[index].queued_us) / 1000;
+    for (; pos > 0; pos--) {
+        uint8_t to = (q->head + pos) % q->depth, from = (q->head + pos - 1) % q->depth;
+        memcpy(&q->items[to * s_item_size], &q->items[from * s_item_size], s_item_size);
+        q->slots[to] = q->slots[from];
+    }
+    q->head = (q->head + 1) % q->depth;
+    if (!--q->cnt && tx_class != TX_CLASS_CONTROL) {
+        q->deficit = 0;
+    }
+    uint8_t bucket = 0;
+    while (bucket < TX_QUEUE_WAIT_BUCKETS - 1 && wait_ms >= (1u << bucket)) {
+        bucket++;
+    }
+    stats->wait_hist[bucket]++;
+    stats->wait_max_ms = MAX(stats->wait_max_ms, wait_ms);
+    stats->sent++;
+}
+
+/* called with the lock held, ESP_OK with the item or the time the next frame is due in wake_us */
+static esp_err_t tx_queue_mngr_take_due(void *item, int64_t now_us, int64_t *wake_us)
+{
+    if (s_hold) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    /* a reply soon, only it may start */
+    int64_t reply_us = INT64_MAX, next_us = INT64_MAX;
+    for (uint8_t i = 0; i < TX_CLASS_MAX; i++) {
+        const tx_queue_class_t *q = &s_classes[i];
+        for (uint8_t j = 0; j < q->cnt; j++) {
+            const tx_queue_slot_t *slot = &q->slots[(q->head + j) % q->depth];
+            next_us = MIN(next_us, slot->not_before_us);
+            if (slot->reply) {
+                reply_us = MIN(reply_us, slot->not_before_us);
+            }
+        }
+    }
+    bool guard = reply_us != INT64_MAX && reply_us - now_us < (int64_t)s_guard_us;
+    int8_t pos = tx_queue_mngr_first_due(&s_classes[TX_CLASS_CONTROL], now_us, guard);
+    tx_class_t tx_class = TX_CLASS_CONTROL;
+    if (pos < 0) {
+        tx_class = guard ? TX_CLASS_MAX : tx_queue_mngr_drr_next(now_us, &pos);
+    }
+    if (tx_class == TX_CLASS_MAX) {
+        *wake_us = guard ? reply_us : next_us;
+        return ESP_ERR_NOT_FOUND;
+    }
+    tx_queue_mngr_take(tx_class, pos, item);
+    return ESP_OK;
+}
+
+/* waits up to timeout for a frame due, the frames waiting for their time stay queued */
+esp_err_t tx_queue_mngr_pop(void *item, TickType_t timeout)
+{
+    if (!s_lock) {
+        return ESP_ERR_TIMEOUT;
+    }
+    int64_t deadline_us = timeout == portMAX_DELAY ? INT64_MAX :
+                          esp_timer_get_time() + (int64_t)timeout * TX_QUEUE_TICK_US;
+    while (pdTRUE) {
+        int64_t now_us = esp_timer_get_time(), wake_us = INT64_MAX;
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        esp_err_t err = tx_queue_mngr_take_due(item, now_us, &wake_us);
+        xSemaphoreGive(s_lock);
+        if (err == ESP_OK) {
+            return ESP_OK;
+        }
+        wake_us = MIN(wake_us, deadline_us);
+        if (now_us >= deadline_us) {
+            return ESP_ERR_TIMEOUT;
+        }
+        TickType_t wait = wake_us == INT64_MAX ? portMAX_DELAY : pdMS_TO_TICKS(MAX(wake_us - now_us, 0) / 1000);
+        xSemaphoreTake(s_wake, MAX(wait, 1));
+    }
+}
+
+/* no frame is popped while held, the pop waits out its timeout */
+void tx_queue_mngr_hold(bool hold)
+{
+    if (!s_lock) {
+        return;
+    }
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    s_hold = hold;
+    xSemaphoreGive(s_lock);
+    xSemaphoreGive(s_wake);
+}
+
+uint32_t tx_queue_mngr_waiting(void)
+{
+    uint32_t waiting = 0;
+    if (!s_lock) {
+        return 0;
+    }
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    for (uint8_t i = 0; i < TX_CLASS_MAX; i++) {
+        waiting += s_classes[i].cnt;
+    }
+    xSemaphoreGive(s_lock);
+    return waiting;
+}
+
+/* one line per class, the histogram as counts of the buckets <1,<2,<4.. ms */
+void tx_queue_mngr_log_stats(void)
+{
+    tx_queue_stats_t stats;
+    tx_queue_mngr_get_stats(&stats);
+    for (uint8_t i = 0; i < TX_CLASS_MAX; i++) {
+        tx_queue_class_stats_t *c = &stats.classes[i];
+        char hist[TX_QUEUE_WAIT_BUCKETS * 11];
+        int len = 0;
+        for (uint8_t b = 0; b < TX_QUEUE_WAIT_BUCKETS; b++) {
+            len += snprintf(&hist[len], sizeof(hist) - len, "%s%" PRIu32, b ? "," : "", c->wait_hist[b]);
+        }
+        ESP_LOGI(TAG, "%s queued:%" PRIu32 " sent:%" PRIu32 " dropped:%" PRIu32 " requeued:%" PRIu32 " high water:%" PRIu32
+                 " wait max:%" PRIu32 "ms hist:%s", s_classes[i].name, c->queued, c->sent, c->dropped,
+                 c->requeued, c->high_water, c->wait_max_ms, hist);
+    }
+}
+
+void tx_queue_mngr_get_stats(tx_queue_stats_t *stats)
+{
+    if (!s_lock) {
+        memset(stats, 0, sizeof(tx_queue_stats_t));
+        return;
+    }
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    *stats = s_stats;
+    xSemaphoreGive(s_lock);
+}
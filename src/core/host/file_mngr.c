@@ -0,0 +1,175 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "core/file_mngr.h"
+
+/*
+ * Host build of the file manager, there is no spiffs partition. Device paths are kept
+ * under a host directory, SIM_FS_ROOT or ./sim_fs, so "/fs/x" is "<root>/fs/x".
+ */
+
+#define FILE_HOST_ROOT_DEFAULT  "sim_fs"
+
+static const char *TAG = "file-mngr";
+
+static const char *file_host_root(void)
+{
+    const char *root = getenv("SIM_FS_ROOT");
+    return root && root[0] ? root : FILE_HOST_ROOT_DEFAULT;
+}
+
+static const char *file_host_path(const char *path, char *host_path, size_t size)
+{
+    snprintf(host_path, size, "%s%s%s", file_host_root(), path[0] == '/' ? "" : "/", path);
+    return host_path;
+}
+
+esp_err_t file_mngr_init(const char *base_path)
+{
+    char host_path[PATH_MAX];
+    if (mkdir(file_host_root(), 0755) && errno != EEXIST) {
+        ESP_LOGE(TAG, "Failed to create %s (%s)", file_host_root(), strerror(errno));
+        return ESP_FAIL;
+    }
+    if (mkdir(file_host_path(base_path, host_path, sizeof(host_path)), 0755) && errno != EEXIST) {
+        ESP_LOGE(TAG, "Failed to create %s (%s)", host_path, strerror(errno));
+        return ESP_FAIL;
+    }
+    ESP_LOGI(TAG, "%s is kept in %s", base_path, host_path);
+    return ESP_OK;
+}
+
+bool file_is_exist(const char *path)
+{
+    char host_path[PATH_MAX];
+    struct stat st;
+    return stat(file_host_path(path, host_path, sizeof(host_path)), &st) == 0;
+}
+
+int file_delete(const char *path)
+{
+    char host_path[PATH_MAX];
+    unlink(file_host_path(path, host_path, sizeof(host_path)));
+    return ESP_OK;
+}
+
+int file_size(const char *path)
+{
+    char host_path[PATH_MAX];
+    struct stat st;
+    if (stat(file_host_path(path, host_path, sizeof(host_path)), &st) == 0) {
+        return st.st_size;
+    }
+    return -1;
+}
+
+int file_read(const char *path, char **buff)
+{
+    char host_path[PATH_MAX];
+    FILE *f = fopen(file_host_path(path, host_path, sizeof(host_path)), "r");
+    if (f == NULL) {
+        ESP_LOGE(TAG, "Failed to open file for reading");
+        return -1;
+    }
+    int fsize = file_size(path);
+    *buff = (char *)calloc(1, fsize + 1);
+    if (!(*buff)) {
+        fclose(f);
+        return -1;
+    }
+    fread(*buff, 1, fsize, f);
+    fclose(f);
+    return fsize + 1; /* null terminated */
+}
+
+static int file_host_write(const char *path, const char *mode, const char *buff, int buff_len)
+{
+    char host_path[PATH_MAX];
+    FILE *f = fopen(file_host_path(path, host_path, sizeof(host_path)), mode);
+    if (f == NULL) {
+        ESP_LOGE(TAG, "Failed to open %s (%s)", host_path, strerror(errno));
+        return -1;
+    }
+    size_t written = fwrite(buff, 1, buff_len, f);
+    fclose(f);
+    return written;
+}
+
+int file_write(const char *path, const char *buff, int buff_len)
+{
+    return file_host_write(path, "w", buff, buff_len);
+}
+
+int file_overwrite(const char *path, const char *buff, int buff_len)
+{
+    file_delete(path);
+
+    if (file_write(path, buff, buff_len) != buff_len) {
+        ESP_LOGE(TAG, "Failed to overwrite file (%s)", path);
+        return -1;
+    }
+
+    return buff_len;
+}
+
+int file_append(const char *path, const char *buff, int buff_len)
+{
+    return file_host_write(path, "a", buff, buff_len);
+}
+
+esp_err_t file_rename(const char *old_name, const char *new_name)
+{
+    char old_path[PATH_MAX], new_path[PATH_MAX];
+    if (rename(file_host_path(old_name, old_path, sizeof(old_path)), file_host_path(new_name, new_path, sizeof(new_path)))) {
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+/* spiffs can't rename over a file, a save that lost power between its two steps left the temp copy */
+static void file_recover(const char *path, const char *temp)
+{
+    if (!file_is_exist(path) && file_is_exist(temp) && file_rename(temp, path) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to recover file (%s)", path);
+    }
+}
+
+/*
+ * Replaces the file through a temp copy, a power loss leaves the old content or the new
+ * one. The old file goes only once the copy is complete, file_load() takes the copy then.
+ */
+int file_save(const char *path, const char *buff, int buff_len)
+{
+    char temp[FILE_PATH_MAX];
+    snprintf(temp, sizeof(temp), "%s" FILE_TEMP_SUFFIX, path);
+    file_recover(path, temp);
+    if (file_write(temp, buff, buff_len) != buff_len) {
+        ESP_LOGE(TAG, "Failed to save file (%s)", path);
+        file_delete(temp);
+        return -1;
+    }
+    file_delete(path);
+    if (file_rename(temp, path) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to save file (%s)", path);
+        return -1;
+    }
+    return buff_len;
+}
+
+/* file_read() of a file written by file_save() */
+int file_load(const char *path, char **buff)
+{
+    char temp[FILE_PATH_MAX];
+    snprintf(temp, sizeof(temp), "%s" FILE_TEMP_SUFFIX, path);
+    file_recover(path, temp);
+    if (!file_is_exist(path)) {
+        return -1;
+    }
+    return file_read(path, buff);
+}
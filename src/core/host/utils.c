@@ -0,0 +1,54 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "esp_err.h"
+#include "esp_log.h"
+
+/*
+ * Host build has no efuse, the mac is SIM_MAC (12 hex digits) or a locally
+ * administered default, processes on the same channel need different ones.
+ */
+
+#define UTILS_HOST_MAC_DEFAULT  "020000000001"
+
+static const char *TAG = "utils";
+
+esp_err_t utils_get_mac_bytes(uint8_t *mac)
+{
+    const char *str = getenv("SIM_MAC");
+    if (!str || strlen(str) != 12) {
+        str = UTILS_HOST_MAC_DEFAULT;
+    }
+    for (uint8_t i = 0; i < 6; i++) {
+        char byte[3] = {str[2 * i], str[2 * i + 1], '\0'};
+        char *end = NULL;
+        mac[i] = (uint8_t)strtoul(byte, &end, 16);
+        if (*end) {
+            ESP_LOGE(TAG, "SIM_MAC has to be 12 hex digits!");
+            return ESP_ERR_INVALID_ARG;
+        }
+    }
+    return ESP_OK;
+}
+
+char *utils_get_mac(void)
+{
+    static char s_mac_addr_cstr[12 + 1] = {0};
+
+    if (s_mac_addr_cstr[0] == '\0') {
+        uint8_t mac_byte_buffer[6] = {0};
+        if (utils_get_mac_bytes(mac_byte_buffer) == ESP_OK) {
+            snprintf(s_mac_addr_cstr, sizeof(s_mac_addr_cstr),
+                     "%02X%02X%02X%02X%02X%02X",
+                     mac_byte_buffer[0],
+                     mac_byte_buffer[1],
+                     mac_byte_buffer[2],
+                     mac_byte_buffer[3],
+                     mac_byte_buffer[4],
+                     mac_byte_buffer[5]);
+        }
+    }
+
+    return s_mac_addr_cstr;
+}
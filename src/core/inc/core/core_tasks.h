@@ -18,4 +18,16 @@
 #define CORE_LORA_TASK_STACK        (4*KBYTE + CORE_TASK_MIN_STACK)
 #define CORE_LORA_TASK_NAME         "lora_process_task_tx"
 
+#define CORE_LORA_RX_PROC_TASK_PRIO     (CORE_TASK_PRIO_MIN + 7)
+#define CORE_LORA_RX_PROC_TASK_STACK    (4*KBYTE + CORE_TASK_MIN_STACK)
+#define CORE_LORA_RX_PROC_TASK_NAME     "lora_rx_proc"
+
+#define CORE_LORA_PUB_TASK_PRIO         (CORE_TASK_PRIO_MIN + 5)
+#define CORE_LORA_PUB_TASK_STACK        (4*KBYTE + CORE_TASK_MIN_STACK)
+#define CORE_LORA_PUB_TASK_NAME         "lora_publish"
+
+#define CORE_LORA_WORKER_TASK_PRIO      (CORE_TASK_PRIO_MIN + 4)
+#define CORE_LORA_WORKER_TASK_STACK     (3*KBYTE + CORE_TASK_MIN_STACK)
+#define CORE_LORA_WORKER_TASK_NAME      "lora_worker"
+
 #endif
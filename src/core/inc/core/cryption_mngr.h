@@ -2,20 +2,21 @@
 #define _CRYPTION_MNGR_H_
 
 #include <stdint.h>
+#include <stddef.h>
 #include "esp_err.h"
 
-typedef enum {
-    CRYPTION_FAIL = false,
-    CRYPTION_OK = true
-} cryption_status;
+/* aes ccm, 2 length bytes leave 13 bytes of nonce */
+#define CRYPTION_NONCE_LEN  13
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 esp_err_t cryption_mngr_init(char *key);
-esp_err_t cryption_mngr_decrypt(char *input, size_t len, char *output);
-esp_err_t cryption_mngr_encrypt(char *input, size_t len, char *output);
+esp_err_t cryption_mngr_seal(const uint8_t *nonce, const uint8_t *aad, size_t aad_len,
+                             const uint8_t *in, size_t len, uint8_t *out, uint8_t *tag, size_t tag_len);
+esp_err_t cryption_mngr_open(const uint8_t *nonce, const uint8_t *aad, size_t aad_len,
+                             const uint8_t *in, size_t len, uint8_t *out, const uint8_t *tag, size_t tag_len);
 
 #ifdef __cplusplus
 }
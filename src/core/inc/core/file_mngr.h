@@ -8,6 +8,9 @@
 extern "C" {
 #endif
 
+#define FILE_PATH_MAX       64
+#define FILE_TEMP_SUFFIX    ".tmp"  /* copy of file_save() until it replaces the file */
+
 esp_err_t file_mngr_init(const char *base_path);
 bool file_is_exist(const char *path);
 int file_delete(const char *path);
@@ -17,6 +20,8 @@ int file_write(const char *path, const char *buff, int buff_len);
 int file_overwrite(const char *path, const char *buff, int buff_len);
 int file_append(const char *path, const char *buff, int buff_len);
 esp_err_t file_rename(const char *old_name, const char *new_name);
+int file_save(const char *path, const char *buff, int buff_len);
+int file_load(const char *path, char **buff);
 
 #ifdef __cplusplus
 }
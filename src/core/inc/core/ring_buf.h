@@ -0,0 +1,38 @@
+#ifndef _RING_BUF_H_
+#define _RING_BUF_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Lock free single producer / single consumer ring of fixed size slots.
+ * Producer reserves a slot, fills it in place and commits it,
+ * consumer peeks the oldest slot and releases it after use.
+ */
+typedef struct {
+    uint8_t *storage;
+    size_t item_size;
+    uint32_t capacity;
+    uint32_t head;          /* written by producer only */
+    uint32_t tail;          /* written by consumer only */
+    uint32_t drops;
+    uint32_t high_water;
+} ring_buf_t;
+
+esp_err_t ring_buf_init(ring_buf_t *ring, void *storage, size_t item_size, uint32_t capacity);
+void *ring_buf_reserve(ring_buf_t *ring);
+void ring_buf_commit(ring_buf_t *ring);
+void *ring_buf_peek(ring_buf_t *ring);
+void ring_buf_release(ring_buf_t *ring);
+uint32_t ring_buf_count(ring_buf_t *ring);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
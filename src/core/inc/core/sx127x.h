@@ -2,7 +2,11 @@
 #define _SX127X_H_
 
 #include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
 #include "driver/spi_master.h"
+#include "driver/gpio.h"
+#include "sx127x_modem.h"
 
 #define TTN_SPI_HOST      SPI2_HOST
 #define TTN_PIN_SPI_SCLK  5
@@ -29,10 +33,16 @@
 #define REG_FIFO_RX_CURRENT_ADDR       0x10
 #define REG_IRQ_FLAGS                  0x12
 #define REG_RX_NB_BYTES                0x13
+#define REG_MODEM_STAT                 0x18
 #define REG_PKT_SNR_VALUE              0x19
 #define REG_PKT_RSSI_VALUE             0x1a
+#define REG_RSSI_VALUE                 0x1b
+#define REG_FEI_MSB                    0x28
+#define REG_FEI_MID                    0x29
+#define REG_FEI_LSB                    0x2a
 #define REG_MODEM_CONFIG_1             0x1d
 #define REG_MODEM_CONFIG_2             0x1e
+#define REG_SYMB_TIMEOUT_LSB           0x1f
 #define REG_PREAMBLE_MSB               0x20
 #define REG_PREAMBLE_LSB               0x21
 #define REG_PAYLOAD_LENGTH             0x22
@@ -53,6 +63,24 @@
 #define MODE_TX                        0x03
 #define MODE_RX_CONTINUOUS             0x05
 #define MODE_RX_SINGLE                 0x06
+#define MODE_CAD                       0x07
+
+/*
+ * Modem configuration
+ */
+#define MODEM_CONFIG_1_IMPLICIT_HEADER 0x01
+#define MODEM_CONFIG_2_CRC_ON          0x04
+#define MODEM_CONFIG_3_LDRO            0x08
+#define MODEM_CONFIG_3_AGC_AUTO        0x04
+#define DETECTION_OPTIMIZE_SF6         0xc5
+#define DETECTION_OPTIMIZE_SF7_12      0xc3
+#define DETECTION_THRESHOLD_SF6        0x0c
+#define DETECTION_THRESHOLD_SF7_12     0x0a
+
+/*
+ * Modem status, signal detected | synchronized | header info valid
+ */
+#define MODEM_STAT_RX_ONGOING_MASK     0x0b
 
 /*
  * PA configuration
@@ -62,9 +90,22 @@
 /*
  * IRQ masks
  */
+#define IRQ_CAD_DETECTED_MASK          0x01
+#define IRQ_CAD_DONE_MASK              0x04
 #define IRQ_TX_DONE_MASK               0x08
 #define IRQ_PAYLOAD_CRC_ERROR_MASK     0x20
 #define IRQ_RX_DONE_MASK               0x40
+#define IRQ_RX_TIMEOUT_MASK            0x80
+#define IRQ_CAD_ALL_MASK               0x05
+#define IRQ_RX_ALL_MASK                0xf0
+
+/*
+ * DIO0 mapping (REG_DIO_MAPPING_1 bits 7-6)
+ */
+#define DIO0_MAPPING_MASK              0xc0
+#define DIO0_MAPPING_RX_DONE           0x00
+#define DIO0_MAPPING_TX_DONE           0x40
+#define DIO0_MAPPING_CAD_DONE          0x80
 
 #define PA_OUTPUT_RFO_PIN              0
 #define PA_OUTPUT_PA_BOOST_PIN         1
@@ -72,34 +113,138 @@
 #define TIMEOUT_RESET                  100
 #define LORA_WRITE_REG_VALUE_1 0
 #define LORA_WRITE_REG_VALUE_2 0x03
-#define LORA_WRITE_REG_VALUE_3 0x04
 #define GPIO_SET_LEVEL_LOW 0
 #define GPIO_SET_LEVEL_HIGH 1
 #define LORA_TX_POWER 17
+#define SX127X_TX_TIMEOUT_MARGIN_MS    1000
+#define SX127X_SCRIPT_MAX_OPS          8
+#define SX127X_RSSI_SETTLE_MS          2
+#define SX127X_CAD_TIMEOUT_MARGIN_MS   10
 
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-#define LoRa_EUROPE_FREQUENCY (838e6)
-
-void sx127x_set_task_params(void *task);
-void sx127x_configure_pins(spi_host_device_t host, uint8_t miso, uint8_t mosi, uint8_t sclk, uint8_t nss, uint8_t rst, uint8_t dio0);
-void sx127x_init(void);
-void sx127x_write_reg(uint8_t adrr, uint8_t data);
-void sx127x_write_buf(uint8_t addr, uint8_t *buf, size_t len);
-uint8_t sx127x_read_reg(uint8_t addr);
-void sx127x_read_buf(uint8_t addr, uint8_t *buf, size_t len);
-void sx127x_reset(void);
-void sx127x_set_frequency(long frequency);
-void sx127x_enable_crc(void);
-void sx127x_send_packet(uint8_t *buf, size_t size);
-void sx127x_receive(void);
-uint8_t sx127x_received(void);
-int sx127x_receive_packet(uint8_t *buf, size_t size);
-int sx127x_packet_rssi(void);
+/**
+ * @brief Radio handle, one per SX127x module. Radios can share an spi host,
+ *        each one has its own chip select, reset and DIO0 pins.
+ */
+typedef struct sx127x_dev_t *sx127x_handle_t;
+
+typedef struct {
+    spi_host_device_t spi_host;
+    gpio_num_t pin_miso;
+    gpio_num_t pin_mosi;
+    gpio_num_t pin_sclk;
+    gpio_num_t pin_nss;
+    gpio_num_t pin_rst;
+    gpio_num_t pin_dio0;
+    void (*rx_task)(void *pvParameter);  /* created per radio, gets the handle as its parameter */
+    void *user_ctx;
+    sx127x_modem_config_t modem;
+} sx127x_config_t;
+
+/**
+ * @brief TX done callback, called from the DIO0 ISR.
+ *        Only ISR safe (FromISR) APIs can be used in it.
+ *
+ * @return true if a higher priority task has been woken up.
+ */
+typedef bool (*sx127x_tx_done_cb_t)(void *arg);
 
+/**
+ * @brief Per packet rx metadata, read in the same spi batch as the packet.
+ */
+typedef struct {
+    int64_t timestamp_us;       /* esp_timer time of the RxDone interrupt */
+    int16_t rssi;               /* packet rssi, dBm */
+    int16_t rssi_corrected;     /* snr corrected packet rssi, dBm */
+    float snr;                  /* dB */
+    int32_t freq_error_hz;
+    uint8_t spreading_factor;
+} sx127x_rx_metadata_t;
+
+/**
+ * @brief Register script, a sequence of register/fifo accesses
+ *        submitted to the spi driver as one batch.
+ */
+typedef struct {
+    spi_transaction_t trans[SX127X_SCRIPT_MAX_OPS];
+    uint8_t *dest[SX127X_SCRIPT_MAX_OPS];
+    uint8_t count;
+} sx127x_script_t;
+
+typedef enum {
+    SX127X_SPI_OP_READ_REG,
+    SX127X_SPI_OP_WRITE_REG,
+    SX127X_SPI_OP_READ_BUF,
+    SX127X_SPI_OP_WRITE_BUF,
+    SX127X_SPI_OP_SCRIPT,
+    SX127X_SPI_OP_TX_PACKET,
+    SX127X_SPI_OP_RX_PACKET,
+    SX127X_SPI_OP_MAX
+} sx127x_spi_op_t;
+
+typedef struct {
+    uint32_t calls;
+    uint32_t transactions;
+    uint64_t time_us;
+} sx127x_spi_op_stats_t;
+
+typedef struct {
+    sx127x_spi_op_stats_t op[SX127X_SPI_OP_MAX];
+} sx127x_spi_stats_t;
+
+esp_err_t sx127x_init(const sx127x_config_t *config, sx127x_handle_t *out_handle);
+void *sx127x_get_user_ctx(sx127x_handle_t dev);
+void sx127x_write_reg(sx127x_handle_t dev, uint8_t adrr, uint8_t data);
+void sx127x_write_buf(sx127x_handle_t dev, uint8_t addr, uint8_t *buf, size_t len);
+uint8_t sx127x_read_reg(sx127x_handle_t dev, uint8_t addr);
+void sx127x_read_buf(sx127x_handle_t dev, uint8_t addr, uint8_t *buf, size_t len);
+void sx127x_reset(sx127x_handle_t dev);
+void sx127x_set_frequency(sx127x_handle_t dev, long frequency);
+void sx127x_enable_crc(sx127x_handle_t dev);
+esp_err_t sx127x_send_packet(sx127x_handle_t dev, uint8_t *buf, size_t size);
+esp_err_t sx127x_send_async(sx127x_handle_t dev, uint8_t *buf, size_t size, sx127x_tx_done_cb_t cb, void *arg);
+void sx127x_tx_done(sx127x_handle_t dev);
+void sx127x_receive(sx127x_handle_t dev);
+void sx127x_idle(sx127x_handle_t dev);
+void sx127x_sleep(sx127x_handle_t dev);
+int64_t sx127x_dio0_timestamp_us(sx127x_handle_t dev);
+uint8_t sx127x_received(sx127x_handle_t dev);
+int sx127x_receive_packet(sx127x_handle_t dev, uint8_t *buf, size_t size, sx127x_rx_metadata_t *meta);
+int sx127x_packet_rssi(sx127x_handle_t dev);
+
+esp_err_t sx127x_apply_modem_config(sx127x_handle_t dev, const sx127x_modem_config_t *config);
+void sx127x_get_modem_config(sx127x_handle_t dev, sx127x_modem_config_t *config);
+esp_err_t sx127x_set_spreading_factor(sx127x_handle_t dev, uint8_t sf);
+esp_err_t sx127x_set_bandwidth(sx127x_handle_t dev, sx127x_bw_t bandwidth);
+esp_err_t sx127x_set_coding_rate(sx127x_handle_t dev, sx127x_cr_t coding_rate);
+esp_err_t sx127x_set_preamble_length(sx127x_handle_t dev, uint16_t preamble_len);
+void sx127x_set_sync_word(sx127x_handle_t dev, uint8_t sync_word);
+void sx127x_explicit_header_mode(sx127x_handle_t dev);
+esp_err_t sx127x_implicit_header_mode(sx127x_handle_t dev, uint8_t payload_len);
+esp_err_t sx127x_set_symbol_timeout(sx127x_handle_t dev, uint16_t symbols);
+
+esp_err_t sx127x_start_cad(sx127x_handle_t dev);
+esp_err_t sx127x_cad_result(sx127x_handle_t dev, bool *detected);
+esp_err_t sx127x_channel_activity(sx127x_handle_t dev, bool *detected);
+esp_err_t sx127x_channel_rssi(sx127x_handle_t dev, int16_t *rssi);
+bool sx127x_rx_ongoing(sx127x_handle_t dev);
+void sx127x_receive_single(sx127x_handle_t dev);
+bool sx127x_rx_timed_out(sx127x_handle_t dev);
+uint32_t sx127x_time_on_air_us(sx127x_handle_t dev, size_t payload_len);
+
+void sx127x_script_init(sx127x_script_t *script);
+esp_err_t sx127x_script_write_reg(sx127x_script_t *script, uint8_t addr, uint8_t data);
+esp_err_t sx127x_script_read_reg(sx127x_script_t *script, uint8_t addr, uint8_t *data);
+esp_err_t sx127x_script_write_buf(sx127x_script_t *script, uint8_t addr, const uint8_t *buf, size_t len);
+esp_err_t sx127x_script_read_buf(sx127x_script_t *script, uint8_t addr, uint8_t *buf, size_t len);
+esp_err_t sx127x_script_run(sx127x_handle_t dev, sx127x_script_t *script);
+
+void sx127x_get_spi_stats(sx127x_handle_t dev, sx127x_spi_stats_t *stats);
+void sx127x_reset_spi_stats(sx127x_handle_t dev);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,86 @@
+#ifndef _SX127X_MODEM_H_
+#define _SX127X_MODEM_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LoRa_EUROPE_FREQUENCY (838e6)
+
+#define SX127X_SF_MIN                  6
+#define SX127X_SF_MAX                  12
+#define SX127X_PREAMBLE_MIN            6
+#define SX127X_FREQUENCY_MIN           (137e6)
+#define SX127X_FREQUENCY_MAX           (1020e6)
+#define SX127X_SYNC_WORD_PRIVATE       0x12
+#define SX127X_SYMBOL_TIMEOUT_MAX      0x3ff
+#define SX127X_SYMBOL_TIMEOUT_DEFAULT  0x64
+
+/* values are the REG_MODEM_CONFIG_1 bandwidth field */
+typedef enum {
+    SX127X_BW_7_8_KHZ,
+    SX127X_BW_10_4_KHZ,
+    SX127X_BW_15_6_KHZ,
+    SX127X_BW_20_8_KHZ,
+    SX127X_BW_31_25_KHZ,
+    SX127X_BW_41_7_KHZ,
+    SX127X_BW_62_5_KHZ,
+    SX127X_BW_125_KHZ,
+    SX127X_BW_250_KHZ,
+    SX127X_BW_500_KHZ,
+    SX127X_BW_MAX
+} sx127x_bw_t;
+
+/* values are the REG_MODEM_CONFIG_1 coding rate field */
+typedef enum {
+    SX127X_CR_4_5 = 1,
+    SX127X_CR_4_6,
+    SX127X_CR_4_7,
+    SX127X_CR_4_8
+} sx127x_cr_t;
+
+typedef struct {
+    long frequency;
+    uint8_t spreading_factor;
+    sx127x_bw_t bandwidth;
+    sx127x_cr_t coding_rate;
+    uint16_t preamble_len;
+    uint8_t sync_word;
+    bool crc_on;
+    bool implicit_header;
+    uint8_t payload_len;    /* fixed frame length in implicit header mode */
+    uint16_t symbol_timeout; /* rx single timeout in symbols */
+} sx127x_modem_config_t;
+
+#define SX127X_MODEM_CONFIG_DEFAULT() {         \
+    .frequency = LoRa_EUROPE_FREQUENCY,         \
+    .spreading_factor = 7,                      \
+    .bandwidth = SX127X_BW_125_KHZ,             \
+    .coding_rate = SX127X_CR_4_5,               \
+    .preamble_len = 8,                          \
+    .sync_word = SX127X_SYNC_WORD_PRIVATE,      \
+    .crc_on = true,                             \
+    .implicit_header = false,                   \
+    .payload_len = 0,                           \
+    .symbol_timeout = SX127X_SYMBOL_TIMEOUT_DEFAULT, \
+}
+
+/*
+ * Pure helpers without any hardware access, they can be built and tested on the host.
+ */
+bool sx127x_modem_config_is_valid(const sx127x_modem_config_t *config);
+uint32_t sx127x_modem_bandwidth_hz(sx127x_bw_t bandwidth);
+sx127x_bw_t sx127x_modem_bandwidth_from_hz(uint32_t hz);
+bool sx127x_modem_low_data_rate_optimize(const sx127x_modem_config_t *config);
+uint32_t sx127x_modem_symbol_time_us(const sx127x_modem_config_t *config);
+uint32_t sx127x_modem_time_on_air_us(const sx127x_modem_config_t *config, size_t payload_len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
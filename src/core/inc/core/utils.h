@@ -9,6 +9,7 @@ extern "C" {
 #endif
 
 char *utils_get_mac(void);
+esp_err_t utils_get_mac_bytes(uint8_t *mac);
 
 #ifdef __cplusplus
 }
@@ -1,93 +1,91 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 #include "esp_err.h"
 #include "esp_log.h"
-#include "mbedtls/aes.h"
+#include "mbedtls/ccm.h"
 #include "core/cryption_mngr.h"
 
-#define TEST_INPUT_LENGTH 256
-
-#define CHECK_AES_LEN(len)                                              \
-    if (len < 16) len = 16;                                             \
-    if ((len % 16)) {                                                   \
-        ESP_LOGE(TAG, "For CBC it has to be a multiple of 16 bytes.");  \
-        return CRYPTION_FAIL;                                           \
-    }                                                                   \
-
-#define CHECK_IS_NULL(ptr)                                              \
-        if (ptr != NULL) {                                              \
-             ESP_LOGE(TAG, "%s already inited!", __func__);             \
-             return ESP_FAIL;                                           \
-        }                                                               \
-                                                                        \
+#define TEST_INPUT_LENGTH 64
+#define TEST_TAG_LENGTH 4
 
 static const char *TAG = "cryption_mngr";
 
-typedef struct {
-    uint8_t *enc_key;
-    unsigned int keybits;
-    unsigned char *iv_in;
-    unsigned char *iv_out;
-    mbedtls_aes_context *aes;
-} s_cryption_if_t;
-
-static s_cryption_if_t s_cryption_if = {.enc_key = NULL,
-                                        .keybits = 256,
-                                        .iv_in = NULL,
-                                        .iv_out = NULL,
-                                       };
-static mbedtls_aes_context s_aes;
+static mbedtls_ccm_context s_ccm;
+static unsigned int s_keybits = 0;
+/* the ccm context keeps the state of the running operation, one at a time */
+static SemaphoreHandle_t s_lock = NULL;
 
-esp_err_t cryption_mngr_encrypt(char *input, size_t len, char *output)
+/*
+ * Every frame has its own nonce, so a lost or reordered frame costs nothing to the next
+ * ones. The nonce must never repeat under the same key, the callers build it from the
+ * sender and its frame counter. in and out may be the same buffer.
+ */
+esp_err_t cryption_mngr_seal(const uint8_t *nonce, const uint8_t *aad, size_t aad_len,
+                             const uint8_t *in, size_t len, uint8_t *out, uint8_t *tag, size_t tag_len)
 {
-    CHECK_AES_LEN(len)
-    return mbedtls_aes_crypt_cbc(s_cryption_if.aes, MBEDTLS_AES_ENCRYPT, len, s_cryption_if.iv_in, (const unsigned char *)input, (unsigned char *)output) ? ESP_FAIL : ESP_OK;
-}
-
-esp_err_t cryption_mngr_decrypt(char *input, size_t len, char *output)
-{
-    CHECK_AES_LEN(len)
-    return mbedtls_aes_crypt_cbc(s_cryption_if.aes, MBEDTLS_AES_DECRYPT, len, s_cryption_if.iv_out, (const unsigned char *)input, (unsigned char *)output) ? ESP_FAIL : ESP_OK;
+    if (!s_lock) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    int ret = mbedtls_ccm_encrypt_and_tag(&s_ccm, len, nonce, CRYPTION_NONCE_LEN, aad, aad_len, in, out, tag, tag_len);
+    xSemaphoreGive(s_lock);
+    return ret ? ESP_FAIL : ESP_OK;
 }
 
-static esp_err_t cryption_mngr_set_key(s_cryption_if_t *s_cryption_ifp)
+/* ESP_ERR_INVALID_CRC for a wrong tag, out is zeroed then */
+esp_err_t cryption_mngr_open(const uint8_t *nonce, const uint8_t *aad, size_t aad_len,
+                             const uint8_t *in, size_t len, uint8_t *out, const uint8_t *tag, size_t tag_len)
 {
-    return mbedtls_aes_setkey_enc(s_cryption_ifp->aes, s_cryption_ifp->enc_key, s_cryption_ifp->keybits) ? ESP_FAIL : ESP_OK;
+    if (!s_lock) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    int ret = mbedtls_ccm_auth_decrypt(&s_ccm, len, nonce, CRYPTION_NONCE_LEN, aad, aad_len, in, out, tag, tag_len);
+    xSemaphoreGive(s_lock);
+    if (ret == MBEDTLS_ERR_CCM_AUTH_FAILED) {
+        return ESP_ERR_INVALID_CRC;
+    }
+    return ret ? ESP_FAIL : ESP_OK;
 }
 
 esp_err_t cryption_mngr_init(char *key)
 {
-    CHECK_IS_NULL(s_cryption_if.aes);
-    CHECK_IS_NULL(s_cryption_if.enc_key);
-    CHECK_IS_NULL(s_cryption_if.iv_in);
-    CHECK_IS_NULL(s_cryption_if.iv_out);
-    mbedtls_aes_init(&s_aes);
-    s_cryption_if.aes = &s_aes;
-    s_cryption_if.enc_key = (uint8_t *)strdup(key);
-    s_cryption_if.iv_in = (unsigned char *)strdup(key);
-    s_cryption_if.iv_out = (unsigned char *)strdup(key);
-
-    esp_err_t sta = ESP_OK;
-    sta |= cryption_mngr_set_key(&s_cryption_if);
-    ESP_LOGI(TAG, "enc_key:\t%s", s_cryption_if.enc_key);
-    ESP_LOGI(TAG, "enc_key iv_in:\t%s", s_cryption_if.iv_in);
-    ESP_LOGI(TAG, "enc_key iv_out:\t%s", s_cryption_if.iv_out);
-    ESP_LOGI(TAG, "enc_key bits:\t%d", s_cryption_if.keybits);
-
-    /* Testing*/
-    char enc_input[TEST_INPUT_LENGTH] = {"EncryptionString"};
-
-    char *encrypt_output = (char *)malloc(TEST_INPUT_LENGTH);
-    if (cryption_mngr_encrypt(enc_input, TEST_INPUT_LENGTH, encrypt_output)) {
-        ESP_LOGI(TAG, "cryption_mngr_encrypt success.");
+    if (s_lock) {
+        ESP_LOGE(TAG, "%s already inited!", __func__);
+        return ESP_FAIL;
     }
+    size_t key_len = strlen(key);
+    if (key_len != 16 && key_len != 24 && key_len != 32) {
+        ESP_LOGE(TAG, "key has to be 16, 24 or 32 bytes!");
+        return ESP_ERR_INVALID_ARG;
+    }
+    mbedtls_ccm_init(&s_ccm);
+    s_keybits = key_len * 8;
+    if (mbedtls_ccm_setkey(&s_ccm, MBEDTLS_CIPHER_ID_AES, (const unsigned char *)key, s_keybits)) {
+        ESP_LOGE(TAG, "key couldn't be set!");
+        return ESP_FAIL;
+    }
+    s_lock = xSemaphoreCreateMutex();
+    if (!s_lock) {
+        return ESP_ERR_NO_MEM;
+    }
+    ESP_LOGI(TAG, "enc_key bits:\t%d", s_keybits);
 
-    char *decrypt_output = (char *)malloc(TEST_INPUT_LENGTH);
-    if (cryption_mngr_decrypt(encrypt_output, TEST_INPUT_LENGTH, decrypt_output)) {
-        ESP_LOGI(TAG, "cryption_mngr_decrypt success.");
+    /* Testing*/
+    uint8_t nonce[CRYPTION_NONCE_LEN] = {0};
+    uint8_t input[TEST_INPUT_LENGTH] = {"EncryptionString"};
+    uint8_t output[TEST_INPUT_LENGTH];
+    uint8_t tag[TEST_TAG_LENGTH];
+    esp_err_t sta = cryption_mngr_seal(nonce, NULL, 0, input, sizeof(input), output, tag, sizeof(tag));
+    sta = sta == ESP_OK ? cryption_mngr_open(nonce, NULL, 0, output, sizeof(output), output, tag, sizeof(tag)) : sta;
+    if (sta != ESP_OK || memcmp(input, output, sizeof(input))) {
+        ESP_LOGE(TAG, "seal/open self test failed!");
+        return ESP_FAIL;
     }
-    ESP_LOGI(TAG, "decrypt output string:%s", decrypt_output);
+    ESP_LOGI(TAG, "decrypt output string:%.16s", (char *)output);
     /* End test */
-    return sta;
+    return ESP_OK;
 }
@@ -6,6 +6,7 @@
 #include "esp_err.h"
 #include "esp_log.h"
 #include "esp_spiffs.h"
+#include "core/file_mngr.h"
 
 static const char *TAG = "file-mngr";
 
@@ -136,3 +137,45 @@ esp_err_t file_rename(const char *old_name, const char *new_name)
     }
     return ESP_OK;
 }
+
+/* spiffs can't rename over a file, a save that lost power between its two steps left the temp copy */
+static void file_recover(const char *path, const char *temp)
+{
+    if (!file_is_exist(path) && file_is_exist(temp) && file_rename(temp, path) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to recover file (%s)", path);
+    }
+}
+
+/*
+ * Replaces the file through a temp copy, a power loss leaves the old content or the new
+ * one. The old file goes only once the copy is complete, file_load() takes the copy then.
+ */
+int file_save(const char *path, const char *buff, int buff_len)
+{
+    char temp[FILE_PATH_MAX];
+    snprintf(temp, sizeof(temp), "%s" FILE_TEMP_SUFFIX, path);
+    file_recover(path, temp);
+    if (file_write(temp, buff, buff_len) != buff_len) {
+        ESP_LOGE(TAG, "Failed to save file (%s)", path);
+        file_delete(temp);
+        return -1;
+    }
+    file_delete(path);
+    if (file_rename(temp, path) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to save file (%s)", path);
+        return -1;
+    }
+    return buff_len;
+}
+
+/* file_read() of a file written by file_save() */
+int file_load(const char *path, char **buff)
+{
+    char temp[FILE_PATH_MAX];
+    snprintf(temp, sizeof(temp), "%s" FILE_TEMP_SUFFIX, path);
+    file_recover(path, temp);
+    if (!file_is_exist(path)) {
+        return -1;
+    }
+    return file_read(path, buff);
+}
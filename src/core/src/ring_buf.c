@@ -0,0 +1,58 @@
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "ring_buf.h"
+
+esp_err_t ring_buf_init(ring_buf_t *ring, void *storage, size_t item_size, uint32_t capacity)
+{
+    /* indexes run free and wrap at 2^32, capacity has to be a power of two */
+    if (!ring || !storage || !item_size || !capacity || (capacity & (capacity - 1))) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    ring->storage = (uint8_t *)storage;
+    ring->item_size = item_size;
+    ring->capacity = capacity;
+    ring->head = 0;
+    ring->tail = 0;
+    ring->drops = 0;
+    ring->high_water = 0;
+    return ESP_OK;
+}
+
+uint32_t ring_buf_count(ring_buf_t *ring)
+{
+    return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+}
+
+void *ring_buf_reserve(ring_buf_t *ring)
+{
+    uint32_t head = ring->head;
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= ring->capacity) {
+        ring->drops++;
+        return NULL;
+    }
+    return ring->storage + (head % ring->capacity) * ring->item_size;
+}
+
+void ring_buf_commit(ring_buf_t *ring)
+{
+    __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+    uint32_t count = ring_buf_count(ring);
+    if (count > ring->high_water) {
+        ring->high_water = count;
+    }
+}
+
+void *ring_buf_peek(ring_buf_t *ring)
+{
+    uint32_t tail = ring->tail;
+    if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == tail) {
+        return NULL;
+    }
+    return ring->storage + (tail % ring->capacity) * ring->item_size;
+}
+
+void ring_buf_release(ring_buf_t *ring)
+{
+    __atomic_store_n(&ring->tail, ring->tail + 1, __ATOMIC_RELEASE);
+}
@@ -1,11 +1,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <inttypes.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/semphr.h"
 #include "driver/gpio.h"
 #include "driver/spi_master.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "sx127x.h"
 
 #define SX127X_UNSED_PIN_NUM        -1
@@ -13,106 +16,111 @@
 #define SX127X_BUS_WRITE_MASK       0x80
 #define SX127X_VERSION              0x12
 #define SX127X_VERSION_TIMEOUT_S    2
+#define SX127X_SPI_SMALL_TRANS_LEN  4
+#define SX127X_FXOSC                32000000
 
 static const char *TAG = "sx127x_driver";
 
-static TaskHandle_t task_handle;
-
-typedef struct {
-    void (*task)(void *pvParameter);
-} sx127x_frtos_params;
-
-typedef struct {
+/* one per radio, every register access goes through its own spi device and lock */
+struct sx127x_dev_t {
     spi_host_device_t spi_host;
-    gpio_num_t pin_miso;
-    gpio_num_t pin_mosi;
-    gpio_num_t pin_sclk;
     gpio_num_t pin_nss;
-    gpio_num_t pin_rx_tx;
     gpio_num_t pin_rst;
     gpio_num_t pin_dio0;
-    sx127x_frtos_params frtos_p;
-} sx127x_pin_conf_t;
-static sx127x_pin_conf_t sx127x_conf;
-static spi_device_handle_t spi_handle;
-static long __frequency = 0;
-static int __implicit  = 0;
+    spi_device_handle_t spi_handle;
+    TaskHandle_t task_handle;
+    void *user_ctx;
+    SemaphoreHandle_t spi_lock;
+    sx127x_spi_stats_t spi_stats;
+    portMUX_TYPE spi_stats_lock;
+    sx127x_modem_config_t modem_config;
+    volatile uint8_t dio0_mapping;
+    volatile int64_t dio0_timestamp_us;
+    volatile bool tx_busy;
+    sx127x_tx_done_cb_t tx_done_cb;
+    void *tx_done_cb_arg;
+    TaskHandle_t cad_waiter;
+};
+
 static void assert_nss(spi_transaction_t *trans);
 static void deassert_nss(spi_transaction_t *trans);
+static int sx127x_rssi_offset(sx127x_handle_t dev);
 
-#define NOTIFY_BIT_DIO 1
-void IRAM_ATTR qio_irq_handler(void *arg)
+#define NOTIFY_BIT_DIO      1
+#define NOTIFY_BIT_TX_DONE  2
+#define NOTIFY_BIT_CAD_DONE 4
+/* isr argument is the radio, every DIO0 line is routed to its own rx task */
+static void IRAM_ATTR qio_irq_handler(void *arg)
 {
+    sx127x_handle_t dev = (sx127x_handle_t)arg;
     BaseType_t higher_prio_task_woken = pdFALSE;
-    xTaskNotifyFromISR(task_handle, NOTIFY_BIT_DIO, eSetBits, &higher_prio_task_woken);
+    dev->dio0_timestamp_us = esp_timer_get_time();
+    if (dev->dio0_mapping == DIO0_MAPPING_TX_DONE) {
+        /* TxDone goes to the sender, the rx task is not woken up for it */
+        if (dev->tx_done_cb && dev->tx_done_cb(dev->tx_done_cb_arg)) {
+            higher_prio_task_woken = pdTRUE;
+        }
+    } else if (dev->dio0_mapping == DIO0_MAPPING_CAD_DONE && dev->cad_waiter) {
+        /* listen before talk cad, the caller waits for it instead of the rx task */
+        xTaskNotifyFromISR(dev->cad_waiter, NOTIFY_BIT_CAD_DONE, eSetBits, &higher_prio_task_woken);
+    } else {
+        xTaskNotifyFromISR(dev->task_handle, NOTIFY_BIT_DIO, eSetBits, &higher_prio_task_woken);
+    }
     if (higher_prio_task_woken) {
         portYIELD_FROM_ISR();
     }
 }
 
-void sx127x_set_task_params(void *task)
-{
-    sx127x_conf.frtos_p.task = task;
-    if (sx127x_conf.frtos_p.task == NULL) {
-        ESP_LOGE(TAG, "sx127x_conf.frtos_p.task is null");
-    }
-}
-
-void sx127x_configure_pins(spi_host_device_t host, uint8_t miso, uint8_t mosi, uint8_t sclk, uint8_t nss, uint8_t rst, uint8_t dio0)
+static esp_err_t sx127x_init_io(sx127x_handle_t dev)
 {
-    sx127x_conf.spi_host = host;
-    sx127x_conf.pin_miso = (gpio_num_t)miso,
-    sx127x_conf.pin_mosi = (gpio_num_t)mosi,
-    sx127x_conf.pin_sclk = (gpio_num_t)sclk,
-    sx127x_conf.pin_nss = (gpio_num_t)nss;
-    sx127x_conf.pin_rst = (gpio_num_t)rst;
-    sx127x_conf.pin_dio0 = (gpio_num_t)dio0;
-}
-
-static void sx127x_init_io(void)
-{
-    // Initialize the GPIO ISR handler service
+    /* the isr service is shared by all radios, it is already there for the second one */
     esp_err_t err = gpio_install_isr_service(ESP_INTR_FLAG_IRAM);
-    ESP_ERROR_CHECK(err);
+    if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) {
+        ESP_LOGE(TAG, "gpio isr service couldn't be installed (%s)", esp_err_to_name(err));
+        return err;
+    }
 
     gpio_config_t output_pin_config = {
-        .pin_bit_mask = BIT64(sx127x_conf.pin_nss),
+        .pin_bit_mask = BIT64(dev->pin_nss),
         .mode = GPIO_MODE_OUTPUT,
         .pull_up_en = false,
         .pull_down_en = false,
         .intr_type = GPIO_INTR_DISABLE
     };
-    output_pin_config.pin_bit_mask |= BIT64(sx127x_conf.pin_rst);
+    output_pin_config.pin_bit_mask |= BIT64(dev->pin_rst);
     gpio_config(&output_pin_config);
-    gpio_set_level(sx127x_conf.pin_nss, 1);
-    gpio_set_level(sx127x_conf.pin_rst, 0);
+    gpio_set_level(dev->pin_nss, 1);
+    gpio_set_level(dev->pin_rst, 0);
 
-    // DIO pins with interrupt handlers
+    // DIO pins with interrupt handlers, the handler is added once the rx task exists
     gpio_config_t input_pin_config = {
-        .pin_bit_mask = BIT64(sx127x_conf.pin_dio0),
+        .pin_bit_mask = BIT64(dev->pin_dio0),
         .mode = GPIO_MODE_INPUT,
         .pull_up_en = false,
         .pull_down_en = true,
         .intr_type = GPIO_INTR_POSEDGE,
     };
     gpio_config(&input_pin_config);
-    gpio_isr_handler_add(sx127x_conf.pin_dio0, qio_irq_handler, (void *)0);
-    ESP_LOGI(TAG, "IO initialized");
+    ESP_LOGI(TAG, "IO initialized, nss:%d rst:%d dio0:%d", dev->pin_nss, dev->pin_rst, dev->pin_dio0);
+    return ESP_OK;
 }
 
-static void sx127x_init_spi(void)
+static esp_err_t sx127x_init_spi(sx127x_handle_t dev, const sx127x_config_t *config)
 {
-    // Initialize SPI bus
+    // Initialize SPI bus, radios on the same host share it
     spi_bus_config_t spi_bus_config = {
-        .miso_io_num =  sx127x_conf.pin_miso,
-        .mosi_io_num =  sx127x_conf.pin_mosi,
-        .sclk_io_num =  sx127x_conf.pin_sclk,
+        .miso_io_num =  config->pin_miso,
+        .mosi_io_num =  config->pin_mosi,
+        .sclk_io_num =  config->pin_sclk,
         .quadwp_io_num = SX127X_UNSED_PIN_NUM,
         .quadhd_io_num = SX127X_UNSED_PIN_NUM,
         .max_transfer_sz = 4092,
     };
-    esp_err_t err = spi_bus_initialize(sx127x_conf.spi_host, &spi_bus_config, SPI_DMA_CH_AUTO);
-    ESP_ERROR_CHECK(err);
+    esp_err_t err = spi_bus_initialize(dev->spi_host, &spi_bus_config, SPI_DMA_CH_AUTO);
+    if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) {
+        ESP_LOGE(TAG, "spi bus couldn't be initialized (%s)", esp_err_to_name(err));
+        return err;
+    }
 
     spi_device_interface_config_t spi_config = {
         .mode = 0,
@@ -120,28 +128,85 @@ static void sx127x_init_spi(void)
         .command_bits = 0,
         .address_bits = 8,
         .spics_io_num = SX127X_UNSED_PIN_NUM,
-        .queue_size = 1,
+        .queue_size = SX127X_SCRIPT_MAX_OPS,
         .pre_cb = assert_nss,
         .post_cb = deassert_nss,
     };
-    esp_err_t ret = spi_bus_add_device(sx127x_conf.spi_host, &spi_config, &spi_handle);
-    ESP_ERROR_CHECK(ret);
+    err = spi_bus_add_device(dev->spi_host, &spi_config, &dev->spi_handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "spi device couldn't be added (%s)", esp_err_to_name(err));
+        return err;
+    }
+    dev->spi_lock = xSemaphoreCreateMutex();
+    if (!dev->spi_lock) {
+        ESP_LOGE(TAG, "couldn't create the spi lock!");
+        return ESP_ERR_NO_MEM;
+    }
     ESP_LOGI(TAG, "SPI initialized");
+    return ESP_OK;
 }
 
-void sx127x_spi_write(uint8_t cmd, const uint8_t *buf, size_t len)
+static void sx127x_spi_stats_add(sx127x_handle_t dev, sx127x_spi_op_t op, uint32_t transactions, int64_t start_us)
 {
+    int64_t elapsed_us = esp_timer_get_time() - start_us;
+    portENTER_CRITICAL(&dev->spi_stats_lock);
+    dev->spi_stats.op[op].calls++;
+    dev->spi_stats.op[op].transactions += transactions;
+    dev->spi_stats.op[op].time_us += elapsed_us;
+    portEXIT_CRITICAL(&dev->spi_stats_lock);
+}
+
+void sx127x_get_spi_stats(sx127x_handle_t dev, sx127x_spi_stats_t *stats)
+{
+    portENTER_CRITICAL(&dev->spi_stats_lock);
+    *stats = dev->spi_stats;
+    portEXIT_CRITICAL(&dev->spi_stats_lock);
+}
+
+void sx127x_reset_spi_stats(sx127x_handle_t dev)
+{
+    portENTER_CRITICAL(&dev->spi_stats_lock);
+    memset(&dev->spi_stats, 0, sizeof(dev->spi_stats));
+    portEXIT_CRITICAL(&dev->spi_stats_lock);
+}
+
+void *sx127x_get_user_ctx(sx127x_handle_t dev)
+{
+    return dev->user_ctx;
+}
+
+/* register sized transfers are polled, it is cheaper than an interrupt round trip */
+static esp_err_t sx127x_spi_transmit(sx127x_handle_t dev, spi_transaction_t *spi_transaction, size_t len)
+{
+    spi_transaction->user = dev;
+    xSemaphoreTake(dev->spi_lock, portMAX_DELAY);
+    esp_err_t err = len <= SX127X_SPI_SMALL_TRANS_LEN ?
+                    spi_device_polling_transmit(dev->spi_handle, spi_transaction) :
+                    spi_device_transmit(dev->spi_handle, spi_transaction);
+    xSemaphoreGive(dev->spi_lock);
+    return err;
+}
+
+void sx127x_spi_write(sx127x_handle_t dev, uint8_t cmd, const uint8_t *buf, size_t len)
+{
+    int64_t start_us = esp_timer_get_time();
     spi_transaction_t spi_transaction = {
         .addr = cmd,
         .length = 8 * len,
         .tx_buffer = buf,
     };
-    esp_err_t err = spi_device_transmit(spi_handle, &spi_transaction);
+    if (len <= SX127X_SPI_SMALL_TRANS_LEN) {
+        spi_transaction.flags = SPI_TRANS_USE_TXDATA;
+        memcpy(spi_transaction.tx_data, buf, len);
+    }
+    esp_err_t err = sx127x_spi_transmit(dev, &spi_transaction, len);
     ESP_ERROR_CHECK(err);
+    sx127x_spi_stats_add(dev, len == 1 ? SX127X_SPI_OP_WRITE_REG : SX127X_SPI_OP_WRITE_BUF, 1, start_us);
 }
 
-void sx127x_spi_read(uint8_t cmd, uint8_t *buf, size_t len)
+void sx127x_spi_read(sx127x_handle_t dev, uint8_t cmd, uint8_t *buf, size_t len)
 {
+    int64_t start_us = esp_timer_get_time();
     spi_transaction_t spi_transaction = {
         .addr = cmd,
         .length = 8 * len,
@@ -149,150 +214,653 @@ void sx127x_spi_read(uint8_t cmd, uint8_t *buf, size_t len)
         .tx_buffer = buf,
         .rx_buffer = buf,
     };
-    esp_err_t err = spi_device_transmit(spi_handle, &spi_transaction);
+    if (len <= SX127X_SPI_SMALL_TRANS_LEN) {
+        spi_transaction.flags = SPI_TRANS_USE_TXDATA | SPI_TRANS_USE_RXDATA;
+    }
+    esp_err_t err = sx127x_spi_transmit(dev, &spi_transaction, len);
     ESP_ERROR_CHECK(err);
+    if (spi_transaction.flags & SPI_TRANS_USE_RXDATA) {
+        memcpy(buf, spi_transaction.rx_data, len);
+    }
+    sx127x_spi_stats_add(dev, len == 1 ? SX127X_SPI_OP_READ_REG : SX127X_SPI_OP_READ_BUF, 1, start_us);
+}
+
+void sx127x_script_init(sx127x_script_t *script)
+{
+    memset(script, 0, sizeof(sx127x_script_t));
+}
+
+static spi_transaction_t *sx127x_script_next(sx127x_script_t *script)
+{
+    if (script->count >= SX127X_SCRIPT_MAX_OPS) {
+        ESP_LOGE(TAG, "script is full(%d ops)!", SX127X_SCRIPT_MAX_OPS);
+        return NULL;
+    }
+    return &script->trans[script->count++];
+}
+
+esp_err_t sx127x_script_write_reg(sx127x_script_t *script, uint8_t addr, uint8_t data)
+{
+    spi_transaction_t *trans = sx127x_script_next(script);
+    if (!trans) {
+        return ESP_ERR_NO_MEM;
+    }
+    trans->flags = SPI_TRANS_USE_TXDATA;
+    trans->addr = addr | SX127X_BUS_WRITE_MASK;
+    trans->length = 8;
+    trans->tx_data[0] = data;
+    return ESP_OK;
+}
+
+esp_err_t sx127x_script_read_reg(sx127x_script_t *script, uint8_t addr, uint8_t *data)
+{
+    spi_transaction_t *trans = sx127x_script_next(script);
+    if (!trans) {
+        return ESP_ERR_NO_MEM;
+    }
+    trans->flags = SPI_TRANS_USE_TXDATA | SPI_TRANS_USE_RXDATA;
+    trans->addr = addr & SX127X_BUS_READ_MASK;
+    trans->length = 8;
+    trans->rxlength = 8;
+    script->dest[script->count - 1] = data;
+    return ESP_OK;
+}
+
+esp_err_t sx127x_script_write_buf(sx127x_script_t *script, uint8_t addr, const uint8_t *buf, size_t len)
+{
+    spi_transaction_t *trans = sx127x_script_next(script);
+    if (!trans) {
+        return ESP_ERR_NO_MEM;
+    }
+    trans->addr = addr | SX127X_BUS_WRITE_MASK;
+    trans->length = 8 * len;
+    trans->tx_buffer = buf;
+    return ESP_OK;
 }
 
+esp_err_t sx127x_script_read_buf(sx127x_script_t *script, uint8_t addr, uint8_t *buf, size_t len)
+{
+    spi_transaction_t *trans = sx127x_script_next(script);
+    if (!trans) {
+        return ESP_ERR_NO_MEM;
+    }
+    trans->addr = addr & SX127X_BUS_READ_MASK;
+    trans->length = 8 * len;
+    trans->rxlength = 8 * len;
+    trans->tx_buffer = buf;
+    trans->rx_buffer = buf;
+    return ESP_OK;
+}
+
+esp_err_t sx127x_script_run(sx127x_handle_t dev, sx127x_script_t *script)
+{
+    esp_err_t err = ESP_OK;
+    uint8_t queued = 0;
+    if (!script->count) {
+        return ESP_OK;
+    }
+
+    int64_t start_us = esp_timer_get_time();
+    for (uint8_t i = 0; i < script->count; i++) {
+        script->trans[i].user = dev;
+    }
+    xSemaphoreTake(dev->spi_lock, portMAX_DELAY);
+    if (script->count == 1) {
+        err = spi_device_polling_transmit(dev->spi_handle, &script->trans[0]);
+    } else {
+        /* queue the whole script and keep the bus, the task wakes up once at the end. */
+        spi_device_acquire_bus(dev->spi_handle, portMAX_DELAY);
+        while (queued < script->count) {
+            err = spi_device_queue_trans(dev->spi_handle, &script->trans[queued], portMAX_DELAY);
+            if (err != ESP_OK) {
+                break;
+            }
+            queued++;
+        }
+        for (uint8_t i = 0; i < queued; i++) {
+            spi_transaction_t *done = NULL;
+            esp_err_t ret = spi_device_get_trans_result(dev->spi_handle, &done, portMAX_DELAY);
+            if (ret != ESP_OK) {
+                err = ret;
+            }
+        }
+        spi_device_release_bus(dev->spi_handle);
+    }
+    xSemaphoreGive(dev->spi_lock);
+    sx127x_spi_stats_add(dev, SX127X_SPI_OP_SCRIPT, script->count, start_us);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "script failed (%s)", esp_err_to_name(err));
+        return err;
+    }
+
+    for (uint8_t i = 0; i < script->count; i++) {
+        if (script->dest[i]) {
+            *script->dest[i] = script->trans[i].rx_data[0];
+        }
+    }
+    return ESP_OK;
+}
+
+/* radios share the bus, every transaction carries its radio for the chip select */
 static void IRAM_ATTR assert_nss(spi_transaction_t *trans)
 {
-    gpio_set_level(sx127x_conf.pin_nss, 0);
+    gpio_set_level(((sx127x_handle_t)trans->user)->pin_nss, 0);
 }
 
 static void IRAM_ATTR deassert_nss(spi_transaction_t *trans)
 {
-    gpio_set_level(sx127x_conf.pin_nss, 1);
+    gpio_set_level(((sx127x_handle_t)trans->user)->pin_nss, 1);
 }
 
-void sx127x_write_reg(uint8_t addr, uint8_t data)
+void sx127x_write_reg(sx127x_handle_t dev, uint8_t addr, uint8_t data)
 {
-    sx127x_spi_write(addr | SX127X_BUS_WRITE_MASK, &data, 1);
+    sx127x_spi_write(dev, addr | SX127X_BUS_WRITE_MASK, &data, 1);
 }
 
-void sx127x_write_buf(uint8_t addr, uint8_t *buf, size_t len)
+void sx127x_write_buf(sx127x_handle_t dev, uint8_t addr, uint8_t *buf, size_t len)
 {
-    sx127x_spi_write(addr | SX127X_BUS_WRITE_MASK, buf, len);
+    sx127x_spi_write(dev, addr | SX127X_BUS_WRITE_MASK, buf, len);
 }
 
-uint8_t sx127x_read_reg(uint8_t addr)
+uint8_t sx127x_read_reg(sx127x_handle_t dev, uint8_t addr)
 {
     uint8_t reg_value_buf = 0;
-    sx127x_spi_read(addr & SX127X_BUS_READ_MASK, &reg_value_buf, 1);
+    sx127x_spi_read(dev, addr & SX127X_BUS_READ_MASK, &reg_value_buf, 1);
     return reg_value_buf;
 }
 
-void sx127x_read_buf(uint8_t addr, uint8_t *buf, size_t len)
+void sx127x_read_buf(sx127x_handle_t dev, uint8_t addr, uint8_t *buf, size_t len)
 {
-    sx127x_spi_read(addr & SX127X_BUS_READ_MASK, buf, len);
+    sx127x_spi_read(dev, addr & SX127X_BUS_READ_MASK, buf, len);
 }
 
-void sx127x_set_frequency(long frequency)
+void sx127x_set_frequency(sx127x_handle_t dev, long frequency)
 {
-    __frequency = frequency;
+    dev->modem_config.frequency = frequency;
 
     uint64_t frf = ((uint64_t)frequency << 19) / 32000000;
 
-    sx127x_write_reg(REG_FRF_MSB, (uint8_t)(frf >> 16));
-    sx127x_write_reg(REG_FRF_MID, (uint8_t)(frf >> 8));
-    sx127x_write_reg(REG_FRF_LSB, (uint8_t)(frf >> 0));
+    sx127x_write_reg(dev, REG_FRF_MSB, (uint8_t)(frf >> 16));
+    sx127x_write_reg(dev, REG_FRF_MID, (uint8_t)(frf >> 8));
+    sx127x_write_reg(dev, REG_FRF_LSB, (uint8_t)(frf >> 0));
+}
+
+static uint8_t sx127x_modem_config_1(const sx127x_modem_config_t *config)
+{
+    return (config->bandwidth << 4) | (config->coding_rate << 1) |
+           (config->implicit_header ? MODEM_CONFIG_1_IMPLICIT_HEADER : 0);
+}
+
+static uint8_t sx127x_modem_config_2(const sx127x_modem_config_t *config)
+{
+    return (config->spreading_factor << 4) | (config->crc_on ? MODEM_CONFIG_2_CRC_ON : 0) |
+           ((config->symbol_timeout >> 8) & 0x03);
+}
+
+static uint8_t sx127x_modem_config_3(const sx127x_modem_config_t *config)
+{
+    return (sx127x_modem_low_data_rate_optimize(config) ? MODEM_CONFIG_3_LDRO : 0) | MODEM_CONFIG_3_AGC_AUTO;
+}
+
+static void sx127x_script_detection(sx127x_script_t *script, const sx127x_modem_config_t *config)
+{
+    bool sf6 = config->spreading_factor == SX127X_SF_MIN;
+    sx127x_script_write_reg(script, REG_DETECTION_OPTIMIZE, sf6 ? DETECTION_OPTIMIZE_SF6 : DETECTION_OPTIMIZE_SF7_12);
+    sx127x_script_write_reg(script, REG_DETECTION_THRESHOLD, sf6 ? DETECTION_THRESHOLD_SF6 : DETECTION_THRESHOLD_SF7_12);
+}
+
+esp_err_t sx127x_apply_modem_config(sx127x_handle_t dev, const sx127x_modem_config_t *config)
+{
+    if (!sx127x_modem_config_is_valid(config)) {
+        ESP_LOGE(TAG, "invalid modem config!");
+        return ESP_ERR_INVALID_ARG;
+    }
+    sx127x_set_frequency(dev, config->frequency);
+    dev->modem_config = *config;
+
+    sx127x_script_t script;
+    sx127x_script_init(&script);
+    sx127x_script_write_reg(&script, REG_MODEM_CONFIG_1, sx127x_modem_config_1(config));
+    sx127x_script_write_reg(&script, REG_MODEM_CONFIG_2, sx127x_modem_config_2(config));
+    sx127x_script_write_reg(&script, REG_MODEM_CONFIG_3, sx127x_modem_config_3(config));
+    sx127x_script_write_reg(&script, REG_PREAMBLE_MSB, (uint8_t)(config->preamble_len >> 8));
+    sx127x_script_write_reg(&script, REG_PREAMBLE_LSB, (uint8_t)(config->preamble_len >> 0));
+    sx127x_script_write_reg(&script, REG_SYNC_WORD, config->sync_word);
+    sx127x_script_detection(&script, config);
+    esp_err_t err = sx127x_script_run(dev, &script);
+    sx127x_write_reg(dev, REG_SYMB_TIMEOUT_LSB, (uint8_t)config->symbol_timeout);
+    if (config->implicit_header) {
+        sx127x_write_reg(dev, REG_PAYLOAD_LENGTH, config->payload_len);
+    }
+    ESP_LOGI(TAG, "modem config SF%d BW%" PRIu32 " CR4/%d preamble:%d sync:0x%02x %s header",
+             config->spreading_factor, sx127x_modem_bandwidth_hz(config->bandwidth),
+             config->coding_rate + 4, config->preamble_len, config->sync_word,
+             config->implicit_header ? "implicit" : "explicit");
+    return err;
+}
+
+void sx127x_get_modem_config(sx127x_handle_t dev, sx127x_modem_config_t *config)
+{
+    *config = dev->modem_config;
+}
+
+esp_err_t sx127x_set_spreading_factor(sx127x_handle_t dev, uint8_t sf)
+{
+    sx127x_modem_config_t config = dev->modem_config;
+    config.spreading_factor = sf;
+    if (!sx127x_modem_config_is_valid(&config)) {
+        ESP_LOGE(TAG, "invalid spreading factor %d", sf);
+        return ESP_ERR_INVALID_ARG;
+    }
+    dev->modem_config = config;
+
+    sx127x_script_t script;
+    sx127x_script_init(&script);
+    sx127x_script_write_reg(&script, REG_MODEM_CONFIG_2, sx127x_modem_config_2(&config));
+    sx127x_script_write_reg(&script, REG_MODEM_CONFIG_3, sx127x_modem_config_3(&config));
+    sx127x_script_detection(&script, &config);
+    return sx127x_script_run(dev, &script);
+}
+
+esp_err_t sx127x_set_bandwidth(sx127x_handle_t dev, sx127x_bw_t bandwidth)
+{
+    sx127x_modem_config_t config = dev->modem_config;
+    config.bandwidth = bandwidth;
+    if (!sx127x_modem_config_is_valid(&config)) {
+        ESP_LOGE(TAG, "invalid bandwidth %d", bandwidth);
+        return ESP_ERR_INVALID_ARG;
+    }
+    dev->modem_config = config;
+
+    sx127x_script_t script;
+    sx127x_script_init(&script);
+    sx127x_script_write_reg(&script, REG_MODEM_CONFIG_1, sx127x_modem_config_1(&config));
+    sx127x_script_write_reg(&script, REG_MODEM_CONFIG_3, sx127x_modem_config_3(&config));
+    return sx127x_script_run(dev, &script);
+}
+
+esp_err_t sx127x_set_coding_rate(sx127x_handle_t dev, sx127x_cr_t coding_rate)
+{
+    sx127x_modem_config_t config = dev->modem_config;
+    config.coding_rate = coding_rate;
+    if (!sx127x_modem_config_is_valid(&config)) {
+        ESP_LOGE(TAG, "invalid coding rate %d", coding_rate);
+        return ESP_ERR_INVALID_ARG;
+    }
+    dev->modem_config = config;
+    sx127x_write_reg(dev, REG_MODEM_CONFIG_1, sx127x_modem_config_1(&config));
+    return ESP_OK;
 }
 
-void sx127x_enable_crc(void)
+esp_err_t sx127x_set_preamble_length(sx127x_handle_t dev, uint16_t preamble_len)
 {
-    sx127x_write_reg(REG_MODEM_CONFIG_2, sx127x_read_reg(REG_MODEM_CONFIG_2) | 0x04);
+    if (preamble_len < SX127X_PREAMBLE_MIN) {
+        ESP_LOGE(TAG, "invalid preamble length %d", preamble_len);
+        return ESP_ERR_INVALID_ARG;
+    }
+    dev->modem_config.preamble_len = preamble_len;
+
+    sx127x_script_t script;
+    sx127x_script_init(&script);
+    sx127x_script_write_reg(&script, REG_PREAMBLE_MSB, (uint8_t)(preamble_len >> 8));
+    sx127x_script_write_reg(&script, REG_PREAMBLE_LSB, (uint8_t)(preamble_len >> 0));
+    return sx127x_script_run(dev, &script);
 }
 
-void sx127x_idle(void)
+void sx127x_set_sync_word(sx127x_handle_t dev, uint8_t sync_word)
 {
-    sx127x_write_reg(REG_OP_MODE, MODE_LONG_RANGE_MODE | MODE_STDBY);
+    dev->modem_config.sync_word = sync_word;
+    sx127x_write_reg(dev, REG_SYNC_WORD, sync_word);
 }
 
-void sx127x_sleep(void)
+esp_err_t sx127x_set_symbol_timeout(sx127x_handle_t dev, uint16_t symbols)
 {
-    sx127x_write_reg(REG_OP_MODE, MODE_LONG_RANGE_MODE | MODE_SLEEP);
+    if (!symbols || symbols > SX127X_SYMBOL_TIMEOUT_MAX) {
+        ESP_LOGE(TAG, "invalid symbol timeout %d", symbols);
+        return ESP_ERR_INVALID_ARG;
+    }
+    dev->modem_config.symbol_timeout = symbols;
+
+    sx127x_script_t script;
+    sx127x_script_init(&script);
+    sx127x_script_write_reg(&script, REG_MODEM_CONFIG_2, sx127x_modem_config_2(&dev->modem_config));
+    sx127x_script_write_reg(&script, REG_SYMB_TIMEOUT_LSB, (uint8_t)symbols);
+    return sx127x_script_run(dev, &script);
 }
 
-void sx127x_send_packet(uint8_t *buf, size_t size)
+uint32_t sx127x_time_on_air_us(sx127x_handle_t dev, size_t payload_len)
 {
-    sx127x_idle();
-    sx127x_write_reg(REG_FIFO_ADDR_PTR, 0);
+    return sx127x_modem_time_on_air_us(&dev->modem_config, payload_len);
+}
+
+void sx127x_enable_crc(sx127x_handle_t dev)
+{
+    dev->modem_config.crc_on = true;
+    sx127x_write_reg(dev, REG_MODEM_CONFIG_2, sx127x_modem_config_2(&dev->modem_config));
+}
+
+void sx127x_idle(sx127x_handle_t dev)
+{
+    sx127x_write_reg(dev, REG_OP_MODE, MODE_LONG_RANGE_MODE | MODE_STDBY);
+}
+
+void sx127x_sleep(sx127x_handle_t dev)
+{
+    sx127x_write_reg(dev, REG_OP_MODE, MODE_LONG_RANGE_MODE | MODE_SLEEP);
+}
+
+/* esp_timer time of the last DIO0 event, TxDone after a send */
+int64_t sx127x_dio0_timestamp_us(sx127x_handle_t dev)
+{
+    return dev->dio0_timestamp_us;
+}
+
+static void sx127x_set_dio0_mapping(sx127x_handle_t dev, uint8_t mapping)
+{
+    if (dev->dio0_mapping == mapping) {
+        return;
+    }
+    dev->dio0_mapping = mapping;
+    /* DIO1-3 are not used, they are kept at their reset mapping. */
+    sx127x_write_reg(dev, REG_DIO_MAPPING_1, mapping);
+}
+
+esp_err_t sx127x_send_async(sx127x_handle_t dev, uint8_t *buf, size_t size, sx127x_tx_done_cb_t cb, void *arg)
+{
+    if (dev->tx_busy) {
+        ESP_LOGE(TAG, "tx is already in progress!");
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (dev->modem_config.implicit_header && size != dev->modem_config.payload_len) {
+        ESP_LOGE(TAG, "implicit header frame has to be %d bytes, not %d!", dev->modem_config.payload_len, size);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    dev->tx_busy = true;
+    dev->tx_done_cb = cb;
+    dev->tx_done_cb_arg = arg;
+
+    int64_t start_us = esp_timer_get_time();
+    sx127x_script_t script;
+    sx127x_script_init(&script);
+    sx127x_script_write_reg(&script, REG_OP_MODE, MODE_LONG_RANGE_MODE | MODE_STDBY);
+    sx127x_script_write_reg(&script, REG_FIFO_ADDR_PTR, 0);
 
     /*  write tx data from buffer to module tx fifo */
-    sx127x_write_buf(REG_FIFO, buf, size);
+    sx127x_script_write_buf(&script, REG_FIFO, buf, size);
 
     /*  write tx buffer len */
-    sx127x_write_reg(REG_PAYLOAD_LENGTH, size);
+    sx127x_script_write_reg(&script, REG_PAYLOAD_LENGTH, size);
+
+    /*  route TxDone to DIO0 and start transmission, conclusion is reported by the isr. */
+    sx127x_script_write_reg(&script, REG_DIO_MAPPING_1, DIO0_MAPPING_TX_DONE);
+    sx127x_script_write_reg(&script, REG_OP_MODE, MODE_LONG_RANGE_MODE | MODE_TX);
+    esp_err_t err = sx127x_script_run(dev, &script);
+    sx127x_spi_stats_add(dev, SX127X_SPI_OP_TX_PACKET, script.count, start_us);
+    if (err != ESP_OK) {
+        dev->tx_busy = false;
+        return err;
+    }
+    /* TxDone can not fire before the end of time on air, switch the isr routing after the batch. */
+    dev->dio0_mapping = DIO0_MAPPING_TX_DONE;
+    return ESP_OK;
+}
+
+void sx127x_tx_done(sx127x_handle_t dev)
+{
+    sx127x_write_reg(dev, REG_IRQ_FLAGS, IRQ_TX_DONE_MASK);
+    dev->tx_done_cb = NULL;
+    dev->tx_done_cb_arg = NULL;
+    dev->tx_busy = false;
+    /* back to continuous rx, the radio listens between the sends */
+    sx127x_receive(dev);
+}
+
+static bool IRAM_ATTR sx127x_tx_done_notify(void *arg)
+{
+    BaseType_t higher_prio_task_woken = pdFALSE;
+    xTaskNotifyFromISR((TaskHandle_t)arg, NOTIFY_BIT_TX_DONE, eSetBits, &higher_prio_task_woken);
+    return higher_prio_task_woken == pdTRUE;
+}
+
+esp_err_t sx127x_send_packet(sx127x_handle_t dev, uint8_t *buf, size_t size)
+{
+    uint32_t notified = 0;
+    uint32_t timeout_ms = sx127x_time_on_air_us(dev, size) / 1000 + SX127X_TX_TIMEOUT_MARGIN_MS;
+    ulTaskNotifyValueClear(NULL, NOTIFY_BIT_TX_DONE);
+    esp_err_t err = sx127x_send_async(dev, buf, size, sx127x_tx_done_notify, xTaskGetCurrentTaskHandle());
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    /* the calling task sleeps for the whole time on air, no polling over spi. */
+    if (xTaskNotifyWait(0, NOTIFY_BIT_TX_DONE, &notified, pdMS_TO_TICKS(timeout_ms)) != pdTRUE ||
+            !(notified & NOTIFY_BIT_TX_DONE)) {
+        ESP_LOGE(TAG, "tx done timeout!");
+        err = ESP_ERR_TIMEOUT;
+    }
+    sx127x_tx_done(dev);
+    return err;
+}
+
+void sx127x_receive(sx127x_handle_t dev)
+{
+    sx127x_set_dio0_mapping(dev, DIO0_MAPPING_RX_DONE);
+    sx127x_write_reg(dev, REG_OP_MODE, MODE_LONG_RANGE_MODE | MODE_RX_CONTINUOUS);
+}
+
+void sx127x_receive_single(sx127x_handle_t dev)
+{
+    sx127x_set_dio0_mapping(dev, DIO0_MAPPING_RX_DONE);
+    sx127x_write_reg(dev, REG_OP_MODE, MODE_LONG_RANGE_MODE | MODE_RX_SINGLE);
+}
 
-    /*  Start transmission and wait for conclusion. */
-    sx127x_write_reg(REG_OP_MODE, MODE_LONG_RANGE_MODE | MODE_TX);
-    while ((sx127x_read_reg(REG_IRQ_FLAGS) & IRQ_TX_DONE_MASK) == 0) {
-        vTaskDelay(2);
+bool sx127x_rx_timed_out(sx127x_handle_t dev)
+{
+    uint8_t irq = sx127x_read_reg(dev, REG_IRQ_FLAGS);
+    if (irq & IRQ_RX_TIMEOUT_MASK) {
+        sx127x_write_reg(dev, REG_IRQ_FLAGS, IRQ_RX_TIMEOUT_MASK);
+        return true;
     }
+    return false;
+}
 
-    sx127x_write_reg(REG_IRQ_FLAGS, IRQ_TX_DONE_MASK);
-    sx127x_receive(); // TODO: Write radio.c to managing lora radio (op mode, rx events ex.)
+esp_err_t sx127x_start_cad(sx127x_handle_t dev)
+{
+    sx127x_script_t script;
+    sx127x_script_init(&script);
+    sx127x_script_write_reg(&script, REG_OP_MODE, MODE_LONG_RANGE_MODE | MODE_STDBY);
+    sx127x_script_write_reg(&script, REG_IRQ_FLAGS, IRQ_CAD_ALL_MASK);
+    if (dev->dio0_mapping != DIO0_MAPPING_CAD_DONE) {
+        sx127x_script_write_reg(&script, REG_DIO_MAPPING_1, DIO0_MAPPING_CAD_DONE);
+    }
+    sx127x_script_write_reg(&script, REG_OP_MODE, MODE_LONG_RANGE_MODE | MODE_CAD);
+    /* CadDone goes to the rx task like RxDone */
+    dev->dio0_mapping = DIO0_MAPPING_CAD_DONE;
+    return sx127x_script_run(dev, &script);
 }
 
-void sx127x_receive(void)
+esp_err_t sx127x_cad_result(sx127x_handle_t dev, bool *detected)
 {
-    sx127x_write_reg(REG_OP_MODE, MODE_LONG_RANGE_MODE | MODE_RX_CONTINUOUS);
+    uint8_t irq = 0;
+    sx127x_script_t script;
+    sx127x_script_init(&script);
+    sx127x_script_read_reg(&script, REG_IRQ_FLAGS, &irq);
+    sx127x_script_write_reg(&script, REG_IRQ_FLAGS, IRQ_CAD_ALL_MASK);
+    esp_err_t err = sx127x_script_run(dev, &script);
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (!(irq & IRQ_CAD_DONE_MASK)) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    *detected = irq & IRQ_CAD_DETECTED_MASK;
+    return ESP_OK;
 }
 
-uint8_t sx127x_received(void)
+/* blocking cad on the current SF, the calling task sleeps until CadDone */
+esp_err_t sx127x_channel_activity(sx127x_handle_t dev, bool *detected)
 {
-    return sx127x_read_reg(REG_IRQ_FLAGS) & IRQ_RX_DONE_MASK;
+    uint32_t notified = 0;
+    /* cad lasts about two symbols */
+    uint32_t timeout_ms = 2 * sx127x_modem_symbol_time_us(&dev->modem_config) / 1000 + SX127X_CAD_TIMEOUT_MARGIN_MS;
+    ulTaskNotifyValueClear(NULL, NOTIFY_BIT_CAD_DONE);
+    dev->cad_waiter = xTaskGetCurrentTaskHandle();
+    esp_err_t err = sx127x_start_cad(dev);
+    if (err == ESP_OK) {
+        if (xTaskNotifyWait(0, NOTIFY_BIT_CAD_DONE, &notified, pdMS_TO_TICKS(timeout_ms)) != pdTRUE ||
+                !(notified & NOTIFY_BIT_CAD_DONE)) {
+            ESP_LOGE(TAG, "cad done timeout!");
+            err = ESP_ERR_TIMEOUT;
+        } else {
+            err = sx127x_cad_result(dev, detected);
+        }
+    }
+    dev->cad_waiter = NULL;
+    return err;
 }
 
-void sx127x_set_tx_power(uint8_t level)
+/* current channel rssi, the radio has to be in rx for it */
+esp_err_t sx127x_channel_rssi(sx127x_handle_t dev, int16_t *rssi)
+{
+    uint8_t op_mode = sx127x_read_reg(dev, REG_OP_MODE) & ~MODE_LONG_RANGE_MODE;
+    if (op_mode != MODE_RX_CONTINUOUS && op_mode != MODE_RX_SINGLE) {
+        sx127x_receive(dev);
+        vTaskDelay(pdMS_TO_TICKS(SX127X_RSSI_SETTLE_MS));
+    }
+    *rssi = sx127x_read_reg(dev, REG_RSSI_VALUE) - sx127x_rssi_offset(dev);
+    return ESP_OK;
+}
+
+/* a preamble or header is being received, tx would cut it */
+bool sx127x_rx_ongoing(sx127x_handle_t dev)
+{
+    return sx127x_read_reg(dev, REG_MODEM_STAT) & MODEM_STAT_RX_ONGOING_MASK;
+}
+
+uint8_t sx127x_received(sx127x_handle_t dev)
+{
+    return sx127x_read_reg(dev, REG_IRQ_FLAGS) & IRQ_RX_DONE_MASK;
+}
+
+void sx127x_set_tx_power(sx127x_handle_t dev, uint8_t level)
 {
     uint8_t opt_level = level < 2 ? 2 : level > 17 ? 17 : level;
-    sx127x_write_reg(REG_PA_CONFIG, PA_BOOST | (opt_level - 2));
+    sx127x_write_reg(dev, REG_PA_CONFIG, PA_BOOST | (opt_level - 2));
 }
 
-void sx127x_explicit_header_mode(void)
+void sx127x_explicit_header_mode(sx127x_handle_t dev)
 {
-    __implicit = 0;
-    sx127x_write_reg(REG_MODEM_CONFIG_1, sx127x_read_reg(REG_MODEM_CONFIG_1) & 0xfe);
+    sx127x_modem_config_t config = dev->modem_config;
+    config.implicit_header = false;
+    if (!sx127x_modem_config_is_valid(&config)) {
+        ESP_LOGE(TAG, "SF%d needs implicit header!", config.spreading_factor);
+        return;
+    }
+    dev->modem_config = config;
+    sx127x_write_reg(dev, REG_MODEM_CONFIG_1, sx127x_modem_config_1(&dev->modem_config));
 }
 
-int sx127x_receive_packet(uint8_t *buf, size_t size)
+esp_err_t sx127x_implicit_header_mode(sx127x_handle_t dev, uint8_t payload_len)
 {
-    /* check interrupts. */
-    uint8_t irq = sx127x_read_reg(REG_IRQ_FLAGS);
-    sx127x_write_reg(REG_IRQ_FLAGS, irq);
-    if (!(irq & IRQ_RX_DONE_MASK) || (irq & IRQ_PAYLOAD_CRC_ERROR_MASK)) {
-        return 0;
+    if (!payload_len) {
+        ESP_LOGE(TAG, "implicit header needs a fixed payload length!");
+        return ESP_ERR_INVALID_ARG;
     }
+    dev->modem_config.implicit_header = true;
+    dev->modem_config.payload_len = payload_len;
+
+    sx127x_script_t script;
+    sx127x_script_init(&script);
+    sx127x_script_write_reg(&script, REG_MODEM_CONFIG_1, sx127x_modem_config_1(&dev->modem_config));
+    sx127x_script_write_reg(&script, REG_PAYLOAD_LENGTH, payload_len);
+    return sx127x_script_run(dev, &script);
+}
 
-    /* find packet size. */
-    int len = __implicit ? sx127x_read_reg(REG_PAYLOAD_LENGTH) : sx127x_read_reg(REG_RX_NB_BYTES);
+static int sx127x_rssi_offset(sx127x_handle_t dev)
+{
+    return dev->modem_config.frequency < 868E6 ? 164 : 157;
+}
 
-    /* transfer data from radio. */
-    sx127x_idle();
-    sx127x_write_reg(REG_FIFO_ADDR_PTR, sx127x_read_reg(REG_FIFO_RX_CURRENT_ADDR));
-    len = len > size ? size : len;
+static void sx127x_fill_rx_metadata(sx127x_handle_t dev, sx127x_rx_metadata_t *meta, uint8_t pkt_rssi, uint8_t pkt_snr, const uint8_t fei[3])
+{
+    meta->timestamp_us = dev->dio0_timestamp_us;
+    meta->spreading_factor = dev->modem_config.spreading_factor;
+    meta->snr = (int8_t)pkt_snr / 4.0f;
+    meta->rssi = pkt_rssi - sx127x_rssi_offset(dev);
+    /* datasheet 5.5.5, rssi is corrected with snr below the noise floor, scaled above it */
+    meta->rssi_corrected = meta->snr < 0 ? meta->rssi + meta->snr : (16 * pkt_rssi) / 15 - sx127x_rssi_offset(dev);
+
+    /* 20 bit signed, Ferr = FEI * 2^24 / Fxosc * BW / 500kHz */
+    int32_t fei_raw = ((int32_t)(fei[0] & 0x0f) << 16) | ((int32_t)fei[1] << 8) | fei[2];
+    if (fei_raw & 0x80000) {
+        fei_raw -= 0x100000;
+    }
+    int64_t bw_hz = sx127x_modem_bandwidth_hz(dev->modem_config.bandwidth);
+    meta->freq_error_hz = (int32_t)(((int64_t)fei_raw << 24) * bw_hz / ((int64_t)SX127X_FXOSC * 500000));
+}
 
-    /* read rx fifo to buffer */
-    sx127x_read_buf(REG_FIFO, buf, len);
-    return len;
+int sx127x_receive_packet(sx127x_handle_t dev, uint8_t *buf, size_t size, sx127x_rx_metadata_t *meta)
+{
+    uint8_t irq = 0, len = 0, fifo_addr = 0, pkt_rssi = 0, pkt_snr = 0, fei[3] = {0};
+    int64_t start_us = esp_timer_get_time();
+    sx127x_script_t script;
+
+    /* check interrupts, find packet size, fifo address and link metadata in one batch. */
+    sx127x_script_init(&script);
+    sx127x_script_read_reg(&script, REG_IRQ_FLAGS, &irq);
+    sx127x_script_read_reg(&script, dev->modem_config.implicit_header ? REG_PAYLOAD_LENGTH : REG_RX_NB_BYTES, &len);
+    sx127x_script_read_reg(&script, REG_FIFO_RX_CURRENT_ADDR, &fifo_addr);
+    if (meta) {
+        sx127x_script_read_reg(&script, REG_PKT_SNR_VALUE, &pkt_snr);
+        sx127x_script_read_reg(&script, REG_PKT_RSSI_VALUE, &pkt_rssi);
+        sx127x_script_read_reg(&script, REG_FEI_MSB, &fei[0]);
+        sx127x_script_read_reg(&script, REG_FEI_MID, &fei[1]);
+        sx127x_script_read_reg(&script, REG_FEI_LSB, &fei[2]);
+    }
+    if (sx127x_script_run(dev, &script) != ESP_OK) {
+        return 0;
+    }
+    uint32_t transactions = script.count;
+    size_t rx_len = len > size ? size : len;
+    bool rx_ok = (irq & IRQ_RX_DONE_MASK) && !(irq & IRQ_PAYLOAD_CRC_ERROR_MASK);
+
+    /* clear flags and transfer data from radio, read rx fifo to buffer */
+    sx127x_script_init(&script);
+    sx127x_script_write_reg(&script, REG_IRQ_FLAGS, IRQ_RX_ALL_MASK);
+    if (rx_ok) {
+        sx127x_script_write_reg(&script, REG_OP_MODE, MODE_LONG_RANGE_MODE | MODE_STDBY);
+        sx127x_script_write_reg(&script, REG_FIFO_ADDR_PTR, fifo_addr);
+        sx127x_script_read_buf(&script, REG_FIFO, buf, rx_len);
+    }
+    esp_err_t err = sx127x_script_run(dev, &script);
+    transactions += script.count;
+    sx127x_spi_stats_add(dev, SX127X_SPI_OP_RX_PACKET, transactions, start_us);
+    if (!rx_ok || err != ESP_OK) {
+        return 0;
+    }
+    if (meta) {
+        sx127x_fill_rx_metadata(dev, meta, pkt_rssi, pkt_snr, fei);
+    }
+    return rx_len;
 }
 
-int sx127x_packet_rssi(void)
+int sx127x_packet_rssi(sx127x_handle_t dev)
 {
-    return (sx127x_read_reg(REG_PKT_RSSI_VALUE) - (__frequency < 868E6 ? 164 : 157));
+    return (sx127x_read_reg(dev, REG_PKT_RSSI_VALUE) - sx127x_rssi_offset(dev));
 }
 
-void sx127x_reset(void)
+void sx127x_reset(sx127x_handle_t dev)
 {
-    gpio_set_level(sx127x_conf.pin_rst, 0);
+    gpio_set_level(dev->pin_rst, 0);
     vTaskDelay(pdMS_TO_TICKS(100));
-    gpio_set_level(sx127x_conf.pin_rst, 1);
+    gpio_set_level(dev->pin_rst, 1);
     vTaskDelay(pdMS_TO_TICKS(100));
 }
 
-esp_err_t sx127x_version_check(uint16_t timeout_sec)
+esp_err_t sx127x_version_check(sx127x_handle_t dev, uint16_t timeout_sec)
 {
     int16_t period = 500, max_try_count = timeout_sec * 1000 / period;
-    while (sx127x_read_reg(REG_VERSION) != SX127X_VERSION) {
+    while (sx127x_read_reg(dev, REG_VERSION) != SX127X_VERSION) {
         vTaskDelay(pdMS_TO_TICKS(period));
         if (--max_try_count <= 0) {
             return ESP_ERR_TIMEOUT;
@@ -302,21 +870,68 @@ esp_err_t sx127x_version_check(uint16_t timeout_sec)
     return ESP_OK;
 }
 
-void sx127x_init(void)
-{
-    sx127x_init_io();
-    sx127x_init_spi();
-    xTaskCreate(sx127x_conf.frtos_p.task, "ttn_lmic", 1024 * 4, NULL, 10, &task_handle); //TODO: tasks, event or queue will manage on efficiently
-    sx127x_reset();
-    sx127x_set_frequency(LoRa_EUROPE_FREQUENCY);
-    sx127x_enable_crc();
-    sx127x_explicit_header_mode();
-    sx127x_sleep();
-    sx127x_write_reg(REG_FIFO_RX_BASE_ADDR, LORA_WRITE_REG_VALUE_1);
-    sx127x_write_reg(REG_FIFO_TX_BASE_ADDR, LORA_WRITE_REG_VALUE_1);
-    sx127x_write_reg(REG_LNA, sx127x_read_reg(REG_LNA) | LORA_WRITE_REG_VALUE_2);
-    sx127x_write_reg(REG_MODEM_CONFIG_3, LORA_WRITE_REG_VALUE_3);
-    sx127x_set_tx_power(LORA_TX_POWER);
-    sx127x_idle();
-    sx127x_version_check(SX127X_VERSION_TIMEOUT_S);
+static void sx127x_free(sx127x_handle_t dev)
+{
+    if (dev->spi_handle) {
+        spi_bus_remove_device(dev->spi_handle);
+    }
+    if (dev->spi_lock) {
+        vSemaphoreDelete(dev->spi_lock);
+    }
+    free(dev);
+}
+
+esp_err_t sx127x_init(const sx127x_config_t *config, sx127x_handle_t *out_handle)
+{
+    sx127x_modem_config_t default_config = SX127X_MODEM_CONFIG_DEFAULT();
+    if (!config || !config->rx_task || !out_handle) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    sx127x_handle_t dev = (sx127x_handle_t)calloc(1, sizeof(struct sx127x_dev_t));
+    if (!dev) {
+        return ESP_ERR_NO_MEM;
+    }
+    dev->spi_host = config->spi_host;
+    dev->pin_nss = config->pin_nss;
+    dev->pin_rst = config->pin_rst;
+    dev->pin_dio0 = config->pin_dio0;
+    dev->user_ctx = config->user_ctx;
+    portMUX_INITIALIZE(&dev->spi_stats_lock);
+    dev->modem_config = default_config;
+    dev->dio0_mapping = DIO0_MAPPING_RX_DONE;
+
+    esp_err_t err = sx127x_init_io(dev);
+    if (err == ESP_OK) {
+        err = sx127x_init_spi(dev, config);
+    }
+    if (err != ESP_OK) {
+        sx127x_free(dev);
+        return err;
+    }
+    sx127x_reset(dev);
+    sx127x_sleep(dev);
+    sx127x_write_reg(dev, REG_FIFO_RX_BASE_ADDR, LORA_WRITE_REG_VALUE_1);
+    sx127x_write_reg(dev, REG_FIFO_TX_BASE_ADDR, LORA_WRITE_REG_VALUE_1);
+    sx127x_write_reg(dev, REG_LNA, sx127x_read_reg(dev, REG_LNA) | LORA_WRITE_REG_VALUE_2);
+    if (sx127x_apply_modem_config(dev, &config->modem) != ESP_OK) {
+        ESP_LOGW(TAG, "default modem config is used");
+        sx127x_apply_modem_config(dev, &default_config);
+    }
+    sx127x_set_tx_power(dev, LORA_TX_POWER);
+    sx127x_idle(dev);
+    if (sx127x_version_check(dev, SX127X_VERSION_TIMEOUT_S) != ESP_OK) {
+        ESP_LOGE(TAG, "radio on nss:%d doesn't respond!", dev->pin_nss);
+        sx127x_free(dev);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    /* every radio has its own rx task, the handle is its parameter */
+    if (xTaskCreate(config->rx_task, "sx127x_rx", 1024 * 4, dev, 10, &dev->task_handle) != pdPASS) {
+        ESP_LOGE(TAG, "couldn't create the rx task!");
+        sx127x_free(dev);
+        return ESP_ERR_NO_MEM;
+    }
+    gpio_isr_handler_add(dev->pin_dio0, qio_irq_handler, dev);
+    *out_handle = dev;
+    return ESP_OK;
 }
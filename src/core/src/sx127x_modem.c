@@ -0,0 +1,107 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "sx127x_modem.h"
+
+#define SX127X_LDRO_SYMBOL_TIME_US  16000
+#define SX127X_PAYLOAD_FIX_SYMBOLS  8
+
+static const uint32_t s_bandwidth_hz[SX127X_BW_MAX] = {
+    [SX127X_BW_7_8_KHZ] = 7800,
+    [SX127X_BW_10_4_KHZ] = 10400,
+    [SX127X_BW_15_6_KHZ] = 15600,
+    [SX127X_BW_20_8_KHZ] = 20800,
+    [SX127X_BW_31_25_KHZ] = 31250,
+    [SX127X_BW_41_7_KHZ] = 41700,
+    [SX127X_BW_62_5_KHZ] = 62500,
+    [SX127X_BW_125_KHZ] = 125000,
+    [SX127X_BW_250_KHZ] = 250000,
+    [SX127X_BW_500_KHZ] = 500000,
+};
+
+uint32_t sx127x_modem_bandwidth_hz(sx127x_bw_t bandwidth)
+{
+    return bandwidth < SX127X_BW_MAX ? s_bandwidth_hz[bandwidth] : 0;
+}
+
+sx127x_bw_t sx127x_modem_bandwidth_from_hz(uint32_t hz)
+{
+    for (int bw = 0; bw < SX127X_BW_MAX; bw++) {
+        if (s_bandwidth_hz[bw] == hz) {
+            return (sx127x_bw_t)bw;
+        }
+    }
+    return SX127X_BW_MAX;
+}
+
+bool sx127x_modem_config_is_valid(const sx127x_modem_config_t *config)
+{
+    if (!config) {
+        return false;
+    }
+    if (config->spreading_factor < SX127X_SF_MIN || config->spreading_factor > SX127X_SF_MAX) {
+        return false;
+    }
+    if (config->bandwidth >= SX127X_BW_MAX) {
+        return false;
+    }
+    if (config->coding_rate < SX127X_CR_4_5 || config->coding_rate > SX127X_CR_4_8) {
+        return false;
+    }
+    if (config->preamble_len < SX127X_PREAMBLE_MIN) {
+        return false;
+    }
+    if (config->frequency < SX127X_FREQUENCY_MIN || config->frequency > SX127X_FREQUENCY_MAX) {
+        return false;
+    }
+    if (!config->symbol_timeout || config->symbol_timeout > SX127X_SYMBOL_TIMEOUT_MAX) {
+        return false;
+    }
+    /* both ends have to know the frame length when there is no header */
+    if (config->implicit_header && !config->payload_len) {
+        return false;
+    }
+    /* SF6 works only with implicit header */
+    if (config->spreading_factor == SX127X_SF_MIN && !config->implicit_header) {
+        return false;
+    }
+    return true;
+}
+
+uint32_t sx127x_modem_symbol_time_us(const sx127x_modem_config_t *config)
+{
+    uint32_t bw_hz = sx127x_modem_bandwidth_hz(config->bandwidth);
+    if (!bw_hz) {
+        return 0;
+    }
+    return (uint32_t)(((uint64_t)1000000 << config->spreading_factor) / bw_hz);
+}
+
+bool sx127x_modem_low_data_rate_optimize(const sx127x_modem_config_t *config)
+{
+    return sx127x_modem_symbol_time_us(config) > SX127X_LDRO_SYMBOL_TIME_US;
+}
+
+/*
+ * Time on air from the SX1276 datasheet (4.1.1.7):
+ *  Tpreamble = (Npreamble + 4.25) * Tsym
+ *  Npayload = 8 + max(ceil((8PL - 4SF + 28 + 16CRC - 20IH) / (4(SF - 2DE))) * (CR + 4), 0)
+ * Symbols are counted in quarters to keep the 4.25 exact with integer math.
+ */
+uint32_t sx127x_modem_time_on_air_us(const sx127x_modem_config_t *config, size_t payload_len)
+{
+    uint32_t bw_hz = sx127x_modem_bandwidth_hz(config->bandwidth);
+    if (!bw_hz) {
+        return 0;
+    }
+    int32_t sf = config->spreading_factor;
+    int32_t de = sx127x_modem_low_data_rate_optimize(config) ? 1 : 0;
+    int32_t num = 8 * (int32_t)payload_len - 4 * sf + 28 + (config->crc_on ? 16 : 0) - (config->implicit_header ? 20 : 0);
+    int32_t den = 4 * (sf - 2 * de);
+    int32_t payload_symbols = SX127X_PAYLOAD_FIX_SYMBOLS;
+    if (num > 0) {
+        payload_symbols += ((num + den - 1) / den) * (config->coding_rate + 4);
+    }
+    uint64_t symbols_x4 = 4 * (uint64_t)config->preamble_len + 17 + 4 * (uint64_t)payload_symbols;
+    return (uint32_t)((symbols_x4 * 1000000 << sf) / (4 * (uint64_t)bw_hz));
+}
@@ -32,4 +32,9 @@ char *utils_get_mac(void)
     }
 
     return s_mac_addr_cstr;
-}
\ No newline at end of file
+}
+
+esp_err_t utils_get_mac_bytes(uint8_t *mac)
+{
+    return esp_efuse_mac_get_default(mac);
+}
@@ -0,0 +1,76 @@
+#ifndef _SX127X_SIM_H_
+#define _SX127X_SIM_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SX127X_SIM_RADIO_MAX    16
+#define SX127X_SIM_TX_MAX       32  /* frames on air at the same time */
+
+/*
+ * Virtual RF channel every simulated radio is attached to. Frames on the same frequency,
+ * bandwidth and SF interfere, other SFs are treated as orthogonal.
+ */
+typedef struct {
+    float noise_figure_db;          /* noise floor is -174 + 10log10(bw) + nf */
+    float default_path_loss_db;     /* between radios without an explicit link */
+    float rssi_jitter_db;           /* uniform +-jitter on every reception */
+    float loss_rate;                /* random frame loss, 0..1 */
+    float capture_db;               /* a frame survives same SF interferers weaker than this */
+    uint32_t seed;
+} sx127x_sim_channel_config_t;
+
+#define SX127X_SIM_CHANNEL_CONFIG_DEFAULT() {   \
+    .noise_figure_db = 6,                       \
+    .default_path_loss_db = 100,                \
+    .rssi_jitter_db = 2,                        \
+    .loss_rate = 0,                             \
+    .capture_db = 6,                            \
+    .seed = 1,                                  \
+}
+
+typedef struct {
+    const char *name;
+    int pin_nss;
+    int pin_rst;
+    int pin_dio0;
+    int32_t freq_offset_hz;         /* crystal error, shows up in the receivers' FEI */
+} sx127x_sim_radio_config_t;
+
+/* per receiver outcome of every frame sent on its channel */
+typedef struct {
+    uint32_t tx_frames;
+    uint32_t tx_aborted;            /* sender left tx before the end of the frame */
+    uint32_t rx_delivered;
+    uint32_t rx_collisions;         /* RxDone with crc error, interferer within capture */
+    uint32_t rx_lost_random;
+    uint32_t rx_below_sensitivity;
+    uint32_t rx_busy;               /* receiver was already locked on another frame */
+    uint32_t rx_not_listening;      /* receiver was not in rx */
+    uint32_t rx_aborted;            /* receiver left rx in the middle of the frame */
+} sx127x_sim_stats_t;
+
+esp_err_t sx127x_sim_channel_init(const sx127x_sim_channel_config_t *config);
+int sx127x_sim_radio_add(const sx127x_sim_radio_config_t *config);
+void sx127x_sim_set_path_loss(int radio_a, int radio_b, float loss_db);
+void sx127x_sim_get_stats(sx127x_sim_stats_t *stats);
+esp_err_t sx127x_sim_get_radio_stats(int radio_id, sx127x_sim_stats_t *stats);
+void sx127x_sim_reset_stats(void);
+
+/* bus side, called by the gpio and spi master stand-ins */
+void sx127x_sim_pin_changed(int pin, uint32_t level);
+void sx127x_sim_spi_transfer(uint8_t addr, const uint8_t *tx, uint8_t *rx, size_t len);
+
+/* gpio stand-in, rising edge on an input pin runs its isr handler */
+void sx127x_sim_isr_trigger(int pin);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,17 @@
+#ifndef _SIM_ESP_TIMER_H_
+#define _SIM_ESP_TIMER_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* microseconds since the simulator started, monotonic host clock */
+int64_t esp_timer_get_time(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,253 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "driver/gpio.h"
+#include "driver/spi_master.h"
+#include "sx127x_sim.h"
+
+/*
+ * Board stand-ins for host builds: gpio levels and isr handlers, an spi master that runs
+ * every transaction synchronously on the simulated radios and a monotonic esp_timer clock.
+ */
+
+#define SIM_SPI_QUEUE_MAX   16
+
+static const char *TAG = "sim_bus";
+
+typedef struct {
+    gpio_isr_t handler;
+    void *arg;
+} sim_gpio_isr_t;
+
+static uint8_t s_gpio_level[GPIO_NUM_MAX];
+static sim_gpio_isr_t s_gpio_isr[GPIO_NUM_MAX];
+static bool s_gpio_isr_service = false;
+/* the radios share the bus, one transaction or acquired device at a time */
+static SemaphoreHandle_t s_spi_bus[SPI_HOST_MAX];
+
+struct spi_device_t {
+    spi_host_device_t host;
+    spi_device_interface_config_t config;
+    spi_transaction_t *done[SIM_SPI_QUEUE_MAX];
+    uint8_t done_head;
+    uint8_t done_cnt;
+};
+
+int64_t esp_timer_get_time(void)
+{
+    static int64_t s_start_us = 0;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    int64_t now_us = (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    if (!s_start_us) {
+        s_start_us = now_us;
+    }
+    return now_us - s_start_us;
+}
+
+static bool sim_gpio_is_valid(gpio_num_t gpio_num)
+{
+    return gpio_num >= 0 && gpio_num < GPIO_NUM_MAX;
+}
+
+esp_err_t gpio_config(const gpio_config_t *config)
+{
+    if (!config) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return ESP_OK;
+}
+
+esp_err_t gpio_set_level(gpio_num_t gpio_num, uint32_t level)
+{
+    if (!sim_gpio_is_valid(gpio_num)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    s_gpio_level[gpio_num] = level ? 1 : 0;
+    sx127x_sim_pin_changed(gpio_num, s_gpio_level[gpio_num]);
+    return ESP_OK;
+}
+
+int gpio_get_level(gpio_num_t gpio_num)
+{
+    return sim_gpio_is_valid(gpio_num) ? s_gpio_level[gpio_num] : 0;
+}
+
+esp_err_t gpio_install_isr_service(int intr_alloc_flags)
+{
+    if (s_gpio_isr_service) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    s_gpio_isr_service = true;
+    return ESP_OK;
+}
+
+esp_err_t gpio_isr_handler_add(gpio_num_t gpio_num, gpio_isr_t isr_handler, void *args)
+{
+    if (!s_gpio_isr_service) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (!sim_gpio_is_valid(gpio_num)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    s_gpio_isr[gpio_num] = (sim_gpio_isr_t) {
+        .handler = isr_handler,
+        .arg = args,
+    };
+    return ESP_OK;
+}
+
+esp_err_t gpio_isr_handler_remove(gpio_num_t gpio_num)
+{
+    if (!sim_gpio_is_valid(gpio_num)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memset(&s_gpio_isr[gpio_num], 0, sizeof(sim_gpio_isr_t));
+    return ESP_OK;
+}
+
+/* runs from the simulator task, the handler sees it like an interrupt */
+void sx127x_sim_isr_trigger(int pin)
+{
+    if (!sim_gpio_is_valid(pin) || !s_gpio_isr[pin].handler) {
+        return;
+    }
+    s_gpio_isr[pin].handler(s_gpio_isr[pin].arg);
+}
+
+esp_err_t spi_bus_initialize(spi_host_device_t host_id, const spi_bus_config_t *bus_config, spi_common_dma_t dma_chan)
+{
+    if (host_id >= SPI_HOST_MAX || !bus_config) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (s_spi_bus[host_id]) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    s_spi_bus[host_id] = xSemaphoreCreateRecursiveMutex();
+    if (!s_spi_bus[host_id]) {
+        return ESP_ERR_NO_MEM;
+    }
+    ESP_LOGI(TAG, "spi host %d initialized", host_id);
+    return ESP_OK;
+}
+
+esp_err_t spi_bus_add_device(spi_host_device_t host_id, const spi_device_interface_config_t *dev_config, spi_device_handle_t *handle)
+{
+    if (host_id >= SPI_HOST_MAX || !dev_config || !handle) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!s_spi_bus[host_id]) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (dev_config->queue_size > SIM_SPI_QUEUE_MAX) {
+        ESP_LOGE(TAG, "queue size %d > %d", dev_config->queue_size, SIM_SPI_QUEUE_MAX);
+        return ESP_ERR_INVALID_ARG;
+    }
+    spi_device_handle_t dev = (spi_device_handle_t)calloc(1, sizeof(struct spi_device_t));
+    if (!dev) {
+        return ESP_ERR_NO_MEM;
+    }
+    dev->host = host_id;
+    dev->config = *dev_config;
+    *handle = dev;
+    return ESP_OK;
+}
+
+esp_err_t spi_bus_remove_device(spi_device_handle_t handle)
+{
+    if (!handle) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (handle->done_cnt) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    free(handle);
+    return ESP_OK;
+}
+
+/* chip select comes from pre_cb/post_cb like on the board, the radio with low nss answers */
+static esp_err_t sim_spi_run(spi_device_handle_t handle, spi_transaction_t *trans)
+{
+    if (!handle || !trans || trans->length % 8) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    size_t len = trans->length / 8;
+    if (((trans->flags & SPI_TRANS_USE_TXDATA) || (trans->flags & SPI_TRANS_USE_RXDATA)) && len > 4) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    const uint8_t *tx = trans->flags & SPI_TRANS_USE_TXDATA ? trans->tx_data : (const uint8_t *)trans->tx_buffer;
+    uint8_t *rx = trans->flags & SPI_TRANS_USE_RXDATA ? trans->rx_data : (uint8_t *)trans->rx_buffer;
+    if (!trans->rxlength) {
+        rx = NULL;
+    }
+    xSemaphoreTakeRecursive(s_spi_bus[handle->host], portMAX_DELAY);
+    if (handle->config.pre_cb) {
+        handle->config.pre_cb(trans);
+    }
+    sx127x_sim_spi_transfer((uint8_t)trans->addr, tx, rx, len);
+    if (handle->config.post_cb) {
+        handle->config.post_cb(trans);
+    }
+    xSemaphoreGiveRecursive(s_spi_bus[handle->host]);
+    return ESP_OK;
+}
+
+esp_err_t spi_device_transmit(spi_device_handle_t handle, spi_transaction_t *trans_desc)
+{
+    return sim_spi_run(handle, trans_desc);
+}
+
+esp_err_t spi_device_polling_transmit(spi_device_handle_t handle, spi_transaction_t *trans_desc)
+{
+    return sim_spi_run(handle, trans_desc);
+}
+
+esp_err_t spi_device_queue_trans(spi_device_handle_t handle, spi_transaction_t *trans_desc, TickType_t ticks_to_wait)
+{
+    if (!handle) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (handle->done_cnt >= handle->config.queue_size) {
+        return ESP_ERR_TIMEOUT;
+    }
+    esp_err_t err = sim_spi_run(handle, trans_desc);
+    if (err != ESP_OK) {
+        return err;
+    }
+    handle->done[(handle->done_head + handle->done_cnt) % SIM_SPI_QUEUE_MAX] = trans_desc;
+    handle->done_cnt++;
+    return ESP_OK;
+}
+
+esp_err_t spi_device_get_trans_result(spi_device_handle_t handle, spi_transaction_t **trans_desc, TickType_t ticks_to_wait)
+{
+    if (!handle || !trans_desc) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!handle->done_cnt) {
+        return ESP_ERR_TIMEOUT;
+    }
+    *trans_desc = handle->done[handle->done_head];
+    handle->done_head = (handle->done_head + 1) % SIM_SPI_QUEUE_MAX;
+    handle->done_cnt--;
+    return ESP_OK;
+}
+
+esp_err_t spi_device_acquire_bus(spi_device_handle_t device, TickType_t wait)
+{
+    if (!device) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return xSemaphoreTakeRecursive(s_spi_bus[device->host], wait) == pdTRUE ? ESP_OK : ESP_ERR_TIMEOUT;
+}
+
+void spi_device_release_bus(spi_device_handle_t dev)
+{
+    xSemaphoreGiveRecursive(s_spi_bus[dev->host]);
+}
@@ -0,0 +1,713 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <inttypes.h>
+#include <sys/param.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "core/sx127x.h"
+#include "core/sx127x_modem.h"
+#include "sx127x_sim.h"
+
+/*
+ * Register level SX127x model for host builds. The driver talks to it over the spi master
+ * stand-in, the simulator task plays the modem state machine and raises DIO0 like the chip.
+ * Only LoRa mode is modelled.
+ */
+
+#define SIM_REG_CNT             0x80
+#define SIM_FIFO_SIZE           256
+#define SIM_VERSION             0x12
+#define SIM_FXOSC               32000000
+#define SIM_HF_BAND_MIN_HZ      779000000
+#define SIM_RSSI_OFFSET_HF      157
+#define SIM_RSSI_OFFSET_LF      164
+#define SIM_CAD_SYMBOLS         2
+#define SIM_SNR_MIN_DB          (-32.0f)
+#define SIM_SNR_MAX_DB          (12.0f)
+#define SIM_MODE_MASK           0x07
+#define SIM_MODEM_STAT_RX       0x0f    /* signal detected | synchronized | rx ongoing | header valid */
+#define SIM_MODEM_STAT_CLEAR    0x10
+#define SIM_TASK_PRIO           (configMAX_PRIORITIES - 1)
+#define SIM_TASK_STACK          (4 * 1024)
+
+static const char *TAG = "sx127x_sim";
+
+/* a frame on air */
+typedef struct {
+    bool used;
+    uint8_t src;
+    long frequency;
+    sx127x_bw_t bandwidth;
+    uint8_t spreading_factor;
+    uint8_t sync_word;
+    bool implicit_header;
+    float power_dbm;
+    int64_t end_us;
+    uint8_t len;
+    uint8_t payload[SIM_FIFO_SIZE];
+} sim_tx_t;
+
+typedef struct {
+    sx127x_sim_radio_config_t config;
+    uint8_t regs[SIM_REG_CNT];
+    uint8_t fifo[SIM_FIFO_SIZE];
+    bool selected;
+    bool in_reset;
+    int8_t tx;                  /* frame this radio is sending, -1 */
+    int8_t rx;                  /* frame the receiver is locked on, -1 */
+    float rx_rssi_dbm;
+    float rx_interference_dbm;  /* strongest same SF interferer during the locked frame */
+    int64_t rx_timeout_us;      /* rx single without a preamble, 0 when not armed */
+    int64_t cad_done_us;        /* 0 when no cad is running */
+    bool cad_detected;
+    sx127x_sim_stats_t stats;   /* tx of this radio, rx of the frames arriving at it */
+} sim_radio_t;
+
+static const uint8_t s_reset_regs[][2] = {
+    {REG_OP_MODE, MODE_STDBY},
+    {REG_FRF_MSB, 0x6c},
+    {REG_FRF_MID, 0x80},
+    {REG_PA_CONFIG, 0x4f},
+    {REG_LNA, 0x20},
+    {REG_FIFO_TX_BASE_ADDR, 0x80},
+    {REG_MODEM_STAT, SIM_MODEM_STAT_CLEAR},
+    {REG_MODEM_CONFIG_1, 0x72},
+    {REG_MODEM_CONFIG_2, 0x70},
+    {REG_SYMB_TIMEOUT_LSB, SX127X_SYMBOL_TIMEOUT_DEFAULT},
+    {REG_PREAMBLE_LSB, 0x08},
+    {REG_PAYLOAD_LENGTH, 0x01},
+    {REG_MODEM_CONFIG_3, MODEM_CONFIG_3_AGC_AUTO},
+    {REG_DETECTION_OPTIMIZE, DETECTION_OPTIMIZE_SF7_12},
+    {REG_DETECTION_THRESHOLD, DETECTION_THRESHOLD_SF7_12},
+    {REG_SYNC_WORD, SX127X_SYNC_WORD_PRIVATE},
+    {REG_VERSION, SIM_VERSION},
+};
+
+static sx127x_sim_channel_config_t s_config;
+static sim_radio_t s_radios[SX127X_SIM_RADIO_MAX];
+static uint8_t s_radio_cnt = 0;
+static sim_tx_t s_txs[SX127X_SIM_TX_MAX];
+static float s_path_loss[SX127X_SIM_RADIO_MAX][SX127X_SIM_RADIO_MAX];
+static uint32_t s_rand_state = 1;
+static SemaphoreHandle_t s_lock = NULL;
+static TaskHandle_t s_task = NULL;
+
+/* xorshift, a fixed seed replays the same channel */
+static float sim_rand(void)
+{
+    s_rand_state ^= s_rand_state << 13;
+    s_rand_state ^= s_rand_state >> 17;
+    s_rand_state ^= s_rand_state << 5;
+    return (s_rand_state >> 8) / (float)(1 << 24);
+}
+
+static uint8_t sim_mode(const sim_radio_t *radio)
+{
+    return radio->regs[REG_OP_MODE] & SIM_MODE_MASK;
+}
+
+static bool sim_is_rx(const sim_radio_t *radio)
+{
+    uint8_t mode = sim_mode(radio);
+    return mode == MODE_RX_CONTINUOUS || mode == MODE_RX_SINGLE;
+}
+
+static void sim_modem(const sim_radio_t *radio, sx127x_modem_config_t *modem)
+{
+    const uint8_t *regs = radio->regs;
+    uint32_t frf = ((uint32_t)regs[REG_FRF_MSB] << 16) | ((uint32_t)regs[REG_FRF_MID] << 8) | regs[REG_FRF_LSB];
+    modem->frequency = (long)(((uint64_t)frf * SIM_FXOSC) >> 19);
+    modem->bandwidth = (sx127x_bw_t)(regs[REG_MODEM_CONFIG_1] >> 4);
+    modem->coding_rate = (sx127x_cr_t)((regs[REG_MODEM_CONFIG_1] >> 1) & 0x07);
+    modem->implicit_header = regs[REG_MODEM_CONFIG_1] & MODEM_CONFIG_1_IMPLICIT_HEADER;
+    modem->spreading_factor = regs[REG_MODEM_CONFIG_2] >> 4;
+    modem->crc_on = regs[REG_MODEM_CONFIG_2] & MODEM_CONFIG_2_CRC_ON;
+    modem->preamble_len = ((uint16_t)regs[REG_PREAMBLE_MSB] << 8) | regs[REG_PREAMBLE_LSB];
+    modem->sync_word = regs[REG_SYNC_WORD];
+    modem->payload_len = regs[REG_PAYLOAD_LENGTH];
+    modem->symbol_timeout = ((uint16_t)(regs[REG_MODEM_CONFIG_2] & 0x03) << 8) | regs[REG_SYMB_TIMEOUT_LSB];
+}
+
+static float sim_noise_floor_dbm(const sx127x_modem_config_t *modem)
+{
+    return -174.0f + 10.0f * log10f((float)sx127x_modem_bandwidth_hz(modem->bandwidth)) + s_config.noise_figure_db;
+}
+
+/* demodulator snr limit of the datasheet table, -7.5dB at SF7 down to -20dB at SF12 */
+static float sim_snr_limit_db(uint8_t spreading_factor)
+{
+    return -5.0f - 2.5f * (spreading_factor - SX127X_SF_MIN);
+}
+
+static int sim_rssi_offset(long frequency)
+{
+    return frequency >= SIM_HF_BAND_MIN_HZ ? SIM_RSSI_OFFSET_HF : SIM_RSSI_OFFSET_LF;
+}
+
+static float sim_tx_power_dbm(const sim_radio_t *radio)
+{
+    uint8_t pa_config = radio->regs[REG_PA_CONFIG];
+    return (pa_config & PA_BOOST) ? 2 + (pa_config & 0x0f) : -1 + (pa_config & 0x0f);
+}
+
+static float sim_rx_power_dbm(const sim_tx_t *tx, uint8_t dst)
+{
+    float jitter_db = (2.0f * sim_rand() - 1.0f) * s_config.rssi_jitter_db;
+    return tx->power_dbm - s_path_loss[tx->src][dst] + jitter_db;
+}
+
+static bool sim_same_frequency(long a, long b, sx127x_bw_t bandwidth)
+{
+    return labs(a - b) < (long)sx127x_modem_bandwidth_hz(bandwidth) / 4;
+}
+
+/* the receiver can lock on the frame, everything but the frequency has to match */
+static bool sim_same_channel(const sim_tx_t *tx, const sx127x_modem_config_t *modem)
+{
+    return tx->bandwidth == modem->bandwidth && tx->spreading_factor == modem->spreading_factor &&
+           tx->sync_word == modem->sync_word && tx->implicit_header == modem->implicit_header &&
+           sim_same_frequency(tx->frequency, modem->frequency, modem->bandwidth);
+}
+
+/* receivers lose the rest of the frame */
+static void sim_tx_abort(sim_radio_t *radio)
+{
+    if (radio->tx < 0) {
+        return;
+    }
+    for (uint8_t i = 0; i < s_radio_cnt; i++) {
+        if (s_radios[i].rx == radio->tx) {
+            s_radios[i].rx = -1;
+        }
+    }
+    s_txs[radio->tx].used = false;
+    radio->tx = -1;
+    radio->stats.tx_aborted++;
+}
+
+static void sim_radio_reset(sim_radio_t *radio)
+{
+    memset(radio->regs, 0, sizeof(radio->regs));
+    memset(radio->fifo, 0, sizeof(radio->fifo));
+    for (size_t i = 0; i < sizeof(s_reset_regs) / sizeof(s_reset_regs[0]); i++) {
+        radio->regs[s_reset_regs[i][0]] = s_reset_regs[i][1];
+    }
+    sim_tx_abort(radio);
+    radio->rx = -1;
+    radio->rx_timeout_us = 0;
+    radio->cad_done_us = 0;
+}
+
+static void sim_notify(void)
+{
+    if (s_task) {
+        xTaskNotifyGive(s_task);
+    }
+}
+
+static void sim_tx_start(sim_radio_t *radio, int64_t now_us)
+{
+    uint8_t src = radio - s_radios;
+    int slot = -1;
+    for (int i = 0; i < SX127X_SIM_TX_MAX; i++) {
+        if (!s_txs[i].used) {
+            slot = i;
+            break;
+        }
+    }
+    if (slot < 0) {
+        ESP_LOGE(TAG, "%s: channel is full, tx ignored", radio->config.name);
+        radio->regs[REG_OP_MODE] = (radio->regs[REG_OP_MODE] & ~SIM_MODE_MASK) | MODE_STDBY;
+        return;
+    }
+
+    sx127x_modem_config_t modem;
+    sim_modem(radio, &modem);
+    sim_tx_t *tx = &s_txs[slot];
+    tx->used = true;
+    tx->src = src;
+    tx->frequency = modem.frequency + radio->config.freq_offset_hz;
+    tx->bandwidth = modem.bandwidth;
+    tx->spreading_factor = modem.spreading_factor;
+    tx->sync_word = modem.sync_word;
+    tx->implicit_header = modem.implicit_header;
+    tx->power_dbm = sim_tx_power_dbm(radio);
+    tx->len = radio->regs[REG_PAYLOAD_LENGTH];
+    for (uint16_t i = 0; i < tx->len; i++) {
+        tx->payload[i] = radio->fifo[(uint8_t)(radio->regs[REG_FIFO_TX_BASE_ADDR] + i)];
+    }
+    tx->end_us = now_us + sx127x_modem_time_on_air_us(&modem, tx->len);
+    radio->tx = slot;
+    radio->stats.tx_frames++;
+    ESP_LOGD(TAG, "%s: tx %d bytes SF%d %" PRIi64 "us", radio->config.name, tx->len,
+             tx->spreading_factor, tx->end_us - now_us);
+
+    for (uint8_t i = 0; i < s_radio_cnt; i++) {
+        sim_radio_t *other = &s_radios[i];
+        sx127x_modem_config_t other_modem;
+        if (i == src || other->in_reset) {
+            continue;
+        }
+        sim_modem(other, &other_modem);
+        if (!sim_same_channel(tx, &other_modem)) {
+            continue;
+        }
+        float rssi_dbm = sim_rx_power_dbm(tx, i);
+        bool audible = rssi_dbm - sim_noise_floor_dbm(&other_modem) >= sim_snr_limit_db(tx->spreading_factor);
+        if (sim_mode(other) == MODE_CAD) {
+            other->cad_detected |= audible;
+            continue;
+        }
+        if (other->rx >= 0) {
+            /* the receiver is busy with another frame, this one only interferes */
+            other->rx_interference_dbm = fmaxf(other->rx_interference_dbm, rssi_dbm);
+            other->stats.rx_busy++;
+            continue;
+        }
+        if (!sim_is_rx(other)) {
+            other->stats.rx_not_listening++;
+            continue;
+        }
+        if (!audible) {
+            other->stats.rx_below_sensitivity++;
+            continue;
+        }
+        if (sim_rand() < s_config.loss_rate) {
+            other->stats.rx_lost_random++;
+            continue;
+        }
+        /* preamble lock, frames already on air interfere with it */
+        other->rx = slot;
+        other->rx_rssi_dbm = rssi_dbm;
+        other->rx_interference_dbm = -INFINITY;
+        other->rx_timeout_us = 0;
+        for (int j = 0; j < SX127X_SIM_TX_MAX; j++) {
+            if (j != slot && s_txs[j].used && s_txs[j].src != i && sim_same_channel(&s_txs[j], &other_modem)) {
+                other->rx_interference_dbm = fmaxf(other->rx_interference_dbm, sim_rx_power_dbm(&s_txs[j], i));
+            }
+        }
+    }
+}
+
+static bool sim_dio0_mapped(const sim_radio_t *radio, uint8_t mapping)
+{
+    return (radio->regs[REG_DIO_MAPPING_1] & DIO0_MAPPING_MASK) == mapping;
+}
+
+static void sim_set_standby(sim_radio_t *radio)
+{
+    radio->regs[REG_OP_MODE] = (radio->regs[REG_OP_MODE] & ~SIM_MODE_MASK) | MODE_STDBY;
+}
+
+/* frame reception with the link metadata the driver reads back */
+static bool sim_rx_done(sim_radio_t *radio, const sim_tx_t *tx)
+{
+    sx127x_modem_config_t modem;
+    sim_modem(radio, &modem);
+    radio->rx = -1;
+
+    bool collided = radio->rx_rssi_dbm - radio->rx_interference_dbm < s_config.capture_db;
+    uint8_t base = radio->regs[REG_FIFO_RX_BASE_ADDR];
+    for (uint16_t i = 0; i < tx->len; i++) {
+        radio->fifo[(uint8_t)(base + i)] = tx->payload[i];
+    }
+    if (collided && !modem.crc_on) {
+        /* nothing catches it without crc */
+        radio->fifo[base] ^= 0xff;
+    }
+    radio->regs[REG_RX_NB_BYTES] = tx->len;
+    radio->regs[REG_FIFO_RX_CURRENT_ADDR] = base;
+
+    float snr_db = fminf(fmaxf(radio->rx_rssi_dbm - sim_noise_floor_dbm(&modem), SIM_SNR_MIN_DB), SIM_SNR_MAX_DB);
+    int offset = sim_rssi_offset(modem.frequency);
+    /* datasheet 5.5.5, packet rssi is scaled above the noise floor */
+    float pkt_rssi = snr_db < 0 ? radio->rx_rssi_dbm - snr_db + offset : (radio->rx_rssi_dbm + offset) * 15 / 16;
+    radio->regs[REG_PKT_RSSI_VALUE] = (uint8_t)fminf(fmaxf(roundf(pkt_rssi), 0), 255);
+    radio->regs[REG_PKT_SNR_VALUE] = (uint8_t)(int8_t)lroundf(snr_db * 4);
+
+    /* FEI = Ferr * 2^24 / Fxosc * 500kHz / BW, 20 bit signed */
+    int64_t freq_error_hz = tx->frequency - modem.frequency - radio->config.freq_offset_hz;
+    int64_t fei = freq_error_hz * SIM_FXOSC * 500000 / ((int64_t)sx127x_modem_bandwidth_hz(modem.bandwidth) << 24);
+    radio->regs[REG_FEI_MSB] = (uint8_t)((fei >> 16) & 0x0f);
+    radio->regs[REG_FEI_MID] = (uint8_t)(fei >> 8);
+    radio->regs[REG_FEI_LSB] = (uint8_t)fei;
+
+    radio->regs[REG_IRQ_FLAGS] |= IRQ_RX_DONE_MASK | (collided && modem.crc_on ? IRQ_PAYLOAD_CRC_ERROR_MASK : 0);
+    if (collided) {
+        radio->stats.rx_collisions++;
+    } else {
+        radio->stats.rx_delivered++;
+    }
+    if (sim_mode(radio) == MODE_RX_SINGLE) {
+        sim_set_standby(radio);
+    }
+    return sim_dio0_mapped(radio, DIO0_MAPPING_RX_DONE);
+}
+
+static void sim_set_mode(sim_radio_t *radio, uint8_t value, int64_t now_us)
+{
+    uint8_t old_mode = sim_mode(radio);
+    uint8_t mode = value & SIM_MODE_MASK;
+    radio->regs[REG_OP_MODE] = value;
+    /* rx continuous and tx go on when they are written again */
+    if (mode == old_mode && (mode == MODE_RX_CONTINUOUS || mode == MODE_TX)) {
+        return;
+    }
+    sim_tx_abort(radio);
+    if (radio->rx >= 0 && mode != old_mode) {
+        radio->rx = -1;
+        radio->stats.rx_aborted++;
+    }
+    radio->rx_timeout_us = 0;
+    radio->cad_done_us = 0;
+
+    sx127x_modem_config_t modem;
+    sim_modem(radio, &modem);
+    switch (mode) {
+    case MODE_TX:
+        sim_tx_start(radio, now_us);
+        break;
+    case MODE_RX_SINGLE:
+        if (radio->rx < 0) {
+            radio->rx_timeout_us = now_us + (int64_t)modem.symbol_timeout * sx127x_modem_symbol_time_us(&modem);
+        }
+        break;
+    case MODE_CAD:
+        /* a preamble already on air is detected, so is one starting during the cad */
+        radio->cad_detected = false;
+        for (int i = 0; i < SX127X_SIM_TX_MAX; i++) {
+            const sim_tx_t *tx = &s_txs[i];
+            if (tx->used && sim_same_channel(tx, &modem) &&
+                    sim_rx_power_dbm(tx, radio - s_radios) - sim_noise_floor_dbm(&modem) >= sim_snr_limit_db(tx->spreading_factor)) {
+                radio->cad_detected = true;
+            }
+        }
+        radio->cad_done_us = now_us + SIM_CAD_SYMBOLS * (int64_t)sx127x_modem_symbol_time_us(&modem);
+        break;
+    default:
+        break;
+    }
+    sim_notify();
+}
+
+/* instantaneous rssi, every frame on the frequency counts whatever its SF */
+static uint8_t sim_rssi_value(const sim_radio_t *radio)
+{
+    sx127x_modem_config_t modem;
+    sim_modem(radio, &modem);
+    if (!sim_is_rx(radio)) {
+        return radio->regs[REG_RSSI_VALUE];
+    }
+    float power_mw = powf(10.0f, sim_noise_floor_dbm(&modem) / 10.0f);
+    for (int i = 0; i < SX127X_SIM_TX_MAX; i++) {
+        const sim_tx_t *tx = &s_txs[i];
+        if (tx->used && tx->src != radio - s_radios && sim_same_frequency(tx->frequency, modem.frequency, modem.bandwidth)) {
+            power_mw += powf(10.0f, sim_rx_power_dbm(tx, radio - s_radios) / 10.0f);
+        }
+    }
+    float rssi = 10.0f * log10f(power_mw) + sim_rssi_offset(modem.frequency);
+    return (uint8_t)fminf(fmaxf(roundf(rssi), 0), 255);
+}
+
+static uint8_t sim_read_reg(sim_radio_t *radio, uint8_t addr)
+{
+    switch (addr) {
+    case REG_FIFO:
+        return radio->fifo[radio->regs[REG_FIFO_ADDR_PTR]++];
+    case REG_RSSI_VALUE:
+        return sim_rssi_value(radio);
+    case REG_MODEM_STAT:
+        return radio->rx >= 0 ? SIM_MODEM_STAT_RX : SIM_MODEM_STAT_CLEAR;
+    default:
+        return radio->regs[addr];
+    }
+}
+
+static void sim_write_reg(sim_radio_t *radio, uint8_t addr, uint8_t data, int64_t now_us)
+{
+    switch (addr) {
+    case REG_FIFO:
+        radio->fifo[radio->regs[REG_FIFO_ADDR_PTR]++] = data;
+        break;
+    case REG_OP_MODE:
+        sim_set_mode(radio, data, now_us);
+        break;
+    case REG_IRQ_FLAGS:
+        /* flags are cleared by writing one */
+        radio->regs[REG_IRQ_FLAGS] &= ~data;
+        break;
+    case REG_FIFO_RX_CURRENT_ADDR:
+    case REG_RX_NB_BYTES:
+    case REG_MODEM_STAT:
+    case REG_PKT_SNR_VALUE:
+    case REG_PKT_RSSI_VALUE:
+    case REG_RSSI_VALUE:
+    case REG_FEI_MSB:
+    case REG_FEI_MID:
+    case REG_FEI_LSB:
+    case REG_VERSION:
+        break;
+    default:
+        radio->regs[addr] = data;
+        break;
+    }
+}
+
+void sx127x_sim_spi_transfer(uint8_t addr, const uint8_t *tx, uint8_t *rx, size_t len)
+{
+    if (!s_lock) {
+        return;
+    }
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    sim_radio_t *radio = NULL;
+    uint8_t selected = 0;
+    for (uint8_t i = 0; i < s_radio_cnt; i++) {
+        if (s_radios[i].selected && !s_radios[i].in_reset) {
+            radio = &s_radios[i];
+            selected++;
+        }
+    }
+    if (selected > 1) {
+        ESP_LOGE(TAG, "%d radios are selected at the same time!", selected);
+        radio = NULL;
+    }
+    bool write = addr & 0x80;
+    uint8_t reg = addr & 0x7f;
+    int64_t now_us = esp_timer_get_time();
+    for (size_t i = 0; i < len; i++) {
+        /* burst access goes on with the next register, except the fifo */
+        uint8_t cur = reg == REG_FIFO ? REG_FIFO : (reg + i) & 0x7f;
+        if (write) {
+            if (radio && tx) {
+                sim_write_reg(radio, cur, tx[i], now_us);
+            }
+        } else if (rx) {
+            /* nothing drives miso without a selected radio */
+            rx[i] = radio ? sim_read_reg(radio, cur) : 0;
+        }
+    }
+    xSemaphoreGive(s_lock);
+}
+
+void sx127x_sim_pin_changed(int pin, uint32_t level)
+{
+    if (!s_lock) {
+        return;
+    }
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    for (uint8_t i = 0; i < s_radio_cnt; i++) {
+        sim_radio_t *radio = &s_radios[i];
+        if (pin == radio->config.pin_nss) {
+            radio->selected = !level;
+        }
+        if (pin == radio->config.pin_rst) {
+            if (!level) {
+                radio->in_reset = true;
+            } else if (radio->in_reset) {
+                sim_radio_reset(radio);
+                radio->in_reset = false;
+            }
+        }
+    }
+    xSemaphoreGive(s_lock);
+}
+
+static int64_t sim_next_event_us(void)
+{
+    int64_t next_us = INT64_MAX;
+    for (int i = 0; i < SX127X_SIM_TX_MAX; i++) {
+        if (s_txs[i].used) {
+            next_us = MIN(next_us, s_txs[i].end_us);
+        }
+    }
+    for (uint8_t i = 0; i < s_radio_cnt; i++) {
+        if (s_radios[i].rx_timeout_us) {
+            next_us = MIN(next_us, s_radios[i].rx_timeout_us);
+        }
+        if (s_radios[i].cad_done_us) {
+            next_us = MIN(next_us, s_radios[i].cad_done_us);
+        }
+    }
+    return next_us;
+}
+
+/* runs the due events, returns the dio0 pins to raise once the lock is released */
+static uint8_t sim_process(int64_t now_us, int *dio0_pins)
+{
+    uint8_t pin_cnt = 0;
+    while (pdTRUE) {
+        /* frames end in time order, a receiver may be locked on the next one */
+        int slot = -1;
+        for (int i = 0; i < SX127X_SIM_TX_MAX; i++) {
+            if (s_txs[i].used && s_txs[i].end_us <= now_us && (slot < 0 || s_txs[i].end_us < s_txs[slot].end_us)) {
+                slot = i;
+            }
+        }
+        if (slot < 0) {
+            break;
+        }
+        sim_tx_t *tx = &s_txs[slot];
+        sim_radio_t *src = &s_radios[tx->src];
+        src->tx = -1;
+        src->regs[REG_IRQ_FLAGS] |= IRQ_TX_DONE_MASK;
+        sim_set_standby(src);
+        if (sim_dio0_mapped(src, DIO0_MAPPING_TX_DONE)) {
+            dio0_pins[pin_cnt++] = src->config.pin_dio0;
+        }
+        for (uint8_t i = 0; i < s_radio_cnt; i++) {
+            if (s_radios[i].rx == slot && sim_rx_done(&s_radios[i], tx)) {
+                dio0_pins[pin_cnt++] = s_radios[i].config.pin_dio0;
+            }
+        }
+        tx->used = false;
+    }
+
+    for (uint8_t i = 0; i < s_radio_cnt; i++) {
+        sim_radio_t *radio = &s_radios[i];
+        if (radio->rx_timeout_us && radio->rx_timeout_us <= now_us) {
+            /* RxTimeout is on DIO1, the driver polls the flag */
+            radio->rx_timeout_us = 0;
+            radio->regs[REG_IRQ_FLAGS] |= IRQ_RX_TIMEOUT_MASK;
+            sim_set_standby(radio);
+        }
+        if (radio->cad_done_us && radio->cad_done_us <= now_us) {
+            radio->cad_done_us = 0;
+            radio->regs[REG_IRQ_FLAGS] |= IRQ_CAD_DONE_MASK | (radio->cad_detected ? IRQ_CAD_DETECTED_MASK : 0);
+            sim_set_standby(radio);
+            if (sim_dio0_mapped(radio, DIO0_MAPPING_CAD_DONE)) {
+                dio0_pins[pin_cnt++] = radio->config.pin_dio0;
+            }
+        }
+    }
+    return pin_cnt;
+}
+
+static void sx127x_sim_task(void *p)
+{
+    /* a radio ends its own frame and receives one at most */
+    int dio0_pins[2 * SX127X_SIM_RADIO_MAX];
+    while (pdTRUE) {
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        uint8_t pin_cnt = sim_process(esp_timer_get_time(), dio0_pins);
+        int64_t next_us = sim_next_event_us();
+        xSemaphoreGive(s_lock);
+
+        /* the handlers see the simulator task like an interrupt */
+        for (uint8_t i = 0; i < pin_cnt; i++) {
+            sx127x_sim_isr_trigger(dio0_pins[i]);
+        }
+        TickType_t wait = portMAX_DELAY;
+        if (next_us != INT64_MAX) {
+            int64_t wait_us = next_us - esp_timer_get_time();
+            wait = wait_us > 0 ? pdMS_TO_TICKS((wait_us + 999) / 1000) : 0;
+        }
+        ulTaskNotifyTake(pdTRUE, wait);
+    }
+}
+
+esp_err_t sx127x_sim_channel_init(const sx127x_sim_channel_config_t *config)
+{
+    sx127x_sim_channel_config_t default_config = SX127X_SIM_CHANNEL_CONFIG_DEFAULT();
+    if (s_lock) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    s_config = config ? *config : default_config;
+    s_rand_state = s_config.seed ? s_config.seed : 1;
+    for (uint8_t i = 0; i < SX127X_SIM_RADIO_MAX; i++) {
+        for (uint8_t j = 0; j < SX127X_SIM_RADIO_MAX; j++) {
+            s_path_loss[i][j] = s_config.default_path_loss_db;
+        }
+    }
+    s_lock = xSemaphoreCreateMutex();
+    if (!s_lock) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (xTaskCreate(sx127x_sim_task, "sx127x_sim", SIM_TASK_STACK, NULL, SIM_TASK_PRIO, &s_task) != pdPASS) {
+        ESP_LOGE(TAG, "couldn't create the simulator task!");
+        return ESP_ERR_NO_MEM;
+    }
+    ESP_LOGI(TAG, "channel path loss:%.1fdB jitter:%.1fdB loss:%.3f capture:%.1fdB",
+             s_config.default_path_loss_db, s_config.rssi_jitter_db, s_config.loss_rate, s_config.capture_db);
+    return ESP_OK;
+}
+
+int sx127x_sim_radio_add(const sx127x_sim_radio_config_t *config)
+{
+    if (!s_lock || !config) {
+        return -1;
+    }
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (s_radio_cnt >= SX127X_SIM_RADIO_MAX) {
+        xSemaphoreGive(s_lock);
+        ESP_LOGE(TAG, "there is no room for another radio!");
+        return -1;
+    }
+    int id = s_radio_cnt++;
+    sim_radio_t *radio = &s_radios[id];
+    memset(radio, 0, sizeof(sim_radio_t));
+    radio->config = *config;
+    radio->tx = -1;
+    sim_radio_reset(radio);
+    xSemaphoreGive(s_lock);
+    ESP_LOGI(TAG, "radio%d %s nss:%d rst:%d dio0:%d", id, config->name ? config->name : "",
+             config->pin_nss, config->pin_rst, config->pin_dio0);
+    return id;
+}
+
+void sx127x_sim_set_path_loss(int radio_a, int radio_b, float loss_db)
+{
+    if (radio_a < 0 || radio_b < 0 || radio_a >= SX127X_SIM_RADIO_MAX || radio_b >= SX127X_SIM_RADIO_MAX) {
+        return;
+    }
+    s_path_loss[radio_a][radio_b] = loss_db;
+    s_path_loss[radio_b][radio_a] = loss_db;
+}
+
+static void sim_stats_add(sx127x_sim_stats_t *total, const sx127x_sim_stats_t *stats)
+{
+    total->tx_frames += stats->tx_frames;
+    total->tx_aborted += stats->tx_aborted;
+    total->rx_delivered += stats->rx_delivered;
+    total->rx_collisions += stats->rx_collisions;
+    total->rx_lost_random += stats->rx_lost_random;
+    total->rx_below_sensitivity += stats->rx_below_sensitivity;
+    total->rx_busy += stats->rx_busy;
+    total->rx_not_listening += stats->rx_not_listening;
+    total->rx_aborted += stats->rx_aborted;
+}
+
+void sx127x_sim_get_stats(sx127x_sim_stats_t *stats)
+{
+    memset(stats, 0, sizeof(sx127x_sim_stats_t));
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    for (uint8_t i = 0; i < s_radio_cnt; i++) {
+        sim_stats_add(stats, &s_radios[i].stats);
+    }
+    xSemaphoreGive(s_lock);
+}
+
+esp_err_t sx127x_sim_get_radio_stats(int radio_id, sx127x_sim_stats_t *stats)
+{
+    if (radio_id < 0 || radio_id >= s_radio_cnt) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    *stats = s_radios[radio_id].stats;
+    xSemaphoreGive(s_lock);
+    return ESP_OK;
+}
+
+void sx127x_sim_reset_stats(void)
+{
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    for (uint8_t i = 0; i < s_radio_cnt; i++) {
+        memset(&s_radios[i].stats, 0, sizeof(sx127x_sim_stats_t));
+    }
+    xSemaphoreGive(s_lock);
+}
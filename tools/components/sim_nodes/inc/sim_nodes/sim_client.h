@@ -0,0 +1,66 @@
+#ifndef _SIM_CLIENT_H_
+#define _SIM_CLIENT_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include "esp_err.h"
+#include "app/lora_manager.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Client node on the simulated channel. lora_manager runs once per process, so a client
+ * keeps its own counter, address and held records and runs them through the client code
+ * of lora_manager: the provisioning request, aggregation and compression. It provisions
+ * until PROVISING_OK then sends the client_timer_cb uplinks, with the sx127x driver on its
+ * own simulated radio.
+ */
+
+#define SIM_CLIENT_MAX              14
+#define SIM_CLIENT_PIN_BASE         32  /* nss, rst and dio0 of client n are base + 3n.. */
+#define SIM_CLIENT_APP_DATA_ID      0xAE
+#define SIM_CLIENT_PROVISION_RETRY_MS 5000
+
+/* uplink data is "c<index>,s<seq>", the gateway publishes it as it is */
+#define SIM_CLIENT_DATA_FMT         "c%u,s%" PRIu32
+#define SIM_CLIENT_DATA_SCN         "c%u,s%" SCNu32
+
+/* called before the uplink goes on air, tx_end_us is when its last symbol will have left, once per record of aggregate frames */
+typedef void (*sim_client_sent_cb_t)(uint8_t index, uint32_t seq, int64_t tx_end_us, void *arg);
+
+typedef struct {
+    uint8_t index;
+    uint8_t spreading_factor;   /* 0 keeps the default modem */
+    uint8_t gateway_radio_cnt;  /* gateway radios are the first ones on the channel */
+    float path_loss_db;         /* to the gateway radios */
+    uint32_t period_ms;
+    uint32_t first_delay_ms;
+    bool env_readings;          /* payload codec env readings instead of the text uplinks */
+    uint32_t aggregate_ms;      /* uplinks wait this long to share a frame, lora_aggregate_ms of the client build */
+    bool compress;              /* text and aggregate frames go compressed, lora_compress of the client build */
+    sim_client_sent_cb_t sent_cb;
+    void *sent_cb_arg;
+} sim_client_config_t;
+
+typedef struct {
+    bool provisioned;
+    uint32_t provisioning_sent;
+    uint32_t uplinks;
+    uint32_t frames;            /* uplink frames on air, fewer than uplinks with aggregation */
+    uint32_t send_failures;
+    uint32_t downlinks;
+    uint32_t compressed;        /* frames that went as LORA_PACKET_ID_COMPRESSED */
+} sim_client_stats_t;
+
+esp_err_t sim_client_start(const sim_client_config_t *config);
+esp_err_t sim_client_get_stats(uint8_t index, sim_client_stats_t *stats);
+esp_err_t sim_client_get_dev_eui(uint8_t index, uint8_t *dev_eui);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef _SIM_GATEWAY_H_
+#define _SIM_GATEWAY_H_
+
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* second gateway radio listens on another SF, the simulated radios are added in this order */
+#define SIM_GATEWAY_RADIO1_PIN_NSS  4
+#define SIM_GATEWAY_RADIO1_PIN_RST  15
+#define SIM_GATEWAY_RADIO1_PIN_DIO0 25
+#define SIM_GATEWAY_RADIO1_SF       9
+
+/* gateway firmware with the defaults of app_start, on radio_cnt simulated radios */
+esp_err_t sim_gateway_start(uint8_t radio_cnt);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,310 @@
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_random.h"
+#include "core/sx127x.h"
+#include "app/app_types.h"
+#include "app/lora_manager.h"
+#include "app/provisioning_manager.h"
+#include "app/payload_codec.h"
+#include "sim/sx127x_sim.h"
+#include "sim_client.h"
+
+#define SIM_CLIENT_APP_KEY      "1234567890abcdef"   /* the test key of lora_manager */
+#define SIM_CLIENT_TASK_STACK   (4 * 1024)
+#define SIM_CLIENT_TASK_PRIO    5
+#define SIM_CLIENT_JITTER_PCT   10  /* clocks of real nodes drift, lockstep clients would collide forever */
+
+static const char *TAG = "sim_client";
+
+typedef struct {
+    sim_client_config_t config;
+    char name[16];
+    uint8_t dev_eui[LORA_DEV_EUI_LEN];
+    uint16_t dev_addr;          /* from PROVISING_OK */
+    uint32_t fcnt;              /* in memory, PROVISING_OK floors it like lora_fcnt_floor() */
+    uint8_t challenge[PROVISIONING_CHALLENGE_LEN];
+    sx127x_handle_t dev;
+    SemaphoreHandle_t lock;
+    payload_codec_state_t env_state;
+    lora_aggregate_t aggregate;
+    uint32_t pending_seq[LORA_RECORD_MAX];  /* of the held records and the one being put, oldest first */
+    uint8_t pending_cnt;
+    int64_t aggregate_deadline_us;
+    sim_client_stats_t stats;
+} sim_client_t;
+
+static sim_client_t s_clients[SIM_CLIENT_MAX];
+
+static void sim_client_rx_task(void *p)
+{
+    sx127x_handle_t dev = (sx127x_handle_t)p;
+    sim_client_t *client = sx127x_get_user_ctx(dev);
+    uint8_t raw[LORA_FRAME_MAX_LEN];
+    lora_frame_t frame;
+    /* the handle is stored once sx127x_init returns */
+    xSemaphoreTake(client->lock, portMAX_DELAY);
+    xSemaphoreGive(client->lock);
+    while (pdTRUE) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        xSemaphoreTake(client->lock, portMAX_DELAY);
+        int len = sx127x_receive_packet(dev, raw, sizeof(raw), NULL);
+        sx127x_receive(dev);
+        xSemaphoreGive(client->lock);
+        if (len <= 0 || lora_frame_decode(raw, len, false, 0, &frame) != ESP_OK) {
+            continue;
+        }
+        if (frame.dev_addr == LORA_DEV_ADDR_NONE ? memcmp(frame.dev_eui, client->dev_eui, LORA_DEV_EUI_LEN) :
+                frame.dev_addr != client->dev_addr) {
+            continue;
+        }
+        uint16_t dev_addr = LORA_DEV_ADDR_NONE;
+        uint32_t fcnt_floor = 0;
+        if (frame.packet_id == LORA_PACKET_ID_PROVISING_OK &&
+                provisioning_mngr_parse_ok(&frame, SIM_CLIENT_APP_KEY, &dev_addr, &fcnt_floor) == ESP_OK) {
+            xSemaphoreTake(client->lock, portMAX_DELAY);
+            if (!client->stats.provisioned) {
+                client->dev_addr = dev_addr;
+                client->fcnt = MAX(client->fcnt, fcnt_floor);
+                ESP_LOGI(TAG, "%s provisioned, address:0x%04x fcnt:%" PRIu32, client->name, dev_addr, client->fcnt);
+            }
+            client->stats.provisioned = true;
+            xSemaphoreGive(client->lock);
+        } else if (frame.packet_id == LORA_PACKET_ID_PROVISING_CHALLENGE && frame.data_len == PROVISIONING_CHALLENGE_LEN) {
+            /* echoed by the next request */
+            xSemaphoreTake(client->lock, portMAX_DELAY);
+            memcpy(client->challenge, frame.data, PROVISIONING_CHALLENGE_LEN);
+            xSemaphoreGive(client->lock);
+        } else if (frame.packet_id == LORA_PACKET_ID_DOWNLINK) {
+            client->stats.downlinks++;
+            ESP_LOGI(TAG, "%s downlink: %.*s", client->name,
+                     (int)MIN(frame.data_len, LORA_PACKET_MAX_DATA_LEN), (char *)frame.data);
+        }
+    }
+}
+
+/* encrypted with the client's own counter and key, sent on its radio */
+static esp_err_t sim_client_send(sim_client_t *client, lora_frame_t *frame, const uint32_t *seq, uint8_t seq_cnt)
+{
+    uint8_t buf[LORA_FRAME_MAX_LEN];
+    size_t len = sizeof(buf);
+    xSemaphoreTake(client->lock, portMAX_DELAY);
+    if (frame->packet_id != LORA_PACKET_ID_PROVISING) {
+        memcpy(frame->dev_eui, client->dev_eui, LORA_DEV_EUI_LEN);
+        frame->dev_addr = client->dev_addr;
+        frame->end_of_frame = 0xDE;
+    }
+    frame->fcnt = client->fcnt++;
+    esp_err_t err = lora_frame_encode(frame, true, buf, &len);
+    if (err == ESP_OK) {
+        /* the gateway may publish it before sx127x_send_packet returns */
+        int64_t tx_end_us = esp_timer_get_time() + sx127x_time_on_air_us(client->dev, len);
+        for (uint8_t i = 0; i < seq_cnt && client->config.sent_cb; i++) {
+            client->config.sent_cb(client->config.index, seq[i], tx_end_us, client->config.sent_cb_arg);
+        }
+        /* the driver goes back to rx after TxDone, the reply window is covered */
+        err = sx127x_send_packet(client->dev, buf, len);
+    }
+    xSemaphoreGive(client->lock);
+    if (err != ESP_OK) {
+        client->stats.send_failures++;
+    }
+    return err;
+}
+
+/* lora_send_compressed() and lora_aggregate_send() of the client build, the held seqs go with it */
+static esp_err_t sim_client_send_uplinks(uint8_t packet_id, uint8_t *data, uint8_t data_len, bool compress,
+                                         uint8_t records, void *arg)
+{
+    sim_client_t *client = arg;
+    lora_frame_t frame = {
+        .packet_id = packet_id,
+        .data_len = data_len,
+    };
+    memcpy(frame.data, data, data_len);
+    if (compress && lora_frame_compress(&frame, 0) == ESP_OK) {
+        client->stats.compressed++;
+    }
+    records = MIN(records, client->pending_cnt);
+    esp_err_t err = sim_client_send(client, &frame, client->pending_seq, records);
+    if (err == ESP_OK) {
+        client->stats.uplinks += records;
+        client->stats.frames++;
+    }
+    client->pending_cnt -= records;
+    memmove(client->pending_seq, &client->pending_seq[records], client->pending_cnt * sizeof(uint32_t));
+    return err;
+}
+
+/* a slow walk around a room climate, every client a bit apart */
+static void sim_client_env_frame(sim_client_t *client, uint32_t seq, lora_frame_t *frame)
+{
+    payload_env_t env = {
+        .temperature_c = 21.0 + 0.5 * client->config.index + 0.05 * (seq % 20),
+        .humidity_pct = 45.0 + 0.1 * (seq % 10),
+        .pressure_hpa = 1013.2,
+        .battery_v = 3.7 - 0.001 * (seq / 10),
+    };
+    size_t len = sizeof(frame->data);
+    frame->packet_id = PAYLOAD_ID_ENV;
+    frame->data_len = 0;
+    if (payload_codec_encode(PAYLOAD_ID_ENV, &env, &client->env_state, frame->data, &len) == ESP_OK) {
+        frame->data_len = len;
+    }
+}
+
+static uint32_t sim_client_delay_ms(uint32_t period_ms)
+{
+    uint32_t jitter_ms = period_ms * SIM_CLIENT_JITTER_PCT / 100;
+    return period_ms - jitter_ms + (jitter_ms ? esp_random() % (2 * jitter_ms) : 0);
+}
+
+/* lora_send_aggregated() of the client build */
+static void sim_client_uplink(sim_client_t *client, lora_frame_t *frame, uint32_t seq)
+{
+    bool compress = client->config.compress && frame->packet_id == SIM_CLIENT_APP_DATA_ID;
+    client->pending_seq[client->pending_cnt++] = seq;
+    esp_err_t err = ESP_ERR_INVALID_SIZE;
+    if (client->config.aggregate_ms) {
+        err = lora_aggregate_put(&client->aggregate, frame->packet_id, frame->data, frame->data_len, compress,
+                                 sim_client_send_uplinks, client);
+    }
+    if (err == ESP_ERR_INVALID_SIZE) {
+        sim_client_send_uplinks(frame->packet_id, frame->data, frame->data_len, compress, 1, client);
+    } else if (err == ESP_OK && client->aggregate.cnt == 1) {
+        client->aggregate_deadline_us = esp_timer_get_time() + (int64_t)client->config.aggregate_ms * 1000;
+    }
+    /* a failed flush takes its records along */
+    client->pending_cnt = client->aggregate.cnt;
+}
+
+static void sim_client_task(void *p)
+{
+    sim_client_t *client = p;
+    lora_frame_t frame;
+    vTaskDelay(pdMS_TO_TICKS(client->config.first_delay_ms));
+    while (!client->stats.provisioned) {
+        /* with the last challenge of the gateway */
+        xSemaphoreTake(client->lock, portMAX_DELAY);
+        lora_provisioning_frame(&frame, client->dev_eui, client->challenge);
+        xSemaphoreGive(client->lock);
+        sim_client_send(client, &frame, NULL, 0);
+        client->stats.provisioning_sent++;
+        vTaskDelay(pdMS_TO_TICKS(sim_client_delay_ms(SIM_CLIENT_PROVISION_RETRY_MS)));
+    }
+    uint32_t seq = 0;
+    int64_t next_uplink_us = esp_timer_get_time();
+    while (pdTRUE) {
+        int64_t now_us = esp_timer_get_time();
+        if (client->aggregate.cnt && now_us >= client->aggregate_deadline_us) {
+            lora_aggregate_flush(&client->aggregate, sim_client_send_uplinks, client);
+        }
+        if (now_us < next_uplink_us) {
+            int64_t wake_us = client->aggregate.cnt ? MIN(next_uplink_us, client->aggregate_deadline_us) : next_uplink_us;
+            vTaskDelay(pdMS_TO_TICKS((wake_us - now_us + 999) / 1000));
+            continue;
+        }
+        memset(&frame, 0, sizeof(frame));
+        if (client->config.env_readings) {
+            sim_client_env_frame(client, seq, &frame);
+        } else {
+            frame.packet_id = SIM_CLIENT_APP_DATA_ID;
+            frame.data_len = snprintf((char *)frame.data, sizeof(frame.data), SIM_CLIENT_DATA_FMT, client->config.index, seq);
+        }
+        sim_client_uplink(client, &frame, seq);
+        seq++;
+        next_uplink_us = now_us + (int64_t)sim_client_delay_ms(client->config.period_ms) * 1000;
+    }
+}
+
+esp_err_t sim_client_start(const sim_client_config_t *config)
+{
+    if (!config || config->index >= SIM_CLIENT_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (config->compress && lora_compress_init() != ESP_OK) {
+        return ESP_ERR_NO_MEM;
+    }
+    sim_client_t *client = &s_clients[config->index];
+    memset(client, 0, sizeof(sim_client_t));
+    client->config = *config;
+    snprintf(client->name, sizeof(client->name), "client%u", config->index);
+    /* locally administered, the gateway has 02:00:00:00:00:01 */
+    client->dev_eui[0] = 0x02;
+    client->dev_eui[4] = 0x10;
+    client->dev_eui[5] = config->index;
+
+    int pin = SIM_CLIENT_PIN_BASE + 3 * config->index;
+    sx127x_sim_radio_config_t sim_config = {
+        .name = client->name,
+        .pin_nss = pin,
+        .pin_rst = pin + 1,
+        .pin_dio0 = pin + 2,
+        .freq_offset_hz = (config->index % 5) * 500 - 1000,
+    };
+    int radio_id = sx127x_sim_radio_add(&sim_config);
+    if (radio_id < 0) {
+        return ESP_FAIL;
+    }
+    for (uint8_t gw = 0; gw < config->gateway_radio_cnt; gw++) {
+        sx127x_sim_set_path_loss(radio_id, gw, config->path_loss_db);
+    }
+
+    client->lock = xSemaphoreCreateMutex();
+    if (!client->lock) {
+        return ESP_ERR_NO_MEM;
+    }
+    sx127x_config_t dev_config = {
+        .spi_host = TTN_SPI_HOST,
+        .pin_miso = TTN_PIN_SPI_MISO,
+        .pin_mosi = TTN_PIN_SPI_MOSI,
+        .pin_sclk = TTN_PIN_SPI_SCLK,
+        .pin_nss = sim_config.pin_nss,
+        .pin_rst = sim_config.pin_rst,
+        .pin_dio0 = sim_config.pin_dio0,
+        .rx_task = sim_client_rx_task,
+        .user_ctx = client,
+        .modem = SX127X_MODEM_CONFIG_DEFAULT(),
+    };
+    if (config->spreading_factor) {
+        dev_config.modem.spreading_factor = config->spreading_factor;
+    }
+    xSemaphoreTake(client->lock, portMAX_DELAY);
+    esp_err_t err = sx127x_init(&dev_config, &client->dev);
+    if (err == ESP_OK) {
+        sx127x_receive(client->dev);
+    }
+    xSemaphoreGive(client->lock);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "%s radio couldn't be started (%s)", client->name, esp_err_to_name(err));
+        return err;
+    }
+    if (xTaskCreate(sim_client_task, "sim_client", SIM_CLIENT_TASK_STACK, client, SIM_CLIENT_TASK_PRIO, NULL) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+esp_err_t sim_client_get_stats(uint8_t index, sim_client_stats_t *stats)
+{
+    if (index >= SIM_CLIENT_MAX || !s_clients[index].dev) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *stats = s_clients[index].stats;
+    return ESP_OK;
+}
+
+esp_err_t sim_client_get_dev_eui(uint8_t index, uint8_t *dev_eui)
+{
+    if (index >= SIM_CLIENT_MAX || !s_clients[index].dev) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memcpy(dev_eui, s_clients[index].dev_eui, LORA_DEV_EUI_LEN);
+    return ESP_OK;
+}
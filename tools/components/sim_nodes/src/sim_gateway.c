@@ -0,0 +1,71 @@
+#include <string.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "core/sx127x.h"
+#include "core/file_mngr.h"
+#include "app/app_types.h"
+#include "app/app_config.h"
+#include "app/lora_manager.h"
+#include "sim/sx127x_sim.h"
+#include "sim_gateway.h"
+
+static const char *TAG = "sim_gateway";
+
+/* app_mngr.c is not in the host build */
+app_params_t app_params;
+
+esp_err_t sim_gateway_start(uint8_t radio_cnt)
+{
+    if (!radio_cnt || radio_cnt > APP_LORA_RADIO_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_err_t err = file_mngr_init(APP_CONFIG_FILE_BASE_PATH);
+    if (err != ESP_OK) {
+        return err;
+    }
+    memset(&app_params, 0, sizeof(app_params));
+    app_params.dev_model = APP_DEV_MODEL;
+    app_params.dev_serial = APP_SERIAL;
+    app_params.device_type = APP_DEVICE_IS_MASTER;
+    app_params.lora_modem = (sx127x_modem_config_t)SX127X_MODEM_CONFIG_DEFAULT();
+    app_params.lora_radios[0] = (app_lora_radio_t) {
+        .pin_nss = TTN_PIN_NSS,
+        .pin_rst = TTN_PIN_RST,
+        .pin_dio0 = TTN_PIN_DIO0,
+    };
+    app_params.lora_radios[1] = (app_lora_radio_t) {
+        .pin_nss = SIM_GATEWAY_RADIO1_PIN_NSS,
+        .pin_rst = SIM_GATEWAY_RADIO1_PIN_RST,
+        .pin_dio0 = SIM_GATEWAY_RADIO1_PIN_DIO0,
+        .spreading_factor = SIM_GATEWAY_RADIO1_SF,
+    };
+    app_params.lora_radio_cnt = radio_cnt;
+    app_params.lora_lbt = (app_lora_lbt_t) {
+        .mode = APP_LORA_LBT_OFF,
+        .rssi_threshold = APP_LORA_LBT_RSSI_THRESHOLD,
+        .max_attempts = APP_LORA_LBT_MAX_ATTEMPTS,
+        .backoff_min_ms = APP_LORA_LBT_BACKOFF_MIN_MS,
+        .backoff_max_ms = APP_LORA_LBT_BACKOFF_MAX_MS,
+    };
+    app_params.lora_duty_cycle = (app_lora_duty_cycle_t) {
+        .enabled = true,
+        .policy = DUTY_CYCLE_POLICY_DEFER,
+        .max_defer_ms = APP_LORA_DUTY_CYCLE_MAX_DEFER_MS,
+    };
+    app_params.lora_rx1_delay_ms = APP_LORA_RX1_DELAY_MS;
+
+    for (uint8_t i = 0; i < app_params.lora_radio_cnt; i++) {
+        const app_lora_radio_t *radio = &app_params.lora_radios[i];
+        sx127x_sim_radio_config_t config = {
+            .name = i ? "gw1" : "gw0",
+            .pin_nss = radio->pin_nss,
+            .pin_rst = radio->pin_rst,
+            .pin_dio0 = radio->pin_dio0,
+        };
+        if (sx127x_sim_radio_add(&config) != i) {
+            ESP_LOGE(TAG, "gateway radios have to be the first ones on the channel!");
+            return ESP_ERR_INVALID_STATE;
+        }
+    }
+    return lora_process_start();
+}
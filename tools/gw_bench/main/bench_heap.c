@@ -0,0 +1,113 @@
+#include <stdint.h>
+#include <stdatomic.h>
+#include <string.h>
+#include "bench_heap.h"
+
+/*
+ * Every block gets a header with its size, blocks libc allocated internally (strdup,
+ * fopen..) don't have the magic and are freed untouched.
+ */
+
+#define BENCH_HEAP_MAGIC    0x68656170u
+#define BENCH_HEAP_HDR_LEN  16  /* keeps the malloc alignment */
+
+typedef struct {
+    uint32_t magic;
+    uint32_t reserved;
+    size_t size;
+} bench_heap_hdr_t;
+
+void *__real_malloc(size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+static atomic_size_t s_in_use = 0;
+static atomic_size_t s_peak = 0;
+
+static void bench_heap_add(size_t size)
+{
+    size_t in_use = atomic_fetch_add(&s_in_use, size) + size;
+    size_t peak = atomic_load(&s_peak);
+    while (in_use > peak && !atomic_compare_exchange_weak(&s_peak, &peak, in_use)) {
+    }
+}
+
+static bench_heap_hdr_t *bench_heap_hdr(void *ptr)
+{
+    bench_heap_hdr_t *hdr = (bench_heap_hdr_t *)((uint8_t *)ptr - BENCH_HEAP_HDR_LEN);
+    return hdr->magic == BENCH_HEAP_MAGIC ? hdr : NULL;
+}
+
+void *__wrap_malloc(size_t size)
+{
+    bench_heap_hdr_t *hdr = __real_malloc(size + BENCH_HEAP_HDR_LEN);
+    if (!hdr) {
+        return NULL;
+    }
+    hdr->magic = BENCH_HEAP_MAGIC;
+    hdr->size = size;
+    bench_heap_add(size);
+    return (uint8_t *)hdr + BENCH_HEAP_HDR_LEN;
+}
+
+void *__wrap_calloc(size_t n, size_t size)
+{
+    if (size && n > SIZE_MAX / size) {
+        return NULL;
+    }
+    void *ptr = __wrap_malloc(n * size);
+    if (ptr) {
+        memset(ptr, 0, n * size);
+    }
+    return ptr;
+}
+
+void __wrap_free(void *ptr)
+{
+    if (!ptr) {
+        return;
+    }
+    bench_heap_hdr_t *hdr = bench_heap_hdr(ptr);
+    if (!hdr) {
+        __real_free(ptr);
+        return;
+    }
+    atomic_fetch_sub(&s_in_use, hdr->size);
+    hdr->magic = 0;
+    __real_free(hdr);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    if (!ptr) {
+        return __wrap_malloc(size);
+    }
+    bench_heap_hdr_t *hdr = bench_heap_hdr(ptr);
+    if (!hdr) {
+        return __real_realloc(ptr, size);
+    }
+    size_t old_size = hdr->size;
+    bench_heap_hdr_t *new_hdr = __real_realloc(hdr, size + BENCH_HEAP_HDR_LEN);
+    if (!new_hdr) {
+        return NULL;
+    }
+    new_hdr->size = size;
+    atomic_fetch_sub(&s_in_use, old_size);
+    bench_heap_add(size);
+    return (uint8_t *)new_hdr + BENCH_HEAP_HDR_LEN;
+}
+
+size_t bench_heap_in_use(void)
+{
+    return atomic_load(&s_in_use);
+}
+
+size_t bench_heap_peak(void)
+{
+    return atomic_load(&s_peak);
+}
+
+void bench_heap_reset_peak(void)
+{
+    atomic_store(&s_peak, atomic_load(&s_in_use));
+}
@@ -0,0 +1,19 @@
+#ifndef _BENCH_HEAP_H_
+#define _BENCH_HEAP_H_
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* bytes allocated through malloc and friends, the linker wraps them for the whole process */
+size_t bench_heap_in_use(void);
+size_t bench_heap_peak(void);
+void bench_heap_reset_peak(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
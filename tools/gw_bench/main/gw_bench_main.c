@@ -0,0 +1,288 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_random.h"
+#include "app/app_types.h"
+#include "app/lora_manager.h"
+#include "app/mqtt_host.h"
+#include "sim/sx127x_sim.h"
+#include "sim_nodes/sim_client.h"
+#include "sim_nodes/sim_gateway.h"
+#include "bench_heap.h"
+
+/*
+ * Gateway load benchmark, the gateway firmware against N simulated clients and an in-process
+ * broker. Uplinks sent in the measurement window are matched to their publishes.
+ *
+ *  BENCH_CLIENTS        client count (8)
+ *  BENCH_RADIOS         gateway radios, 1 or 2 (2), odd clients use the SF of the second one
+ *  BENCH_PERIOD_MS      uplink period of a client (10000)
+ *  BENCH_DURATION_S     measurement window (60)
+ *  BENCH_WARMUP_S       provisioning time limit before the window (30)
+ *  BENCH_LOSS           random frame loss, 0..1 (0)
+ *  BENCH_PATH_LOSS      client to gateway path loss in dB (100)
+ *  BENCH_PUB_DELAY_MS   broker time per publish (0)
+ *  BENCH_PUB_FAIL       failed publish ratio, 0..1 (0)
+ *  BENCH_AGGREGATE_MS   clients hold uplinks this long to send them in one frame (0)
+ */
+
+#define BENCH_SENT_WINDOW       256     /* uplinks of a client waiting for their publish */
+#define BENCH_LATENCY_MAX       (64 * 1024)
+#define BENCH_DRAIN_MS          3000
+#define BENCH_PROGRESS_MS       10000
+
+static const char *TAG = "gw_bench";
+
+typedef struct {
+    uint32_t seq;
+    int64_t tx_end_us;
+    bool valid;
+    bool published;
+} bench_sent_t;
+
+typedef struct {
+    uint32_t sent;
+    uint32_t published;
+    uint32_t unknown;           /* publishes without an uplink of the window */
+} bench_counters_t;
+
+static SemaphoreHandle_t s_lock = NULL;
+static bench_sent_t s_sent[SIM_CLIENT_MAX][BENCH_SENT_WINDOW];
+static bench_counters_t s_counters = {0};
+static int64_t s_latency_us[BENCH_LATENCY_MAX];   /* not on the measured heap */
+static uint32_t s_latency_cnt = 0;
+static volatile bool s_measuring = false;
+static uint32_t s_pub_delay_ms = 0;
+static float s_pub_fail = 0;
+
+static long bench_env(const char *name, long def)
+{
+    const char *value = getenv(name);
+    return value && value[0] ? strtol(value, NULL, 0) : def;
+}
+
+static float bench_env_float(const char *name, float def)
+{
+    const char *value = getenv(name);
+    return value && value[0] ? strtof(value, NULL) : def;
+}
+
+static void bench_on_sent(uint8_t index, uint32_t seq, int64_t tx_end_us, void *arg)
+{
+    if (!s_measuring) {
+        return;
+    }
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    s_sent[index][seq % BENCH_SENT_WINDOW] = (bench_sent_t) {
+        .seq = seq,
+        .tx_end_us = tx_end_us,
+        .valid = true,
+    };
+    s_counters.sent++;
+    xSemaphoreGive(s_lock);
+}
+
+/* broker stand-in, the publish task of lora_manager blocks in here like on a slow broker */
+static esp_err_t bench_on_publish(const char *topic, const char *data, void *arg)
+{
+    int64_t now_us = esp_timer_get_time();
+    unsigned index;
+    uint32_t seq;
+    if (s_pub_delay_ms) {
+        vTaskDelay(pdMS_TO_TICKS(s_pub_delay_ms));
+    }
+    if (s_pub_fail > 0 && (float)esp_random() / UINT32_MAX < s_pub_fail) {
+        return ESP_FAIL;
+    }
+    if (sscanf(data, SIM_CLIENT_DATA_SCN, &index, &seq) != 2 || index >= SIM_CLIENT_MAX) {
+        return ESP_OK;
+    }
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    bench_sent_t *sent = &s_sent[index][seq % BENCH_SENT_WINDOW];
+    if (!sent->valid || sent->seq != seq) {
+        s_counters.unknown++;
+    } else if (!sent->published) {
+        sent->published = true;
+        s_counters.published++;
+        if (s_latency_cnt < BENCH_LATENCY_MAX) {
+            s_latency_us[s_latency_cnt++] = now_us - sent->tx_end_us;
+        }
+    }
+    xSemaphoreGive(s_lock);
+    return ESP_OK;
+}
+
+static int bench_cmp_i64(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static int64_t bench_percentile(const int64_t *sorted, uint32_t cnt, uint32_t per_mille)
+{
+    if (!cnt) {
+        return 0;
+    }
+    uint32_t i = (uint32_t)(((uint64_t)cnt * per_mille + 999) / 1000);
+    return sorted[MIN(MAX(i, 1), cnt) - 1];
+}
+
+static uint32_t bench_provisioned(uint8_t client_cnt)
+{
+    uint32_t provisioned = 0;
+    for (uint8_t i = 0; i < client_cnt; i++) {
+        sim_client_stats_t stats;
+        if (sim_client_get_stats(i, &stats) == ESP_OK) {
+            provisioned += stats.provisioned;
+        }
+    }
+    return provisioned;
+}
+
+/* uplink frames on air, with aggregation one carries several uplinks */
+static uint32_t bench_client_frames(uint8_t client_cnt)
+{
+    uint32_t frames = 0;
+    for (uint8_t i = 0; i < client_cnt; i++) {
+        sim_client_stats_t stats;
+        if (sim_client_get_stats(i, &stats) == ESP_OK) {
+            frames += stats.frames;
+        }
+    }
+    return frames;
+}
+
+/* outcome of the frames arriving at the gateway radios */
+static void bench_gateway_channel_stats(uint8_t radio_cnt, sx127x_sim_stats_t *total)
+{
+    memset(total, 0, sizeof(sx127x_sim_stats_t));
+    for (uint8_t i = 0; i < radio_cnt; i++) {
+        sx127x_sim_stats_t stats;
+        sx127x_sim_get_radio_stats(i, &stats);
+        total->tx_frames += stats.tx_frames;
+        total->rx_delivered += stats.rx_delivered;
+        total->rx_collisions += stats.rx_collisions;
+        total->rx_lost_random += stats.rx_lost_random;
+        total->rx_below_sensitivity += stats.rx_below_sensitivity;
+        total->rx_busy += stats.rx_busy;
+        total->rx_not_listening += stats.rx_not_listening;
+        total->rx_aborted += stats.rx_aborted;
+    }
+}
+
+void app_main(void)
+{
+    sx127x_sim_channel_config_t channel = SX127X_SIM_CHANNEL_CONFIG_DEFAULT();
+    channel.loss_rate = bench_env_float("BENCH_LOSS", channel.loss_rate);
+    float path_loss_db = bench_env_float("BENCH_PATH_LOSS", channel.default_path_loss_db);
+    uint8_t client_cnt = MIN(MAX(bench_env("BENCH_CLIENTS", 8), 1), SIM_CLIENT_MAX);
+    uint8_t radio_cnt = MIN(MAX(bench_env("BENCH_RADIOS", 2), 1), APP_LORA_RADIO_MAX);
+    uint32_t period_ms = bench_env("BENCH_PERIOD_MS", 10000);
+    uint32_t duration_s = bench_env("BENCH_DURATION_S", 60);
+    uint32_t warmup_s = bench_env("BENCH_WARMUP_S", 30);
+    s_pub_delay_ms = bench_env("BENCH_PUB_DELAY_MS", 0);
+    s_pub_fail = bench_env_float("BENCH_PUB_FAIL", 0);
+    uint32_t aggregate_ms = bench_env("BENCH_AGGREGATE_MS", 0);
+
+    s_lock = xSemaphoreCreateMutex();
+    ESP_ERROR_CHECK(sx127x_sim_channel_init(&channel));
+    mqtt_host_set_publish_cb(bench_on_publish, NULL);
+    ESP_ERROR_CHECK(sim_gateway_start(radio_cnt));
+    for (uint8_t i = 0; i < client_cnt; i++) {
+        sim_client_config_t config = {
+            .index = i,
+            .spreading_factor = radio_cnt > 1 && i % 2 ? SIM_GATEWAY_RADIO1_SF : 0,
+            .gateway_radio_cnt = radio_cnt,
+            .path_loss_db = path_loss_db,
+            .period_ms = period_ms,
+            .first_delay_ms = i * period_ms / client_cnt,
+            .aggregate_ms = aggregate_ms,
+            .sent_cb = bench_on_sent,
+        };
+        ESP_ERROR_CHECK(sim_client_start(&config));
+    }
+
+    int64_t warmup_end_us = esp_timer_get_time() + (int64_t)warmup_s * 1000000;
+    while (bench_provisioned(client_cnt) < client_cnt && esp_timer_get_time() < warmup_end_us) {
+        vTaskDelay(pdMS_TO_TICKS(100));
+    }
+    uint32_t provisioned = bench_provisioned(client_cnt);
+    if (provisioned < client_cnt) {
+        ESP_LOGW(TAG, "%" PRIu32 "/%d clients are provisioned after the warmup", provisioned, client_cnt);
+    }
+
+    /* counters of the firmware can't be reset, the window is the difference */
+    lora_rx_stats_t rx_start, rx_end;
+    lora_get_rx_stats(&rx_start);
+    sx127x_sim_reset_stats();
+    bench_heap_reset_peak();
+    uint32_t frames_start = bench_client_frames(client_cnt);
+    int64_t start_us = esp_timer_get_time();
+    int64_t end_us = start_us + (int64_t)duration_s * 1000000;
+    s_measuring = true;
+    printf("measuring %" PRIu32 "/%d provisioned clients, %d gateway radios, %" PRIu32 "ms period for %" PRIu32 "s\n",
+           provisioned, client_cnt, radio_cnt, period_ms, duration_s);
+    while (esp_timer_get_time() < end_us) {
+        vTaskDelay(pdMS_TO_TICKS(MIN(BENCH_PROGRESS_MS, (end_us - esp_timer_get_time()) / 1000 + 1)));
+        printf("%3" PRIi64 "s sent:%" PRIu32 " published:%" PRIu32 "\n",
+               (esp_timer_get_time() - start_us) / 1000000, s_counters.sent, s_counters.published);
+    }
+    s_measuring = false;
+    uint32_t frames = bench_client_frames(client_cnt) - frames_start;
+    /* the frames of the window still in the gateway */
+    vTaskDelay(pdMS_TO_TICKS(BENCH_DRAIN_MS));
+
+    lora_get_rx_stats(&rx_end);
+    sx127x_sim_stats_t gw;
+    bench_gateway_channel_stats(radio_cnt, &gw);
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    bench_counters_t counters = s_counters;
+    uint32_t latency_cnt = s_latency_cnt;
+    qsort(s_latency_us, latency_cnt, sizeof(int64_t), bench_cmp_i64);
+    xSemaphoreGive(s_lock);
+
+    double window_s = (double)(end_us - start_us) / 1000000;
+    uint32_t lost = counters.sent > counters.published ? counters.sent - counters.published : 0;
+    /* overlapping frames, the one the receiver locked on fails its crc, the later one is missed */
+    uint32_t collision = gw.rx_collisions + gw.rx_busy;
+    /* gateway radio was transmitting or switching */
+    uint32_t deaf = gw.rx_not_listening + gw.rx_aborted;
+    uint32_t weak = gw.rx_below_sensitivity;
+    uint32_t random = gw.rx_lost_random;
+    uint32_t queue_overflow = (rx_end.rx_ring_drops - rx_start.rx_ring_drops) + (rx_end.pub_ring_drops - rx_start.pub_ring_drops);
+    uint32_t publish_failure = rx_end.publish_failures - rx_start.publish_failures;
+    uint32_t attributed = collision + deaf + weak + random + queue_overflow + publish_failure;
+    int64_t p50 = bench_percentile(s_latency_us, latency_cnt, 500);
+    int64_t p99 = bench_percentile(s_latency_us, latency_cnt, 990);
+    int64_t p999 = bench_percentile(s_latency_us, latency_cnt, 999);
+    int64_t max = latency_cnt ? s_latency_us[latency_cnt - 1] : 0;
+
+    printf("uplinks sent:%" PRIu32 " in frames:%" PRIu32 " published:%" PRIu32 " (%.2f/s) lost:%" PRIu32 " (%.1f%%)\n",
+           counters.sent, frames, counters.published, counters.published / window_s, lost,
+           counters.sent ? 100.0 * lost / counters.sent : 0);
+    printf("radio to publish latency p50:%" PRIi64 "us p99:%" PRIi64 "us p999:%" PRIi64 "us max:%" PRIi64 "us\n",
+           p50, p99, p999, max);
+    printf("loss collision:%" PRIu32 " rx deaf:%" PRIu32 " weak:%" PRIu32 " random:%" PRIu32
+           " queue overflow:%" PRIu32 " publish failure:%" PRIu32 " other:%" PRIu32 "\n",
+           collision, deaf, weak, random, queue_overflow, publish_failure,
+           lost > attributed ? lost - attributed : 0);
+    printf("peak heap:%zu bytes, in use:%zu bytes\n", bench_heap_peak(), bench_heap_in_use());
+    /* one line for the regression scripts */
+    printf("{\"clients\":%d,\"provisioned\":%" PRIu32 ",\"radios\":%d,\"period_ms\":%" PRIu32 ",\"window_s\":%.1f,"
+           "\"sent\":%" PRIu32 ",\"frames\":%" PRIu32 ",\"published\":%" PRIu32 ",\"uplinks_per_s\":%.3f,"
+           "\"latency_us\":{\"p50\":%" PRIi64 ",\"p99\":%" PRIi64 ",\"p999\":%" PRIi64 ",\"max\":%" PRIi64 "},"
+           "\"loss\":{\"total\":%" PRIu32 ",\"collision\":%" PRIu32 ",\"rx_deaf\":%" PRIu32 ",\"weak\":%" PRIu32
+           ",\"random\":%" PRIu32 ",\"queue_overflow\":%" PRIu32 ",\"publish_failure\":%" PRIu32 "},"
+           "\"peak_heap\":%zu}\n",
+           client_cnt, provisioned, radio_cnt, period_ms, window_s, counters.sent, frames, counters.published,
+           counters.published / window_s, p50, p99, p999, max, lost, collision, deaf, weak, random,
+           queue_overflow, publish_failure, bench_heap_peak());
+    exit(lost && !counters.published ? 1 : 0);
+}
@@ -0,0 +1,168 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "app/app_types.h"
+#include "app/lora_manager.h"
+#include "app/downlink_manager.h"
+#include "app/mqtt_host.h"
+#include "app/payload_codec.h"
+#include "app/address_manager.h"
+#include "app/tx_queue_manager.h"
+#include "app/frame_pool_manager.h"
+#include "sim/sx127x_sim.h"
+#include "sim_nodes/sim_client.h"
+#include "sim_nodes/sim_gateway.h"
+
+/*
+ * Gateway firmware on the host. lora_manager runs unmodified on two simulated radios,
+ * the clients are simulated radios driven with the sx127x driver on the same channel.
+ *
+ *  SIM_CLIENTS      client count (4)
+ *  SIM_PERIOD_MS    uplink period of a client (5000)
+ *  SIM_LOSS         random frame loss, 0..1 (0)
+ *  SIM_PATH_LOSS    client to gateway path loss in dB (100)
+ *  SIM_DURATION_S   run time, 0 runs forever (0)
+ *  SIM_ENV          clients send payload codec env readings instead of text (0)
+ *  SIM_AGGREGATE_MS clients hold uplinks this long to send them in one frame (0)
+ *  SIM_COMPRESS     clients compress their text and aggregate frames (0)
+ */
+
+#define HOST_SIM_GW_RADIO_CNT       2
+#define HOST_SIM_STATS_PERIOD_MS    10000
+#define HOST_SIM_DOWNLINK_PERIOD_MS 30000
+
+static const char *TAG = "host_sim";
+
+static uint8_t s_client_cnt = 0;
+static volatile uint32_t s_published = 0;
+
+static long host_sim_env(const char *name, long def)
+{
+    const char *value = getenv(name);
+    return value && value[0] ? strtol(value, NULL, 0) : def;
+}
+
+static float host_sim_env_float(const char *name, float def)
+{
+    const char *value = getenv(name);
+    return value && value[0] ? strtof(value, NULL) : def;
+}
+
+static esp_err_t host_sim_on_publish(const char *topic, const char *data, void *arg)
+{
+    s_published++;
+    ESP_LOGD(TAG, "published %s: %s", topic, data);
+    return ESP_OK;
+}
+
+static void host_sim_print_stats(void)
+{
+    lora_rx_stats_t rx;
+    lora_tx_stats_t tx;
+    sx127x_sim_stats_t channel;
+    downlink_stats_t downlink;
+    payload_codec_stats_t codec;
+    address_stats_t address;
+    lora_get_rx_stats(&rx);
+    lora_get_tx_stats(&tx);
+    sx127x_sim_get_stats(&channel);
+    downlink_mngr_get_stats(&downlink);
+    payload_codec_get_stats(&codec);
+    address_mngr_get_stats(&address);
+    uint32_t uplinks = 0, frames = 0, compressed = 0, downlinks = 0, provisioned = 0;
+    for (uint8_t i = 0; i < s_client_cnt; i++) {
+        sim_client_stats_t client;
+        sim_client_get_stats(i, &client);
+        uplinks += client.uplinks;
+        frames += client.frames;
+        compressed += client.compressed;
+        downlinks += client.downlinks;
+        provisioned += client.provisioned;
+    }
+    ESP_LOGI(TAG, "clients:%d provisioned:%" PRIu32 " uplinks:%" PRIu32 " frames:%" PRIu32 " compressed:%" PRIu32 " downlinks:%" PRIu32,
+             s_client_cnt, provisioned, uplinks, frames, compressed, downlinks);
+    ESP_LOGI(TAG, "gateway rx:%" PRIu32 " records:%" PRIu32 " published:%" PRIu32 " latency avg/max:%" PRIi64 "/%" PRIi64 "us tx:%" PRIu32 " replies:%" PRIu32 " missed:%" PRIu32,
+             rx.rx_frames, rx.rx_records, s_published, rx.publish_latency_avg_us, rx.publish_latency_max_us,
+             tx.sent, tx.replies_sent, tx.reply_windows_missed);
+    ESP_LOGI(TAG, "gateway duplicates:%" PRIu32 " replays:%" PRIu32 " addresses:%" PRIu32 " unknown address:%" PRIu32
+             " decompress errors:%" PRIu32 " bad lengths:%" PRIu32 " bad tags:%" PRIu32 " resyncs:%" PRIu32,
+             rx.rx_duplicates, rx.rx_replays, address.assigned, address.unknown, rx.rx_decompress_errors,
+             rx.rx_bad_lengths, rx.rx_bad_tags, rx.rx_fcnt_resyncs);
+    ESP_LOGI(TAG, "channel tx:%" PRIu32 " aborted:%" PRIu32 " delivered:%" PRIu32 " collisions:%" PRIu32
+             " lost:%" PRIu32 " weak:%" PRIu32 " busy:%" PRIu32 " not listening:%" PRIu32 " rx aborted:%" PRIu32,
+             channel.tx_frames, channel.tx_aborted, channel.rx_delivered, channel.rx_collisions,
+             channel.rx_lost_random, channel.rx_below_sensitivity, channel.rx_busy, channel.rx_not_listening, channel.rx_aborted);
+    ESP_LOGI(TAG, "downlinks queued:%" PRIu32 " delivered:%" PRIu32, downlink.queued, downlink.delivered);
+    ESP_LOGI(TAG, "readings encoded:%" PRIu32 " decoded:%" PRIu32 " no base:%" PRIu32 " duplicates:%" PRIu32 " invalid:%" PRIu32,
+             codec.encoded, codec.decoded, codec.no_base, codec.duplicates, codec.invalid);
+    tx_queue_mngr_log_stats();
+    frame_pool_mngr_log_stats();
+}
+
+/* what the broker would send on the downlink topic */
+static void host_sim_send_downlink(uint8_t client)
+{
+    uint8_t eui[LORA_DEV_EUI_LEN];
+    char downlink[96];
+    if (sim_client_get_dev_eui(client, eui) != ESP_OK) {
+        return;
+    }
+    int len = snprintf(downlink, sizeof(downlink), "{\"dev_eui\":\"%02X%02X%02X%02X%02X%02X\",\"data\":\"hello\"}",
+                       eui[0], eui[1], eui[2], eui[3], eui[4], eui[5]);
+    downlink_mngr_handle_mqtt(downlink, len);
+}
+
+void app_main(void)
+{
+    sx127x_sim_channel_config_t channel = SX127X_SIM_CHANNEL_CONFIG_DEFAULT();
+    channel.loss_rate = host_sim_env_float("SIM_LOSS", channel.loss_rate);
+    float path_loss_db = host_sim_env_float("SIM_PATH_LOSS", channel.default_path_loss_db);
+    uint8_t client_cnt = MIN(host_sim_env("SIM_CLIENTS", 4), SIM_CLIENT_MAX);
+    uint32_t period_ms = host_sim_env("SIM_PERIOD_MS", 5000);
+    uint32_t duration_s = host_sim_env("SIM_DURATION_S", 0);
+    bool env_readings = host_sim_env("SIM_ENV", 0);
+    uint32_t aggregate_ms = host_sim_env("SIM_AGGREGATE_MS", 0);
+    bool compress = host_sim_env("SIM_COMPRESS", 0);
+
+    ESP_ERROR_CHECK(sx127x_sim_channel_init(&channel));
+    mqtt_host_set_publish_cb(host_sim_on_publish, NULL);
+    ESP_ERROR_CHECK(sim_gateway_start(HOST_SIM_GW_RADIO_CNT));
+    for (uint8_t i = 0; i < client_cnt; i++) {
+        sim_client_config_t config = {
+            .index = i,
+            /* every other client talks to the second gateway radio */
+            .spreading_factor = i % 2 ? SIM_GATEWAY_RADIO1_SF : 0,
+            .gateway_radio_cnt = HOST_SIM_GW_RADIO_CNT,
+            .path_loss_db = path_loss_db,
+            .period_ms = period_ms,
+            .first_delay_ms = i * period_ms / client_cnt,
+            .env_readings = env_readings,
+            .aggregate_ms = aggregate_ms,
+            .compress = compress,
+        };
+        if (sim_client_start(&config) != ESP_OK) {
+            ESP_LOGE(TAG, "client%d couldn't be started!", i);
+            break;
+        }
+        s_client_cnt++;
+    }
+
+    int64_t start_us = esp_timer_get_time();
+    int64_t last_downlink_us = start_us;
+    while (!duration_s || esp_timer_get_time() - start_us < (int64_t)duration_s * 1000000) {
+        vTaskDelay(pdMS_TO_TICKS(HOST_SIM_STATS_PERIOD_MS));
+        host_sim_print_stats();
+        if (s_client_cnt && esp_timer_get_time() - last_downlink_us >= HOST_SIM_DOWNLINK_PERIOD_MS * 1000LL) {
+            host_sim_send_downlink(0);
+            last_downlink_us = esp_timer_get_time();
+        }
+    }
+    host_sim_print_stats();
+    exit(0);
+}
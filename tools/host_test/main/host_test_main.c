@@ -0,0 +1,364 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <inttypes.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "core/sx127x_modem.h"
+#include "core/file_mngr.h"
+#include "app/app_config.h"
+#include "app/app_types.h"
+#include "app/lora_manager.h"
+#include "app/payload_codec.h"
+#include "app/replay_manager.h"
+#include "app/fragment_manager.h"
+#include "app/lz_codec.h"
+
+/*
+ * Unit tests of the pure gateway code, known values and round trips, then the broken
+ * inputs a frame from the air may carry. A case stops at its first failed check, the exit
+ * status is the number of failed cases.
+ *
+ *  TEST_FILTER        runs the cases with this in their name (all)
+ *  SIM_FS_ROOT        host directory of the replay table (sim_fs)
+ */
+
+#define HOST_TEST_FRAGMENT_MAX  (FRAGMENT_COUNT_MAX + 2)
+#define HOST_TEST_FRAGMENT_LEN  600
+
+#define HOST_TEST_CHECK(cond) do {                                      \
+        if (!(cond)) {                                                  \
+            printf("  %s:%d: %s\n", __FILE__, __LINE__, #cond);         \
+            return ESP_FAIL;                                            \
+        }                                                               \
+    } while (0)
+
+/* lora_manager reads it, the gateway defaults are enough here */
+app_params_t app_params;
+
+typedef struct {
+    const char *name;
+    esp_err_t (*run)(void);
+} host_test_case_t;
+
+static const uint8_t s_dev_eui[LORA_DEV_EUI_LEN] = {0x02, 0x00, 0x00, 0x00, 0x10, 0x01};
+
+/* known values of the Semtech LoRa calculator, 8 symbol preamble, crc on */
+static esp_err_t test_toa_sf7(void)
+{
+    sx127x_modem_config_t modem = SX127X_MODEM_CONFIG_DEFAULT();
+    HOST_TEST_CHECK(!sx127x_modem_low_data_rate_optimize(&modem));
+    HOST_TEST_CHECK(sx127x_modem_symbol_time_us(&modem) == 1024);
+    HOST_TEST_CHECK(sx127x_modem_time_on_air_us(&modem, 20) == 56576);
+    modem.implicit_header = true;
+    HOST_TEST_CHECK(sx127x_modem_time_on_air_us(&modem, 20) == 51456);
+    HOST_TEST_CHECK(sx127x_modem_time_on_air_us(&modem, 0) == 20736);
+    return ESP_OK;
+}
+
+/* a 32.768ms symbol turns the low data rate optimization on */
+static esp_err_t test_toa_sf12_ldro(void)
+{
+    sx127x_modem_config_t modem = SX127X_MODEM_CONFIG_DEFAULT();
+    modem.spreading_factor = 12;
+    HOST_TEST_CHECK(sx127x_modem_low_data_rate_optimize(&modem));
+    HOST_TEST_CHECK(sx127x_modem_time_on_air_us(&modem, 51) == 2465792);
+    modem.implicit_header = true;
+    HOST_TEST_CHECK(sx127x_modem_time_on_air_us(&modem, 51) == 2301952);
+    return ESP_OK;
+}
+
+static esp_err_t test_lz_round_trip(void)
+{
+    uint8_t random[LZ_CODEC_INPUT_MAX], out[LZ_CODEC_INPUT_MAX + LZ_CODEC_INPUT_MAX / 64 + 8], back[LZ_CODEC_INPUT_MAX];
+    srand(1);
+    for (size_t i = 0; i < sizeof(random); i++) {
+        random[i] = rand();
+    }
+    const struct {
+        const uint8_t *data;
+        size_t len;
+    } inputs[] = {
+        {(const uint8_t *)"{\"type\":\"env\",\"seq\":3,\"temperature_c\":21.5,\"humidity_pct\":40.2}", 62},
+        {(const uint8_t *)"aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa", 48},
+        {(const uint8_t *)"x", 1},
+        {random, sizeof(random)},
+    };
+    HOST_TEST_CHECK(lz_codec_init() == ESP_OK);
+    for (uint8_t i = 0; i < sizeof(inputs) / sizeof(inputs[0]); i++) {
+        int len = lz_codec_compress(inputs[i].data, inputs[i].len, out, sizeof(out));
+        HOST_TEST_CHECK(len > 0);
+        HOST_TEST_CHECK(lz_codec_decompress(out, len, back, sizeof(back)) == (int)inputs[i].len);
+        HOST_TEST_CHECK(!memcmp(back, inputs[i].data, inputs[i].len));
+    }
+    /* a run of one byte is a match of the bytes it produces */
+    HOST_TEST_CHECK(lz_codec_compress(inputs[1].data, inputs[1].len, out, sizeof(out)) < 8);
+    return ESP_OK;
+}
+
+static esp_err_t test_lz_malformed(void)
+{
+    uint8_t out[LZ_CODEC_INPUT_MAX], back[LZ_CODEC_INPUT_MAX];
+    const uint8_t short_run[] = {0x05, 'a', 'b'};
+    const uint8_t no_distance[] = {0x00, 'a', 0x80};
+    const uint8_t far_match[] = {0x83, 0xff};
+    HOST_TEST_CHECK(lz_codec_init() == ESP_OK);
+    HOST_TEST_CHECK(lz_codec_decompress(short_run, sizeof(short_run), back, sizeof(back)) < 0);
+    HOST_TEST_CHECK(lz_codec_decompress(no_distance, sizeof(no_distance), back, sizeof(back)) < 0);
+    /* before the start of the dictionary */
+    HOST_TEST_CHECK(lz_codec_decompress(far_match, sizeof(far_match), back, sizeof(back)) < 0);
+    const char *text = "{\"type\":\"status\",\"seq\":1,\"uptime_s\":1234}";
+    int len = lz_codec_compress((const uint8_t *)text, strlen(text), out, sizeof(out));
+    HOST_TEST_CHECK(len > 0);
+    HOST_TEST_CHECK(lz_codec_decompress(out, len, back, strlen(text) - 1) < 0);
+    HOST_TEST_CHECK(lz_codec_compress((const uint8_t *)text, strlen(text), out, 2) < 0);
+    HOST_TEST_CHECK(lz_codec_compress(out, LZ_CODEC_INPUT_MAX + 1, back, sizeof(back)) < 0);
+    return ESP_OK;
+}
+
+/* key readings every PAYLOAD_CODEC_KEY_INTERVAL, deltas between, both sides agree on every value */
+static esp_err_t test_payload_codec_round_trip(void)
+{
+    const payload_schema_t *schema = payload_codec_schema(PAYLOAD_ID_ENV);
+    payload_codec_state_t tx = {0}, rx = {0};
+    payload_env_t env = {.temperature_c = 21.5, .humidity_pct = 40.2, .pressure_hpa = 1013.2, .battery_v = 3.7};
+    HOST_TEST_CHECK(schema);
+    for (uint8_t n = 0; n < 2 * PAYLOAD_CODEC_KEY_INTERVAL + 1; n++) {
+        uint8_t buf[LORA_PACKET_MAX_DATA_LEN];
+        size_t len = sizeof(buf);
+        payload_reading_t reading;
+        env.temperature_c += n % 2 ? 0.25 : -0.5;
+        env.battery_v -= 0.001;
+        HOST_TEST_CHECK(payload_codec_encode(PAYLOAD_ID_ENV, &env, &tx, buf, &len) == ESP_OK);
+        HOST_TEST_CHECK(payload_codec_decode(PAYLOAD_ID_ENV, buf, len, &rx, &reading) == ESP_OK);
+        HOST_TEST_CHECK(reading.key == !(n % PAYLOAD_CODEC_KEY_INTERVAL));
+        HOST_TEST_CHECK(reading.values[0] == (int32_t)round(env.temperature_c * 100));
+        HOST_TEST_CHECK(reading.values[3] == (int32_t)round(env.battery_v * 1000));
+        HOST_TEST_CHECK(!memcmp(reading.values, tx.values, schema->field_cnt * sizeof(int32_t)));
+    }
+    char json[256];
+    payload_reading_t reading = {.schema = schema};
+    memcpy(reading.values, rx.values, sizeof(rx.values));
+    HOST_TEST_CHECK(payload_codec_to_json(&reading, s_dev_eui, json, sizeof(json)) > 0);
+    HOST_TEST_CHECK(strstr(json, "\"type\":\"env\""));
+    HOST_TEST_CHECK(payload_codec_to_json(&reading, s_dev_eui, json, 8) <= 0);
+    return ESP_OK;
+}
+
+static esp_err_t test_payload_codec_malformed(void)
+{
+    payload_codec_state_t tx = {0}, rx = {0};
+    payload_reading_t reading;
+    payload_status_t status = {.uptime_s = 100, .free_heap = 150000, .min_free_heap = 120000, .tx_sent = 3};
+    uint8_t key[LORA_PACKET_MAX_DATA_LEN], delta[LORA_PACKET_MAX_DATA_LEN];
+    size_t key_len = sizeof(key), delta_len = sizeof(delta);
+    HOST_TEST_CHECK(payload_codec_encode(PAYLOAD_ID_STATUS, &status, &tx, key, &key_len) == ESP_OK);
+    status.uptime_s += 60;
+    HOST_TEST_CHECK(payload_codec_encode(PAYLOAD_ID_STATUS, &status, &tx, delta, &delta_len) == ESP_OK);
+
+    HOST_TEST_CHECK(payload_codec_decode(PAYLOAD_ID_STATUS, key, 0, &rx, &reading) == ESP_ERR_INVALID_SIZE);
+    HOST_TEST_CHECK(payload_codec_decode(PAYLOAD_ID_STATUS, key, key_len - 1, &rx, &reading) == ESP_ERR_INVALID_SIZE);
+    HOST_TEST_CHECK(payload_codec_decode(0x01, key, key_len, &rx, &reading) == ESP_ERR_INVALID_ARG);
+    /* a delta is worth nothing without the reading before it */
+    HOST_TEST_CHECK(payload_codec_decode(PAYLOAD_ID_STATUS, delta, delta_len, &rx, &reading) == ESP_ERR_INVALID_STATE);
+    HOST_TEST_CHECK(payload_codec_decode(PAYLOAD_ID_STATUS, key, key_len, &rx, &reading) == ESP_OK);
+    HOST_TEST_CHECK(payload_codec_decode(PAYLOAD_ID_STATUS, delta, delta_len, &rx, &reading) == ESP_OK);
+    HOST_TEST_CHECK(payload_codec_decode(PAYLOAD_ID_STATUS, delta, delta_len, &rx, &reading) == ESP_ERR_INVALID_STATE);
+    HOST_TEST_CHECK(reading.values[0] == 160);
+
+    /* a varint that never ends */
+    uint8_t endless[LORA_PACKET_MAX_DATA_LEN];
+    memset(endless, 0xff, sizeof(endless));
+    endless[0] = PAYLOAD_CODEC_KEY_FLAG;
+    HOST_TEST_CHECK(payload_codec_decode(PAYLOAD_ID_STATUS, endless, sizeof(endless), &rx, &reading) == ESP_ERR_INVALID_SIZE);
+
+    size_t len = 2;
+    HOST_TEST_CHECK(payload_codec_encode(PAYLOAD_ID_STATUS, &status, &tx, key, &len) == ESP_ERR_INVALID_SIZE);
+    len = sizeof(key);
+    status.free_heap = 1e12;
+    HOST_TEST_CHECK(payload_codec_encode(PAYLOAD_ID_STATUS, &status, &tx, key, &len) == ESP_ERR_INVALID_ARG);
+    return ESP_OK;
+}
+
+/* new counters move the window, late ones inside it go once, older ones never */
+static esp_err_t test_replay_window(void)
+{
+    const uint8_t dev_eui[LORA_DEV_EUI_LEN] = {0x02, 0x00, 0x00, 0x00, 0x20, 0x01};
+    file_delete(APP_CONFIG_FILE_REPLAY_TABLE);
+    HOST_TEST_CHECK(replay_mngr_init() == ESP_OK);
+    HOST_TEST_CHECK(replay_mngr_last(dev_eui) == 0);
+    HOST_TEST_CHECK(replay_mngr_accept(dev_eui, 100));
+    HOST_TEST_CHECK(!replay_mngr_accept(dev_eui, 100));
+    HOST_TEST_CHECK(replay_mngr_accept(dev_eui, 105));
+    HOST_TEST_CHECK(replay_mngr_accept(dev_eui, 103));
+    HOST_TEST_CHECK(!replay_mngr_accept(dev_eui, 103));
+    HOST_TEST_CHECK(replay_mngr_accept(dev_eui, 105 - REPLAY_WINDOW + 1));
+    HOST_TEST_CHECK(!replay_mngr_accept(dev_eui, 105 - REPLAY_WINDOW));
+    HOST_TEST_CHECK(replay_mngr_last(dev_eui) == 105);
+    /* a jump over the window forgets what was in it */
+    HOST_TEST_CHECK(replay_mngr_accept(dev_eui, 1000));
+    HOST_TEST_CHECK(!replay_mngr_accept(dev_eui, 999 - REPLAY_WINDOW));
+    HOST_TEST_CHECK(replay_mngr_accept(dev_eui, 999));
+    HOST_TEST_CHECK(!replay_mngr_accept(dev_eui, 0));
+
+    replay_stats_t stats;
+    replay_mngr_get_stats(&stats);
+    HOST_TEST_CHECK(stats.duplicates == 2 && stats.replays == 3);
+
+    /* the saved limit is ahead of every accepted counter */
+    HOST_TEST_CHECK(replay_mngr_save() == ESP_OK);
+    char *buf = NULL;
+    int len = file_load(APP_CONFIG_FILE_REPLAY_TABLE, &buf);
+    bool saved = false;
+    for (int pos = 0; buf && pos + LORA_DEV_EUI_LEN + 4 <= len; pos += LORA_DEV_EUI_LEN + 4) {
+        uint32_t limit;
+        memcpy(&limit, &buf[pos + LORA_DEV_EUI_LEN], sizeof(limit));
+        saved |= !memcmp(&buf[pos], dev_eui, LORA_DEV_EUI_LEN) && limit > 1000;
+    }
+    free(buf);
+    HOST_TEST_CHECK(saved);
+    return ESP_OK;
+}
+
+/* frames the fragment manager hands to the radio */
+static lora_frame_t s_sent[HOST_TEST_FRAGMENT_MAX];
+static uint8_t s_sent_cnt = 0;
+
+static esp_err_t test_fragment_send(const uint8_t *dev_eui, uint8_t packet_id, const uint8_t *data, uint8_t data_len)
+{
+    if (s_sent_cnt >= HOST_TEST_FRAGMENT_MAX) {
+        return ESP_ERR_NO_MEM;
+    }
+    lora_frame_t *frame = &s_sent[s_sent_cnt++];
+    memset(frame, 0, sizeof(lora_frame_t));
+    frame->packet_id = packet_id;
+    memcpy(frame->dev_eui, dev_eui, LORA_DEV_EUI_LEN);
+    memcpy(frame->data, data, data_len);
+    frame->data_len = data_len;
+    return ESP_OK;
+}
+
+static esp_err_t test_fragment_init(void)
+{
+    static bool s_init = false;
+    s_sent_cnt = 0;
+    if (!s_init) {
+        s_init = fragment_mngr_init(test_fragment_send) == ESP_OK;
+    }
+    return s_init ? ESP_OK : ESP_FAIL;
+}
+
+/* out of order with a copy in between, the receiver's status acknowledges the message */
+static esp_err_t test_fragment_round_trip(void)
+{
+    uint8_t payload[HOST_TEST_FRAGMENT_LEN];
+    for (size_t i = 0; i < sizeof(payload); i++) {
+        payload[i] = 'a' + i % 26;
+    }
+    HOST_TEST_CHECK(test_fragment_init() == ESP_OK);
+    HOST_TEST_CHECK(fragment_mngr_send(s_dev_eui, 0x42, payload, sizeof(payload)) == ESP_OK);
+    uint8_t count = s_sent_cnt, chunk_max = lora_data_max() - FRAGMENT_HEADER_LEN;
+    HOST_TEST_CHECK(count == (sizeof(payload) + chunk_max - 1) / chunk_max && s_sent[0].data[3] == count);
+    lora_frame_t fragments[HOST_TEST_FRAGMENT_MAX];
+    memcpy(fragments, s_sent, count * sizeof(lora_frame_t));
+
+    fragment_msg_t *msg = NULL;
+    for (int8_t i = count - 1; i >= 0; i--) {
+        HOST_TEST_CHECK(!msg);
+        msg = fragment_mngr_handle(&fragments[i]);
+        if (i == count - 1) {
+            HOST_TEST_CHECK(!fragment_mngr_handle(&fragments[i]));
+        }
+    }
+    HOST_TEST_CHECK(msg && msg->packet_id == 0x42 && msg->len == sizeof(payload));
+    HOST_TEST_CHECK(!memcmp(msg->data, payload, sizeof(payload)) && !msg->data[msg->len]);
+    fragment_mngr_release(msg);
+
+    /* the last status acknowledges all, a late copy gets it again */
+    const lora_frame_t *status = &s_sent[s_sent_cnt - 1];
+    HOST_TEST_CHECK(status->packet_id == LORA_PACKET_ID_FRAGMENT_STATUS && status->data[1] == 0 && status->data[2] == 0);
+    HOST_TEST_CHECK(!fragment_mngr_handle(status));
+    HOST_TEST_CHECK(!fragment_mngr_handle(&fragments[0]));
+    fragment_stats_t stats;
+    fragment_mngr_get_stats(&stats);
+    HOST_TEST_CHECK(stats.tx_delivered == 1 && stats.rx_messages == 1 && stats.rx_duplicates == 2);
+    return ESP_OK;
+}
+
+static esp_err_t test_fragment_malformed(void)
+{
+    HOST_TEST_CHECK(test_fragment_init() == ESP_OK);
+    fragment_stats_t before, after;
+    fragment_mngr_get_stats(&before);
+    lora_frame_t frame = {.packet_id = LORA_PACKET_ID_FRAGMENT};
+    memcpy(frame.dev_eui, s_dev_eui, LORA_DEV_EUI_LEN);
+    const uint8_t headers[][FRAGMENT_HEADER_LEN] = {
+        {0x70, 0x42, 0, 0},                         /* no fragments */
+        {0x71, 0x42, 2, 2},                         /* index past the count */
+        {0x72, 0x42, 0, FRAGMENT_COUNT_MAX + 1},    /* over the status bitmap */
+        {0x73, 0x42, 0, 2},                         /* short, but not the last one */
+    };
+    for (uint8_t i = 0; i < sizeof(headers) / sizeof(headers[0]); i++) {
+        memcpy(frame.data, headers[i], FRAGMENT_HEADER_LEN);
+        frame.data_len = FRAGMENT_HEADER_LEN + 10;
+        HOST_TEST_CHECK(!fragment_mngr_handle(&frame));
+    }
+    /* a header without a chunk */
+    frame.data_len = FRAGMENT_HEADER_LEN;
+    HOST_TEST_CHECK(!fragment_mngr_handle(&frame));
+    frame.packet_id = LORA_PACKET_ID_FRAGMENT_STATUS;
+    frame.data_len = FRAGMENT_STATUS_LEN + 1;
+    HOST_TEST_CHECK(!fragment_mngr_handle(&frame));
+    fragment_mngr_get_stats(&after);
+    HOST_TEST_CHECK(after.rx_invalid - before.rx_invalid == 6 && after.rx_fragments == before.rx_fragments);
+
+    /* a copy with another count is not the message being filled */
+    const uint8_t last[FRAGMENT_HEADER_LEN] = {0x74, 0x42, 1, 2}, other[FRAGMENT_HEADER_LEN] = {0x74, 0x42, 0, 3};
+    const uint8_t first[FRAGMENT_HEADER_LEN] = {0x74, 0x42, 0, 2};
+    uint8_t chunk_max = lora_data_max() - FRAGMENT_HEADER_LEN;
+    frame.packet_id = LORA_PACKET_ID_FRAGMENT;
+    memcpy(frame.data, last, FRAGMENT_HEADER_LEN);
+    frame.data_len = FRAGMENT_HEADER_LEN + 10;
+    HOST_TEST_CHECK(!fragment_mngr_handle(&frame));
+    memcpy(frame.data, other, FRAGMENT_HEADER_LEN);
+    memset(&frame.data[FRAGMENT_HEADER_LEN], 'x', chunk_max);
+    frame.data_len = FRAGMENT_HEADER_LEN + chunk_max;
+    HOST_TEST_CHECK(!fragment_mngr_handle(&frame));
+    memcpy(frame.data, first, FRAGMENT_HEADER_LEN);
+    memset(&frame.data[FRAGMENT_HEADER_LEN], 'y', chunk_max);
+    fragment_msg_t *msg = fragment_mngr_handle(&frame);
+    HOST_TEST_CHECK(msg && msg->len == chunk_max + 10 && msg->data[0] == 'y');
+    fragment_mngr_release(msg);
+    return ESP_OK;
+}
+
+static const host_test_case_t s_cases[] = {
+    {"toa_sf7", test_toa_sf7},
+    {"toa_sf12_ldro", test_toa_sf12_ldro},
+    {"lz_round_trip", test_lz_round_trip},
+    {"lz_malformed", test_lz_malformed},
+    {"payload_codec_round_trip", test_payload_codec_round_trip},
+    {"payload_codec_malformed", test_payload_codec_malformed},
+    {"replay_window", test_replay_window},
+    {"fragment_round_trip", test_fragment_round_trip},
+    {"fragment_malformed", test_fragment_malformed},
+};
+
+void app_main(void)
+{
+    const char *filter = getenv("TEST_FILTER");
+    uint8_t ran = 0, failed = 0;
+    ESP_ERROR_CHECK(file_mngr_init(APP_CONFIG_FILE_BASE_PATH));
+    for (uint8_t i = 0; i < sizeof(s_cases) / sizeof(s_cases[0]); i++) {
+        if (filter && filter[0] && !strstr(s_cases[i].name, filter)) {
+            continue;
+        }
+        esp_err_t err = s_cases[i].run();
+        printf("%-28s %s\n", s_cases[i].name, err == ESP_OK ? "ok" : "FAILED");
+        ran++;
+        failed += err != ESP_OK;
+    }
+    printf("%d cases, %d failed\n", ran, failed);
+    exit(failed);
+}
@@ -0,0 +1,86 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <inttypes.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "micro_bench.h"
+
+static const char *TAG = "micro_bench";
+
+/* esp_timer is microseconds, the short cases need the host clock */
+static int64_t micro_bench_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int micro_bench_cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static esp_err_t micro_bench_batch(const micro_bench_case_t *bench, uint32_t iterations, int64_t *elapsed_ns)
+{
+    int64_t start_ns = micro_bench_now_ns();
+    for (uint32_t i = 0; i < iterations; i++) {
+        esp_err_t err = bench->fn(bench->arg);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "%s failed (%s)", bench->name, esp_err_to_name(err));
+            return err;
+        }
+    }
+    *elapsed_ns = micro_bench_now_ns() - start_ns;
+    return ESP_OK;
+}
+
+/*
+ * Warmup doubles the batch until one takes sample_us, the samples then run that many calls
+ * each. Caches, branch predictors and lazy allocations settle before anything is kept.
+ */
+esp_err_t micro_bench_run(const micro_bench_config_t *config, const micro_bench_case_t *bench, micro_bench_result_t *result)
+{
+    if (!config || !bench || !bench->fn || !result || !config->samples || config->samples > MICRO_BENCH_SAMPLES_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    double per_call_ns[MICRO_BENCH_SAMPLES_MAX];
+    uint32_t iterations = 1;
+    int64_t elapsed_ns = 0;
+    int64_t warmup_end_ns = micro_bench_now_ns() + (int64_t)config->warmup_ms * 1000000;
+    esp_err_t err = ESP_OK;
+
+    while (true) {
+        err = micro_bench_batch(bench, iterations, &elapsed_ns);
+        if (err != ESP_OK) {
+            return err;
+        }
+        if (elapsed_ns < (int64_t)config->sample_us * 1000 && iterations < UINT32_MAX / 2) {
+            iterations *= 2;
+        } else if (micro_bench_now_ns() >= warmup_end_ns) {
+            break;
+        }
+    }
+
+    for (uint32_t i = 0; i < config->samples; i++) {
+        err = micro_bench_batch(bench, iterations, &elapsed_ns);
+        if (err != ESP_OK) {
+            return err;
+        }
+        per_call_ns[i] = (double)elapsed_ns / iterations;
+    }
+    qsort(per_call_ns, config->samples, sizeof(double), micro_bench_cmp_double);
+
+    memset(result, 0, sizeof(micro_bench_result_t));
+    result->iterations = iterations;
+    result->samples = config->samples;
+    result->min_ns = per_call_ns[0];
+    result->median_ns = per_call_ns[config->samples / 2];
+    result->p90_ns = per_call_ns[(config->samples * 9) / 10];
+    result->max_ns = per_call_ns[config->samples - 1];
+    if (bench->bytes && result->median_ns > 0) {
+        result->mb_per_s = bench->bytes * 1000.0 / result->median_ns;
+    }
+    return ESP_OK;
+}
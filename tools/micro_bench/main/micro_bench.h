@@ -0,0 +1,53 @@
+#ifndef _MICRO_BENCH_H_
+#define _MICRO_BENCH_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* one call of the measured code, an error stops the case */
+typedef esp_err_t (*micro_bench_fn_t)(void *arg);
+
+typedef struct {
+    const char *name;
+    micro_bench_fn_t fn;
+    void *arg;
+    size_t bytes;           /* processed by one call, 0 when throughput means nothing */
+} micro_bench_case_t;
+
+typedef struct {
+    uint32_t warmup_ms;     /* calls before the samples, also sizes the samples */
+    uint32_t sample_us;     /* minimum time of a sample, short ones are all timer noise */
+    uint32_t samples;
+} micro_bench_config_t;
+
+#define MICRO_BENCH_SAMPLES_MAX 255
+
+#define MICRO_BENCH_CONFIG_DEFAULT() {  \
+    .warmup_ms = 200,                   \
+    .sample_us = 20000,                 \
+    .samples = 25,                      \
+}
+
+/* per call times, the median is the one to compare between runs */
+typedef struct {
+    uint32_t iterations;    /* calls in a sample */
+    uint32_t samples;
+    double min_ns;
+    double median_ns;
+    double p90_ns;
+    double max_ns;
+    double mb_per_s;        /* at the median */
+} micro_bench_result_t;
+
+esp_err_t micro_bench_run(const micro_bench_config_t *config, const micro_bench_case_t *bench, micro_bench_result_t *result);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
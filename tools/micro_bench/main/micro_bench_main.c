@@ -0,0 +1,498 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "core/cryption_mngr.h"
+#include "core/file_mngr.h"
+#include "app/app_config.h"
+#include "app/app_types.h"
+#include "app/app_config_parser.h"
+#include "app/lora_manager.h"
+#include "app/payload_codec.h"
+#include "app/replay_manager.h"
+#include "app/lz_codec.h"
+#include "micro_bench.h"
+
+/*
+ * Micro benchmarks of the gateway hot paths, every case runs the firmware function on
+ * fixed inputs. Results go to stdout as a table and a json line for the regression scripts.
+ *
+ *  BENCH_FILTER       runs the cases with this in their name (all)
+ *  BENCH_SAMPLES      samples of a case (25)
+ *  BENCH_WARMUP_MS    warmup of a case (200)
+ *  BENCH_SAMPLE_MS    minimum time of a sample (20)
+ *  SIM_FS_ROOT        host directory of the file cases (sim_fs)
+ */
+
+#define MICRO_BENCH_APP_KEY     "1234567890abcdef"   /* the test key of lora_manager */
+#define MICRO_BENCH_FS_PATH     "/bench"
+#define MICRO_BENCH_CRYPT_MAX   1024
+#define MICRO_BENCH_FILE_MAX    4096
+#define MICRO_BENCH_CASE_MAX    40
+#define MICRO_BENCH_LZ_CNT      4
+
+static const char *TAG = "micro_bench";
+
+/* lora_manager reads it, the gateway defaults are enough here */
+app_params_t app_params;
+
+/* sealed once in the setup, the open case checks the tag of it on every call */
+typedef struct {
+    size_t len;
+    uint8_t nonce[CRYPTION_NONCE_LEN];
+    uint8_t header[LORA_WIRE_HEADER_LEN];
+    uint8_t in[MICRO_BENCH_CRYPT_MAX];
+    uint8_t out[MICRO_BENCH_CRYPT_MAX];
+    uint8_t plain[MICRO_BENCH_CRYPT_MAX];
+    uint8_t tag[LORA_WIRE_TAG_LEN];
+} bench_crypt_t;
+
+typedef struct {
+    lora_frame_t frame;
+    uint8_t buf[LORA_FRAME_MAX_LEN];
+    size_t len;
+} bench_frame_t;
+
+typedef struct {
+    const char *json;
+    uint16_t len;
+    app_params_t params;
+} bench_config_t;
+
+typedef struct {
+    const char *path;
+    size_t len;
+    char data[MICRO_BENCH_FILE_MAX];
+} bench_file_t;
+
+/* a delta env reading, both sides start from the key reading before it */
+typedef struct {
+    payload_env_t env;
+    payload_codec_state_t tx_base;
+    payload_codec_state_t rx_base;
+    payload_reading_t reading;
+    uint8_t buf[LORA_PACKET_MAX_DATA_LEN];
+    size_t len;
+    char json[256];
+} bench_codec_t;
+
+/* a gateway with every address given out, the case walks the devices with new counters */
+#define MICRO_BENCH_REPLAY_DEVS ADDRESS_DEV_MAX
+typedef struct {
+    uint8_t dev_eui[MICRO_BENCH_REPLAY_DEVS][LORA_DEV_EUI_LEN];
+    uint32_t fcnt;
+    uint16_t next;
+} bench_replay_t;
+
+static long bench_env(const char *name, long def)
+{
+    const char *value = getenv(name);
+    return value && value[0] ? strtol(value, NULL, 0) : def;
+}
+
+/* same inputs on every run, xorshift32 with a fixed seed */
+static void bench_fill(void *buf, size_t len, uint32_t seed)
+{
+    uint8_t *p = buf;
+    uint32_t x = seed ? seed : 1;
+    for (size_t i = 0; i < len; i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        p[i] = x;
+    }
+}
+
+static esp_err_t bench_encrypt(void *arg)
+{
+    bench_crypt_t *crypt = arg;
+    return cryption_mngr_seal(crypt->nonce, crypt->header, sizeof(crypt->header), crypt->in, crypt->len,
+                              crypt->out, crypt->tag, sizeof(crypt->tag));
+}
+
+static esp_err_t bench_decrypt(void *arg)
+{
+    bench_crypt_t *crypt = arg;
+    return cryption_mngr_open(crypt->nonce, crypt->header, sizeof(crypt->header), crypt->out, crypt->len,
+                              crypt->plain, crypt->tag, sizeof(crypt->tag));
+}
+
+static esp_err_t bench_provisioning_packet(void *arg)
+{
+    bench_frame_t *frame = arg;
+    lora_prepare_provisioning_packet(&frame->frame);
+    return ESP_OK;
+}
+
+static esp_err_t bench_frame_encode(void *arg)
+{
+    bench_frame_t *frame = arg;
+    frame->len = sizeof(frame->buf);
+    return lora_frame_encode(&frame->frame, true, frame->buf, &frame->len);
+}
+
+static esp_err_t bench_frame_decode(void *arg)
+{
+    bench_frame_t *frame = arg;
+    return lora_frame_decode(frame->buf, frame->len, true, frame->frame.fcnt, &frame->frame);
+}
+
+static esp_err_t bench_config_parse(void *arg)
+{
+    bench_config_t *config = arg;
+    return app_parse_config_data(&config->params, config->json, config->len);
+}
+
+static esp_err_t bench_codec_encode(void *arg)
+{
+    bench_codec_t *codec = arg;
+    payload_codec_state_t state = codec->tx_base;
+    codec->len = sizeof(codec->buf);
+    return payload_codec_encode(PAYLOAD_ID_ENV, &codec->env, &state, codec->buf, &codec->len);
+}
+
+static esp_err_t bench_codec_decode(void *arg)
+{
+    bench_codec_t *codec = arg;
+    payload_codec_state_t state = codec->rx_base;
+    return payload_codec_decode(PAYLOAD_ID_ENV, codec->buf, codec->len, &state, &codec->reading);
+}
+
+static esp_err_t bench_codec_json(void *arg)
+{
+    bench_codec_t *codec = arg;
+    static const uint8_t s_eui[LORA_DEV_EUI_LEN] = {0x02, 0x00, 0x00, 0x00, 0x10, 0x00};
+    return payload_codec_to_json(&codec->reading, s_eui, codec->json, sizeof(codec->json)) > 0 ? ESP_OK : ESP_FAIL;
+}
+
+static esp_err_t bench_replay_accept(void *arg)
+{
+    bench_replay_t *replay = arg;
+    uint16_t dev = replay->next++ % MICRO_BENCH_REPLAY_DEVS;
+    if (!dev) {
+        replay->fcnt++;
+    }
+    return replay_mngr_accept(replay->dev_eui[dev], replay->fcnt) ? ESP_OK : ESP_FAIL;
+}
+
+static esp_err_t bench_replay_duplicate(void *arg)
+{
+    bench_replay_t *replay = arg;
+    return replay_mngr_accept(replay->dev_eui[0], replay->fcnt) ? ESP_FAIL : ESP_OK;
+}
+
+/* a text uplink through lz_codec, out is filled by the setup for the decompress case */
+typedef struct {
+    const char *name;
+    uint8_t in[LORA_PACKET_MAX_DATA_LEN];
+    size_t len;
+    uint8_t out[LZ_CODEC_INPUT_MAX];
+    int out_len;
+    uint8_t plain[LORA_PACKET_MAX_DATA_LEN];
+} bench_lz_t;
+
+static esp_err_t bench_lz_compress(void *arg)
+{
+    bench_lz_t *lz = arg;
+    return lz_codec_compress(lz->in, lz->len, lz->out, sizeof(lz->out)) == lz->out_len ? ESP_OK : ESP_FAIL;
+}
+
+static esp_err_t bench_lz_decompress(void *arg)
+{
+    bench_lz_t *lz = arg;
+    return lz_codec_decompress(lz->out, lz->out_len, lz->plain, sizeof(lz->plain)) == (int)lz->len ? ESP_OK : ESP_FAIL;
+}
+
+static esp_err_t bench_file_read(void *arg)
+{
+    bench_file_t *file = arg;
+    char *buff = NULL;
+    int len = file_read(file->path, &buff);
+    free(buff);
+    return len == (int)file->len + 1 ? ESP_OK : ESP_FAIL;
+}
+
+static esp_err_t bench_file_append(void *arg)
+{
+    bench_file_t *file = arg;
+    return file_append(file->path, file->data, file->len) == (int)file->len ? ESP_OK : ESP_FAIL;
+}
+
+/* what app_set_default_dev_config() writes on the first boot */
+static const char s_config_default[] =
+    "{\"device_type\":\"master\",\"wifi_ssid\":\"Blanc Coffee&Cocktails\",\"wifi_pass\":\"blanccoffee2023\","
+    "\"mqtt_broker\":\"mqtt://mqtt.meplis.dev\",\"mqtt_broker_port\":1883}";
+
+/* a two radio gateway with every lora key set, as the s/cfg topic sends it */
+static const char s_config_full[] =
+    "{\n"
+    "  \"device_type\": \"master\",\n"
+    "  \"wifi_ssid\": \"Blanc Coffee&Cocktails\",\n"
+    "  \"wifi_pass\": \"blanccoffee2023\",\n"
+    "  \"mqtt_broker\": \"mqtt://mqtt.meplis.dev\",\n"
+    "  \"mqtt_broker_port\": 1883,\n"
+    "  \"lora_frequency\": 868100000,\n"
+    "  \"lora_sf\": 7,\n"
+    "  \"lora_bw\": 125,\n"
+    "  \"lora_cr\": 5,\n"
+    "  \"lora_preamble\": 8,\n"
+    "  \"lora_implicit_header\": false,\n"
+    "  \"lora_implicit_len\": 64,\n"
+    "  \"lora_sync_word\": 52,\n"
+    "  \"lora_cad_sf\": [7, 8, 9, 10, 11, 12],\n"
+    "  \"lora_radios\": [\n"
+    "    {\"nss\": 18, \"rst\": 14, \"dio0\": 26, \"frequency\": 868100000, \"sf\": 7},\n"
+    "    {\"nss\": 4, \"rst\": 15, \"dio0\": 25, \"frequency\": 868300000, \"sf\": 9}\n"
+    "  ],\n"
+    "  \"lora_duty_cycle\": true,\n"
+    "  \"lora_duty_cycle_policy\": \"defer\",\n"
+    "  \"lora_duty_cycle_max_defer_ms\": 60000,\n"
+    "  \"lora_class_a\": true,\n"
+    "  \"lora_rx1_delay_ms\": 1000,\n"
+    "  \"lora_lbt\": \"cad\",\n"
+    "  \"lora_lbt_rssi_threshold\": -90,\n"
+    "  \"lora_lbt_max_attempts\": 6,\n"
+    "  \"lora_lbt_backoff_min_ms\": 20,\n"
+    "  \"lora_lbt_backoff_max_ms\": 2000\n"
+    "}\n";
+
+static bench_crypt_t s_crypt[4];
+static const size_t s_crypt_len[4] = {16, 64, LORA_FRAME_MAX_LEN, MICRO_BENCH_CRYPT_MAX};
+static bench_frame_t s_provisioning, s_uplink, s_uplink_max;
+static bench_codec_t s_codec = {
+    .env = {.temperature_c = 21.53, .humidity_pct = 45.2, .pressure_hpa = 1013.2, .battery_v = 3.702},
+};
+static bench_config_t s_config[2] = {
+    {.json = s_config_default, .len = sizeof(s_config_default) - 1},
+    {.json = s_config_full, .len = sizeof(s_config_full) - 1},
+};
+static bench_file_t s_file_read[2] = {
+    {.path = MICRO_BENCH_FS_PATH"/read_1k.json", .len = 1024},
+    {.path = MICRO_BENCH_FS_PATH"/read_4k.json", .len = 4096},
+};
+/* mqtt config chunks are appended as they come, 429 is the tail of a 2467 byte config */
+static bench_file_t s_file_append[2] = {
+    {.path = MICRO_BENCH_FS_PATH"/append_64.json", .len = 64},
+    {.path = MICRO_BENCH_FS_PATH"/append_429.json", .len = 429},
+};
+
+static bench_replay_t s_replay;
+/* the client test uplink, published json and key=value text, none in the dictionary, and noise that goes raw */
+static bench_lz_t s_lz[MICRO_BENCH_LZ_CNT] = {
+    {.name = "test"}, {.name = "json"}, {.name = "text"}, {.name = "random"},
+};
+static const char *s_lz_text[MICRO_BENCH_LZ_CNT - 1] = {
+    "0123456789ABCDEF_client_test_data",
+    "{\"dev_eui\":\"020000001003\",\"type\":\"env\",\"seq\":3,\"temperature_c\":21.53,\"humidity_pct\":45.2,"
+    "\"pressure_hpa\":1013.2,\"battery_v\":3.702}",
+    "t=21.53;h=45.2;p=1013.2;b=3.702|t=21.57;h=45.2;p=1013.1;b=3.702|t=21.61;h=45.3;p=1013.1;b=3.701",
+};
+static micro_bench_case_t s_cases[MICRO_BENCH_CASE_MAX];
+static micro_bench_result_t s_results[MICRO_BENCH_CASE_MAX];
+static uint8_t s_case_cnt = 0;
+
+static void bench_add(const char *name, micro_bench_fn_t fn, void *arg, size_t bytes)
+{
+    if (s_case_cnt >= MICRO_BENCH_CASE_MAX) {
+        ESP_LOGE(TAG, "%s is not added, MICRO_BENCH_CASE_MAX is reached!", name);
+        return;
+    }
+    s_cases[s_case_cnt++] = (micro_bench_case_t) {
+        .name = name,
+        .fn = fn,
+        .arg = arg,
+        .bytes = bytes,
+    };
+}
+
+static esp_err_t bench_setup(void)
+{
+    static char s_names[8][24];
+    esp_err_t err = cryption_mngr_init(MICRO_BENCH_APP_KEY);
+    if (err != ESP_OK) {
+        return err;
+    }
+    for (uint8_t i = 0; i < 4; i++) {
+        s_crypt[i].len = s_crypt_len[i];
+        bench_fill(s_crypt[i].in, s_crypt[i].len, i + 1);
+        bench_fill(s_crypt[i].nonce, sizeof(s_crypt[i].nonce), i + 10);
+        bench_fill(s_crypt[i].header, sizeof(s_crypt[i].header), i + 20);
+        err = bench_encrypt(&s_crypt[i]);
+        if (err != ESP_OK) {
+            return err;
+        }
+        snprintf(s_names[i], sizeof(s_names[i]), "encrypt_%zu", s_crypt[i].len);
+        bench_add(s_names[i], bench_encrypt, &s_crypt[i], s_crypt[i].len);
+    }
+    for (uint8_t i = 0; i < 4; i++) {
+        snprintf(s_names[4 + i], sizeof(s_names[4 + i]), "decrypt_%zu", s_crypt[i].len);
+        bench_add(s_names[4 + i], bench_decrypt, &s_crypt[i], s_crypt[i].len);
+    }
+
+    bench_add("provisioning_packet", bench_provisioning_packet, &s_provisioning, 0);
+    /* the uplink the client test timer sends and a full one */
+    s_uplink.frame.data_len = snprintf((char *)s_uplink.frame.data, sizeof(s_uplink.frame.data), "0123456789ABCDEF_client_test_data");
+    s_uplink_max.frame.data_len = LORA_PACKET_MAX_DATA_LEN;
+    bench_fill(s_uplink_max.frame.data, LORA_PACKET_MAX_DATA_LEN, 50);
+    bench_frame_t *frames[2] = {&s_uplink, &s_uplink_max};
+    for (uint8_t i = 0; i < 2; i++) {
+        frames[i]->frame.packet_id = 0xAE;
+        memset(frames[i]->frame.dev_eui, 0x10, LORA_DEV_EUI_LEN);
+        /* a provisioned client, its frames carry the short address */
+        frames[i]->frame.dev_addr = 1;
+        frames[i]->frame.end_of_frame = 0xDE;
+        frames[i]->len = sizeof(frames[i]->buf);
+        err = lora_frame_encode(&frames[i]->frame, true, frames[i]->buf, &frames[i]->len);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+    bench_add("frame_encode", bench_frame_encode, &s_uplink, s_uplink.len);
+    bench_add("frame_decode", bench_frame_decode, &s_uplink, s_uplink.len);
+    bench_add("frame_encode_max", bench_frame_encode, &s_uplink_max, s_uplink_max.len);
+    bench_add("frame_decode_max", bench_frame_decode, &s_uplink_max, s_uplink_max.len);
+
+    payload_codec_state_t tx_state = {0}, rx_state = {0};
+    s_codec.len = sizeof(s_codec.buf);
+    err = payload_codec_encode(PAYLOAD_ID_ENV, &s_codec.env, &tx_state, s_codec.buf, &s_codec.len);
+    err = err == ESP_OK ? payload_codec_decode(PAYLOAD_ID_ENV, s_codec.buf, s_codec.len, &rx_state, &s_codec.reading) : err;
+    s_codec.tx_base = tx_state;
+    s_codec.rx_base = rx_state;
+    s_codec.env.temperature_c += 0.04;
+    s_codec.env.battery_v -= 0.001;
+    err = err == ESP_OK ? bench_codec_encode(&s_codec) : err;
+    if (err != ESP_OK) {
+        return err;
+    }
+    bench_add("codec_encode_env", bench_codec_encode, &s_codec, s_codec.len);
+    bench_add("codec_decode_env", bench_codec_decode, &s_codec, s_codec.len);
+    bench_add("codec_json_env", bench_codec_json, &s_codec, 0);
+
+    /* macs of a batch, they differ in the last byte, a table left by a host_sim run would floor their counters */
+    file_delete(APP_CONFIG_FILE_REPLAY_TABLE);
+    err = replay_mngr_init();
+    if (err != ESP_OK) {
+        return err;
+    }
+    for (uint16_t i = 0; i < MICRO_BENCH_REPLAY_DEVS; i++) {
+        memcpy(s_replay.dev_eui[i], (uint8_t[]) {0x02, 0x00, 0x00, 0x00, 0x10, (uint8_t)i}, LORA_DEV_EUI_LEN);
+        replay_mngr_accept(s_replay.dev_eui[i], 0);
+    }
+    bench_add("replay_accept", bench_replay_accept, &s_replay, 0);
+    bench_add("replay_duplicate", bench_replay_duplicate, &s_replay, 0);
+
+    static char s_lz_names[2 * MICRO_BENCH_LZ_CNT][24];
+    lz_codec_init();
+    for (uint8_t i = 0; i < MICRO_BENCH_LZ_CNT; i++) {
+        bench_lz_t *lz = &s_lz[i];
+        if (i < MICRO_BENCH_LZ_CNT - 1) {
+            lz->len = strlen(s_lz_text[i]);
+            memcpy(lz->in, s_lz_text[i], lz->len);
+        } else {
+            lz->len = LORA_PACKET_MAX_DATA_LEN;
+            bench_fill(lz->in, lz->len, 60);
+        }
+        lz->out_len = lz_codec_compress(lz->in, lz->len, lz->out, sizeof(lz->out));
+        if (lz->out_len < 0) {
+            return ESP_FAIL;
+        }
+        snprintf(s_lz_names[2 * i], sizeof(s_lz_names[0]), "lz_compress_%s", lz->name);
+        snprintf(s_lz_names[2 * i + 1], sizeof(s_lz_names[0]), "lz_decompress_%s", lz->name);
+        bench_add(s_lz_names[2 * i], bench_lz_compress, lz, lz->len);
+        bench_add(s_lz_names[2 * i + 1], bench_lz_decompress, lz, lz->len);
+    }
+
+    bench_add("config_parse_default", bench_config_parse, &s_config[0], s_config[0].len);
+    bench_add("config_parse_full", bench_config_parse, &s_config[1], s_config[1].len);
+
+    err = file_mngr_init(MICRO_BENCH_FS_PATH);
+    if (err != ESP_OK) {
+        return err;
+    }
+    for (uint8_t i = 0; i < 2; i++) {
+        /* printable, like the json files on the partition */
+        bench_fill(s_file_read[i].data, s_file_read[i].len, 100 + i);
+        for (size_t j = 0; j < s_file_read[i].len; j++) {
+            s_file_read[i].data[j] = ' ' + (uint8_t)s_file_read[i].data[j] % 95;
+        }
+        if (file_overwrite(s_file_read[i].path, s_file_read[i].data, s_file_read[i].len) != (int)s_file_read[i].len) {
+            return ESP_FAIL;
+        }
+        memcpy(s_file_append[i].data, s_file_read[i].data, s_file_append[i].len);
+        file_delete(s_file_append[i].path);
+    }
+    bench_add("file_read_1k", bench_file_read, &s_file_read[0], s_file_read[0].len);
+    bench_add("file_read_4k", bench_file_read, &s_file_read[1], s_file_read[1].len);
+    bench_add("file_append_64", bench_file_append, &s_file_append[0], s_file_append[0].len);
+    bench_add("file_append_429", bench_file_append, &s_file_append[1], s_file_append[1].len);
+    return ESP_OK;
+}
+
+static void bench_teardown(void)
+{
+    for (uint8_t i = 0; i < 2; i++) {
+        file_delete(s_file_read[i].path);
+        file_delete(s_file_append[i].path);
+        free((void *)s_config[i].params.dev_wifi_ssid);
+        free((void *)s_config[i].params.dev_wifi_pass);
+        free((void *)s_config[i].params.dev_mqtt_broker);
+    }
+}
+
+void app_main(void)
+{
+    micro_bench_config_t config = MICRO_BENCH_CONFIG_DEFAULT();
+    config.samples = bench_env("BENCH_SAMPLES", config.samples);
+    config.warmup_ms = bench_env("BENCH_WARMUP_MS", config.warmup_ms);
+    config.sample_us = bench_env("BENCH_SAMPLE_MS", config.sample_us / 1000) * 1000;
+    const char *filter = getenv("BENCH_FILTER");
+
+    ESP_ERROR_CHECK(bench_setup());
+    printf("%-24s %10s %12s %12s\n", "lz payload", "bytes", "compressed", "ratio");
+    for (uint8_t i = 0; i < MICRO_BENCH_LZ_CNT; i++) {
+        printf("%-24s %10zu %12d %12.2f\n", s_lz[i].name, s_lz[i].len, s_lz[i].out_len, (double)s_lz[i].len / s_lz[i].out_len);
+    }
+    bool failed = false;
+    bool ran[MICRO_BENCH_CASE_MAX] = {0};
+    printf("%-24s %10s %12s %12s %12s %10s\n", "case", "calls", "min ns", "median ns", "p90 ns", "MB/s");
+    for (uint8_t i = 0; i < s_case_cnt; i++) {
+        if (filter && filter[0] && !strstr(s_cases[i].name, filter)) {
+            continue;
+        }
+        if (micro_bench_run(&config, &s_cases[i], &s_results[i]) != ESP_OK) {
+            printf("%-24s failed\n", s_cases[i].name);
+            failed = true;
+            continue;
+        }
+        ran[i] = true;
+        micro_bench_result_t *r = &s_results[i];
+        printf("%-24s %10" PRIu32 " %12.1f %12.1f %12.1f %10.1f\n",
+               s_cases[i].name, r->iterations, r->min_ns, r->median_ns, r->p90_ns, r->mb_per_s);
+    }
+    bench_teardown();
+
+    /* one line for the regression scripts */
+    printf("{\"samples\":%" PRIu32 ",\"sample_us\":%" PRIu32 ",\"results\":[", config.samples, config.sample_us);
+    const char *sep = "";
+    for (uint8_t i = 0; i < s_case_cnt; i++) {
+        if (!ran[i]) {
+            continue;
+        }
+        micro_bench_result_t *r = &s_results[i];
+        printf("%s{\"name\":\"%s\",\"bytes\":%zu,\"iterations\":%" PRIu32 ",\"min_ns\":%.1f,\"median_ns\":%.1f,"
+               "\"p90_ns\":%.1f,\"max_ns\":%.1f,\"mb_per_s\":%.2f}",
+               sep, s_cases[i].name, s_cases[i].bytes, r->iterations, r->min_ns, r->median_ns,
+               r->p90_ns, r->max_ns, r->mb_per_s);
+        sep = ",";
+    }
+    printf("],\"lz\":[");
+    for (uint8_t i = 0; i < MICRO_BENCH_LZ_CNT; i++) {
+        printf("%s{\"name\":\"%s\",\"bytes\":%zu,\"compressed\":%d}", i ? "," : "", s_lz[i].name, s_lz[i].len, s_lz[i].out_len);
+    }
+    printf("]}\n");
+    exit(failed ? 1 : 0);
+}